@@ -0,0 +1,75 @@
+/* Integer arithmetic of KPL */
+
+#ifndef __ARITH_H__
+#define __ARITH_H__
+
+#include <stdint.h>
+
+// INTEGER is 32-bit two's complement and wraps around on overflow.
+// Division truncates toward zero; dividing by zero is a run-time error
+// the callers check for, before calling kplDiv or kplMod. Every engine
+// and the constant folder compute through these, so they agree.
+
+static inline int32_t kplAdd(int32_t a, int32_t b) {
+  return (int32_t)((uint32_t)a + (uint32_t)b);
+}
+
+static inline int32_t kplSub(int32_t a, int32_t b) {
+  return (int32_t)((uint32_t)a - (uint32_t)b);
+}
+
+static inline int32_t kplMul(int32_t a, int32_t b) {
+  return (int32_t)((uint32_t)a * (uint32_t)b);
+}
+
+static inline int32_t kplNeg(int32_t a) {
+  return (int32_t)(0u - (uint32_t)a);
+}
+
+// b != 0; the most negative number divided by -1 wraps to itself
+static inline int32_t kplDiv(int32_t a, int32_t b) {
+  return b == -1 ? kplNeg(a) : a / b;
+}
+
+// b != 0; the sign follows the dividend
+static inline int32_t kplMod(int32_t a, int32_t b) {
+  return b == -1 ? 0 : a % b;
+}
+
+// Zero to a negative power divides by zero
+static inline int kplPowFails(int32_t a, int32_t b) {
+  return a == 0 && b < 0;
+}
+
+// a ** b by squaring; a negative power is 1 / a ** -b truncated
+static inline int32_t kplPow(int32_t a, int32_t b) {
+  uint32_t result = 1, base = (uint32_t)a, n = (uint32_t)b;
+
+  if (b < 0)
+    return a == 1 ? 1 : a == -1 ? ((b & 1) ? -1 : 1) : 0;
+  while (n != 0) {
+    if (n & 1)
+      result *= base;
+    base *= base;
+    n >>= 1;
+  }
+  return (int32_t)result;
+}
+
+// Strength reductions by a power of two 2 ** k, 0 <= k <= 30. Shifting
+// alone would round a negative dividend down, so it is first biased by
+// 2 ** k - 1, as a truncating division does.
+static inline int32_t kplShl(int32_t a, int k) {
+  return (int32_t)((uint32_t)a << k);
+}
+
+static inline int32_t kplDivShift(int32_t a, int k) {
+  return (a + ((a >> 31) & ((1 << k) - 1))) >> k;
+}
+
+static inline int32_t kplModMask(int32_t a, int k) {
+  int32_t bias = (a >> 31) & ((1 << k) - 1);
+  return ((a + bias) & ((1 << k) - 1)) - bias;
+}
+
+#endif
@@ -0,0 +1,125 @@
+/* Parse tree */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ast.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+void initTree(ParseTree *tree) {
+  tree->root = NULL;
+  tree->blocks = NULL;
+  tree->nodeCount = 0;
+  tree->failed = 0;
+}
+
+void freeTree(ParseTree *tree) {
+  ArenaBlock *block = tree->blocks, *next;
+  while (block != NULL) {
+    next = block->next;
+    free(block);
+    block = next;
+  }
+  initTree(tree);
+}
+
+static void *arenaAlloc(ParseTree *tree, size_t size) {
+  ArenaBlock *block = tree->blocks;
+  size_t blockSize;
+  void *p;
+
+  size = (size + 7) & ~(size_t)7;
+  if (block == NULL || block->used + size > block->size) {
+    blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + blockSize);
+    block->next = tree->blocks;
+    block->used = 0;
+    block->size = blockSize;
+    tree->blocks = block;
+  }
+  p = (char*)(block + 1) + block->used;
+  block->used += size;
+  return p;
+}
+
+Node *newNode(ParseTree *tree, NodeKind kind, Token *token) {
+  Node *node = (Node*)arenaAlloc(tree, sizeof(Node));
+
+  memset(node, 0, sizeof(Node));
+  node->kind = kind;
+  if (token != NULL) {
+    node->lineNo = token->lineNo;
+    node->colNo = token->colNo;
+  }
+  tree->nodeCount++;
+  return node;
+}
+
+void setNodeText(ParseTree *tree, Node *node, char *text) {
+  size_t length = strlen(text);
+  node->text = (char*)arenaAlloc(tree, length + 1);
+  memcpy(node->text, text, length + 1);
+}
+
+void appendChild(Node *parent, Node *child) {
+  if (parent->lastChild == NULL)
+    parent->firstChild = child;
+  else parent->lastChild->next = child;
+  child->prev = parent->lastChild;
+  parent->lastChild = child;
+  parent->childCount++;
+}
+
+// Constant time, so operator chains in a long argument list stay linear
+Node *removeLastChild(Node *parent) {
+  Node *last = parent->lastChild;
+
+  if (last == NULL)
+    return NULL;
+  parent->lastChild = last->prev;
+  if (last->prev == NULL)
+    parent->firstChild = NULL;
+  else last->prev->next = NULL;
+  last->prev = NULL;
+  parent->childCount--;
+  return last;
+}
+
+Node *childAt(Node *node, int index) {
+  Node *child = node->firstChild;
+  while (child != NULL && index-- > 0)
+    child = child->next;
+  return child;
+}
+
+char *nodeKindToString(NodeKind kind) {
+  switch (kind) {
+  case N_PROGRAM: return "Program";
+  case N_BLOCK: return "Block";
+  case N_CONST_DECL: return "ConstDecl";
+  case N_TYPE_DECL: return "TypeDecl";
+  case N_VAR_DECL: return "VarDecl";
+  case N_FUNC_DECL: return "FuncDecl";
+  case N_PROC_DECL: return "ProcDecl";
+  case N_PARAM: return "Param";
+  case N_TYPE: return "Type";
+  case N_EMPTY: return "EmptySt";
+  case N_ASSIGN: return "AssignSt";
+  case N_CALL: return "CallSt";
+  case N_GROUP: return "GroupSt";
+  case N_IF: return "IfSt";
+  case N_WHILE: return "WhileSt";
+  case N_FOR: return "ForSt";
+  case N_REPEAT: return "RepeatSt";
+  case N_CONDITION: return "Condition";
+  case N_BINARY: return "Binary";
+  case N_UNARY: return "Unary";
+  case N_NUMBER: return "Number";
+  case N_CHAR: return "Char";
+  case N_STRING: return "String";
+  case N_VARIABLE: return "Variable";
+  case N_FUNC_CALL: return "FuncCall";
+  default: return "";
+  }
+}
@@ -0,0 +1,80 @@
+/* Parse tree */
+
+#ifndef __AST_H__
+#define __AST_H__
+
+#include <stddef.h>
+#include "token.h"
+
+typedef enum {
+  N_PROGRAM,      // text: name; children: block
+  N_BLOCK,        // children: declarations, then the body (N_GROUP)
+  N_CONST_DECL,   // text: name; children: constant
+  N_TYPE_DECL,    // text: name; children: type
+  N_VAR_DECL,     // text: name; children: type
+  N_FUNC_DECL,    // text: name; children: params, return type, block
+  N_PROC_DECL,    // text: name; children: params, block
+  N_PARAM,        // text: name; op: KW_VAR for a reference parameter; children: type
+  N_TYPE,         // op: KW_INTEGER, KW_CHAR, KW_STRING, KW_BYTES, TK_IDENT (text) or
+                  // KW_ARRAY (value: size; children: element type)
+
+  N_EMPTY,
+  N_ASSIGN,       // value: number of targets; children: targets, then expressions
+  N_CALL,         // text: procedure; children: arguments
+  N_GROUP,        // children: statements
+  N_IF,           // children: condition, then, [else]
+  N_WHILE,        // children: condition, statement
+  N_FOR,          // text: variable; children: from, to, statement
+  N_REPEAT,       // children: statements, then the condition
+
+  N_CONDITION,    // op: comparator; children: left, right
+  N_BINARY,       // op: SB_PLUS, SB_MINUS, SB_TIMES, SB_SLASH, SB_MOD or SB_POWER
+  N_UNARY,        // op: SB_PLUS or SB_MINUS; children: operand
+  N_NUMBER,       // value
+  N_CHAR,         // value
+  N_STRING,       // text
+  N_VARIABLE,     // text: name; children: indexes (a constant or a variable)
+  N_FUNC_CALL     // text: name; children: arguments
+} NodeKind;
+
+#define NODE_KIND_COUNT (N_FUNC_CALL + 1)
+
+struct Symbol;
+struct Type;
+
+typedef struct Node {
+  NodeKind kind;
+  TokenType op;
+  int lineNo, colNo;
+  int value;
+  char *text;
+  struct Symbol *symbol;   // with --check: the declaration named by text
+  struct Type *type;       // set by the type checker
+  int childCount;
+  struct Node *firstChild, *lastChild;
+  struct Node *next, *prev;
+} Node;
+
+// Nodes and their strings live in the arena of their tree and are freed together
+typedef struct ArenaBlock {
+  struct ArenaBlock *next;
+  size_t used, size;
+} ArenaBlock;
+
+typedef struct {
+  Node *root;
+  ArenaBlock *blocks;
+  int nodeCount;
+  int failed;
+} ParseTree;
+
+void initTree(ParseTree *tree);
+void freeTree(ParseTree *tree);
+Node *newNode(ParseTree *tree, NodeKind kind, Token *token);
+void setNodeText(ParseTree *tree, Node *node, char *text);
+void appendChild(Node *parent, Node *child);
+Node *removeLastChild(Node *parent);
+Node *childAt(Node *node, int index);
+char *nodeKindToString(NodeKind kind);
+
+#endif
@@ -0,0 +1,102 @@
+/* Batch driver */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "reader.h"
+#include "scanner.h"
+#include "parser.h"
+#include "error.h"
+#include "workpool.h"
+#include "stats.h"
+#include "batch.h"
+
+typedef struct {
+  char *text;
+  size_t length;
+  long tokens;
+  int status;
+  int done;
+} BatchResult;
+
+typedef struct {
+  char **fileNames;
+  BatchResult *results;
+  int fileCount;
+  int nextToPrint;
+  pthread_mutex_t lock;
+} Batch;
+
+#define BATCH_OK 0
+#define BATCH_SYNTAX_ERROR 1
+#define BATCH_IO_ERROR 2
+
+// Print every finished result that directly follows the ones already printed,
+// so the output stays in command line order while files finish in any order.
+static void flushResults(Batch *batch) {
+  BatchResult *result;
+
+  while (batch->nextToPrint < batch->fileCount) {
+    result = &batch->results[batch->nextToPrint];
+    if (!result->done)
+      break;
+    printf("==> %s <==\n", batch->fileNames[batch->nextToPrint]);
+    fwrite(result->text, 1, result->length, stdout);
+    free(result->text);
+    result->text = NULL;
+    batch->nextToPrint++;
+  }
+}
+
+static void compileOne(int index, void *arg) {
+  Batch *batch = (Batch*)arg;
+  BatchResult *result = &batch->results[index];
+  FILE *out = open_memstream(&result->text, &result->length);
+
+  setOutputStream(out);
+  if (compile(batch->fileNames[index]) == IO_ERROR) {
+    fprintf(out, "Can\'t read input file!\n");
+    result->status = BATCH_IO_ERROR;
+  } else result->status = errorRaised ? BATCH_SYNTAX_ERROR : BATCH_OK;
+  result->tokens = tokenCount;
+  setOutputStream(NULL);
+  fclose(out);
+
+  pthread_mutex_lock(&batch->lock);
+  result->done = 1;
+  flushResults(batch);
+  pthread_mutex_unlock(&batch->lock);
+}
+
+int compileBatch(char **fileNames, int fileCount, int jobs) {
+  Batch batch;
+  long tokens = 0;
+  int i, failed = 0;
+  double start, elapsed;
+
+  batch.fileNames = fileNames;
+  batch.fileCount = fileCount;
+  batch.nextToPrint = 0;
+  batch.results = (BatchResult*)calloc(fileCount, sizeof(BatchResult));
+  pthread_mutex_init(&batch.lock, NULL);
+
+  start = statsClock();
+  runWorkPool(jobs, fileCount, compileOne, &batch);
+  elapsed = statsClock() - start;
+  fflush(stdout);
+
+  for (i = 0; i < fileCount; i++) {
+    tokens += batch.results[i].tokens;
+    if (batch.results[i].status != BATCH_OK)
+      failed++;
+  }
+  if (elapsed <= 0) elapsed = 1e-9;
+
+  fprintf(stderr, "%d files (%d failed), %ld tokens, %d jobs in %.3f s: %.1f files/s, %.0f tokens/s\n",
+          fileCount, failed, tokens, jobs, elapsed, fileCount / elapsed, tokens / elapsed);
+
+  pthread_mutex_destroy(&batch.lock);
+  free(batch.results);
+  return failed;
+}
@@ -0,0 +1,8 @@
+/* Batch driver */
+
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+int compileBatch(char **fileNames, int fileCount, int jobs);
+
+#endif
@@ -0,0 +1,631 @@
+/* Benchmarks */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "reader.h"
+#include "scanner.h"
+#include "parser.h"
+#include "error.h"
+#include "perfcount.h"
+#include "typecheck.h"
+#include "codegen.h"
+#include "vm.h"
+#include "closure.h"
+#include "fold.h"
+#include "reduce.h"
+#include "iropt.h"
+#include "vector.h"
+#include "stats.h"
+
+#define MAX_BENCHMARKS 32
+#define RUNS 3
+
+extern __thread Token *lookAhead;
+
+typedef struct {
+  char *text;
+  size_t size, capacity;
+} Source;
+
+typedef struct {
+  char name[64];
+  size_t bytes;
+  long tokens;
+  long iterations;
+  double seconds;       // median time of one iteration
+  int counted;
+  double counts[COUNTER_COUNT];   // hardware events per iteration
+} Result;
+
+typedef long (*BenchFunc)(Source *input);
+
+static Result results[MAX_BENCHMARKS];
+static int resultCount = 0;
+static double minTime = 0.2;
+static char *filter = NULL;
+static FILE *devNull;
+static CounterSet counters;
+static int countersOn = 0;
+
+/******************************************************************/
+
+static void append(Source *s, char *format, int n) {
+  char line[256];
+  int length = snprintf(line, sizeof(line), format, n, n, n);
+
+  if (s->size + length + 1 > s->capacity) {
+    s->capacity = s->capacity ? s->capacity * 2 : 4096;
+    while (s->size + length + 1 > s->capacity)
+      s->capacity *= 2;
+    s->text = (char*)realloc(s->text, s->capacity);
+  }
+  memcpy(s->text + s->size, line, length + 1);
+  s->size += length;
+}
+
+// A program of procCount procedures using every statement of the language
+static void makeProgram(Source *s, int procCount) {
+  static char *procedure[] = {
+    "PROCEDURE P%d(VAR a : INTEGER; b : INTEGER);\n",
+    "CONST K = %d;\n",
+    "VAR i : INTEGER;\n    s : STRING;\n    t : ARRAY(. 10 .) OF INTEGER;\n",
+    "BEGIN\n",
+    "  (* procedure %d *)\n",
+    "  s := \"text %d\";\n",
+    "  i, a := 0, b; // parallel assignment\n",
+    "  FOR i := 1 TO 10 DO\n    t(. i .) := (a + i * K) %% 7 - b ** 2;\n",
+    "  WHILE a > 0 DO\n    BEGIN\n      a := a - 1;\n",
+    "      IF a %% 2 = 0 THEN CALL WRITEI(a) ELSE CALL WRITELN\n    END;\n",
+    "  REPEAT\n    b := b + t(. 1 .) * 'c'\n  UNTIL b >= K\n",
+    "END;\n\n",
+    NULL
+  };
+  int i, j;
+
+  s->size = 0;
+  append(s, "PROGRAM BENCH;\nCONST N = %d;\nVAR g : INTEGER;\n\n", procCount);
+  for (i = 0; i < procCount; i++)
+    for (j = 0; procedure[j] != NULL; j++)
+      append(s, procedure[j], i);
+  append(s, "BEGIN\n  g := N;\n  CALL P%d(g, 1)\nEND.\n", 0);
+}
+
+// Expressions each followed by a semicolon (a FOLLOW token of Expression)
+static void makeExpressions(Source *s, int count) {
+  int i;
+
+  s->size = 0;
+  for (i = 0; i < count; i++) {
+    append(s, "(a + b * (c - %d) ** 2 %% d(. i .) - f(x, 1) * (-y)) / 3 + 'z'", i % 100);
+    append(s, ";\n", 0);
+  }
+}
+
+/******************************************************************/
+
+static long benchGetToken(Source *input) {
+  Token *token;
+  long count = 0;
+
+  openInputBuffer(input->text, input->size);
+  while ((token = getToken())->tokenType != TK_EOF) {
+    freeToken(token);
+    count++;
+  }
+  freeToken(token);
+  closeInputStream();
+  return count;
+}
+
+static char **words;
+static int wordCount;
+static size_t wordBytes;
+
+static long benchCheckKeyword(Source *input) {
+  static volatile long found;
+  int i;
+
+  for (i = 0; i < wordCount; i++)
+    found += checkKeyword(words[i]) != TK_NONE;
+  return wordCount;
+}
+
+static void expressionList(void) {
+  while (lookAhead->tokenType != TK_EOF) {
+    compileExpression();
+    eat(SB_SEMICOLON);
+  }
+}
+
+static long benchExpressions(Source *input) {
+  parseBuffer(input->text, input->size, expressionList);
+  return tokenCount;
+}
+
+static long benchCompile(Source *input) {
+  compileBuffer(input->text, input->size);
+  return tokenCount;
+}
+
+// Identifiers and keywords in the order the scanner meets them
+static void collectWords(Source *input) {
+  Token *token;
+  int capacity = 1024;
+
+  wordCount = 0;
+  wordBytes = 0;
+  words = (char**)malloc(capacity * sizeof(char*));
+  openInputBuffer(input->text, input->size);
+  while ((token = getToken())->tokenType != TK_EOF) {
+    if (token->tokenType == TK_IDENT || checkKeyword(token->string) != TK_NONE) {
+      if (wordCount == capacity) {
+        capacity *= 2;
+        words = (char**)realloc(words, capacity * sizeof(char*));
+      }
+      words[wordCount++] = strdup(token->string);
+      wordBytes += strlen(token->string);
+    }
+    freeToken(token);
+  }
+  freeToken(token);
+  closeInputStream();
+}
+
+// Loop-heavy programs for the run benchmarks; steps, the work of one run
+// in inner iterations, elements or calls, is reported as its tokens
+typedef struct {
+  char *name;
+  long steps;
+  char *text;
+} Kernel;
+
+static Kernel kernels[] = {
+  {"loops", 1000000,
+   "PROGRAM LOOPS;\nVAR I : INTEGER; J : INTEGER; S : INTEGER;\n"
+   "BEGIN\n  S := 0;\n  FOR I := 1 TO 1000 DO\n    FOR J := 1 TO 1000 DO\n"
+   "      S := (S + I * J) % 1000003;\n  CALL WRITEI(S)\nEND.\n"},
+  {"sieve", 100000,
+   "PROGRAM SIEVE;\nCONST N = 100000;\nVAR P : ARRAY(. 100000 .) OF INTEGER;\n"
+   "    I : INTEGER; J : INTEGER; C : INTEGER;\n"
+   "BEGIN\n  FOR I := 2 TO N DO P(. I .) := 1;\n  I := 2;\n"
+   "  WHILE I * I <= N DO\n    BEGIN\n      IF P(. I .) = 1 THEN\n        BEGIN\n"
+   "          J := I * I;\n          WHILE J <= N DO\n            BEGIN P(. J .) := 0; J := J + I END\n"
+   "        END;\n      I := I + 1\n    END;\n"
+   "  C := 0;\n  FOR I := 2 TO N DO C := C + P(. I .);\n  CALL WRITEI(C)\nEND.\n"},
+  {"fib", 242785,
+   "PROGRAM FIBONACCI;\nFUNCTION FIB(N : INTEGER) : INTEGER;\n"
+   "BEGIN\n  IF N < 2 THEN FIB := N ELSE FIB := FIB(N - 1) + FIB(N - 2)\nEND;\n"
+   "BEGIN\n  CALL WRITEI(FIB(25))\nEND.\n"},
+  {"bubble", 499500,
+   "PROGRAM BUBBLE;\nVAR A : ARRAY(. 1000 .) OF INTEGER; I : INTEGER; J : INTEGER; X : INTEGER;\n"
+   "PROCEDURE SWAP(VAR P : INTEGER; VAR Q : INTEGER);\nBEGIN\n  P, Q := Q, P\nEND;\n"
+   "BEGIN\n  X := 12345;\n  FOR I := 1 TO 1000 DO\n"
+   "    BEGIN X := (X * 1103515245 + 12345) % 65536; A(. I .) := X END;\n"
+   "  FOR I := 1 TO 999 DO\n    FOR J := 1 TO 1000 - I DO\n"
+   "      IF A(. J .) > A(. J + 1 .) THEN CALL SWAP(A(. J .), A(. J + 1 .));\n"
+   "  CALL WRITEI(A(. 1 .))\nEND.\n"},
+  {NULL, 0, NULL}
+};
+
+// Arithmetic-heavy loops, run with and without strength reduction
+static Kernel arithKernels[] = {
+  {"powers", 1000000,
+   "PROGRAM POWERS;\nVAR I : INTEGER; S : INTEGER;\n"
+   "BEGIN\n  S := 0;\n  FOR I := 1 TO 1000000 DO\n"
+   "    S := S + I ** 3 - I ** 2 + (I % 100) ** 5;\n  CALL WRITEI(S)\nEND.\n"},
+  {"shifts", 1000000,
+   "PROGRAM SHIFTS;\nCONST W = 16;\nVAR I : INTEGER; S : INTEGER; H : INTEGER;\n"
+   "BEGIN\n  S := 0; H := 0;\n  FOR I := 1 TO 1000000 DO\n    BEGIN\n"
+   "      H := (H * W + I) / 8 % 65536;\n      S := S + H / 4 - S % 1024 + 2 * (I % W)\n"
+   "    END;\n  CALL WRITEI(S)\nEND.\n"},
+  {NULL, 0, NULL}
+};
+
+// Loops over arrays, run with and without vectorization
+static Kernel vectorKernels[] = {
+  {"saxpy", 1000000,
+   "PROGRAM SAXPY;\nVAR X : ARRAY(. 10000 .) OF INTEGER; Y : ARRAY(. 10000 .) OF INTEGER;\n"
+   "    I : INTEGER; R : INTEGER; S : INTEGER;\n"
+   "BEGIN\n  FOR I := 1 TO 10000 DO X(. I .) := I * 7;\n  S := 0;\n  FOR R := 1 TO 50 DO\n"
+   "    BEGIN\n      FOR I := 1 TO 10000 DO Y(. I .) := X(. I .) * 3 + R;\n"
+   "      FOR I := 1 TO 10000 DO S := S + Y(. I .) - X(. I .)\n    END;\n"
+   "  CALL WRITEI(S)\nEND.\n"},
+  {NULL, 0, NULL}
+};
+
+// A short grading-style run: what counts is how soon it starts
+static char *startupProgram =
+  "PROGRAM HANOI;\nVAR I : INTEGER; N : INTEGER;\n"
+  "PROCEDURE MOVE(N : INTEGER; S : INTEGER; Z : INTEGER);\nBEGIN\n"
+  "  IF N != 0 THEN\n    BEGIN\n      CALL MOVE(N - 1, S, 6 - S - Z);\n      I := I + 1;\n"
+  "      CALL WRITEI(I); CALL WRITEI(N); CALL WRITEI(S); CALL WRITEI(Z); CALL WRITELN;\n"
+  "      CALL MOVE(N - 1, 6 - S - Z, Z)\n    END\nEND;\n"
+  "BEGIN\n  FOR N := 2 TO 4 DO\n    BEGIN I := 0; CALL MOVE(N, 1, 2); CALL WRITELN END\nEND.\n";
+
+static CheckedProgram *kernelProgram;
+static Bytecode *kernelCode;
+static ClosureProgram *kernelClosures;
+static IrProgram *kernelIr;
+static long kernelSteps;
+
+// The checker reads files, so the kernel goes through a temporary one
+static int checkKernel(char *text, CheckedProgram *program) {
+  char path[] = "/tmp/kplbenchXXXXXX";
+  int fd = mkstemp(path), failed;
+  FILE *f;
+
+  if (fd < 0 || (f = fdopen(fd, "w")) == NULL)
+    return 0;
+  fputs(text, f);
+  fclose(f);
+  initCheckedProgram(program);
+  failed = checkProgram(path, program) == IO_ERROR || program->failed;
+  unlink(path);
+  return !failed;
+}
+
+static long benchRunBytecode(Source *input) {
+  runBytecode(kernelCode, stdin, devNull);
+  return kernelSteps;
+}
+
+static long benchRunClosures(Source *input) {
+  runClosures(kernelClosures, stdin, devNull);
+  return kernelSteps;
+}
+
+static long benchRunIr(Source *input) {
+  runIr(kernelIr, stdin, devNull, NULL);
+  return kernelSteps;
+}
+
+// A fresh JIT each run, so warming up and compiling are counted
+static long benchRunJit(Source *input) {
+  Jit jit;
+
+  initJit(&jit, kernelCode, JIT_THRESHOLD);
+  runBytecodeJit(kernelCode, stdin, devNull, &jit);
+  freeJit(&jit);
+  return kernelSteps;
+}
+
+// Code generation included, one token per run
+static long benchStartBytecode(Source *input) {
+  Bytecode bc;
+
+  initBytecode(&bc);
+  generateBytecode(kernelProgram, &bc);
+  runBytecode(&bc, stdin, devNull);
+  freeBytecode(&bc);
+  return 1;
+}
+
+static long benchStartClosures(Source *input) {
+  ClosureProgram closures;
+
+  compileClosures(kernelProgram, &closures);
+  runClosures(&closures, stdin, devNull);
+  freeClosures(&closures);
+  return 1;
+}
+
+/******************************************************************/
+
+static int compareDouble(const void *a, const void *b) {
+  double x = *(double*)a, y = *(double*)b;
+  return x < y ? -1 : x > y;
+}
+
+// Each run repeats the benchmark for at least minTime / RUNS seconds;
+// the median time per iteration of RUNS runs is kept
+static void runBenchmark(char *name, BenchFunc func, Source *input, size_t bytes) {
+  Result *result;
+  double times[RUNS], start, elapsed;
+  long iterations, tokens = 0;
+  int run, i;
+
+  if (filter != NULL && strstr(name, filter) == NULL)
+    return;
+  result = &results[resultCount++];
+  strcpy(result->name, name);
+  result->iterations = 0;
+
+  if (countersOn)
+    startCounters(&counters);
+  for (run = 0; run < RUNS; run++) {
+    iterations = 0;
+    start = statsClock();
+    do {
+      tokens = func(input);
+      iterations++;
+      elapsed = statsClock() - start;
+    } while (elapsed < minTime / RUNS);
+    times[run] = elapsed / iterations;
+    result->iterations += iterations;
+  }
+  result->counted = countersOn;
+  if (countersOn) {
+    stopCounters(&counters);
+    for (i = 0; i < COUNTER_COUNT; i++)
+      result->counts[i] = counters.values[i] / result->iterations;
+  }
+  qsort(times, RUNS, sizeof(double), compareDouble);
+  result->seconds = times[RUNS / 2];
+  result->bytes = bytes;
+  result->tokens = tokens;
+
+  printf("%-24s %10lu %9ld %8ld %10.1f %9.1f %11.2f\n", name, (unsigned long)bytes, tokens,
+         result->iterations, result->seconds * 1e9 / tokens, bytes / result->seconds / 1e6,
+         tokens / result->seconds / 1e6);
+  fflush(stdout);
+}
+
+// The kernel checked and folded as `parser run` does, reduced or not and
+// vectorized or not, then each engine on it
+static int benchKernel(Kernel *kernel, int reduce, int vectorize, char *suffix) {
+  CheckedProgram program;
+  Bytecode code;
+  ClosureProgram closures;
+  IrProgram ir;
+  IrPassStats passes[IR_PASS_RUNS];
+  FoldStats folded;
+  ReduceStats reduced;
+  VectorStats vectorized;
+  char name[64];
+
+  if (!checkKernel(kernel->text, &program)) {
+    fprintf(stderr, "kplbench: %s does not compile\n", kernel->name);
+    return 0;
+  }
+  foldConstants(&program, &folded, NULL);
+  if (reduce)
+    reduceStrength(&program, &reduced, NULL);
+  if (vectorize)
+    vectorizeLoops(&program, &vectorized, NULL);
+  initBytecode(&code);
+  generateBytecode(&program, &code);
+  compileClosures(&program, &closures);
+  kernelCode = &code;
+  kernelClosures = &closures;
+  kernelSteps = kernel->steps;
+  sprintf(name, "run/%s%s", kernel->name, suffix);
+  runBenchmark(name, benchRunBytecode, NULL, code.count * sizeof(int32_t));
+  sprintf(name, "closure/%s%s", kernel->name, suffix);
+  runBenchmark(name, benchRunClosures, NULL, code.count * sizeof(int32_t));
+  sprintf(name, "jit/%s%s", kernel->name, suffix);
+  runBenchmark(name, benchRunJit, NULL, code.count * sizeof(int32_t));
+  // The IR renumbers the cells, after the others were built
+  buildIr(&program, &ir);
+  optimizeIr(&ir, passes);
+  kernelIr = &ir;
+  sprintf(name, "ir/%s%s", kernel->name, suffix);
+  runBenchmark(name, benchRunIr, NULL, code.count * sizeof(int32_t));
+  freeIr(&ir);
+  freeClosures(&closures);
+  freeBytecode(&code);
+  freeCheckedProgram(&program);
+  return 1;
+}
+
+static void printCount(Result *r, Counter counter, double per, char *format) {
+  if (counterAvailable(&counters, counter))
+    printf(format, r->counts[counter] / per);
+  else printf(" %10s", "-");
+}
+
+// Events per token, or per input byte when byBytes is set
+static void printCounters(int byBytes) {
+  Result *r;
+  double per;
+  int i;
+
+  printf("\n%-24s %10s %10s %6s %10s %10s %10s\n", byBytes ? "per byte" : "per token",
+         "cycles", "instrs", "IPC", "br-miss", "L1d-miss", "LLC-miss");
+  for (i = 0; i < resultCount; i++) {
+    r = &results[i];
+    per = byBytes ? (double)r->bytes : (double)r->tokens;
+    printf("%-24s", r->name);
+    printCount(r, COUNTER_CYCLES, per, " %10.1f");
+    printCount(r, COUNTER_INSTRUCTIONS, per, " %10.1f");
+    if (counterAvailable(&counters, COUNTER_CYCLES) &&
+        counterAvailable(&counters, COUNTER_INSTRUCTIONS) && r->counts[COUNTER_CYCLES] > 0)
+      printf(" %6.2f", r->counts[COUNTER_INSTRUCTIONS] / r->counts[COUNTER_CYCLES]);
+    else printf(" %6s", "-");
+    printCount(r, COUNTER_BRANCH_MISSES, per, " %10.3f");
+    printCount(r, COUNTER_L1D_MISSES, per, " %10.3f");
+    printCount(r, COUNTER_LLC_MISSES, per, " %10.4f");
+    printf("\n");
+  }
+}
+
+static void writeJsonCounters(FILE *f, Result *r) {
+  char *separator = "";
+  int i;
+
+  if (!r->counted)
+    return;
+  fprintf(f, ", \"counters\": {");
+  for (i = 0; i < COUNTER_COUNT; i++)
+    if (counterAvailable(&counters, i)) {
+      fprintf(f, "%s\"%s_per_token\": %.4f, \"%s_per_byte\": %.4f", separator,
+              counterName(i), r->counts[i] / r->tokens, counterName(i), r->counts[i] / r->bytes);
+      separator = ", ";
+    }
+  fprintf(f, "}");
+}
+
+// One benchmark per line so a baseline can be read back with sscanf
+static void writeJson(FILE *f) {
+  Result *r;
+  int i;
+
+  fprintf(f, "{\"benchmarks\": [\n");
+  for (i = 0; i < resultCount; i++) {
+    r = &results[i];
+    fprintf(f, "  {\"name\": \"%s\", \"bytes\": %lu, \"tokens\": %ld, \"iterations\": %ld, "
+            "\"ns_per_token\": %.3f, \"mb_per_s\": %.3f, \"tokens_per_s\": %.0f",
+            r->name, (unsigned long)r->bytes, r->tokens, r->iterations,
+            r->seconds * 1e9 / r->tokens, r->bytes / r->seconds / 1e6, r->tokens / r->seconds);
+    writeJsonCounters(f, r);
+    fprintf(f, "}%s\n", i + 1 < resultCount ? "," : "");
+  }
+  fprintf(f, "]}\n");
+}
+
+// Returns the number of benchmarks slower than the baseline by more than threshold percent
+static int compareBaseline(char *fileName, double threshold) {
+  FILE *f = fopen(fileName, "rt");
+  char line[1024], name[64], *p;
+  double old, current, change;
+  int i, regressions = 0;
+
+  if (f == NULL) {
+    fprintf(stderr, "kplbench: can\'t read baseline %s\n", fileName);
+    return -1;
+  }
+  printf("\n%-24s %12s %12s %8s\n", "vs baseline", "old ns/tok", "new ns/tok", "change");
+  while (fgets(line, sizeof(line), f) != NULL) {
+    if (sscanf(line, " {\"name\": \"%63[^\"]\"", name) != 1 ||
+        (p = strstr(line, "\"ns_per_token\": ")) == NULL)
+      continue;
+    old = atof(p + strlen("\"ns_per_token\": "));
+    for (i = 0; i < resultCount && strcmp(results[i].name, name) != 0; i++)
+      ;
+    if (i == resultCount || old <= 0)
+      continue;
+    current = results[i].seconds * 1e9 / results[i].tokens;
+    change = (current - old) / old * 100;
+    printf("%-24s %12.1f %12.1f %+7.1f%%%s\n", name, old, current, change,
+           change > threshold ? "  REGRESSION" : "");
+    if (change > threshold)
+      regressions++;
+  }
+  fclose(f);
+  return regressions;
+}
+
+int main(int argc, char *argv[]) {
+  static char *sizeNames[] = {"small", "medium", "large"};
+  char *jsonName = NULL, *baselineName = NULL;
+  double threshold = 10, largeMb = 8;
+  Source programs[3] = {{NULL, 0, 0}, {NULL, 0, 0}, {NULL, 0, 0}};
+  Source expressions[3] = {{NULL, 0, 0}, {NULL, 0, 0}, {NULL, 0, 0}};
+  CheckedProgram program;
+  char name[64], *reason = NULL;
+  FILE *f;
+  int i, procCount, regressions, useCounters = 1;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--json") == 0 && i + 1 < argc)
+      jsonName = argv[++i];
+    else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+      baselineName = argv[++i];
+    else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+      threshold = atof(argv[++i]);
+    else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc)
+      minTime = atof(argv[++i]);
+    else if (strcmp(argv[i], "--large-mb") == 0 && i + 1 < argc)
+      largeMb = atof(argv[++i]);
+    else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc)
+      filter = argv[++i];
+    else if (strcmp(argv[i], "--no-counters") == 0)
+      useCounters = 0;
+    else {
+      printf("usage: kplbench [--json FILE] [--baseline FILE] [--threshold PCT] "
+             "[--min-time SEC] [--large-mb MB] [--filter TEXT] [--no-counters]\n");
+      return 2;
+    }
+  }
+
+  makeProgram(&programs[0], 1);
+  makeProgram(&programs[1], 128);
+  procCount = (int)(largeMb * 1e6 / (programs[1].size / 128.0));
+  makeProgram(&programs[2], procCount > 1 ? procCount : 1);
+  makeExpressions(&expressions[0], 4);
+  makeExpressions(&expressions[1], 1000);
+  makeExpressions(&expressions[2], (int)(largeMb * 1e6 / 64));
+
+  // Traces are formatted as usual but thrown away
+  devNull = fopen("/dev/null", "w");
+  setOutputStream(devNull);
+
+  for (i = 0; i < 3; i++) {
+    compileBuffer(programs[i].text, programs[i].size);
+    if (!errorRaised)
+      parseBuffer(expressions[i].text, expressions[i].size, expressionList);
+    if (errorRaised) {
+      fprintf(stderr, "kplbench: generated %s input does not parse\n", sizeNames[i]);
+      return 2;
+    }
+  }
+
+  // Hardware events when the kernel lets us count them, wall time regardless
+  if (useCounters) {
+    countersOn = openCounters(&counters, &reason) > 0;
+    if (!countersOn)
+      printf("hardware counters unavailable: %s; wall time only\n\n", reason);
+  }
+
+  printf("%-24s %10s %9s %8s %10s %9s %11s\n", "benchmark", "bytes", "tokens", "iters",
+         "ns/token", "MB/s", "Mtokens/s");
+  for (i = 0; i < 3; i++) {
+    sprintf(name, "getToken/%s", sizeNames[i]);
+    runBenchmark(name, benchGetToken, &programs[i], programs[i].size);
+  }
+  collectWords(&programs[1]);
+  runBenchmark("checkKeyword/medium", benchCheckKeyword, NULL, wordBytes);
+  for (i = 0; i < 3; i++) {
+    sprintf(name, "expression/%s", sizeNames[i]);
+    runBenchmark(name, benchExpressions, &expressions[i], expressions[i].size);
+  }
+  for (i = 0; i < 3; i++) {
+    sprintf(name, "compile/%s", sizeNames[i]);
+    runBenchmark(name, benchCompile, &programs[i], programs[i].size);
+  }
+  for (i = 0; kernels[i].name != NULL; i++)
+    if (!benchKernel(&kernels[i], 1, 1, ""))
+      return 2;
+  for (i = 0; arithKernels[i].name != NULL; i++)
+    if (!benchKernel(&arithKernels[i], 1, 1, "") || !benchKernel(&arithKernels[i], 0, 1, "-unreduced"))
+      return 2;
+  for (i = 0; vectorKernels[i].name != NULL; i++)
+    if (!benchKernel(&vectorKernels[i], 1, 1, "") || !benchKernel(&vectorKernels[i], 1, 0, "-scalar"))
+      return 2;
+  if (!checkKernel(startupProgram, &program)) {
+    fprintf(stderr, "kplbench: the startup program does not compile\n");
+    return 2;
+  }
+  kernelProgram = &program;
+  runBenchmark("startup/bytecode", benchStartBytecode, NULL, strlen(startupProgram));
+  runBenchmark("startup/closure", benchStartClosures, NULL, strlen(startupProgram));
+  freeCheckedProgram(&program);
+  if (countersOn) {
+    printCounters(0);
+    printCounters(1);
+  }
+
+  if (jsonName != NULL) {
+    f = strcmp(jsonName, "-") == 0 ? stdout : fopen(jsonName, "w");
+    if (f == NULL) {
+      fprintf(stderr, "kplbench: can\'t write %s\n", jsonName);
+      return 2;
+    }
+    writeJson(f);
+    if (f != stdout) fclose(f);
+  }
+  if (countersOn)
+    closeCounters(&counters);
+
+  regressions = 0;
+  if (baselineName != NULL && (regressions = compareBaseline(baselineName, threshold)) != 0) {
+    if (regressions < 0)
+      return 2;
+    printf("%d benchmarks regressed by more than %.0f%%\n", regressions, threshold);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,88 @@
+/* Bytecode */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bytecode.h"
+
+static struct {
+  char *name;
+  int operands;
+} ops[OP_COUNT] = {
+  {"HALT", 0}, {"PUSH", 1}, {"PUSH_STR", 1}, {"POP", 0},
+  {"LOAD_LOCAL", 1}, {"STORE_LOCAL", 1}, {"ADDR_LOCAL", 1},
+  {"LOAD_GLOBAL", 1}, {"STORE_GLOBAL", 1}, {"ADDR_GLOBAL", 1},
+  {"LOAD_OUTER", 2}, {"STORE_OUTER", 2}, {"ADDR_OUTER", 2},
+  {"LOAD_IND", 0}, {"STORE_IND", 0}, {"INDEX", 2},
+  {"INC_LOCAL", 1}, {"INC_GLOBAL", 1},
+  {"ADD", 0}, {"SUB", 0}, {"MUL", 0}, {"DIV", 0}, {"MOD", 0}, {"POW", 0}, {"NEG", 0},
+  {"SHL", 1}, {"DIV_SHIFT", 1}, {"MOD_MASK", 1}, {"POW_CONST", 1},
+  {"STRCMP", 0},
+  {"JMP", 1}, {"JEQ", 1}, {"JNE", 1}, {"JLT", 1}, {"JLE", 1}, {"JGT", 1}, {"JGE", 1},
+  {"FRAME", 0}, {"CALL", 3}, {"ENTER", 3}, {"RET", 0}, {"RET_VALUE", 0},
+  {"READC", 0}, {"READI", 0}, {"WRITEC", 0}, {"WRITEI", 0}, {"WRITELN", 0}
+};
+
+void initBytecode(Bytecode *bc) {
+  memset(bc, 0, sizeof(Bytecode));
+}
+
+void freeBytecode(Bytecode *bc) {
+  int i;
+
+  for (i = 0; i < bc->stringCount; i++)
+    free(bc->strings[i]);
+  free(bc->strings);
+  free(bc->code);
+  free(bc->lineNos);
+  free(bc->colNos);
+  initBytecode(bc);
+}
+
+// Returns the address of the word
+int emitWord(Bytecode *bc, int32_t word) {
+  if (bc->count == bc->capacity) {
+    bc->capacity = bc->capacity ? 2 * bc->capacity : 1024;
+    bc->code = (int32_t*)realloc(bc->code, bc->capacity * sizeof(int32_t));
+    bc->lineNos = (int*)realloc(bc->lineNos, bc->capacity * sizeof(int));
+    bc->colNos = (int*)realloc(bc->colNos, bc->capacity * sizeof(int));
+  }
+  bc->lineNos[bc->count] = bc->colNos[bc->count] = 0;
+  bc->code[bc->count] = word;
+  return bc->count++;
+}
+
+int addString(Bytecode *bc, char *text) {
+  if (bc->stringCount == bc->stringCapacity) {
+    bc->stringCapacity = bc->stringCapacity ? 2 * bc->stringCapacity : 16;
+    bc->strings = (char**)realloc(bc->strings, bc->stringCapacity * sizeof(char*));
+  }
+  bc->strings[bc->stringCount] = strdup(text);
+  return bc->stringCount++;
+}
+
+char *opName(OpCode op) {
+  return ops[op].name;
+}
+
+int opOperands(OpCode op) {
+  return ops[op].operands;
+}
+
+void printBytecode(Bytecode *bc, FILE *out) {
+  int pc = 0, i;
+  OpCode op;
+
+  while (pc < bc->count) {
+    op = (OpCode)bc->code[pc];
+    fprintf(out, "%6d  %-12s", pc, opName(op));
+    for (i = 1; i <= opOperands(op); i++)
+      fprintf(out, " %d", bc->code[pc + i]);
+    if (op == OP_PUSH_STR)
+      fprintf(out, "  ; \"%s\"", bc->strings[bc->code[pc + 1]]);
+    if (bc->lineNos[pc] > 0)
+      fprintf(out, "%*s; %d-%d", op == OP_PUSH_STR ? 2 : 4, "", bc->lineNos[pc], bc->colNos[pc]);
+    fputc('\n', out);
+    pc += 1 + opOperands(op);
+  }
+}
@@ -0,0 +1,92 @@
+/* Bytecode */
+
+#ifndef __BYTECODE_H__
+#define __BYTECODE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+// A stack machine. Every instruction is an opcode word followed by its
+// operand words. A frame is the cells from fp on: parameters, then
+// locals, then temporaries; below fp lie four header cells.
+typedef enum {
+  OP_HALT,
+  OP_PUSH,          // value
+  OP_PUSH_STR,      // string index
+  OP_POP,
+  OP_LOAD_LOCAL,    // offset
+  OP_STORE_LOCAL,   // offset
+  OP_ADDR_LOCAL,    // offset
+  OP_LOAD_GLOBAL,   // offset
+  OP_STORE_GLOBAL,  // offset
+  OP_ADDR_GLOBAL,   // offset
+  OP_LOAD_OUTER,    // hops offset: hops static links up
+  OP_STORE_OUTER,   // hops offset
+  OP_ADDR_OUTER,    // hops offset
+  OP_LOAD_IND,      // address -- value
+  OP_STORE_IND,     // value address --
+  OP_INDEX,         // length cells: address index -- address of element index
+  OP_INC_LOCAL,     // offset: the FOR step
+  OP_INC_GLOBAL,    // offset
+  OP_ADD,
+  OP_SUB,
+  OP_MUL,
+  OP_DIV,
+  OP_MOD,
+  OP_POW,
+  OP_NEG,
+  OP_SHL,           // k: multiplies by 2 ** k
+  OP_DIV_SHIFT,     // k: divides by 2 ** k
+  OP_MOD_MASK,      // k: the remainder by 2 ** k
+  OP_POW_CONST,     // n: raises to the power n >= 0
+  OP_STRCMP,        // string string -- sign
+  OP_JMP,           // target
+  OP_JEQ,           // target: a b --, jumps when a = b
+  OP_JNE,
+  OP_JLT,
+  OP_JLE,
+  OP_JGT,
+  OP_JGE,
+  OP_FRAME,         // pushes the header of a call
+  OP_CALL,          // entry argc hops
+  OP_ENTER,         // params size depth: frame cells and operand stack depth
+  OP_RET,
+  OP_RET_VALUE,     // leaves the function result on the stack
+  OP_READC,
+  OP_READI,
+  OP_WRITEC,
+  OP_WRITEI,
+  OP_WRITELN,
+  OP_COUNT
+} OpCode;
+
+// Header cells below fp
+#define FRAME_RESULT -4
+#define FRAME_LINK -3     // static link: frame of the enclosing routine
+#define FRAME_CALLER -2   // dynamic link
+#define FRAME_RETURN -1
+#define FRAME_HEADER 4
+
+typedef union Cell {
+  int64_t i;
+  union Cell *p;
+  char *s;
+} Cell;
+
+typedef struct {
+  int32_t *code;
+  int count, capacity;
+  int *lineNos, *colNos;   // source position of each instruction
+  char **strings;
+  int stringCount, stringCapacity;
+} Bytecode;
+
+void initBytecode(Bytecode *bc);
+void freeBytecode(Bytecode *bc);
+int emitWord(Bytecode *bc, int32_t word);
+int addString(Bytecode *bc, char *text);
+char *opName(OpCode op);
+int opOperands(OpCode op);
+void printBytecode(Bytecode *bc, FILE *out);
+
+#endif
@@ -0,0 +1,804 @@
+/* Translation to C */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "cgen.h"
+#include "codegen.h"
+#include "vm.h"
+
+// Variables of the program are C globals. A routine's variables are C
+// locals, except in a routine that declares routines: those live in a
+// frame struct `fr`, and the nested routines get a pointer to it, the
+// environment `env`, whose `link` leads further out. Routines become
+// file-level functions named r<id>_<name>.
+//
+// C leaves the order of operands open where KPL evaluates left to right,
+// so an operand followed by one that may call, read or fail is computed
+// into a temporary first.
+
+// What the translated program needs: the arithmetic of arith.h, and the
+// run-time errors and I/O of the VM
+static const char *prelude =
+  "#include <stdio.h>\n"
+  "#include <stdlib.h>\n"
+  "#include <stdint.h>\n"
+  "#include <string.h>\n"
+  "\n"
+  "static uintptr_t kplStackLimit;\n"
+  "// Counting the calls in and out keeps them from being tail calls, which\n"
+  "// would turn a recursion that overflows the stack into an endless loop\n"
+  "static unsigned long kplDepth;\n"
+  "\n"
+  "static void kplFail(int line, int col, const char *message) {\n"
+  "  fflush(stdout);\n"
+  "  fprintf(stderr, \"%d-%d:%s\\n\", line, col, message);\n"
+  "  exit(1);\n"
+  "}\n"
+  "\n"
+  "static inline int32_t kplAdd(int32_t a, int32_t b) { return (int32_t)((uint32_t)a + (uint32_t)b); }\n"
+  "static inline int32_t kplSub(int32_t a, int32_t b) { return (int32_t)((uint32_t)a - (uint32_t)b); }\n"
+  "static inline int32_t kplMul(int32_t a, int32_t b) { return (int32_t)((uint32_t)a * (uint32_t)b); }\n"
+  "static inline int32_t kplNeg(int32_t a) { return (int32_t)(0u - (uint32_t)a); }\n"
+  "\n"
+  "static inline int32_t kplDiv(int32_t a, int32_t b, int line, int col) {\n"
+  "  if (b == 0)\n"
+  "    kplFail(line, col, \"" ERM_DIVISIONBYZERO "\");\n"
+  "  return b == -1 ? kplNeg(a) : a / b;\n"
+  "}\n"
+  "\n"
+  "static inline int32_t kplMod(int32_t a, int32_t b, int line, int col) {\n"
+  "  if (b == 0)\n"
+  "    kplFail(line, col, \"" ERM_DIVISIONBYZERO "\");\n"
+  "  return b == -1 ? 0 : a % b;\n"
+  "}\n"
+  "\n"
+  "static inline int32_t kplPow(int32_t a, int32_t b, int line, int col) {\n"
+  "  uint32_t result = 1, base = (uint32_t)a, n = (uint32_t)b;\n"
+  "\n"
+  "  if (b < 0) {\n"
+  "    if (a == 0)\n"
+  "      kplFail(line, col, \"" ERM_DIVISIONBYZERO "\");\n"
+  "    return a == 1 ? 1 : a == -1 ? ((b & 1) ? -1 : 1) : 0;\n"
+  "  }\n"
+  "  for (; n != 0; n >>= 1) {\n"
+  "    if (n & 1)\n"
+  "      result *= base;\n"
+  "    base *= base;\n"
+  "  }\n"
+  "  return (int32_t)result;\n"
+  "}\n"
+  "\n"
+  "// The offset of element i of n, each of the given cells, after base\n"
+  "static inline int32_t kplIndex(int32_t base, int32_t i, int32_t n, int32_t cells, int line, int col) {\n"
+  "  if (i < 1 || i > n)\n"
+  "    kplFail(line, col, \"" ERM_INDEXOUTOFRANGE "\");\n"
+  "  return base + (i - 1) * cells;\n"
+  "}\n"
+  "\n"
+  "static inline int kplCompare(const char *a, const char *b) {\n"
+  "  int sign = strcmp(a != NULL ? a : \"\", b != NULL ? b : \"\");\n"
+  "  return (sign > 0) - (sign < 0);\n"
+  "}\n"
+  "\n"
+  "// The stack grows down from main()\n"
+  "static inline void kplCheckStack(int line, int col) {\n"
+  "  char here;\n"
+  "  if ((uintptr_t)&here < kplStackLimit)\n"
+  "    kplFail(line, col, \"" ERM_STACKOVERFLOW "\");\n"
+  "}\n"
+  "\n"
+  "static int32_t kplReadC(int line, int col) {\n"
+  "  int c = getchar();\n"
+  "  if (c == EOF)\n"
+  "    kplFail(line, col, \"" ERM_ENDOFINPUT "\");\n"
+  "  return c;\n"
+  "}\n"
+  "\n"
+  "static int32_t kplReadI(int line, int col) {\n"
+  "  int n;\n"
+  "  if (scanf(\"%d\", &n) != 1)\n"
+  "    kplFail(line, col, \"" ERM_ENDOFINPUT "\");\n"
+  "  return n;\n"
+  "}\n"
+  "\n"
+  "static void kplWriteI(int32_t n) { printf(\"%d\", (int)n); }\n"
+  "static void kplWriteC(int32_t c) { putchar((char)c); }\n"
+  "\n";
+
+// One C function being written
+typedef struct {
+  FILE *out;            // its body, until the temporaries are known
+  int level;            // scope level of its code: 1 for the program body
+  int framed;           // its variables are in the frame struct fr
+  char **temps;         // C type of each temporary t<i>
+  int tempCount, tempCapacity;
+  int indent;
+} Translator;
+
+static void emitExpression(Translator *t, Node *node);
+static void emitStatement(Translator *t, Node *node);
+
+static int isString(Type *type) {
+  while (type->typeClass == TY_ARRAY)
+    type = type->element;
+  return type->typeClass == TY_STRING || type->typeClass == TY_BYTES;
+}
+
+// C types, written so a name can follow directly
+static char *valueType(Type *type) {
+  return isString(type) ? "char *" : "int32_t ";
+}
+
+static char *pointerType(Type *type) {
+  return isString(type) ? "char **" : "int32_t *";
+}
+
+// A VAR parameter, or an array parameter, holds the address of its argument
+static int isPointer(Symbol *symbol) {
+  return symbol->kind == SYM_PARAMETER &&
+         (symbol->node->op == KW_VAR || symbol->type->typeClass == TY_ARRAY);
+}
+
+static int hasRoutines(Node *block) {
+  Node *child;
+
+  for (child = block->firstChild; child != NULL; child = child->next)
+    if (child->kind == N_FUNC_DECL || child->kind == N_PROC_DECL)
+      return 1;
+  return 0;
+}
+
+static int newTemp(Translator *t, char *type) {
+  if (t->tempCount == t->tempCapacity) {
+    t->tempCapacity = t->tempCapacity ? 2 * t->tempCapacity : 8;
+    t->temps = (char**)realloc(t->temps, t->tempCapacity * sizeof(char*));
+  }
+  t->temps[t->tempCount] = type;
+  return t->tempCount++;
+}
+
+static void emitIndent(Translator *t) {
+  fprintf(t->out, "%*s", 2 * t->indent, "");
+}
+
+// Evaluating it has no effect and cannot fail, whenever it happens
+static int isConstant(Node *node) {
+  switch (node->kind) {
+  case N_NUMBER:
+  case N_CHAR:
+  case N_STRING:
+    return 1;
+  case N_UNARY:
+    return isConstant(node->firstChild);
+  case N_VARIABLE:
+    return node->symbol->kind == SYM_CONSTANT;
+  default:
+    return 0;
+  }
+}
+
+// Evaluating it may call, read or fail, so what comes before it in KPL
+// must be computed before it in C
+static int isImpure(Node *node) {
+  switch (node->kind) {
+  case N_NUMBER:
+  case N_CHAR:
+  case N_STRING:
+    return 0;
+  case N_UNARY:
+    return isImpure(node->firstChild);
+  case N_BINARY:
+    if (node->op == SB_SLASH || node->op == SB_MOD || node->op == SB_POWER)
+      return 1;
+    return isImpure(node->firstChild) || isImpure(node->lastChild);
+  case N_VARIABLE:
+    if (node->symbol->kind == SYM_CONSTANT)
+      return 0;
+    // An index may be out of range
+    return node->symbol->kind == SYM_FUNCTION || node->firstChild != NULL;
+  default:
+    return 1;
+  }
+}
+
+// The frame of the given level as a pointer, for a call
+static void emitEnv(Translator *t, int level) {
+  int hops;
+
+  if (level == t->level) {
+    fputs("&fr", t->out);
+    return;
+  }
+  fputs("env", t->out);
+  for (hops = t->level - 1 - level; hops > 0; hops--)
+    fputs("->link", t->out);
+}
+
+// What precedes a name in the frame of the given level
+static void emitFrame(Translator *t, int level) {
+  if (level == 1)
+    return;
+  if (level == t->level) {
+    if (t->framed)
+      fputs("fr.", t->out);
+    return;
+  }
+  emitEnv(t, level);
+  fputs("->", t->out);
+}
+
+// The variable itself: for a pointer parameter, the pointer
+static void emitName(Translator *t, Symbol *symbol) {
+  emitFrame(t, symbol->level);
+  fprintf(t->out, "v_%s", symbol->name);
+}
+
+static void emitOffset(Translator *t, Node *index, Type **types, int k) {
+  int temp = -1;
+
+  if (k == 0) {
+    fputs("kplIndex(0, ", t->out);
+  } else if (isImpure(index)) {
+    temp = newTemp(t, "int32_t ");
+    fprintf(t->out, "(t%d = ", temp);
+    emitOffset(t, index->prev, types, k - 1);
+    fprintf(t->out, ", kplIndex(t%d, ", temp);
+  } else {
+    fputs("kplIndex(", t->out);
+    emitOffset(t, index->prev, types, k - 1);
+    fputs(", ", t->out);
+  }
+  emitExpression(t, index);
+  fprintf(t->out, ", %d, %d, %d, %d)", types[k]->size, typeCells(types[k]->element),
+          index->lineNo, index->colNo);
+  if (temp >= 0)
+    fputc(')', t->out);
+}
+
+// A variable or parameter as an lvalue
+static void emitScalar(Translator *t, Symbol *symbol) {
+  if (isPointer(symbol) && symbol->type->typeClass != TY_ARRAY) {
+    fputs("(*", t->out);
+    emitName(t, symbol);
+    fputc(')', t->out);
+  } else emitName(t, symbol);
+}
+
+// A variable, parameter or array element as an lvalue
+static void emitVariable(Translator *t, Node *node) {
+  Symbol *symbol = node->symbol;
+  Type *types[node->childCount + 1], *type = symbol->type;
+  int k;
+
+  if (node->firstChild == NULL) {
+    emitScalar(t, symbol);
+    return;
+  }
+  for (k = 0; k < node->childCount; k++, type = type->element)
+    types[k] = type;
+  emitName(t, symbol);
+  fputc('[', t->out);
+  emitOffset(t, node->lastChild, types, node->childCount - 1);
+  fputc(']', t->out);
+}
+
+// The address of a VAR argument
+static void emitAddress(Translator *t, Node *node) {
+  Symbol *symbol = node->symbol;
+
+  if (node->firstChild != NULL) {
+    fputc('&', t->out);
+    emitVariable(t, node);
+  } else if (isPointer(symbol) || symbol->type->typeClass == TY_ARRAY)
+    emitName(t, symbol);
+  else {
+    fputc('&', t->out);
+    emitName(t, symbol);
+  }
+}
+
+// prefix left middle right suffix, with left computed first when right
+// may have an effect
+static void emitPair(Translator *t, char *prefix, Node *left, char *middle, Node *right, char *suffix) {
+  int temp = -1;
+
+  if (isImpure(right) && !isConstant(left)) {
+    temp = newTemp(t, valueType(left->type));
+    fprintf(t->out, "(t%d = ", temp);
+    emitExpression(t, left);
+    fputs(", ", t->out);
+  }
+  fputs(prefix, t->out);
+  if (temp >= 0)
+    fprintf(t->out, "t%d", temp);
+  else emitExpression(t, left);
+  fputs(middle, t->out);
+  emitExpression(t, right);
+  fputs(suffix, t->out);
+  if (temp >= 0)
+    fputc(')', t->out);
+}
+
+// A function or procedure of the program, or READC and READI
+static void emitCall(Translator *t, Node *call) {
+  Symbol *symbol = call->symbol;
+  Type *type = symbol->type;
+  Node *arg, *args[type->size];
+  int temps[type->size], impure = 0, i;
+
+  switch (symbol->builtin) {
+  case BUILTIN_READC:
+    fprintf(t->out, "kplReadC(%d, %d)", call->lineNo, call->colNo);
+    return;
+  case BUILTIN_READI:
+    fprintf(t->out, "kplReadI(%d, %d)", call->lineNo, call->colNo);
+    return;
+  default:
+    break;
+  }
+
+  for (i = 0, arg = call->firstChild; i < type->size; i++, arg = arg->next)
+    args[i] = arg;
+  // From the last argument back: those before an impure one go first
+  fputc('(', t->out);
+  for (i = type->size - 1; i >= 0; i--) {
+    temps[i] = -1;
+    if (impure && !isConstant(args[i]))
+      temps[i] = newTemp(t, type->byRef[i] || type->params[i]->typeClass == TY_ARRAY ?
+                         pointerType(type->params[i]) : valueType(type->params[i]));
+    impure |= isImpure(args[i]);
+  }
+  for (i = 0; i < type->size; i++)
+    if (temps[i] >= 0) {
+      fprintf(t->out, "t%d = ", temps[i]);
+      if (type->byRef[i] || type->params[i]->typeClass == TY_ARRAY)
+        emitAddress(t, args[i]);
+      else emitExpression(t, args[i]);
+      fputs(", ", t->out);
+    }
+  fprintf(t->out, "kplCheckStack(%d, %d), r%d_%s(", call->lineNo, call->colNo,
+          symbol->offset, symbol->name);
+  if (symbol->level > 1) {
+    emitEnv(t, symbol->level);
+    if (type->size > 0)
+      fputs(", ", t->out);
+  }
+  for (i = 0; i < type->size; i++) {
+    if (i > 0)
+      fputs(", ", t->out);
+    if (temps[i] >= 0)
+      fprintf(t->out, "t%d", temps[i]);
+    else if (type->byRef[i] || type->params[i]->typeClass == TY_ARRAY)
+      emitAddress(t, args[i]);
+    else emitExpression(t, args[i]);
+  }
+  fputs("))", t->out);
+}
+
+static void emitNumber(Translator *t, int value) {
+  if (value == INT32_MIN)
+    fputs("(-2147483647 - 1)", t->out);
+  else fprintf(t->out, "%d", value);
+}
+
+static void emitString(Translator *t, char *text) {
+  unsigned char *c;
+
+  fputc('"', t->out);
+  for (c = (unsigned char*)(text != NULL ? text : ""); *c != '\0'; c++)
+    if (*c == '"' || *c == '\\' || *c == '?')
+      fprintf(t->out, "\\%c", *c);
+    else if (isprint(*c))
+      fputc(*c, t->out);
+    else fprintf(t->out, "\\%03o", *c);
+  fputc('"', t->out);
+}
+
+static void emitExpression(Translator *t, Node *node) {
+  Symbol *symbol = node->symbol;
+  char suffix[32];
+
+  switch (node->kind) {
+  case N_NUMBER:
+  case N_CHAR:
+    emitNumber(t, node->value);
+    break;
+  case N_STRING:
+    emitString(t, node->text);
+    break;
+  case N_UNARY:
+    if (node->op == SB_MINUS) {
+      fputs("kplNeg(", t->out);
+      emitExpression(t, node->firstChild);
+      fputc(')', t->out);
+    } else emitExpression(t, node->firstChild);
+    break;
+  case N_BINARY:
+    sprintf(suffix, ", %d, %d)", node->lineNo, node->colNo);
+    switch (node->op) {
+    case SB_PLUS: emitPair(t, "kplAdd(", node->firstChild, ", ", node->lastChild, ")"); break;
+    case SB_MINUS: emitPair(t, "kplSub(", node->firstChild, ", ", node->lastChild, ")"); break;
+    case SB_TIMES: emitPair(t, "kplMul(", node->firstChild, ", ", node->lastChild, ")"); break;
+    case SB_SLASH: emitPair(t, "kplDiv(", node->firstChild, ", ", node->lastChild, suffix); break;
+    case SB_MOD: emitPair(t, "kplMod(", node->firstChild, ", ", node->lastChild, suffix); break;
+    default: emitPair(t, "kplPow(", node->firstChild, ", ", node->lastChild, suffix); break;
+    }
+    break;
+  case N_VARIABLE:
+    if (symbol->kind == SYM_CONSTANT)
+      emitExpression(t, symbol->node->firstChild);
+    else if (symbol->kind == SYM_FUNCTION)
+      emitCall(t, node);
+    else emitVariable(t, node);
+    break;
+  default:
+    emitCall(t, node);
+    break;
+  }
+}
+
+static void emitCondition(Translator *t, Node *cond) {
+  char *op, suffix[16];
+
+  switch (cond->op) {
+  case SB_EQ: op = " == "; break;
+  case SB_NEQ: op = " != "; break;
+  case SB_LT: op = " < "; break;
+  case SB_LE: op = " <= "; break;
+  case SB_GT: op = " > "; break;
+  default: op = " >= "; break;
+  }
+  if (isString(cond->firstChild->type)) {
+    sprintf(suffix, ")%s0", op);
+    emitPair(t, "kplCompare(", cond->firstChild, ", ", cond->lastChild, suffix);
+  } else emitPair(t, "", cond->firstChild, op, cond->lastChild, "");
+}
+
+static void emitTarget(Translator *t, Node *target) {
+  Symbol *symbol = target->symbol;
+
+  if (symbol->kind == SYM_FUNCTION) {
+    emitFrame(t, symbol->level + 1);
+    fputs("result", t->out);
+  } else emitVariable(t, target);
+}
+
+// target := value; the value comes first, before any index is checked
+static void emitAssignment(Translator *t, Node *target, Node *value) {
+  int temp;
+
+  emitIndent(t);
+  if (target->firstChild != NULL && isImpure(value)) {
+    temp = newTemp(t, valueType(value->type != NULL ? value->type : target->type));
+    fprintf(t->out, "t%d = ", temp);
+    emitExpression(t, value);
+    fputs(";\n", t->out);
+    emitIndent(t);
+    emitTarget(t, target);
+    fprintf(t->out, " = t%d;\n", temp);
+  } else {
+    emitTarget(t, target);
+    fputs(" = ", t->out);
+    emitExpression(t, value);
+    fputs(";\n", t->out);
+  }
+}
+
+// Every value first, so X, Y := Y, X swaps; then the stores, last first
+static void emitParallel(Translator *t, Node *node) {
+  Node *value, *target;
+  int temps[node->value], i;
+
+  for (i = 0, value = childAt(node, node->value); value != NULL; i++, value = value->next) {
+    temps[i] = newTemp(t, valueType(value->type));
+    emitIndent(t);
+    fprintf(t->out, "t%d = ", temps[i]);
+    emitExpression(t, value);
+    fputs(";\n", t->out);
+  }
+  target = childAt(node, node->value - 1);
+  for (i = node->value - 1; i >= 0; i--, target = target->prev) {
+    emitIndent(t);
+    emitTarget(t, target);
+    fprintf(t->out, " = t%d;\n", temps[i]);
+  }
+}
+
+static void emitCallSt(Translator *t, Node *node) {
+  Symbol *symbol = node->symbol;
+
+  switch (symbol->builtin) {
+  case BUILTIN_WRITEC:
+  case BUILTIN_WRITEI:
+    emitIndent(t);
+    fputs(symbol->builtin == BUILTIN_WRITEC ? "kplWriteC(" : "kplWriteI(", t->out);
+    emitExpression(t, node->firstChild);
+    fputs(");\n", t->out);
+    return;
+  case BUILTIN_WRITELN:
+    emitIndent(t);
+    fputs("putchar('\\n');\n", t->out);
+    return;
+  default:
+    break;
+  }
+  // CALL READC(C) and CALL READI(N) read into their argument
+  if (symbol->kind == SYM_FUNCTION && node->firstChild != NULL)
+    emitAssignment(t, node->firstChild, node);
+  else {
+    emitIndent(t);
+    emitCall(t, node);
+    fputs(";\n", t->out);
+  }
+}
+
+static void emitBlock(Translator *t, Node *node) {
+  t->indent++;
+  emitStatement(t, node);
+  t->indent--;
+}
+
+// The bound is computed once; the test at the bottom stops before the
+// variable steps past it, so it never wraps
+static void emitFor(Translator *t, Node *node) {
+  Node *from = node->firstChild;
+  int bound = newTemp(t, "int32_t ");
+
+  emitIndent(t);
+  emitScalar(t, node->symbol);
+  fputs(" = ", t->out);
+  emitExpression(t, from);
+  fputs(";\n", t->out);
+  emitIndent(t);
+  fprintf(t->out, "t%d = ", bound);
+  emitExpression(t, from->next);
+  fputs(";\n", t->out);
+  emitIndent(t);
+  fputs("if (", t->out);
+  emitScalar(t, node->symbol);
+  fprintf(t->out, " <= t%d)\n", bound);
+  t->indent++;
+  emitIndent(t);
+  fputs("for (;;) {\n", t->out);
+  emitBlock(t, node->lastChild);
+  t->indent++;
+  emitIndent(t);
+  fputs("if (", t->out);
+  emitScalar(t, node->symbol);
+  fprintf(t->out, " >= t%d)\n", bound);
+  emitIndent(t);
+  fputs("  break;\n", t->out);
+  emitIndent(t);
+  emitScalar(t, node->symbol);
+  fputs("++;\n", t->out);
+  t->indent--;
+  emitIndent(t);
+  fputs("}\n", t->out);
+  t->indent--;
+}
+
+static void emitStatement(Translator *t, Node *node) {
+  Node *child;
+
+  switch (node->kind) {
+  case N_ASSIGN:
+    if (node->value == 1)
+      emitAssignment(t, node->firstChild, node->lastChild);
+    else emitParallel(t, node);
+    break;
+  case N_CALL:
+    emitCallSt(t, node);
+    break;
+  case N_GROUP:
+    for (child = node->firstChild; child != NULL; child = child->next)
+      emitStatement(t, child);
+    break;
+  case N_IF:
+    emitIndent(t);
+    fputs("if (", t->out);
+    emitCondition(t, node->firstChild);
+    fputs(") {\n", t->out);
+    emitBlock(t, node->firstChild->next);
+    if (node->childCount > 2) {
+      emitIndent(t);
+      fputs("} else {\n", t->out);
+      emitBlock(t, node->lastChild);
+    }
+    emitIndent(t);
+    fputs("}\n", t->out);
+    break;
+  case N_WHILE:
+    emitIndent(t);
+    fputs("while (", t->out);
+    emitCondition(t, node->firstChild);
+    fputs(") {\n", t->out);
+    emitBlock(t, node->lastChild);
+    emitIndent(t);
+    fputs("}\n", t->out);
+    break;
+  case N_FOR:
+    emitFor(t, node);
+    break;
+  case N_REPEAT:
+    emitIndent(t);
+    fputs("do {\n", t->out);
+    t->indent++;
+    for (child = node->firstChild; child != node->lastChild; child = child->next)
+      emitStatement(t, child);
+    t->indent--;
+    emitIndent(t);
+    fputs("} while (!(", t->out);
+    emitCondition(t, node->lastChild);
+    fputs("));\n", t->out);
+    break;
+  default:
+    break;
+  }
+}
+
+static void declare(FILE *out, Symbol *symbol) {
+  Type *type = symbol->type;
+
+  if (isPointer(symbol))
+    fprintf(out, "%sv_%s", pointerType(type), symbol->name);
+  else if (type->typeClass == TY_ARRAY)
+    fprintf(out, "%sv_%s[%d]", valueType(type), symbol->name, typeCells(type));
+  else fprintf(out, "%sv_%s", valueType(type), symbol->name);
+}
+
+// A routine declared in another gets the frame of that one as env
+static void emitSignature(FILE *out, Node *routine, Node *parent) {
+  Symbol *symbol = routine->symbol;
+  Type *result = symbol->type->element;
+  Node *child;
+  int first = 1;
+
+  fprintf(out, "static %sr%d_%s(", result != NULL ? valueType(result) : "void ",
+          symbol->offset, symbol->name);
+  if (parent != NULL) {
+    fprintf(out, "struct F%d *env", parent->symbol->offset);
+    first = 0;
+  }
+  for (child = routine->firstChild; child->kind == N_PARAM; child = child->next, first = 0) {
+    if (!first)
+      fputs(", ", out);
+    declare(out, child->symbol);
+  }
+  if (first)
+    fputs("void", out);
+  fputc(')', out);
+}
+
+static void emitFrameStruct(FILE *out, Node *routine, Node *parent) {
+  Node *block = routine->lastChild, *child;
+
+  fprintf(out, "struct F%d {\n", routine->symbol->offset);
+  if (parent != NULL)
+    fprintf(out, "  struct F%d *link;\n", parent->symbol->offset);
+  else fputs("  void *link;\n", out);
+  if (routine->kind == N_FUNC_DECL)
+    fprintf(out, "  %sresult;\n", valueType(routine->symbol->type->element));
+  for (child = routine->firstChild; child->kind == N_PARAM; child = child->next) {
+    fputs("  ", out);
+    declare(out, child->symbol);
+    fputs(";\n", out);
+  }
+  for (child = block->firstChild; child != NULL; child = child->next)
+    if (child->kind == N_VAR_DECL) {
+      fputs("  ", out);
+      declare(out, child->symbol);
+      fputs(";\n", out);
+    }
+  fputs("};\n\n", out);
+}
+
+// Numbers the routines, in the order they are declared, and writes their
+// frame structs and prototypes, each struct before the routines using it
+static void declareRoutines(FILE *out, Node *block, Node *parent, int *count) {
+  Node *child;
+
+  for (child = block->firstChild; child != NULL; child = child->next)
+    if (child->kind == N_FUNC_DECL || child->kind == N_PROC_DECL) {
+      child->symbol->offset = ++*count;
+      if (hasRoutines(child->lastChild))
+        emitFrameStruct(out, child, parent);
+      emitSignature(out, child, parent);
+      fputs(";\n", out);
+      declareRoutines(out, child->lastChild, child, count);
+    }
+}
+
+// The body of a routine, or of main() when routine is NULL. The body is
+// written first, to learn which temporaries it needs.
+static void emitFunction(FILE *out, Translator *t, Node *block, Node *routine) {
+  Node *child;
+  char *body = NULL, *frame = t->framed ? "fr." : "";
+  size_t size = 0;
+  int i;
+
+  t->out = open_memstream(&body, &size);
+  t->indent = 1;
+  emitStatement(t, block->lastChild);
+  fclose(t->out);
+
+  // Variables start at zero, as the VM's frames do
+  if (routine == NULL)
+    fputs("  char base;\n", out);
+  else if (t->framed)
+    fprintf(out, "  struct F%d fr = {0};\n", routine->symbol->offset);
+  else {
+    if (routine->kind == N_FUNC_DECL)
+      fprintf(out, "  %sresult = 0;\n", valueType(routine->symbol->type->element));
+    for (child = block->firstChild; child != NULL; child = child->next)
+      if (child->kind == N_VAR_DECL) {
+        fputs("  ", out);
+        declare(out, child->symbol);
+        fputs(child->symbol->type->typeClass == TY_ARRAY ? " = {0};\n" : " = 0;\n", out);
+      }
+  }
+  for (i = 0; i < t->tempCount; i++)
+    fprintf(out, "  %st%d;\n", t->temps[i], i);
+  if (routine == NULL)
+    fprintf(out, "\n  kplStackLimit = (uintptr_t)&base - %d;\n", CGEN_C_STACK);
+  else {
+    if (t->framed && routine->symbol->level > 1)
+      fputs("  fr.link = env;\n", out);
+    for (child = routine->firstChild; t->framed && child->kind == N_PARAM; child = child->next)
+      fprintf(out, "  fr.v_%s = v_%s;\n", child->symbol->name, child->symbol->name);
+    fputs("  kplDepth++;\n", out);
+  }
+  fputs(body, out);
+  if (routine == NULL)
+    fputs("  return 0;\n", out);
+  else {
+    fputs("  kplDepth--;\n", out);
+    if (routine->kind == N_FUNC_DECL)
+      fprintf(out, "  return %sresult;\n", frame);
+  }
+  fputs("}\n\n", out);
+  free(body);
+  free(t->temps);
+}
+
+static void defineRoutines(FILE *out, Node *block, Node *parent) {
+  Node *child;
+  Translator t;
+
+  for (child = block->firstChild; child != NULL; child = child->next)
+    if (child->kind == N_FUNC_DECL || child->kind == N_PROC_DECL) {
+      memset(&t, 0, sizeof(Translator));
+      t.level = child->symbol->level + 1;
+      t.framed = hasRoutines(child->lastChild);
+      emitSignature(out, child, parent);
+      fputs(" {\n", out);
+      emitFunction(out, &t, child->lastChild, child);
+      defineRoutines(out, child->lastChild, child);
+    }
+}
+
+void generateC(CheckedProgram *program, FILE *out) {
+  Node *block = program->tree.root->firstChild, *child;
+  Translator t;
+  int count = 0;
+
+  fprintf(out, "// PROGRAM %s, translated by parser build\n\n", program->tree.root->text);
+  fputs(prelude, out);
+  for (child = block->firstChild; child != NULL; child = child->next)
+    if (child->kind == N_VAR_DECL) {
+      fputs("static ", out);
+      declare(out, child->symbol);
+      fputs(";\n", out);
+    }
+  fputc('\n', out);
+  declareRoutines(out, block, NULL, &count);
+  fputc('\n', out);
+  defineRoutines(out, block, NULL);
+
+  memset(&t, 0, sizeof(Translator));
+  t.level = 1;
+  fputs("int main(void) {\n", out);
+  emitFunction(out, &t, block, NULL);
+}
@@ -0,0 +1,18 @@
+/* Translation to C */
+
+#ifndef __CGEN_H__
+#define __CGEN_H__
+
+#include <stdio.h>
+#include "typecheck.h"
+
+// C stack the translated program lets its calls use before it reports
+// a stack overflow, as the engines do
+#define CGEN_C_STACK (4 << 20)
+
+// Writes a checked program that did not fail as one self-contained C
+// file. The program behaves as under `parser run`: the same output,
+// wraparound arithmetic and "line-col:message" run-time errors.
+void generateC(CheckedProgram *program, FILE *out);
+
+#endif
@@ -0,0 +1,179 @@
+/* Parse server client */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+#define CLIENT_OK 0
+#define CLIENT_SYNTAX_ERROR 1
+#define CLIENT_FAILED 2
+
+static int connectServer(char *socketPath) {
+  struct sockaddr_un addr;
+  int fd;
+
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+    return -1;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socketPath);
+  fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+    close(fd);
+    fd = -1;
+  }
+  return fd;
+}
+
+static int writeAll(int fd, char *data, size_t size) {
+  ssize_t n;
+
+  while (size > 0) {
+    n = write(fd, data, size);
+    if (n <= 0)
+      return 0;
+    data += n;
+    size -= n;
+  }
+  return 1;
+}
+
+static char *readFile(char *fileName, size_t *size) {
+  FILE *f = fopen(fileName, "rb");
+  char *data;
+  long n;
+
+  if (f == NULL)
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  n = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  data = (char*)malloc(n > 0 ? n : 1);
+  *size = fread(data, 1, n > 0 ? n : 0, f);
+  fclose(f);
+  return data;
+}
+
+// Send one request, print the reply without its status line and map the status to an exit code
+static int request(char *socketPath, char *header, char *body, size_t size) {
+  char *reply = NULL, *status;
+  size_t length = 0, capacity = 0;
+  ssize_t n;
+  int fd = connectServer(socketPath);
+
+  if (fd < 0) {
+    fprintf(stderr, "kplclient: can\'t connect to %s\n", socketPath);
+    return CLIENT_FAILED;
+  }
+  if (!writeAll(fd, header, strlen(header)) || !writeAll(fd, body, size)) {
+    close(fd);
+    return CLIENT_FAILED;
+  }
+  shutdown(fd, SHUT_WR);
+
+  for (;;) {
+    if (length == capacity) {
+      capacity = capacity ? capacity * 2 : 4096;
+      reply = (char*)realloc(reply, capacity + 1);
+    }
+    n = read(fd, reply + length, capacity - length);
+    if (n <= 0)
+      break;
+    length += n;
+  }
+  close(fd);
+  if (reply == NULL)
+    return CLIENT_FAILED;
+  reply[length] = '\0';
+
+  // The status is the last line of the reply
+  status = NULL;
+  if (length > 0 && reply[length - 1] == '\n') {
+    reply[length - 1] = '\0';
+    status = strrchr(reply, '\n');
+    status = status == NULL ? reply : status + 1;
+    if (strncmp(status, STATUS_PREFIX, strlen(STATUS_PREFIX)) != 0)
+      status = NULL;
+  }
+  if (status == NULL) {
+    fprintf(stderr, "kplclient: truncated reply\n");
+    free(reply);
+    return CLIENT_FAILED;
+  }
+  fwrite(reply, 1, status - reply, stdout);
+  status += strlen(STATUS_PREFIX);
+
+  n = strcmp(status, "ok") == 0 ? CLIENT_OK :
+      strcmp(status, "error") == 0 ? CLIENT_SYNTAX_ERROR : CLIENT_FAILED;
+  if (n == CLIENT_FAILED && strcmp(status, "io-error") != 0)
+    fprintf(stderr, "kplclient: %s\n", status);
+  free(reply);
+  return (int)n;
+}
+
+static int requestFile(char *socketPath, char *fileName, int byPath) {
+  char header[4200];
+  char *body;
+  size_t size;
+  int status;
+
+  if (byPath) {
+    if (strlen(fileName) > 4096)
+      return CLIENT_FAILED;
+    sprintf(header, "PATH %s\n", fileName);
+    return request(socketPath, header, "", 0);
+  }
+  if ((body = readFile(fileName, &size)) == NULL) {
+    printf("Can\'t read input file!\n");
+    return CLIENT_FAILED;
+  }
+  sprintf(header, "SOURCE %lu\n", (unsigned long)size);
+  status = request(socketPath, header, body, size);
+  free(body);
+  return status;
+}
+
+int main(int argc, char *argv[]) {
+  char *socketPath = NULL;
+  int byPath = 0, files = 0, status, worst = CLIENT_OK, i;
+
+  for (i = 1; i < argc; i++)
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+      socketPath = argv[++i];
+    else if (strcmp(argv[i], "--path") == 0)
+      byPath = 1;
+    else if (argv[i][0] != '-')
+      files++;
+  if (socketPath == NULL && (socketPath = defaultSocketPath()) == NULL) {
+    fprintf(stderr, "kplclient: no private directory for the socket, name one with -s\n");
+    return CLIENT_FAILED;
+  }
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0) {
+      i++;
+      continue;
+    }
+    if (strcmp(argv[i], "--stats") == 0)
+      status = request(socketPath, "STATS\n", "", 0);
+    else if (strcmp(argv[i], "--shutdown") == 0)
+      status = request(socketPath, "SHUTDOWN\n", "", 0);
+    else if (strcmp(argv[i], "--path") == 0)
+      continue;
+    else {
+      // Same layout as the batch mode of the parser
+      if (files > 1)
+        printf("==> %s <==\n", argv[i]);
+      status = requestFile(socketPath, argv[i], byPath);
+    }
+    fflush(stdout);
+    if (status > worst)
+      worst = status;
+  }
+  return worst;
+}
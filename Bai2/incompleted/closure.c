@@ -0,0 +1,896 @@
+/* Closure compilation */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arith.h"
+#include "codegen.h"
+#include "vm.h"
+#include "closure.h"
+#include "fold.h"
+#include "reduce.h"
+
+// The tree is turned into closures in one pass with no code buffer,
+// jump patching or stack depth bookkeeping, so a short program starts
+// running almost at once; the cost is an indirect call per operation.
+// A frame has two header cells below fp.
+#define CLOSURE_LINK -2
+#define CLOSURE_RESULT -1
+#define CLOSURE_HEADER 2
+
+typedef struct {
+  ClosureProgram *program;
+  int level;              // scope level of the frame being built
+  int cells;
+} Builder;
+
+static Closure *buildExpression(Builder *b, Node *node);
+static Closure *buildStatement(Builder *b, Node *node);
+
+static void fail(Machine *m, Closure *c, char *message) {
+  m->failure = message;
+  m->failedAt = c;
+  longjmp(m->trap, 1);
+}
+
+static Cell *outerFrame(Machine *m, int hops) {
+  Cell *frame = m->fp;
+
+  for (; hops > 0; hops--)
+    frame = frame[CLOSURE_LINK].p;
+  return frame;
+}
+
+/******************************************************************/
+
+static Cell evalConstant(Closure *c, Machine *m) {
+  Cell value;
+  value.i = c->a;
+  return value;
+}
+
+static Cell evalString(Closure *c, Machine *m) {
+  Cell value;
+  value.s = c->text;
+  return value;
+}
+
+static Cell evalLocal(Closure *c, Machine *m) {
+  return m->fp[c->a];
+}
+
+static Cell evalGlobal(Closure *c, Machine *m) {
+  return m->globals[c->a];
+}
+
+static Cell evalOuter(Closure *c, Machine *m) {
+  return outerFrame(m, c->b)[c->a];
+}
+
+static Cell evalDeref(Closure *c, Machine *m) {
+  return *c->x->eval(c->x, m).p;
+}
+
+static Cell addrLocal(Closure *c, Machine *m) {
+  Cell value;
+  value.p = m->fp + c->a;
+  return value;
+}
+
+static Cell addrGlobal(Closure *c, Machine *m) {
+  Cell value;
+  value.p = m->globals + c->a;
+  return value;
+}
+
+static Cell addrOuter(Closure *c, Machine *m) {
+  Cell value;
+  value.p = outerFrame(m, c->b) + c->a;
+  return value;
+}
+
+// Arrays are indexed from 1; a is the length, b the cells of an element
+static Cell addrElement(Closure *c, Machine *m) {
+  Cell base = c->x->eval(c->x, m);
+  int64_t index = c->y->eval(c->y, m).i;
+
+  if (index < 1 || index > c->a)
+    fail(m, c, ERM_INDEXOUTOFRANGE);
+  base.p += (index - 1) * c->b;
+  return base;
+}
+
+static Cell evalNeg(Closure *c, Machine *m) {
+  Cell value = c->x->eval(c->x, m);
+  value.i = kplNeg(value.i);
+  return value;
+}
+
+// The left operand is computed first, as in every engine: C leaves the
+// order of a function's arguments, or of an operator's operands, open
+static Cell evalAdd(Closure *c, Machine *m) {
+  int32_t left = c->x->eval(c->x, m).i;
+  Cell value;
+
+  value.i = kplAdd(left, c->y->eval(c->y, m).i);
+  return value;
+}
+
+static Cell evalAddConstant(Closure *c, Machine *m) {
+  Cell value;
+  value.i = kplAdd(c->x->eval(c->x, m).i, c->a);
+  return value;
+}
+
+static Cell evalSub(Closure *c, Machine *m) {
+  int32_t left = c->x->eval(c->x, m).i;
+  Cell value;
+
+  value.i = kplSub(left, c->y->eval(c->y, m).i);
+  return value;
+}
+
+static Cell evalSubConstant(Closure *c, Machine *m) {
+  Cell value;
+  value.i = kplSub(c->x->eval(c->x, m).i, c->a);
+  return value;
+}
+
+static Cell evalMul(Closure *c, Machine *m) {
+  int32_t left = c->x->eval(c->x, m).i;
+  Cell value;
+
+  value.i = kplMul(left, c->y->eval(c->y, m).i);
+  return value;
+}
+
+static Cell evalDiv(Closure *c, Machine *m) {
+  int32_t left = c->x->eval(c->x, m).i, right = c->y->eval(c->y, m).i;
+  Cell value;
+
+  if (right == 0)
+    fail(m, c, ERM_DIVISIONBYZERO);
+  value.i = kplDiv(left, right);
+  return value;
+}
+
+static Cell evalMod(Closure *c, Machine *m) {
+  int32_t left = c->x->eval(c->x, m).i, right = c->y->eval(c->y, m).i;
+  Cell value;
+
+  if (right == 0)
+    fail(m, c, ERM_DIVISIONBYZERO);
+  value.i = kplMod(left, right);
+  return value;
+}
+
+static Cell evalPow(Closure *c, Machine *m) {
+  int32_t left = c->x->eval(c->x, m).i, right = c->y->eval(c->y, m).i;
+  Cell value;
+
+  if (kplPowFails(left, right))
+    fail(m, c, ERM_DIVISIONBYZERO);
+  value.i = kplPow(left, right);
+  return value;
+}
+
+// By a number: a is the shift, the mask's width or the exponent
+static Cell evalShl(Closure *c, Machine *m) {
+  Cell value;
+  value.i = kplShl(c->x->eval(c->x, m).i, c->a);
+  return value;
+}
+
+static Cell evalDivShift(Closure *c, Machine *m) {
+  Cell value;
+  value.i = kplDivShift(c->x->eval(c->x, m).i, c->a);
+  return value;
+}
+
+static Cell evalModMask(Closure *c, Machine *m) {
+  Cell value;
+  value.i = kplModMask(c->x->eval(c->x, m).i, c->a);
+  return value;
+}
+
+static Cell evalSquare(Closure *c, Machine *m) {
+  int32_t x = c->x->eval(c->x, m).i;
+  Cell value;
+
+  value.i = kplMul(x, x);
+  return value;
+}
+
+static Cell evalPowConstant(Closure *c, Machine *m) {
+  Cell value;
+  value.i = kplPow(c->x->eval(c->x, m).i, c->a);
+  return value;
+}
+
+static Cell evalReadC(Closure *c, Machine *m) {
+  Cell value;
+
+  if ((value.i = getc(m->in)) == EOF)
+    fail(m, c, ERM_ENDOFINPUT);
+  return value;
+}
+
+static Cell evalReadI(Closure *c, Machine *m) {
+  Cell value;
+  int n;
+
+  if (fscanf(m->in, "%d", &n) != 1)
+    fail(m, c, ERM_ENDOFINPUT);
+  value.i = n;
+  return value;
+}
+
+// The new frame is reserved before the arguments are evaluated, so the
+// calls among them get frames above it. b is the static link hops.
+static Cell evalCall(Closure *c, Machine *m) {
+  Routine *routine = c->routine;
+  Cell *frame = m->sp + CLOSURE_HEADER, *caller = m->fp, *sp = m->sp;
+  int i;
+
+  if (m->limit - frame < routine->size || (uintptr_t)&i < m->cLimit)
+    fail(m, c, ERM_STACKOVERFLOW);
+  m->sp = frame + routine->size;
+  for (i = 0; i < c->count; i++)
+    frame[i] = c->list[i]->eval(c->list[i], m);
+  for (; i < routine->size; i++)
+    frame[i].i = 0;
+  frame[CLOSURE_LINK].p = outerFrame(m, c->b);
+  frame[CLOSURE_RESULT].i = 0;
+  m->fp = frame;
+  routine->body->exec(routine->body, m);
+  m->fp = caller;
+  m->sp = sp;
+  return frame[CLOSURE_RESULT];
+}
+
+/******************************************************************/
+
+static int testEq(Closure *c, Machine *m) {
+  int64_t left = c->x->eval(c->x, m).i;
+  return left == c->y->eval(c->y, m).i;
+}
+
+static int testNe(Closure *c, Machine *m) {
+  int64_t left = c->x->eval(c->x, m).i;
+  return left != c->y->eval(c->y, m).i;
+}
+
+static int testLt(Closure *c, Machine *m) {
+  int64_t left = c->x->eval(c->x, m).i;
+  return left < c->y->eval(c->y, m).i;
+}
+
+static int testLe(Closure *c, Machine *m) {
+  int64_t left = c->x->eval(c->x, m).i;
+  return left <= c->y->eval(c->y, m).i;
+}
+
+static int testGt(Closure *c, Machine *m) {
+  int64_t left = c->x->eval(c->x, m).i;
+  return left > c->y->eval(c->y, m).i;
+}
+
+static int testGe(Closure *c, Machine *m) {
+  int64_t left = c->x->eval(c->x, m).i;
+  return left >= c->y->eval(c->y, m).i;
+}
+
+// STRING and BYTES; a is the comparator
+static int testString(Closure *c, Machine *m) {
+  char *left = c->x->eval(c->x, m).s, *right = c->y->eval(c->y, m).s;
+  int sign = strcmp(left != NULL ? left : "", right != NULL ? right : "");
+
+  switch (c->a) {
+  case SB_EQ: return sign == 0;
+  case SB_NEQ: return sign != 0;
+  case SB_LT: return sign < 0;
+  case SB_LE: return sign <= 0;
+  case SB_GT: return sign > 0;
+  default: return sign >= 0;
+  }
+}
+
+/******************************************************************/
+
+static void execGroup(Closure *c, Machine *m) {
+  int i;
+
+  for (i = 0; i < c->count; i++)
+    c->list[i]->exec(c->list[i], m);
+}
+
+static void execStoreLocal(Closure *c, Machine *m) {
+  m->fp[c->a] = c->x->eval(c->x, m);
+}
+
+static void execStoreGlobal(Closure *c, Machine *m) {
+  m->globals[c->a] = c->x->eval(c->x, m);
+}
+
+// The value first, then the address, as the bytecode does
+static void execStore(Closure *c, Machine *m) {
+  Cell value = c->x->eval(c->x, m);
+  *c->y->eval(c->y, m).p = value;
+}
+
+// list: count values, then the addresses of the count targets
+static void execParallel(Closure *c, Machine *m) {
+  Cell values[c->count];
+  int i;
+
+  for (i = 0; i < c->count; i++)
+    values[i] = c->list[i]->eval(c->list[i], m);
+  for (i = c->count - 1; i >= 0; i--)
+    *c->list[c->count + i]->eval(c->list[c->count + i], m).p = values[i];
+}
+
+static void execEval(Closure *c, Machine *m) {
+  c->x->eval(c->x, m);
+}
+
+static void execWriteI(Closure *c, Machine *m) {
+  fprintf(m->out, "%d", (int32_t)c->x->eval(c->x, m).i);
+}
+
+static void execWriteC(Closure *c, Machine *m) {
+  putc((char)c->x->eval(c->x, m).i, m->out);
+}
+
+static void execWriteLn(Closure *c, Machine *m) {
+  putc('\n', m->out);
+}
+
+static void execIf(Closure *c, Machine *m) {
+  if (c->x->test(c->x, m))
+    c->y->exec(c->y, m);
+  else if (c->z != NULL)
+    c->z->exec(c->z, m);
+}
+
+static void execWhile(Closure *c, Machine *m) {
+  while (c->x->test(c->x, m))
+    c->y->exec(c->y, m);
+}
+
+static void execRepeat(Closure *c, Machine *m) {
+  do
+    c->y->exec(c->y, m);
+  while (!c->x->test(c->x, m));
+}
+
+static void runFor(Closure *c, Machine *m, Cell *var, int32_t to) {
+  for (;;) {
+    c->w->exec(c->w, m);
+    if (var->i >= to)
+      break;
+    var->i = kplAdd(var->i, 1);
+  }
+}
+
+// x: address of the variable, y: from, z: to, w: body. The bound is
+// evaluated once and the variable never steps past it.
+static void execFor(Closure *c, Machine *m) {
+  Cell *var = c->x->eval(c->x, m).p;
+  int32_t to;
+
+  var->i = c->y->eval(c->y, m).i;
+  to = c->z->eval(c->z, m).i;
+  if (var->i <= to)
+    runFor(c, m, var, to);
+}
+
+static int inBounds(Node *node, int offset, int64_t first, int64_t last) {
+  return first + offset >= 1 && last + offset <= node->symbol->type->size;
+}
+
+// The iterations first to last of a vectorized loop, a block at a time,
+// each step of the plan over the whole block. list: the first cell of
+// each element's array or the value of each invariant, then the first
+// cell of the array stored into or the address of the sum. Returns 0,
+// having done nothing, when an element is out of its array: the scalar
+// loop then fails where it should.
+static int runVector(Closure *c, Machine *m, int64_t first, int64_t last) {
+  static int64_t zeros[VECTOR_BLOCK];
+  VectorLoop *plan = c->vector;
+  SimdKernels *k = simdKernels();
+  VectorOperand *op;
+  int64_t *elements[plan->count], *values[plan->count], *temp, *target, sum = 0, start, value;
+  Cell *cell;
+  int i, j, n;
+
+  for (i = 0; i < plan->count; i++)
+    if (plan->operands[i].kind == VEC_ELEMENT &&
+        !inBounds(plan->operands[i].node, plan->operands[i].offset, first, last))
+      return 0;
+  if (plan->sum == 0 && !inBounds(plan->target, plan->targetOffset, first, last))
+    return 0;
+
+  n = last - first + 1 < VECTOR_BLOCK ? last - first + 1 : VECTOR_BLOCK;
+  for (i = 0; i < plan->count; i++) {
+    op = &plan->operands[i];
+    if (op->kind == VEC_ELEMENT)
+      elements[i] = &c->list[i]->eval(c->list[i], m).p[first + op->offset - 1].i;
+    else if (op->kind == VEC_INVARIANT)
+      for (value = c->list[i]->eval(c->list[i], m).i, temp = c->temps + i * VECTOR_BLOCK, j = 0; j < n; j++)
+        temp[j] = value;
+  }
+  cell = c->list[plan->count]->eval(c->list[plan->count], m).p;
+  target = plan->sum != 0 ? NULL : &cell[first + plan->targetOffset - 1].i;
+
+  for (start = 0; start <= last - first; start += n) {
+    n = last - first + 1 - start < VECTOR_BLOCK ? last - first + 1 - start : VECTOR_BLOCK;
+    for (i = 0; i < plan->count; i++) {
+      op = &plan->operands[i];
+      values[i] = temp = c->temps + i * VECTOR_BLOCK;
+      switch (op->kind) {
+      case VEC_ELEMENT: values[i] = elements[i] + start; break;
+      case VEC_INVARIANT: break;
+      case VEC_INDEX:
+        for (j = 0; j < n; j++)
+          temp[j] = first + start + j;
+        break;
+      case VEC_ADD: k->add(temp, values[op->x], values[op->y], n); break;
+      case VEC_SUB: k->sub(temp, values[op->x], values[op->y], n); break;
+      case VEC_MUL: k->mul(temp, values[op->x], values[op->y], n); break;
+      default: k->sub(temp, zeros, values[op->x], n); break;
+      }
+    }
+    if (target != NULL)
+      k->store(target + start, values[plan->count - 1], n);
+    else sum += k->sum(values[plan->count - 1], n);
+  }
+  if (plan->sum == SB_PLUS)
+    cell->i = kplAdd(cell->i, (int32_t)(uint32_t)sum);
+  else if (plan->sum == SB_MINUS)
+    cell->i = kplSub(cell->i, (int32_t)(uint32_t)sum);
+  return 1;
+}
+
+static void execVectorFor(Closure *c, Machine *m) {
+  Cell *var = c->x->eval(c->x, m).p;
+  int32_t to;
+
+  var->i = c->y->eval(c->y, m).i;
+  to = c->z->eval(c->z, m).i;
+  if (var->i > to)
+    return;
+  if (runVector(c, m, var->i, to))
+    var->i = to;
+  else runFor(c, m, var, to);
+}
+
+// z: address of the variable, w: its bound; x and y as execWhile's
+static void execVectorWhile(Closure *c, Machine *m) {
+  Cell *var = c->z->eval(c->z, m).p;
+  int64_t last = c->w->eval(c->w, m).i - !c->vector->inclusive;
+
+  if (var->i <= last && runVector(c, m, var->i, last))
+    var->i = kplAdd((int32_t)last, 1);
+  else execWhile(c, m);
+}
+
+static void execNothing(Closure *c, Machine *m) {
+}
+
+/******************************************************************/
+
+static Closure *newClosure(Builder *b, Node *node) {
+  Closure *c = (Closure*)calloc(1, sizeof(Closure));
+
+  c->allocated = b->program->allocated;
+  b->program->allocated = c;
+  if (node != NULL) {
+    c->lineNo = node->lineNo;
+    c->colNo = node->colNo;
+  }
+  return c;
+}
+
+static Closure *makeEval(Builder *b, Node *node, Cell (*eval)(Closure*, Machine*),
+                         Closure *x, Closure *y) {
+  Closure *c = newClosure(b, node);
+
+  c->eval = eval;
+  c->x = x;
+  c->y = y;
+  return c;
+}
+
+static Closure *makeExec(Builder *b, Node *node, void (*exec)(Closure*, Machine*),
+                         Closure *x, Closure *y) {
+  Closure *c = newClosure(b, node);
+
+  c->exec = exec;
+  c->x = x;
+  c->y = y;
+  return c;
+}
+
+static int isByRef(Symbol *symbol) {
+  return symbol->kind == SYM_PARAMETER && symbol->node->op == KW_VAR;
+}
+
+// The cell of a frame at the given level
+static Closure *buildCell(Builder *b, Node *node, int address, int level, int offset) {
+  Closure *c;
+
+  if (level == b->level)
+    c = makeEval(b, node, address ? addrLocal : evalLocal, NULL, NULL);
+  else if (level == 1)
+    c = makeEval(b, node, address ? addrGlobal : evalGlobal, NULL, NULL);
+  else {
+    c = makeEval(b, node, address ? addrOuter : evalOuter, NULL, NULL);
+    c->b = b->level - level;
+  }
+  c->a = offset;
+  return c;
+}
+
+// Address of a variable, parameter, array element or function result
+static Closure *buildAddress(Builder *b, Node *node) {
+  Symbol *symbol = node->symbol;
+  Type *type = symbol->type;
+  Node *index = node->firstChild;
+  int count, offset = constantOffset(node, &count);
+  Closure *c;
+
+  if (symbol->kind == SYM_FUNCTION)
+    return buildCell(b, node, 1, symbol->level + 1, CLOSURE_RESULT);
+  // Indexes that are numbers in range need no check
+  c = buildCell(b, node, !isByRef(symbol), symbol->level, symbol->offset + offset);
+  for (; count > 0; count--, index = index->next)
+    type = type->element;
+  for (; index != NULL; index = index->next) {
+    c = makeEval(b, index, addrElement, c, buildExpression(b, index));
+    c->a = type->size;
+    c->b = typeCells(type->element);
+    type = type->element;
+  }
+  return c;
+}
+
+static Closure *buildCall(Builder *b, Node *call) {
+  Symbol *symbol = call->symbol;
+  Closure *c;
+  Node *arg;
+  int i;
+
+  switch (symbol->builtin) {
+  case BUILTIN_READC:
+    return makeEval(b, call, evalReadC, NULL, NULL);
+  case BUILTIN_READI:
+    return makeEval(b, call, evalReadI, NULL, NULL);
+  default:
+    break;
+  }
+  c = makeEval(b, call, evalCall, NULL, NULL);
+  c->routine = b->program->routines[symbol->offset];
+  c->b = b->level - symbol->level;
+  c->count = call->childCount;
+  c->list = (Closure**)malloc((c->count + 1) * sizeof(Closure*));
+  for (i = 0, arg = call->firstChild; arg != NULL; i++, arg = arg->next)
+    c->list[i] = symbol->type->byRef[i] ? buildAddress(b, arg) : buildExpression(b, arg);
+  return c;
+}
+
+static Closure *buildBinary(Builder *b, Node *node) {
+  Closure *x = buildExpression(b, node->firstChild), *y, *c;
+
+  // By a number, the reduced operation keeps it in a
+  switch (reductionKind(node)) {
+  case REDUCE_IDENTITY: return x;
+  case REDUCE_SHIFT: c = makeEval(b, node, evalShl, x, NULL); break;
+  case REDUCE_DIVIDE: c = makeEval(b, node, evalDivShift, x, NULL); break;
+  case REDUCE_MODULO: c = makeEval(b, node, evalModMask, x, NULL); break;
+  case REDUCE_POWER:
+    c = makeEval(b, node, reductionAmount(node) == 2 ? evalSquare : evalPowConstant, x, NULL);
+    break;
+  default: c = NULL; break;
+  }
+  if (c != NULL) {
+    c->a = reductionAmount(node);
+    return c;
+  }
+  y = buildExpression(b, node->lastChild);
+  // Adding or subtracting a constant needs one call less
+  if ((node->op == SB_PLUS || node->op == SB_MINUS) && y->eval == evalConstant) {
+    c = makeEval(b, node, node->op == SB_PLUS ? evalAddConstant : evalSubConstant, x, NULL);
+    c->a = y->a;
+    return c;
+  }
+  switch (node->op) {
+  case SB_PLUS: return makeEval(b, node, evalAdd, x, y);
+  case SB_MINUS: return makeEval(b, node, evalSub, x, y);
+  case SB_TIMES: return makeEval(b, node, evalMul, x, y);
+  case SB_SLASH: return makeEval(b, node, evalDiv, x, y);
+  case SB_MOD: return makeEval(b, node, evalMod, x, y);
+  default: return makeEval(b, node, evalPow, x, y);
+  }
+}
+
+static Closure *buildExpression(Builder *b, Node *node) {
+  Symbol *symbol = node->symbol;
+  Closure *c;
+  int count, offset;
+
+  switch (node->kind) {
+  case N_NUMBER:
+  case N_CHAR:
+    c = makeEval(b, node, evalConstant, NULL, NULL);
+    c->a = node->value;
+    return c;
+  case N_STRING:
+    c = makeEval(b, node, evalString, NULL, NULL);
+    c->text = strdup(node->text);
+    return c;
+  case N_UNARY:
+    c = buildExpression(b, node->firstChild);
+    if (node->op != SB_MINUS)
+      return c;
+    if (c->eval == evalConstant) {
+      c->a = kplNeg(c->a);
+      return c;
+    }
+    return makeEval(b, node, evalNeg, c, NULL);
+  case N_BINARY:
+    return buildBinary(b, node);
+  case N_FUNC_CALL:
+    return buildCall(b, node);
+  default:
+    if (symbol->kind == SYM_CONSTANT)
+      return buildExpression(b, symbol->node->firstChild);
+    if (symbol->kind == SYM_FUNCTION)
+      return buildCall(b, node);
+    if (node->firstChild == NULL && !isByRef(symbol))
+      return buildCell(b, node, 0, symbol->level, symbol->offset);
+    offset = constantOffset(node, &count);
+    if (node->firstChild != NULL && count == node->childCount)
+      return buildCell(b, node, 0, symbol->level, symbol->offset + offset);
+    return makeEval(b, node, evalDeref, buildAddress(b, node), NULL);
+  }
+}
+
+static Closure *buildTest(Builder *b, Node *cond) {
+  Closure *x = buildExpression(b, cond->firstChild), *y = buildExpression(b, cond->lastChild);
+  Closure *c = newClosure(b, cond);
+
+  c->x = x;
+  c->y = y;
+  if (cond->firstChild->type == &stringType || cond->firstChild->type == &bytesType) {
+    c->test = testString;
+    c->a = cond->op;
+    return c;
+  }
+  switch (cond->op) {
+  case SB_EQ: c->test = testEq; break;
+  case SB_NEQ: c->test = testNe; break;
+  case SB_LT: c->test = testLt; break;
+  case SB_LE: c->test = testLe; break;
+  case SB_GT: c->test = testGt; break;
+  default: c->test = testGe; break;
+  }
+  return c;
+}
+
+static Closure *buildStore(Builder *b, Node *target, Closure *value) {
+  Symbol *symbol = target->symbol;
+  int count, offset = constantOffset(target, &count);
+  Closure *c;
+
+  if (symbol->kind != SYM_FUNCTION && count == target->childCount && !isByRef(symbol) &&
+      (symbol->level == b->level || symbol->level == 1)) {
+    c = makeExec(b, target, symbol->level == b->level ? execStoreLocal : execStoreGlobal, value, NULL);
+    c->a = symbol->offset + offset;
+    return c;
+  }
+  return makeExec(b, target, execStore, value, buildAddress(b, target));
+}
+
+static Closure *buildAssignment(Builder *b, Node *node) {
+  Node *value, *target;
+  Closure *c;
+  int i;
+
+  if (node->value == 1)
+    return buildStore(b, node->firstChild, buildExpression(b, node->lastChild));
+  c = makeExec(b, node, execParallel, NULL, NULL);
+  c->count = node->value;
+  c->list = (Closure**)malloc(2 * c->count * sizeof(Closure*));
+  value = childAt(node, node->value);
+  for (i = 0, target = node->firstChild; i < c->count; i++, target = target->next, value = value->next) {
+    c->list[i] = buildExpression(b, value);
+    c->list[c->count + i] = buildAddress(b, target);
+  }
+  return c;
+}
+
+static Closure *buildCallSt(Builder *b, Node *node) {
+  Symbol *symbol = node->symbol;
+
+  switch (symbol->builtin) {
+  case BUILTIN_WRITEI:
+    return makeExec(b, node, execWriteI, buildExpression(b, node->firstChild), NULL);
+  case BUILTIN_WRITEC:
+    return makeExec(b, node, execWriteC, buildExpression(b, node->firstChild), NULL);
+  case BUILTIN_WRITELN:
+    return makeExec(b, node, execWriteLn, NULL, NULL);
+  default:
+    break;
+  }
+  // CALL READC(C) and CALL READI(N) read into their argument
+  if (symbol->kind == SYM_FUNCTION && node->firstChild != NULL)
+    return buildStore(b, node->firstChild, buildCall(b, node));
+  return makeExec(b, node, execEval, buildCall(b, node), NULL);
+}
+
+static Closure *buildGroup(Builder *b, Node *node, Node *end) {
+  Closure *c = makeExec(b, node, execGroup, NULL, NULL);
+  Node *child;
+  int i = 0;
+
+  c->list = (Closure**)malloc((node->childCount + 1) * sizeof(Closure*));
+  for (child = node->firstChild; child != end; child = child->next)
+    c->list[i++] = buildStatement(b, child);
+  c->count = i;
+  return c;
+}
+
+static Closure *buildArray(Builder *b, Node *node) {
+  Symbol *symbol = node->symbol;
+  return buildCell(b, node, !isByRef(symbol), symbol->level, symbol->offset);
+}
+
+// Turns the closure of a loop the vectorizer marked into its vectorized
+// form, run being execVectorFor or execVectorWhile
+static void buildVector(Builder *b, Closure *c, Node *loop, void (*run)(Closure *c, Machine *m)) {
+  VectorLoop *plan = planVectorLoop(loop);
+  VectorOperand *op;
+  int i;
+
+  if (plan == NULL)
+    return;
+  c->exec = run;
+  c->vector = plan;
+  c->temps = (int64_t*)malloc(plan->count * VECTOR_BLOCK * sizeof(int64_t));
+  c->list = (Closure**)calloc(plan->count + 1, sizeof(Closure*));
+  for (i = 0; i < plan->count; i++) {
+    op = &plan->operands[i];
+    if (op->kind == VEC_ELEMENT)
+      c->list[i] = buildArray(b, op->node);
+    else if (op->kind == VEC_INVARIANT)
+      c->list[i] = buildExpression(b, op->node);
+  }
+  c->list[plan->count] = plan->sum != 0 ? buildAddress(b, plan->target) : buildArray(b, plan->target);
+}
+
+static Closure *buildStatement(Builder *b, Node *node) {
+  Closure *c;
+
+  switch (node->kind) {
+  case N_ASSIGN:
+    return buildAssignment(b, node);
+  case N_CALL:
+    return buildCallSt(b, node);
+  case N_GROUP:
+    return buildGroup(b, node, NULL);
+  case N_IF:
+    c = makeExec(b, node, execIf, buildTest(b, node->firstChild),
+                 buildStatement(b, node->firstChild->next));
+    if (node->childCount > 2)
+      c->z = buildStatement(b, node->lastChild);
+    return c;
+  case N_WHILE:
+    c = makeExec(b, node, execWhile, buildTest(b, node->firstChild),
+                 buildStatement(b, node->lastChild));
+    if (isVectorLoop(node)) {
+      c->z = buildAddress(b, node->firstChild->firstChild);
+      c->w = buildExpression(b, node->firstChild->lastChild);
+      buildVector(b, c, node, execVectorWhile);
+    }
+    return c;
+  case N_FOR:
+    c = makeExec(b, node, execFor, NULL, buildExpression(b, node->firstChild));
+    c->x = buildCell(b, node, !isByRef(node->symbol), node->symbol->level, node->symbol->offset);
+    c->z = buildExpression(b, node->firstChild->next);
+    c->w = buildStatement(b, node->lastChild);
+    if (isVectorLoop(node))
+      buildVector(b, c, node, execVectorFor);
+    return c;
+  case N_REPEAT:
+    return makeExec(b, node, execRepeat, buildTest(b, node->lastChild),
+                    buildGroup(b, node, node->lastChild));
+  default:
+    return makeExec(b, node, execNothing, NULL, NULL);
+  }
+}
+
+static Closure *buildBody(Builder *b, Node *block);
+
+static void buildRoutine(Builder *b, Node *node) {
+  ClosureProgram *program = b->program;
+  Builder routine = {program, node->symbol->level + 1, 0};
+  Routine *r = (Routine*)calloc(1, sizeof(Routine));
+  Node *child;
+
+  if (program->routineCount == program->routineCapacity) {
+    program->routineCapacity = program->routineCapacity ? 2 * program->routineCapacity : 16;
+    program->routines = (Routine**)realloc(program->routines, program->routineCapacity * sizeof(Routine*));
+  }
+  // Before the body, which may call itself
+  node->symbol->offset = program->routineCount;
+  program->routines[program->routineCount++] = r;
+
+  for (child = node->firstChild; child->kind == N_PARAM; child = child->next)
+    child->symbol->offset = routine.cells++;
+  if (node->kind == N_FUNC_DECL)
+    child = child->next;
+  r->params = routine.cells;
+  r->body = buildBody(&routine, child);
+  r->size = routine.cells;
+}
+
+static Closure *buildBody(Builder *b, Node *block) {
+  Node *child;
+
+  for (child = block->firstChild; child != NULL; child = child->next)
+    if (child->kind == N_VAR_DECL) {
+      child->symbol->offset = b->cells;
+      b->cells += typeCells(child->symbol->type);
+    } else if (child->kind == N_FUNC_DECL || child->kind == N_PROC_DECL)
+      buildRoutine(b, child);
+  return buildStatement(b, block->lastChild);
+}
+
+void compileClosures(CheckedProgram *program, ClosureProgram *closures) {
+  Builder b = {closures, 1, 0};
+
+  memset(closures, 0, sizeof(ClosureProgram));
+  closures->main = buildBody(&b, program->tree.root->firstChild);
+  closures->size = b.cells;
+}
+
+void freeClosures(ClosureProgram *closures) {
+  Closure *c, *next;
+  int i;
+
+  for (c = closures->allocated; c != NULL; c = next) {
+    next = c->allocated;
+    free(c->list);
+    free(c->text);
+    free(c->temps);
+    freeVectorLoop(c->vector);
+    free(c);
+  }
+  for (i = 0; i < closures->routineCount; i++)
+    free(closures->routines[i]);
+  free(closures->routines);
+  memset(closures, 0, sizeof(ClosureProgram));
+}
+
+int runClosures(ClosureProgram *closures, FILE *in, FILE *out) {
+  size_t cells = CLOSURE_HEADER + closures->size + VM_STACK_CELLS;
+  Cell *stack = (Cell*)malloc(cells * sizeof(Cell));
+  Machine m;
+
+  // Calls clear their own frames
+  memset(stack, 0, (CLOSURE_HEADER + closures->size) * sizeof(Cell));
+  m.globals = m.fp = stack + CLOSURE_HEADER;
+  m.sp = m.fp + closures->size;
+  m.limit = stack + cells;
+  m.in = in;
+  m.out = out;
+  m.failure = NULL;
+  m.cLimit = (uintptr_t)&m - CLOSURE_C_STACK;
+  if (setjmp(m.trap) == 0)
+    closures->main->exec(closures->main, &m);
+  fflush(out);
+  if (m.failure != NULL)
+    fprintf(stderr, "%d-%d:%s\n", m.failedAt->lineNo, m.failedAt->colNo, m.failure);
+  free(stack);
+  return m.failure != NULL;
+}
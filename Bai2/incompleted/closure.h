@@ -0,0 +1,69 @@
+/* Closure compilation */
+
+#ifndef __CLOSURE_H__
+#define __CLOSURE_H__
+
+#include <stdio.h>
+#include <setjmp.h>
+#include <stdint.h>
+
+#include "typecheck.h"
+#include "bytecode.h"
+#include "vector.h"
+
+// Each KPL call nests a few C calls, so recursion is bounded by the C
+// stack as well as by the KPL stack
+#define CLOSURE_C_STACK (4 << 20)
+
+struct Closure;
+struct Routine;
+
+typedef struct {
+  Cell *fp, *globals, *sp, *limit;
+  uintptr_t cLimit;             // lowest C stack address the calls may reach
+  FILE *in, *out;
+  jmp_buf trap;
+  char *failure;
+  struct Closure *failedAt;
+} Machine;
+
+// One operation of the program, bound to the C function that runs it.
+// Operands are resolved when the tree is built: frame offsets, static
+// link hops, constants and the closures of subexpressions. Expressions
+// have eval, conditions test and statements exec.
+typedef struct Closure {
+  Cell (*eval)(struct Closure *c, Machine *m);
+  int (*test)(struct Closure *c, Machine *m);
+  void (*exec)(struct Closure *c, Machine *m);
+  int a, b;
+  struct Closure *x, *y, *z, *w;
+  struct Closure **list;
+  int count;
+  struct Routine *routine;
+  VectorLoop *vector;
+  int64_t *temps;               // VECTOR_BLOCK cells per operand of vector
+  char *text;
+  int lineNo, colNo;
+  struct Closure *allocated;    // every closure of the program, to free them
+} Closure;
+
+typedef struct Routine {
+  Closure *body;
+  int params, size;             // frame cells: parameters, then locals and temporaries
+} Routine;
+
+typedef struct {
+  Closure *main;
+  int size;                     // cells of the program's frame
+  Routine **routines;
+  int routineCount, routineCapacity;
+  Closure *allocated;
+} ClosureProgram;
+
+// Builds the closures of a checked program that did not fail
+void compileClosures(CheckedProgram *program, ClosureProgram *closures);
+void freeClosures(ClosureProgram *closures);
+// Same contract as runBytecode()
+int runClosures(ClosureProgram *closures, FILE *in, FILE *out);
+
+#endif
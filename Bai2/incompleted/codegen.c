@@ -0,0 +1,411 @@
+/* Code generation */
+
+#include <stdlib.h>
+
+#include "codegen.h"
+#include "fold.h"
+#include "reduce.h"
+
+// One routine being generated. Its frame is at scope level `level`;
+// cells counts the frame cells in use (parameters, locals, then FOR
+// temporaries) and depth the operand stack, so ENTER can reserve both.
+typedef struct {
+  Bytecode *bc;
+  int level;
+  int cells, maxCells;
+  int depth, maxDepth;
+} Generator;
+
+typedef enum {
+  ACCESS_LOAD,
+  ACCESS_STORE,
+  ACCESS_ADDR
+} Access;
+
+static void genExpression(Generator *g, Node *node);
+static void genStatement(Generator *g, Node *node);
+static void genBody(Generator *g, Node *block, int params, OpCode exit);
+
+int typeCells(Type *type) {
+  return type->typeClass == TY_ARRAY ? type->size * typeCells(type->element) : 1;
+}
+
+static void push(Generator *g, int cells) {
+  g->depth += cells;
+  if (g->depth > g->maxDepth)
+    g->maxDepth = g->depth;
+}
+
+// Emits op with as many of a, b and c as it takes; returns its address
+static int emitOp(Generator *g, Node *node, OpCode op, int a, int b, int c) {
+  int pc = emitWord(g->bc, op), n = opOperands(op);
+
+  if (node != NULL) {
+    g->bc->lineNos[pc] = node->lineNo;
+    g->bc->colNos[pc] = node->colNo;
+  }
+  if (n > 0) emitWord(g->bc, a);
+  if (n > 1) emitWord(g->bc, b);
+  if (n > 2) emitWord(g->bc, c);
+  return pc;
+}
+
+// Points the jump at pc to the next instruction
+static void patchHere(Generator *g, int pc) {
+  g->bc->code[pc + 1] = g->bc->count;
+}
+
+static void accessCell(Generator *g, Node *node, Access access, int level, int offset) {
+  static OpCode local[] = {OP_LOAD_LOCAL, OP_STORE_LOCAL, OP_ADDR_LOCAL};
+  static OpCode global[] = {OP_LOAD_GLOBAL, OP_STORE_GLOBAL, OP_ADDR_GLOBAL};
+  static OpCode outer[] = {OP_LOAD_OUTER, OP_STORE_OUTER, OP_ADDR_OUTER};
+
+  if (level == g->level)
+    emitOp(g, node, local[access], offset, 0, 0);
+  else if (level == 1)
+    emitOp(g, node, global[access], offset, 0, 0);
+  else emitOp(g, node, outer[access], g->level - level, offset, 0);
+  push(g, access == ACCESS_STORE ? -1 : 1);
+}
+
+// A VAR parameter holds the address of its argument
+static int isByRef(Symbol *symbol) {
+  return symbol->kind == SYM_PARAMETER && symbol->node->op == KW_VAR;
+}
+
+static void loadSymbol(Generator *g, Node *node, Symbol *symbol) {
+  accessCell(g, node, ACCESS_LOAD, symbol->level, symbol->offset);
+  if (isByRef(symbol))
+    emitOp(g, node, OP_LOAD_IND, 0, 0, 0);
+}
+
+static void storeSymbol(Generator *g, Node *node, Symbol *symbol) {
+  if (isByRef(symbol)) {
+    accessCell(g, node, ACCESS_LOAD, symbol->level, symbol->offset);
+    emitOp(g, node, OP_STORE_IND, 0, 0, 0);
+    push(g, -2);
+  } else accessCell(g, node, ACCESS_STORE, symbol->level, symbol->offset);
+}
+
+// Address of a variable, parameter or array element. Indexes that are
+// numbers in range are added to the offset instead of being checked.
+static void genAddress(Generator *g, Node *node) {
+  Symbol *symbol = node->symbol;
+  Type *type = symbol->type;
+  Node *index = node->firstChild;
+  int count, offset = constantOffset(node, &count);
+
+  accessCell(g, node, isByRef(symbol) ? ACCESS_LOAD : ACCESS_ADDR, symbol->level, symbol->offset + offset);
+  for (; count > 0; count--, index = index->next)
+    type = type->element;
+  for (; index != NULL; index = index->next) {
+    genExpression(g, index);
+    emitOp(g, index, OP_INDEX, type->size, typeCells(type->element), 0);
+    push(g, -1);
+    type = type->element;
+  }
+}
+
+// Stores the value on top of the stack
+static void genStore(Generator *g, Node *node) {
+  Symbol *symbol = node->symbol;
+  int count, offset = constantOffset(node, &count);
+
+  if (symbol->kind == SYM_FUNCTION)
+    accessCell(g, node, ACCESS_STORE, symbol->level + 1, FRAME_RESULT);
+  else if (node->firstChild == NULL)
+    storeSymbol(g, node, symbol);
+  else if (count == node->childCount)
+    accessCell(g, node, ACCESS_STORE, symbol->level, symbol->offset + offset);
+  else {
+    genAddress(g, node);
+    emitOp(g, node, OP_STORE_IND, 0, 0, 0);
+    push(g, -2);
+  }
+}
+
+static void genCall(Generator *g, Node *call) {
+  Symbol *symbol = call->symbol;
+  Type *type = symbol->type;
+  Node *arg;
+  int i;
+
+  switch (symbol->builtin) {
+  case BUILTIN_READC:
+    emitOp(g, call, OP_READC, 0, 0, 0);
+    push(g, 1);
+    return;
+  case BUILTIN_READI:
+    emitOp(g, call, OP_READI, 0, 0, 0);
+    push(g, 1);
+    return;
+  case BUILTIN_WRITEC:
+    genExpression(g, call->firstChild);
+    emitOp(g, call, OP_WRITEC, 0, 0, 0);
+    push(g, -1);
+    return;
+  case BUILTIN_WRITEI:
+    genExpression(g, call->firstChild);
+    emitOp(g, call, OP_WRITEI, 0, 0, 0);
+    push(g, -1);
+    return;
+  case BUILTIN_WRITELN:
+    emitOp(g, call, OP_WRITELN, 0, 0, 0);
+    return;
+  default:
+    break;
+  }
+
+  emitOp(g, call, OP_FRAME, 0, 0, 0);
+  push(g, FRAME_HEADER);
+  for (i = 0, arg = call->firstChild; arg != NULL; i++, arg = arg->next)
+    if (type->byRef[i])
+      genAddress(g, arg);
+    else genExpression(g, arg);
+  // The static link is the frame of the scope declaring the routine
+  emitOp(g, call, OP_CALL, symbol->offset, type->size, g->level - symbol->level);
+  push(g, -(FRAME_HEADER + type->size) + (type->element != NULL));
+}
+
+static void genExpression(Generator *g, Node *node) {
+  Symbol *symbol = node->symbol;
+  int count, offset;
+
+  switch (node->kind) {
+  case N_NUMBER:
+  case N_CHAR:
+    emitOp(g, node, OP_PUSH, node->value, 0, 0);
+    push(g, 1);
+    break;
+  case N_STRING:
+    emitOp(g, node, OP_PUSH_STR, addString(g->bc, node->text), 0, 0);
+    push(g, 1);
+    break;
+  case N_UNARY:
+    genExpression(g, node->firstChild);
+    if (node->op == SB_MINUS)
+      emitOp(g, node, OP_NEG, 0, 0, 0);
+    break;
+  case N_BINARY:
+    genExpression(g, node->firstChild);
+    // By a number, the reduced operation takes it as an operand
+    switch (reductionKind(node)) {
+    case REDUCE_IDENTITY: return;
+    case REDUCE_SHIFT: emitOp(g, node, OP_SHL, reductionAmount(node), 0, 0); return;
+    case REDUCE_DIVIDE: emitOp(g, node, OP_DIV_SHIFT, reductionAmount(node), 0, 0); return;
+    case REDUCE_MODULO: emitOp(g, node, OP_MOD_MASK, reductionAmount(node), 0, 0); return;
+    case REDUCE_POWER: emitOp(g, node, OP_POW_CONST, reductionAmount(node), 0, 0); return;
+    default: break;
+    }
+    genExpression(g, node->lastChild);
+    switch (node->op) {
+    case SB_PLUS: emitOp(g, node, OP_ADD, 0, 0, 0); break;
+    case SB_MINUS: emitOp(g, node, OP_SUB, 0, 0, 0); break;
+    case SB_TIMES: emitOp(g, node, OP_MUL, 0, 0, 0); break;
+    case SB_SLASH: emitOp(g, node, OP_DIV, 0, 0, 0); break;
+    case SB_MOD: emitOp(g, node, OP_MOD, 0, 0, 0); break;
+    default: emitOp(g, node, OP_POW, 0, 0, 0); break;
+    }
+    push(g, -1);
+    break;
+  case N_FUNC_CALL:
+    genCall(g, node);
+    break;
+  default:
+    offset = constantOffset(node, &count);
+    if (symbol->kind == SYM_CONSTANT)
+      genExpression(g, symbol->node->firstChild);
+    else if (symbol->kind == SYM_FUNCTION)
+      genCall(g, node);
+    else if (node->firstChild == NULL)
+      loadSymbol(g, node, symbol);
+    else if (count == node->childCount)
+      accessCell(g, node, ACCESS_LOAD, symbol->level, symbol->offset + offset);
+    else {
+      genAddress(g, node);
+      emitOp(g, node, OP_LOAD_IND, 0, 0, 0);
+    }
+    break;
+  }
+}
+
+// Jumps when the condition is whenTrue; returns the jump to patch
+static int genBranch(Generator *g, Node *cond, int whenTrue) {
+  OpCode jump;
+
+  genExpression(g, cond->firstChild);
+  genExpression(g, cond->lastChild);
+  if (cond->firstChild->type == &stringType || cond->firstChild->type == &bytesType) {
+    emitOp(g, cond, OP_STRCMP, 0, 0, 0);
+    emitOp(g, cond, OP_PUSH, 0, 0, 0);
+  }
+  switch (cond->op) {
+  case SB_EQ: jump = whenTrue ? OP_JEQ : OP_JNE; break;
+  case SB_NEQ: jump = whenTrue ? OP_JNE : OP_JEQ; break;
+  case SB_LT: jump = whenTrue ? OP_JLT : OP_JGE; break;
+  case SB_LE: jump = whenTrue ? OP_JLE : OP_JGT; break;
+  case SB_GT: jump = whenTrue ? OP_JGT : OP_JLE; break;
+  default: jump = whenTrue ? OP_JGE : OP_JLT; break;
+  }
+  push(g, -2);
+  return emitOp(g, cond, jump, -1, 0, 0);
+}
+
+static void genAssignment(Generator *g, Node *node) {
+  Node *value, *target;
+  int i;
+
+  // Every value first, so X, Y := Y, X swaps
+  for (value = childAt(node, node->value); value != NULL; value = value->next)
+    genExpression(g, value);
+  target = childAt(node, node->value - 1);
+  for (i = 0; i < node->value; i++, target = target->prev)
+    genStore(g, target);
+}
+
+static void genCallSt(Generator *g, Node *node) {
+  // CALL READC(C) and CALL READI(N) read into their argument
+  if (node->symbol->kind == SYM_FUNCTION) {
+    genCall(g, node);
+    if (node->firstChild != NULL)
+      genStore(g, node->firstChild);
+    else {
+      emitOp(g, node, OP_POP, 0, 0, 0);
+      push(g, -1);
+    }
+  } else genCall(g, node);
+}
+
+// The upper bound is evaluated once into a temporary cell; the test at
+// the bottom stops before the variable steps past it, so it never wraps
+static void genFor(Generator *g, Node *node) {
+  Symbol *var = node->symbol;
+  int bound = g->cells++, skip, done, top;
+
+  if (g->cells > g->maxCells)
+    g->maxCells = g->cells;
+  genExpression(g, node->firstChild);
+  storeSymbol(g, node, var);
+  genExpression(g, node->firstChild->next);
+  accessCell(g, node, ACCESS_STORE, g->level, bound);
+  loadSymbol(g, node, var);
+  accessCell(g, node, ACCESS_LOAD, g->level, bound);
+  push(g, -2);
+  skip = emitOp(g, node, OP_JGT, -1, 0, 0);
+
+  top = g->bc->count;
+  genStatement(g, node->lastChild);
+  loadSymbol(g, node, var);
+  accessCell(g, node, ACCESS_LOAD, g->level, bound);
+  push(g, -2);
+  done = emitOp(g, node, OP_JGE, -1, 0, 0);
+  if (!isByRef(var) && var->level == g->level)
+    emitOp(g, node, OP_INC_LOCAL, var->offset, 0, 0);
+  else if (!isByRef(var) && var->level == 1)
+    emitOp(g, node, OP_INC_GLOBAL, var->offset, 0, 0);
+  else {
+    loadSymbol(g, node, var);
+    emitOp(g, node, OP_PUSH, 1, 0, 0);
+    emitOp(g, node, OP_ADD, 0, 0, 0);
+    storeSymbol(g, node, var);
+  }
+  emitOp(g, node, OP_JMP, top, 0, 0);
+  patchHere(g, skip);
+  patchHere(g, done);
+  g->cells--;
+}
+
+static void genStatement(Generator *g, Node *node) {
+  Node *child;
+  int jump, top;
+
+  switch (node->kind) {
+  case N_ASSIGN:
+    genAssignment(g, node);
+    break;
+  case N_CALL:
+    genCallSt(g, node);
+    break;
+  case N_GROUP:
+    for (child = node->firstChild; child != NULL; child = child->next)
+      genStatement(g, child);
+    break;
+  case N_IF:
+    jump = genBranch(g, node->firstChild, 0);
+    genStatement(g, node->firstChild->next);
+    if (node->childCount > 2) {
+      top = emitOp(g, node, OP_JMP, -1, 0, 0);
+      patchHere(g, jump);
+      genStatement(g, node->lastChild);
+      patchHere(g, top);
+    } else patchHere(g, jump);
+    break;
+  case N_WHILE:
+    // The test sits at the bottom: one jump per iteration
+    jump = emitOp(g, node, OP_JMP, -1, 0, 0);
+    top = g->bc->count;
+    genStatement(g, node->lastChild);
+    patchHere(g, jump);
+    // Emitting may move the code, so the jump is found after
+    jump = genBranch(g, node->firstChild, 1);
+    g->bc->code[jump + 1] = top;
+    break;
+  case N_FOR:
+    genFor(g, node);
+    break;
+  case N_REPEAT:
+    top = g->bc->count;
+    for (child = node->firstChild; child != node->lastChild; child = child->next)
+      genStatement(g, child);
+    jump = genBranch(g, node->lastChild, 0);
+    g->bc->code[jump + 1] = top;
+    break;
+  default:
+    break;
+  }
+}
+
+static void genRoutine(Generator *g, Node *node) {
+  Generator routine = {g->bc, node->symbol->level + 1, 0, 0, 0, 0};
+  Node *child;
+
+  for (child = node->firstChild; child->kind == N_PARAM; child = child->next)
+    child->symbol->offset = routine.cells++;
+  if (node->kind == N_FUNC_DECL)
+    child = child->next;
+  // Before the body, which may call itself
+  node->symbol->offset = g->bc->count;
+  genBody(&routine, child, routine.cells, node->kind == N_FUNC_DECL ? OP_RET_VALUE : OP_RET);
+}
+
+static void genBody(Generator *g, Node *block, int params, OpCode exit) {
+  int enter = emitOp(g, block, OP_ENTER, params, 0, 0), jump = -1;
+  Node *child;
+
+  for (child = block->firstChild; child != NULL; child = child->next)
+    if (child->kind == N_VAR_DECL) {
+      child->symbol->offset = g->cells;
+      g->cells += typeCells(child->symbol->type);
+    }
+  g->maxCells = g->cells;
+
+  for (child = block->firstChild; child != block->lastChild; child = child->next)
+    if (child->kind == N_FUNC_DECL || child->kind == N_PROC_DECL) {
+      if (jump < 0)
+        jump = emitOp(g, NULL, OP_JMP, -1, 0, 0);
+      genRoutine(g, child);
+    }
+  if (jump >= 0)
+    patchHere(g, jump);
+
+  genStatement(g, block->lastChild);
+  emitOp(g, NULL, exit, 0, 0, 0);
+  g->bc->code[enter + 2] = g->maxCells;
+  g->bc->code[enter + 3] = g->maxDepth;
+}
+
+void generateBytecode(CheckedProgram *program, Bytecode *bc) {
+  Generator g = {bc, 1, 0, 0, 0, 0};
+
+  genBody(&g, program->tree.root->firstChild, 0, OP_HALT);
+}
@@ -0,0 +1,15 @@
+/* Code generation */
+
+#ifndef __CODEGEN_H__
+#define __CODEGEN_H__
+
+#include "typecheck.h"
+#include "bytecode.h"
+
+// Cells a value of the type takes in a frame
+int typeCells(Type *type);
+// Bytecode for a checked program that did not fail; sets the offset of
+// every variable, parameter and routine symbol
+void generateBytecode(CheckedProgram *program, Bytecode *bc);
+
+#endif
@@ -6,61 +6,119 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include "reader.h"
 #include "error.h"
+#include "stats.h"
+
+__thread jmp_buf *errorTrap;
+__thread int errorRaised;
+__thread int traceEnabled = 1;
+
+void abortCompile(void) {
+  errorRaised = 1;
+  if (errorTrap != NULL)
+    longjmp(*errorTrap, 1);
+  exit(0);
+}
 
 void error(ErrorCode err, int lineNo, int colNo) {
   switch (err) {
   case ERR_ENDOFCOMMENT:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_ENDOFCOMMENT);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_ENDOFCOMMENT);
     break;
   case ERR_IDENTTOOLONG:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_IDENTTOOLONG);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_IDENTTOOLONG);
+    break;
+  case ERR_STRINGTOOLONG:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_STRINGTOOLONG);
     break;
   case ERR_INVALIDCHARCONSTANT:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDCHARCONSTANT);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDCHARCONSTANT);
     break;
   case ERR_INVALIDSYMBOL:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDSYMBOL);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDSYMBOL);
     break;
   case ERR_INVALIDCONSTANT:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDCONSTANT);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDCONSTANT);
     break;
   case ERR_INVALIDTYPE:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDTYPE);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDTYPE);
     break;
   case ERR_INVALIDBASICTYPE:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDBASICTYPE);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDBASICTYPE);
     break;
   case ERR_INVALIDPARAM:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDPARAM);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDPARAM);
     break;
   case ERR_INVALIDSTATEMENT:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDSTATEMENT);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDSTATEMENT);
     break;
   case ERR_INVALIDARGUMENTS:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDARGUMENTS);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDARGUMENTS);
     break;
   case ERR_INVALIDCOMPARATOR:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDCOMPARATOR);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDCOMPARATOR);
     break;
   case ERR_INVALIDEXPRESSION:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDEXPRESSION);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDEXPRESSION);
     break;
   case ERR_INVALIDTERM:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDTERM);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDTERM);
     break;
   case ERR_INVALIDFACTOR:
-    printf("%d-%d:%s\n", lineNo, colNo, ERM_INVALIDFACTOR);
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDFACTOR);
+    break;
+  case ERR_NESTINGTOODEEP:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_NESTINGTOODEEP);
+    break;
+  case ERR_UNDECLAREDIDENT:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_UNDECLAREDIDENT);
+    break;
+  case ERR_UNDECLAREDCONSTANT:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_UNDECLAREDCONSTANT);
+    break;
+  case ERR_UNDECLAREDTYPE:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_UNDECLAREDTYPE);
+    break;
+  case ERR_UNDECLAREDVARIABLE:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_UNDECLAREDVARIABLE);
+    break;
+  case ERR_UNDECLAREDFUNCTION:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_UNDECLAREDFUNCTION);
+    break;
+  case ERR_UNDECLAREDPROCEDURE:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_UNDECLAREDPROCEDURE);
+    break;
+  case ERR_DUPLICATEIDENT:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_DUPLICATEIDENT);
+    break;
+  case ERR_INVALIDLVALUE:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_INVALIDLVALUE);
+    break;
+  case ERR_TYPEINCONSISTENCY:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_TYPEINCONSISTENCY);
+    break;
+  case ERR_NOTANARRAY:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_NOTANARRAY);
+    break;
+  case ERR_UNBALANCEDASSIGNMENT:
+    fprintf(getOutputStream(), "%d-%d:%s\n", lineNo, colNo, ERM_UNBALANCEDASSIGNMENT);
     break;
   }
-  exit(0);
+  abortCompile();
 }
 
 void missingToken(TokenType tokenType, int lineNo, int colNo) {
-  printf("%d-%d:Missing %s\n", lineNo, colNo, tokenToString(tokenType));
-  exit(0);
+  fprintf(getOutputStream(), "%d-%d:Missing %s\n", lineNo, colNo, tokenToString(tokenType));
+  abortCompile();
 }
 
 void assert(char *msg) {
-  printf("%s\n", msg);
+  double start;
+
+  if (!traceEnabled) return;
+  start = STATS_ON ? phaseStart(PHASE_OUTPUT) : 0;
+  fprintf(getOutputStream(), "%s\n", msg);
+  if (STATS_ON)
+    chargePhase(PHASE_OUTPUT, start);
 }
\ No newline at end of file
@@ -6,6 +6,7 @@
 
 #ifndef __ERROR_H__
 #define __ERROR_H__
+#include <setjmp.h>
 #include "token.h"
 
 typedef enum {
@@ -22,12 +23,26 @@ typedef enum {
   ERR_INVALIDCOMPARATOR,
   ERR_INVALIDEXPRESSION,
   ERR_INVALIDTERM,
-  ERR_INVALIDFACTOR
+  ERR_INVALIDFACTOR,
+  ERR_NESTINGTOODEEP,
+  ERR_UNDECLAREDIDENT,
+  ERR_UNDECLAREDCONSTANT,
+  ERR_UNDECLAREDTYPE,
+  ERR_UNDECLAREDVARIABLE,
+  ERR_UNDECLAREDFUNCTION,
+  ERR_UNDECLAREDPROCEDURE,
+  ERR_DUPLICATEIDENT,
+  ERR_INVALIDLVALUE,
+  ERR_TYPEINCONSISTENCY,
+  ERR_NOTANARRAY,
+  ERR_UNBALANCEDASSIGNMENT,
+  ERR_STRINGTOOLONG
 } ErrorCode;
 
 
 #define ERM_ENDOFCOMMENT "End of comment expected!"
 #define ERM_IDENTTOOLONG "Identification too long!"
+#define ERM_STRINGTOOLONG "String too long!"
 #define ERM_INVALIDCHARCONSTANT "Invalid const char!"
 #define ERM_INVALIDSYMBOL "Invalid symbol!"
 #define ERM_INVALIDCONSTANT "Invalid constant!"
@@ -40,7 +55,27 @@ typedef enum {
 #define ERM_INVALIDEXPRESSION "Invalid expression!"
 #define ERM_INVALIDTERM "Invalid term!"
 #define ERM_INVALIDFACTOR "Invalid factor!"
+#define ERM_NESTINGTOODEEP "Nesting too deep!"
+#define ERM_UNDECLAREDIDENT "Undeclared identifier!"
+#define ERM_UNDECLAREDCONSTANT "Undeclared constant!"
+#define ERM_UNDECLAREDTYPE "Undeclared type!"
+#define ERM_UNDECLAREDVARIABLE "Undeclared variable!"
+#define ERM_UNDECLAREDFUNCTION "Undeclared function!"
+#define ERM_UNDECLAREDPROCEDURE "Undeclared procedure!"
+#define ERM_DUPLICATEIDENT "Duplicate identifier!"
+#define ERM_INVALIDLVALUE "Invalid lvalue in assignment!"
+#define ERM_TYPEINCONSISTENCY "Type inconsistency!"
+#define ERM_NOTANARRAY "Not an array!"
+#define ERM_UNBALANCEDASSIGNMENT "Unbalanced parallel assignment!"
 
+// When errorTrap is set, an error jumps back to it instead of exiting,
+// so one failing file does not stop the other files of a batch.
+extern __thread jmp_buf *errorTrap;
+extern __thread int errorRaised;
+// Parsing traces (assert messages and eaten tokens) are printed only when set
+extern __thread int traceEnabled;
+
+void abortCompile(void);
 void error(ErrorCode err, int lineNo, int colNo);
 void missingToken(TokenType tokenType, int lineNo, int colNo);
 void assert(char *msg);
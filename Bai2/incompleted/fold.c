@@ -0,0 +1,259 @@
+/* Constant folding */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "arith.h"
+#include "codegen.h"
+#include "fold.h"
+
+typedef struct {
+  FoldStats *stats;
+  FILE *report;
+} Folder;
+
+// The value of a constant expression. Returns 0 when it is not one, or
+// when computing it fails, which is then left for run time.
+static int evaluate(Node *node, int32_t *value) {
+  int32_t a, b;
+
+  switch (node->kind) {
+  case N_NUMBER:
+  case N_CHAR:
+    *value = node->value;
+    return 1;
+  case N_UNARY:
+    if (!evaluate(node->firstChild, &a))
+      return 0;
+    *value = node->op == SB_MINUS ? kplNeg(a) : a;
+    return 1;
+  case N_BINARY:
+    if (!evaluate(node->firstChild, &a) || !evaluate(node->lastChild, &b))
+      return 0;
+    switch (node->op) {
+    case SB_PLUS: *value = kplAdd(a, b); return 1;
+    case SB_MINUS: *value = kplSub(a, b); return 1;
+    case SB_TIMES: *value = kplMul(a, b); return 1;
+    case SB_SLASH:
+      if (b == 0)
+        return 0;
+      *value = kplDiv(a, b);
+      return 1;
+    case SB_MOD:
+      if (b == 0)
+        return 0;
+      *value = kplMod(a, b);
+      return 1;
+    default:
+      if (kplPowFails(a, b))
+        return 0;
+      *value = kplPow(a, b);
+      return 1;
+    }
+  case N_VARIABLE:
+    return node->symbol->kind == SYM_CONSTANT && evaluate(node->symbol->node->firstChild, value);
+  default:
+    return 0;
+  }
+}
+
+// A string CONST, down its chain of names
+static char *constantText(Node *node) {
+  while (node->kind == N_VARIABLE && node->symbol->kind == SYM_CONSTANT)
+    node = node->symbol->node->firstChild;
+  return node->kind == N_STRING ? node->text : NULL;
+}
+
+static int countOperations(Node *node) {
+  Node *child;
+  int count = node->kind == N_BINARY || (node->kind == N_UNARY && node->op == SB_MINUS);
+
+  for (child = node->firstChild; child != NULL; child = child->next)
+    count += countOperations(child);
+  return count;
+}
+
+static char *operatorText(TokenType op) {
+  switch (op) {
+  case SB_PLUS: return "+";
+  case SB_MINUS: return "-";
+  case SB_TIMES: return "*";
+  case SB_SLASH: return "/";
+  case SB_MOD: return "%";
+  default: return "**";
+  }
+}
+
+static void printExpression(FILE *out, Node *node) {
+  switch (node->kind) {
+  case N_NUMBER:
+    fprintf(out, "%d", node->value);
+    break;
+  case N_CHAR:
+    fprintf(out, "'%c'", node->value);
+    break;
+  case N_UNARY:
+    fputs(operatorText(node->op), out);
+    printExpression(out, node->firstChild);
+    break;
+  case N_BINARY:
+    if (node->firstChild->kind == N_BINARY) {
+      fputc('(', out);
+      printExpression(out, node->firstChild);
+      fputc(')', out);
+    } else printExpression(out, node->firstChild);
+    fprintf(out, " %s ", operatorText(node->op));
+    if (node->lastChild->kind == N_BINARY) {
+      fputc('(', out);
+      printExpression(out, node->lastChild);
+      fputc(')', out);
+    } else printExpression(out, node->lastChild);
+    break;
+  default:
+    fputs(node->symbol->name, out);
+    break;
+  }
+}
+
+// The node becomes a literal; its children stay in the arena
+static void replace(Node *node, NodeKind kind, int32_t value, char *text) {
+  node->kind = kind;
+  node->op = kind == N_NUMBER ? TK_NUMBER : kind == N_CHAR ? TK_CHAR : TK_STRING;
+  node->value = value;
+  node->text = text;
+  node->symbol = NULL;
+  node->childCount = 0;
+  node->firstChild = node->lastChild = NULL;
+}
+
+static void reportIndexes(Folder *f, Node *node) {
+  Type *type = node->symbol->type;
+  Node *index;
+  int count, i;
+
+  constantOffset(node, &count);
+  for (i = 0, index = node->firstChild; index != NULL; i++, index = index->next, type = type->element)
+    if (i < count) {
+      f->stats->indexes++;
+      if (f->report != NULL)
+        fprintf(f->report, "%d-%d: index %d of ARRAY(. %d .) needs no check\n",
+                index->lineNo, index->colNo, index->value, type->size);
+    } else if (index->kind == N_NUMBER && (index->value < 1 || index->value > type->size)) {
+      f->stats->kept++;
+      if (f->report != NULL)
+        fprintf(f->report, "%d-%d: index %d of ARRAY(. %d .) left to fail at run time\n",
+                index->lineNo, index->colNo, index->value, type->size);
+    }
+}
+
+static void foldExpression(Folder *f, Node *node) {
+  Symbol *symbol = node->symbol;
+  Node *child;
+  int32_t value, a, b;
+  char *text;
+
+  switch (node->kind) {
+  case N_NUMBER:
+  case N_CHAR:
+  case N_STRING:
+    return;
+  case N_VARIABLE:
+    if (symbol->kind != SYM_CONSTANT)
+      break;
+    f->stats->constants++;
+    if ((text = constantText(node)) != NULL) {
+      if (f->report != NULL)
+        fprintf(f->report, "%d-%d: %s = '%s'\n", node->lineNo, node->colNo, symbol->name, text);
+      replace(node, N_STRING, 0, text);
+    } else {
+      evaluate(node, &value);
+      replace(node, node->type == &charType ? N_CHAR : N_NUMBER, value, NULL);
+      if (f->report != NULL) {
+        fprintf(f->report, "%d-%d: %s = ", node->lineNo, node->colNo, symbol->name);
+        printExpression(f->report, node);
+        fputc('\n', f->report);
+      }
+    }
+    return;
+  case N_UNARY:
+  case N_BINARY:
+    if (!evaluate(node, &value))
+      break;
+    f->stats->expressions++;
+    f->stats->operations += countOperations(node);
+    if (f->report != NULL) {
+      fprintf(f->report, "%d-%d: ", node->lineNo, node->colNo);
+      printExpression(f->report, node);
+      fprintf(f->report, " = %d\n", value);
+    }
+    replace(node, N_NUMBER, value, NULL);
+    return;
+  default:
+    break;
+  }
+
+  for (child = node->firstChild; child != NULL; child = child->next)
+    foldExpression(f, child);
+  if (node->kind == N_VARIABLE && node->firstChild != NULL)
+    reportIndexes(f, node);
+  // Both operands known, yet it fails: division by zero
+  else if (node->kind == N_BINARY && evaluate(node->firstChild, &a) && evaluate(node->lastChild, &b)) {
+    f->stats->kept++;
+    if (f->report != NULL) {
+      fprintf(f->report, "%d-%d: ", node->lineNo, node->colNo);
+      printExpression(f->report, node);
+      fprintf(f->report, " left to fail at run time\n");
+    }
+  }
+}
+
+static void foldNode(Folder *f, Node *node) {
+  Node *child;
+
+  switch (node->kind) {
+  case N_CONST_DECL:
+  case N_TYPE_DECL:
+  case N_VAR_DECL:
+  case N_PARAM:
+  case N_TYPE:
+    return;
+  case N_UNARY:
+  case N_BINARY:
+  case N_NUMBER:
+  case N_CHAR:
+  case N_STRING:
+  case N_VARIABLE:
+  case N_FUNC_CALL:
+    foldExpression(f, node);
+    return;
+  default:
+    for (child = node->firstChild; child != NULL; child = child->next)
+      foldNode(f, child);
+    return;
+  }
+}
+
+void foldConstants(CheckedProgram *program, FoldStats *stats, FILE *report) {
+  Folder f = {stats, report};
+
+  memset(stats, 0, sizeof(FoldStats));
+  foldNode(&f, program->tree.root);
+}
+
+int constantOffset(Node *variable, int *count) {
+  Type *type = variable->symbol->type;
+  Node *index = variable->firstChild;
+  int offset = 0;
+
+  // A parameter's array is reached through an address
+  *count = 0;
+  if (variable->symbol->kind != SYM_VARIABLE)
+    return 0;
+  for (; index != NULL && index->kind == N_NUMBER; index = index->next, type = type->element) {
+    if (index->value < 1 || index->value > type->size)
+      break;
+    offset += (index->value - 1) * typeCells(type->element);
+    (*count)++;
+  }
+  return offset;
+}
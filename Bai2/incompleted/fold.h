@@ -0,0 +1,29 @@
+/* Constant folding */
+
+#ifndef __FOLD_H__
+#define __FOLD_H__
+
+#include <stdio.h>
+#include "typecheck.h"
+
+typedef struct {
+  int expressions;    // constant expressions replaced by their value
+  int operations;     // operators evaluated in them
+  int constants;      // CONST identifiers replaced by their value
+  int indexes;        // constant indexes found in range of their array
+  int kept;           // constant operations left to fail at run time
+} FoldStats;
+
+// Replaces, in the tree of a checked program that did not fail, every
+// constant expression and CONST identifier by its value, computed as at
+// run time (arith.h). An operation that would fail, such as a division
+// by zero, is left in place to fail when it runs. With report set, each
+// change is written there as "line-col: ...".
+void foldConstants(CheckedProgram *program, FoldStats *stats, FILE *report);
+
+// The cells skipped by the leading indexes of a variable that are
+// numbers within their array's bounds, which need no check; *count is
+// set to how many indexes that is
+int constantOffset(Node *variable, int *count);
+
+#endif
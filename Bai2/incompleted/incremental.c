@@ -0,0 +1,295 @@
+/* Incremental parsing */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reader.h"
+#include "scanner.h"
+#include "parser.h"
+#include "error.h"
+#include "incremental.h"
+
+extern __thread Token *currentToken;
+extern __thread Token *lookAhead;
+extern __thread Incremental *incremental;
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+static void initTable(SubResultTable *table) {
+  table->slots = NULL;
+  table->capacity = 0;
+  table->count = 0;
+}
+
+static void freeTable(SubResultTable *table) {
+  int i;
+  for (i = 0; i < table->capacity; i++)
+    free(table->slots[i].text);
+  free(table->slots);
+  initTable(table);
+}
+
+// Open addressing with linear probing; returns the slot of hash or the
+// empty slot where it would go
+static SubResult *findSlot(SubResultTable *table, unsigned long long hash) {
+  int i;
+
+  if (table->capacity == 0)
+    return NULL;
+  i = (int)(hash & (table->capacity - 1));
+  while (table->slots[i].hash != 0 && table->slots[i].hash != hash)
+    i = (i + 1) & (table->capacity - 1);
+  return &table->slots[i];
+}
+
+static SubResult *lookupResult(SubResultTable *table, unsigned long long hash) {
+  SubResult *slot = findSlot(table, hash);
+  return slot != NULL && slot->hash == hash ? slot : NULL;
+}
+
+static void insertResult(SubResultTable *table, SubResult *result) {
+  SubResultTable grown;
+  SubResult *slot;
+  int i;
+
+  if (2 * (table->count + 1) > table->capacity) {
+    grown.capacity = table->capacity ? 2 * table->capacity : 64;
+    grown.count = 0;
+    grown.slots = (SubResult*)calloc(grown.capacity, sizeof(SubResult));
+    for (i = 0; i < table->capacity; i++)
+      if (table->slots[i].hash != 0)
+        insertResult(&grown, &table->slots[i]);
+    free(table->slots);
+    *table = grown;
+  }
+  slot = findSlot(table, result->hash);
+  if (slot->hash == 0) {
+    *slot = *result;
+    table->count++;
+  } else free(result->text);
+}
+
+// Moves the results of from that into lacks into it and empties from
+static void mergeTable(SubResultTable *into, SubResultTable *from) {
+  int i;
+
+  for (i = 0; i < from->capacity; i++)
+    if (from->slots[i].hash != 0)
+      insertResult(into, &from->slots[i]);
+  free(from->slots);
+  initTable(from);
+}
+
+void initIncremental(Incremental *inc) {
+  initTable(&inc->previous);
+  initTable(&inc->current);
+  inc->reused = 0;
+  inc->reparsed = 0;
+}
+
+void freeIncremental(Incremental *inc) {
+  freeTable(&inc->previous);
+  freeTable(&inc->current);
+}
+
+/******************************************************************/
+
+static unsigned long long mix(unsigned long long hash, unsigned long long value) {
+  int i;
+  for (i = 0; i < 8; i++) {
+    hash ^= (value >> (8 * i)) & 0xff;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static unsigned long long mixToken(unsigned long long hash, Token *token, int firstLine) {
+  char *s;
+
+  hash = mix(hash, token->tokenType);
+  hash = mix(hash, token->lineNo - firstLine);
+  hash = mix(hash, token->colNo);
+  switch (token->tokenType) {
+  case TK_IDENT:
+  case TK_NUMBER:
+  case TK_CHAR:
+  case TK_STRING:
+    for (s = token->string; *s != '\0'; s++)
+      hash = mix(hash, (unsigned char)*s);
+    break;
+  default:
+    break;
+  }
+  return hash;
+}
+
+// Skip one subroutine declaration (nested ones included) at token level,
+// hashing its tokens. Every FUNCTION/PROCEDURE opens one level and the END
+// closing its body closes it. Returns 0 if the declaration is malformed.
+static int skimSubroutine(unsigned long long *hash) {
+  int firstLine = lookAhead->lineNo;
+  int levels = 0, nesting = 0;
+  unsigned long long h = FNV_OFFSET;
+
+  do {
+    switch (lookAhead->tokenType) {
+    case KW_FUNCTION:
+    case KW_PROCEDURE:
+      if (nesting == 0) levels++;
+      break;
+    case KW_BEGIN:
+      nesting++;
+      break;
+    case KW_END:
+      if (--nesting == 0) levels--;
+      break;
+    case TK_EOF:
+      return 0;
+    default:
+      break;
+    }
+    h = mixToken(h, lookAhead, firstLine);
+    scan();
+  } while (levels > 0 && nesting >= 0);
+
+  if (nesting < 0 || lookAhead->tokenType != SB_SEMICOLON)
+    return 0;
+  h = mixToken(h, lookAhead, firstLine);
+  scan();
+  *hash = h != 0 ? h : 1;
+  return 1;
+}
+
+// Reuse a trace made when the subroutine started at another line: only the
+// line numbers of the "line-col:" prefixes change
+static void writeShifted(SubResult *result, int lineNo, FILE *out) {
+  int delta = lineNo - result->lineNo;
+  char *p = result->text, *end = result->text + result->length;
+  char *eol, *dash;
+  long line;
+
+  if (delta == 0) {
+    fwrite(result->text, 1, result->length, out);
+    return;
+  }
+  while (p < end) {
+    eol = memchr(p, '\n', end - p);
+    eol = eol != NULL ? eol + 1 : end;
+    line = strtol(p, &dash, 10);
+    if (dash != p && *dash == '-') {
+      fprintf(out, "%ld", line + delta);
+      p = dash;
+    }
+    fwrite(p, 1, eol - p, out);
+    p = eol;
+  }
+}
+
+// A lexical error while skimming only means the subroutine must be
+// parsed. Kept apart so that nothing the caller changes is live across
+// the longjmp.
+static int trySkim(Incremental *inc, unsigned long long *hash) {
+  FILE *real = getOutputStream();
+  jmp_buf trap, *outer = errorTrap;
+  int skimmed = 0;
+
+  errorTrap = &trap;
+  setOutputStream(inc->skimErrors);
+  if (setjmp(trap) == 0)
+    skimmed = skimSubroutine(hash);
+  errorTrap = outer;
+  setOutputStream(real);
+  return skimmed;
+}
+
+void compileSubDeclIncremental(void) {
+  Incremental *inc = incremental;
+  TokenType kind = lookAhead->tokenType;
+  long offset = tokenOffset;
+  int lineNo = lookAhead->lineNo, colNo = lookAhead->colNo;
+  unsigned long long hash = 0;
+  int skimmed = trySkim(inc, &hash);
+  SubResult *cached, result;
+  jmp_buf trap, *outer = errorTrap;
+  FILE *real = getOutputStream(), *out;
+  volatile int failed = 0;
+
+  if (skimmed) {
+    cached = lookupResult(&inc->previous, hash);
+    if (cached == NULL)
+      cached = lookupResult(&inc->current, hash);
+    if (cached != NULL) {
+      writeShifted(cached, lineNo, getOutputStream());
+      result.hash = hash;
+      result.lineNo = cached->lineNo;
+      result.length = cached->length;
+      result.text = (char*)malloc(cached->length + 1);
+      memcpy(result.text, cached->text, cached->length);
+      insertResult(&inc->current, &result);
+      inc->reused++;
+      return;
+    }
+  }
+
+  // Changed (or malformed): go back to the keyword and parse it for real
+  freeToken(lookAhead);
+  lookAhead = NULL;
+  seekInputStream(offset, lineNo, colNo);
+  lookAhead = getValidToken();
+
+  result.text = NULL;
+  result.length = 0;
+  out = open_memstream(&result.text, &result.length);
+  setOutputStream(out);
+  errorTrap = &trap;
+  incremental = NULL;      // nested subroutines are parsed normally
+  if (setjmp(trap) == 0) {
+    if (kind == KW_FUNCTION)
+      compileFuncDecl();
+    else compileProcDecl();
+  } else failed = 1;
+  incremental = inc;
+  errorTrap = outer;
+  setOutputStream(real);
+  fclose(out);
+  fwrite(result.text, 1, result.length, real);
+  inc->reparsed++;
+
+  if (failed || !skimmed) {
+    free(result.text);
+    if (failed)
+      longjmp(*outer, 1);
+    return;
+  }
+  result.hash = hash;
+  result.lineNo = lineNo;
+  insertResult(&inc->current, &result);
+}
+
+// Parse a new version of a file, reusing the results of the subroutines
+// that did not change since the last call with the same inc
+int compileIncremental(char *fileName, Incremental *inc) {
+  char *skimText = NULL;
+  size_t skimLength = 0;
+  int status;
+
+  inc->reused = 0;
+  inc->reparsed = 0;
+  inc->skimErrors = open_memstream(&skimText, &skimLength);
+  incremental = inc;
+  status = compile(fileName);
+  incremental = NULL;
+  fclose(inc->skimErrors);
+  free(skimText);
+
+  // A parse stopped by an error never reached the subroutines after it:
+  // their results from before stay for the next version
+  if (status == IO_ERROR || errorRaised)
+    mergeTable(&inc->current, &inc->previous);
+  else freeTable(&inc->previous);
+  inc->previous = inc->current;
+  initTable(&inc->current);
+  return status;
+}
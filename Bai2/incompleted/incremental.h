@@ -0,0 +1,35 @@
+/* Incremental parsing */
+
+#ifndef __INCREMENTAL_H__
+#define __INCREMENTAL_H__
+
+#include <stdio.h>
+
+// Parse result of one top-level FUNCTION/PROCEDURE, keyed by the hash of
+// its tokens (types, spellings and positions relative to its first line)
+typedef struct {
+  unsigned long long hash;   // 0: empty slot
+  int lineNo;                // line of the FUNCTION/PROCEDURE keyword
+  char *text;                // trace printed while parsing it
+  size_t length;
+} SubResult;
+
+typedef struct {
+  SubResult *slots;
+  int capacity;
+  int count;
+} SubResultTable;
+
+typedef struct {
+  SubResultTable previous;   // results of the last parse
+  SubResultTable current;    // results of the parse in progress
+  int reused, reparsed;
+  FILE *skimErrors;          // swallows lexical errors met while skimming
+} Incremental;
+
+void initIncremental(Incremental *inc);
+void freeIncremental(Incremental *inc);
+int compileIncremental(char *fileName, Incremental *inc);
+void compileSubDeclIncremental(void);
+
+#endif
@@ -0,0 +1,793 @@
+/* Intermediate representation */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "codegen.h"
+#include "ir.h"
+
+// SSA is built as the tree is walked (Braun et al., "Simple and
+// Efficient Construction of Static Single Assignment Form"): each block
+// keeps the value of each variable assigned in it, a read looks back
+// through the predecessors, and a block whose predecessors are not all
+// known yet, a loop header, gets a PHI completed when it is sealed.
+
+// Symbols by address: the scalars kept in memory
+typedef struct {
+  Symbol **slots;
+  int capacity, count;
+} SymbolSet;
+
+typedef struct {
+  IrProgram *ir;
+  IrFunction *f;
+  SymbolSet *memory;
+  IrBlock *block;               // where instructions are appended
+  IrLoop *loop;                 // innermost loop being built
+  Symbol **vars;                // the promoted variables
+  int varCount;
+  int *cellVars;                // variable held in each frame cell, -1: none
+  int resultVar;                // -1: the result stays in its cell
+  IrInstr **refs;               // address held by each VAR parameter, by cell
+} Builder;
+
+static IrInstr *buildExpression(Builder *b, Node *node);
+static void buildStatement(Builder *b, Node *node);
+
+/******************************************************************/
+
+static int findSymbol(SymbolSet *set, Symbol *symbol) {
+  unsigned i = (unsigned)((uintptr_t)symbol >> 4) * 2654435761u;
+
+  for (i &= set->capacity - 1; set->slots[i] != NULL && set->slots[i] != symbol; i = (i + 1) & (set->capacity - 1))
+    ;
+  return i;
+}
+
+static void addSymbol(SymbolSet *set, Symbol *symbol) {
+  Symbol **old = set->slots;
+  int capacity = set->capacity, i;
+
+  if (2 * (set->count + 1) > set->capacity) {
+    set->capacity = capacity ? 2 * capacity : 64;
+    set->slots = (Symbol**)calloc(set->capacity, sizeof(Symbol*));
+    for (i = 0; i < capacity; i++)
+      if (old[i] != NULL)
+        set->slots[findSymbol(set, old[i])] = old[i];
+    free(old);
+  }
+  i = findSymbol(set, symbol);
+  if (set->slots[i] == NULL) {
+    set->slots[i] = symbol;
+    set->count++;
+  }
+}
+
+static int hasSymbol(SymbolSet *set, Symbol *symbol) {
+  return set->capacity > 0 && set->slots[findSymbol(set, symbol)] == symbol;
+}
+
+static int isCell(Symbol *symbol) {
+  return symbol->kind == SYM_VARIABLE || symbol->kind == SYM_PARAMETER || symbol->kind == SYM_FUNCTION;
+}
+
+// A variable used by a routine nested in its own, a function result
+// assigned there, or anything passed as a VAR argument, must stay in
+// its cell. level is the frame level of the code walked.
+static void findMemory(SymbolSet *memory, Node *node, int level) {
+  Symbol *symbol = node->symbol;
+  Node *child;
+  int i;
+
+  switch (node->kind) {
+  case N_FUNC_DECL:
+  case N_PROC_DECL:
+    level = symbol->level + 1;
+    break;
+  case N_VARIABLE:
+  case N_FOR:
+    if ((symbol->kind == SYM_VARIABLE || symbol->kind == SYM_PARAMETER) && symbol->level < level)
+      addSymbol(memory, symbol);
+    break;
+  case N_ASSIGN:
+    for (i = 0, child = node->firstChild; i < node->value; i++, child = child->next)
+      if (child->symbol->kind == SYM_FUNCTION && child->symbol->level + 1 < level)
+        addSymbol(memory, child->symbol);
+    break;
+  case N_CALL:
+  case N_FUNC_CALL:
+    child = node->firstChild;
+    if (symbol->builtin != BUILTIN_NONE) {
+      if (node->kind == N_CALL && child != NULL && child->kind == N_VARIABLE && child->symbol->kind == SYM_FUNCTION &&
+          child->symbol->level + 1 < level)
+        addSymbol(memory, child->symbol);
+      break;
+    }
+    for (i = 0; child != NULL; i++, child = child->next)
+      if (symbol->type->byRef[i] && child->kind == N_VARIABLE && isCell(child->symbol))
+        addSymbol(memory, child->symbol);
+    break;
+  default:
+    break;
+  }
+  for (child = node->firstChild; child != NULL; child = child->next)
+    findMemory(memory, child, level);
+}
+
+/******************************************************************/
+
+void *irAlloc(IrProgram *ir, size_t size) {
+  IrChunk *chunk = ir->chunks;
+  void *p;
+
+  size = (size + 15) & ~(size_t)15;
+  if (chunk == NULL || chunk->used + size > chunk->size) {
+    chunk = (IrChunk*)malloc(sizeof(IrChunk) + (size > 65536 ? size : 65536));
+    chunk->size = size > 65536 ? size : 65536;
+    chunk->used = 0;
+    chunk->next = ir->chunks;
+    ir->chunks = chunk;
+  }
+  p = (char*)(chunk + 1) + chunk->used;
+  chunk->used += size;
+  memset(p, 0, size);
+  return p;
+}
+
+void freeIr(IrProgram *ir) {
+  IrChunk *chunk, *next;
+  int i;
+
+  for (i = 0; i < ir->count; i++) {
+    free(ir->functions[i]->blocks);
+    free(ir->functions[i]->loops);
+  }
+  free(ir->functions);
+  for (chunk = ir->chunks; chunk != NULL; chunk = next) {
+    next = chunk->next;
+    free(chunk);
+  }
+  memset(ir, 0, sizeof(IrProgram));
+}
+
+// Arrays in the arena grow by moving
+static void *grow(IrProgram *ir, void *items, int count, int *capacity, size_t size) {
+  void *moved;
+
+  if (count < *capacity)
+    return items;
+  *capacity = *capacity ? 2 * *capacity : 4;
+  moved = irAlloc(ir, *capacity * size);
+  if (count > 0)
+    memcpy(moved, items, count * size);
+  return moved;
+}
+
+static void addArg(IrProgram *ir, IrInstr *instr, IrInstr *arg) {
+  instr->args = (IrInstr**)grow(ir, instr->args, instr->argCount, &instr->argCapacity, sizeof(IrInstr*));
+  instr->args[instr->argCount++] = arg;
+}
+
+static void addPred(IrProgram *ir, IrBlock *block, IrBlock *pred) {
+  block->preds = (IrBlock**)grow(ir, block->preds, block->predCount, &block->predCapacity, sizeof(IrBlock*));
+  block->preds[block->predCount++] = pred;
+}
+
+// After where, or first when where is NULL
+static void linkAfter(IrBlock *block, IrInstr *where, IrInstr *instr) {
+  instr->block = block;
+  instr->prev = where;
+  instr->next = where != NULL ? where->next : block->first;
+  if (instr->next != NULL)
+    instr->next->prev = instr;
+  else block->last = instr;
+  if (where != NULL)
+    where->next = instr;
+  else block->first = instr;
+}
+
+static IrInstr *newInstr(Builder *b, IrOp op, Node *node) {
+  IrInstr *instr = (IrInstr*)irAlloc(b->ir, sizeof(IrInstr));
+
+  instr->op = op;
+  instr->id = b->f->valueCount++;
+  if (node != NULL) {
+    instr->lineNo = node->lineNo;
+    instr->colNo = node->colNo;
+  }
+  return instr;
+}
+
+static IrInstr *append(Builder *b, IrOp op, Node *node, IrInstr *x, IrInstr *y) {
+  IrInstr *instr = newInstr(b, op, node);
+
+  if (x != NULL)
+    addArg(b->ir, instr, x);
+  if (y != NULL)
+    addArg(b->ir, instr, y);
+  linkAfter(b->block, b->block->last, instr);
+  return instr;
+}
+
+static IrInstr *constant(Builder *b, int value) {
+  IrInstr *instr = append(b, IR_CONST, NULL, NULL, NULL);
+  instr->value = value;
+  return instr;
+}
+
+static IrBlock *newBlock(Builder *b, IrLoop *loop) {
+  IrFunction *f = b->f;
+  IrBlock *block = (IrBlock*)irAlloc(b->ir, sizeof(IrBlock));
+
+  if (f->blockCount == f->blockCapacity) {
+    f->blockCapacity = f->blockCapacity ? 2 * f->blockCapacity : 16;
+    f->blocks = (IrBlock**)realloc(f->blocks, f->blockCapacity * sizeof(IrBlock*));
+  }
+  block->id = f->blockCount;
+  block->loop = loop;
+  block->defs = (IrInstr**)irAlloc(b->ir, (b->varCount + 1) * sizeof(IrInstr*));
+  f->blocks[f->blockCount++] = block;
+  return block;
+}
+
+static void jump(Builder *b, IrBlock *to) {
+  append(b, IR_JUMP, NULL, NULL, NULL);
+  b->block->succs[0] = to;
+  b->block->succCount = 1;
+  addPred(b->ir, to, b->block);
+}
+
+static void compare(Builder *b, Node *node, IrInstr *x, IrInstr *y, TokenType op,
+                    IrBlock *whenTrue, IrBlock *whenFalse) {
+  append(b, IR_BRANCH, node, x, y)->value = op;
+  b->block->succs[0] = whenTrue;
+  b->block->succs[1] = whenFalse;
+  b->block->succCount = 2;
+  addPred(b->ir, whenTrue, b->block);
+  addPred(b->ir, whenFalse, b->block);
+}
+
+static void branch(Builder *b, Node *cond, IrBlock *whenTrue, IrBlock *whenFalse) {
+  IrInstr *x = buildExpression(b, cond->firstChild), *y = buildExpression(b, cond->lastChild);
+
+  if (cond->firstChild->type == &stringType || cond->firstChild->type == &bytesType) {
+    x = append(b, IR_STRCMP, cond, x, y);
+    y = constant(b, 0);
+  }
+  compare(b, cond, x, y, cond->op, whenTrue, whenFalse);
+}
+
+/******************************************************************/
+
+static IrInstr *readVariable(Builder *b, IrBlock *block, int var);
+
+// PHI go first in their block
+static IrInstr *newPhi(Builder *b, IrBlock *block, int var) {
+  IrInstr *phi = newInstr(b, IR_PHI, NULL), *at = NULL, *p;
+
+  phi->symbol = b->vars[var];
+  phi->value = var;
+  for (p = block->first; p != NULL && p->op == IR_PHI; p = p->next)
+    at = p;
+  linkAfter(block, at, phi);
+  return phi;
+}
+
+static void addPhiOperands(Builder *b, IrInstr *phi) {
+  int i;
+
+  for (i = 0; i < phi->block->predCount; i++)
+    addArg(b->ir, phi, readVariable(b, phi->block->preds[i], phi->value));
+}
+
+static IrInstr *readVariable(Builder *b, IrBlock *block, int var) {
+  IrInstr *value = block->defs[var];
+
+  if (value != NULL)
+    return value;
+  if (!block->sealed) {
+    // Completed when the block is sealed
+    value = newPhi(b, block, var);
+    value->mark = 1;
+  } else if (block->predCount == 1)
+    value = readVariable(b, block->preds[0], var);
+  else if (block->predCount == 0) {
+    // Unreachable
+    value = newInstr(b, IR_CONST, NULL);
+    linkAfter(block, NULL, value);
+  } else {
+    // The PHI first, which a loop reads back through itself
+    value = block->defs[var] = newPhi(b, block, var);
+    addPhiOperands(b, value);
+  }
+  block->defs[var] = value;
+  return value;
+}
+
+static void sealBlock(Builder *b, IrBlock *block) {
+  IrInstr *phi;
+
+  for (phi = block->first; phi != NULL && phi->op == IR_PHI; phi = phi->next)
+    if (phi->mark) {
+      phi->mark = 0;
+      addPhiOperands(b, phi);
+    }
+  block->sealed = 1;
+}
+
+// A VAR parameter holds the address of its argument
+static int isByRef(Symbol *symbol) {
+  return symbol->kind == SYM_PARAMETER && symbol->node->op == KW_VAR;
+}
+
+// The variable holding a scalar of the function, or -1
+static int promoted(Builder *b, Symbol *symbol) {
+  if (symbol->kind == SYM_FUNCTION)
+    return symbol == b->f->symbol ? b->resultVar : -1;
+  if (symbol->level != b->f->level || (symbol->kind != SYM_VARIABLE && symbol->kind != SYM_PARAMETER))
+    return -1;
+  return b->cellVars[symbol->offset];
+}
+
+// The cell of a variable or function result, or what a VAR parameter
+// points at
+static IrInstr *baseAddress(Builder *b, Node *node, Symbol *symbol) {
+  IrInstr *address;
+
+  // Its own parameters' addresses never change
+  if (isByRef(symbol) && symbol->level == b->f->level)
+    return b->refs[symbol->offset];
+  address = append(b, IR_ADDR, node, NULL, NULL);
+  address->symbol = symbol;
+  if (symbol->kind == SYM_FUNCTION) {
+    address->level = symbol->level + 1;
+    address->value = IR_RESULT;
+    return address;
+  }
+  address->level = symbol->level;
+  address->value = symbol->offset;
+  return isByRef(symbol) ? append(b, IR_LOAD, node, address, NULL) : address;
+}
+
+static IrInstr *buildAddress(Builder *b, Node *node) {
+  Type *type = node->symbol->type;
+  IrInstr *address = baseAddress(b, node, node->symbol);
+  Node *index;
+
+  for (index = node->firstChild; index != NULL; index = index->next, type = type->element) {
+    address = append(b, IR_INDEX, index, address, buildExpression(b, index));
+    address->value = type->size;
+    address->level = typeCells(type->element);
+  }
+  return address;
+}
+
+static IrInstr *readSymbol(Builder *b, Node *node, Symbol *symbol) {
+  int var = promoted(b, symbol);
+
+  if (var >= 0)
+    return readVariable(b, b->block, var);
+  return append(b, IR_LOAD, node, baseAddress(b, node, symbol), NULL);
+}
+
+static void writeSymbol(Builder *b, Node *node, Symbol *symbol, IrInstr *value) {
+  int var = promoted(b, symbol);
+
+  if (var >= 0) {
+    value = append(b, IR_COPY, node, value, NULL);
+    value->symbol = symbol;
+    b->block->defs[var] = value;
+  } else append(b, IR_STORE, node, baseAddress(b, node, symbol), value);
+}
+
+static void buildStore(Builder *b, Node *node, IrInstr *value) {
+  if (node->firstChild == NULL)
+    writeSymbol(b, node, node->symbol, value);
+  else append(b, IR_STORE, node, buildAddress(b, node), value);
+}
+
+/******************************************************************/
+
+static IrInstr *buildCall(Builder *b, Node *call) {
+  Symbol *symbol = call->symbol;
+  IrInstr *args[call->childCount + 1], *instr;
+  Node *arg;
+  int i;
+
+  switch (symbol->builtin) {
+  case BUILTIN_READC:
+    return append(b, IR_READC, call, NULL, NULL);
+  case BUILTIN_READI:
+    return append(b, IR_READI, call, NULL, NULL);
+  case BUILTIN_WRITEC:
+    return append(b, IR_WRITEC, call, buildExpression(b, call->firstChild), NULL);
+  case BUILTIN_WRITEI:
+    return append(b, IR_WRITEI, call, buildExpression(b, call->firstChild), NULL);
+  case BUILTIN_WRITELN:
+    return append(b, IR_WRITELN, call, NULL, NULL);
+  default:
+    break;
+  }
+  for (i = 0, arg = call->firstChild; arg != NULL; i++, arg = arg->next)
+    args[i] = symbol->type->byRef[i] ? buildAddress(b, arg) : buildExpression(b, arg);
+  instr = append(b, IR_CALL, call, NULL, NULL);
+  instr->symbol = symbol;
+  instr->level = b->f->level - symbol->level;
+  for (i = 0; i < call->childCount; i++)
+    addArg(b->ir, instr, args[i]);
+  return instr;
+}
+
+static IrInstr *buildExpression(Builder *b, Node *node) {
+  Symbol *symbol = node->symbol;
+  IrInstr *x, *instr;
+
+  switch (node->kind) {
+  case N_NUMBER:
+  case N_CHAR:
+    return constant(b, node->value);
+  case N_STRING:
+    instr = append(b, IR_STRING, node, NULL, NULL);
+    instr->text = node->text;
+    return instr;
+  case N_UNARY:
+    x = buildExpression(b, node->firstChild);
+    return node->op == SB_MINUS ? append(b, IR_NEG, node, x, NULL) : x;
+  case N_BINARY:
+    x = buildExpression(b, node->firstChild);
+    switch (node->op) {
+    case SB_PLUS: return append(b, IR_ADD, node, x, buildExpression(b, node->lastChild));
+    case SB_MINUS: return append(b, IR_SUB, node, x, buildExpression(b, node->lastChild));
+    case SB_TIMES: return append(b, IR_MUL, node, x, buildExpression(b, node->lastChild));
+    case SB_SLASH: return append(b, IR_DIV, node, x, buildExpression(b, node->lastChild));
+    case SB_MOD: return append(b, IR_MOD, node, x, buildExpression(b, node->lastChild));
+    default: return append(b, IR_POW, node, x, buildExpression(b, node->lastChild));
+    }
+  case N_FUNC_CALL:
+    return buildCall(b, node);
+  default:
+    if (symbol->kind == SYM_CONSTANT)
+      return buildExpression(b, symbol->node->firstChild);
+    if (symbol->kind == SYM_FUNCTION)
+      return buildCall(b, node);
+    if (node->firstChild == NULL)
+      return readSymbol(b, node, symbol);
+    return append(b, IR_LOAD, node, buildAddress(b, node), NULL);
+  }
+}
+
+static IrLoop *startLoop(Builder *b) {
+  IrLoop *loop = (IrLoop*)irAlloc(b->ir, sizeof(IrLoop));
+
+  loop->parent = b->loop;
+  loop->preheader = newBlock(b, b->loop);
+  jump(b, loop->preheader);
+  sealBlock(b, loop->preheader);
+  b->block = loop->preheader;
+  loop->header = newBlock(b, loop);
+  jump(b, loop->header);
+  b->block = loop->header;
+  b->loop = loop;
+  return loop;
+}
+
+static void endLoop(Builder *b, IrLoop *loop, IrBlock *exit) {
+  IrFunction *f = b->f;
+
+  sealBlock(b, loop->header);
+  sealBlock(b, exit);
+  b->block = exit;
+  b->loop = loop->parent;
+  if (f->loopCount == f->loopCapacity) {
+    f->loopCapacity = f->loopCapacity ? 2 * f->loopCapacity : 8;
+    f->loops = (IrLoop**)realloc(f->loops, f->loopCapacity * sizeof(IrLoop*));
+  }
+  f->loops[f->loopCount++] = loop;
+}
+
+// As the bytecode runs it: the bound is evaluated once, and the test at
+// the bottom stops before the variable steps past it
+static void buildFor(Builder *b, Node *node) {
+  Symbol *var = node->symbol;
+  IrLoop *loop = (IrLoop*)irAlloc(b->ir, sizeof(IrLoop));
+  IrBlock *exit, *step;
+  IrInstr *bound;
+
+  writeSymbol(b, node, var, buildExpression(b, node->firstChild));
+  bound = buildExpression(b, node->firstChild->next);
+  loop->parent = b->loop;
+  loop->preheader = newBlock(b, b->loop);
+  exit = newBlock(b, b->loop);
+  compare(b, node, readSymbol(b, node, var), bound, SB_GT, exit, loop->preheader);
+  sealBlock(b, loop->preheader);
+  b->block = loop->preheader;
+  loop->header = newBlock(b, loop);
+  jump(b, loop->header);
+  b->block = loop->header;
+  b->loop = loop;
+
+  buildStatement(b, node->lastChild);
+  step = newBlock(b, loop);
+  compare(b, node, readSymbol(b, node, var), bound, SB_GE, exit, step);
+  sealBlock(b, step);
+  b->block = step;
+  writeSymbol(b, node, var, append(b, IR_ADD, node, readSymbol(b, node, var), constant(b, 1)));
+  jump(b, loop->header);
+  endLoop(b, loop, exit);
+}
+
+static void buildStatement(Builder *b, Node *node) {
+  IrInstr *values[node->kind == N_ASSIGN ? node->value : 1], *value;
+  IrBlock *then, *otherwise, *join;
+  IrLoop *loop;
+  Node *child;
+  int i;
+
+  switch (node->kind) {
+  case N_ASSIGN:
+    // Every value first, so X, Y := Y, X swaps; stored last first
+    for (i = 0, child = childAt(node, node->value); child != NULL; i++, child = child->next)
+      values[i] = buildExpression(b, child);
+    for (i = node->value - 1, child = childAt(node, i); i >= 0; i--, child = child->prev)
+      buildStore(b, child, values[i]);
+    break;
+  case N_CALL:
+    // CALL READC(C) and CALL READI(N) read into their argument
+    value = buildCall(b, node);
+    if (node->symbol->kind == SYM_FUNCTION && node->firstChild != NULL)
+      buildStore(b, node->firstChild, value);
+    break;
+  case N_GROUP:
+    for (child = node->firstChild; child != NULL; child = child->next)
+      buildStatement(b, child);
+    break;
+  case N_IF:
+    then = newBlock(b, b->loop);
+    join = newBlock(b, b->loop);
+    otherwise = node->childCount > 2 ? newBlock(b, b->loop) : join;
+    branch(b, node->firstChild, then, otherwise);
+    sealBlock(b, then);
+    b->block = then;
+    buildStatement(b, node->firstChild->next);
+    jump(b, join);
+    if (otherwise != join) {
+      sealBlock(b, otherwise);
+      b->block = otherwise;
+      buildStatement(b, node->lastChild);
+      jump(b, join);
+    }
+    sealBlock(b, join);
+    b->block = join;
+    break;
+  case N_WHILE:
+    loop = startLoop(b);
+    then = newBlock(b, loop);
+    join = newBlock(b, loop->parent);
+    branch(b, node->firstChild, then, join);
+    sealBlock(b, then);
+    b->block = then;
+    buildStatement(b, node->lastChild);
+    jump(b, loop->header);
+    endLoop(b, loop, join);
+    break;
+  case N_FOR:
+    buildFor(b, node);
+    break;
+  case N_REPEAT:
+    loop = startLoop(b);
+    for (child = node->firstChild; child != node->lastChild; child = child->next)
+      buildStatement(b, child);
+    join = newBlock(b, loop->parent);
+    branch(b, node->lastChild, join, loop->header);
+    endLoop(b, loop, join);
+    break;
+  default:
+    break;
+  }
+}
+
+static void addFunction(IrProgram *ir, IrFunction *f) {
+  if (ir->count == ir->capacity) {
+    ir->capacity = ir->capacity ? 2 * ir->capacity : 16;
+    ir->functions = (IrFunction**)realloc(ir->functions, ir->capacity * sizeof(IrFunction*));
+  }
+  ir->functions[ir->count++] = f;
+}
+
+// The variable of a scalar the function declares, unless it stays in memory
+static void promote(Builder *b, Symbol *symbol) {
+  if (isBasicType(symbol->type) && !isByRef(symbol) && !hasSymbol(b->memory, symbol)) {
+    b->cellVars[symbol->offset] = b->varCount;
+    b->vars[b->varCount++] = symbol;
+  }
+}
+
+static void buildFunction(IrProgram *ir, SymbolSet *memory, Node *routine, int level) {
+  IrFunction *f = (IrFunction*)irAlloc(ir, sizeof(IrFunction));
+  Node *child = routine->firstChild, *block;
+  IrInstr *zero, *param;
+  Builder b;
+  int i;
+
+  f->level = level;
+  if (routine->kind != N_PROGRAM) {
+    f->symbol = routine->symbol;
+    f->symbol->offset = ir->count;
+  }
+  addFunction(ir, f);
+  for (; child->kind == N_PARAM; child = child->next)
+    child->symbol->offset = f->params++;
+  if (routine->kind == N_FUNC_DECL)
+    child = child->next;
+  block = child;
+  f->cells = f->params;
+  for (child = block->firstChild; child != NULL; child = child->next)
+    if (child->kind == N_VAR_DECL) {
+      child->symbol->offset = f->cells;
+      f->cells += typeCells(child->symbol->type);
+    }
+  for (child = block->firstChild; child != block->lastChild; child = child->next)
+    if (child->kind == N_FUNC_DECL || child->kind == N_PROC_DECL)
+      buildFunction(ir, memory, child, child->symbol->level + 1);
+
+  memset(&b, 0, sizeof(Builder));
+  b.ir = ir;
+  b.f = f;
+  b.memory = memory;
+  b.vars = (Symbol**)malloc((f->cells + 1) * sizeof(Symbol*));
+  b.cellVars = (int*)malloc((f->cells + 1) * sizeof(int));
+  b.refs = (IrInstr**)calloc(f->cells + 1, sizeof(IrInstr*));
+  for (i = 0; i < f->cells; i++)
+    b.cellVars[i] = -1;
+  for (child = routine->firstChild; child->kind == N_PARAM; child = child->next)
+    promote(&b, child->symbol);
+  for (child = block->firstChild; child != NULL; child = child->next)
+    if (child->kind == N_VAR_DECL)
+      promote(&b, child->symbol);
+  b.resultVar = -1;
+  if (routine->kind == N_FUNC_DECL && !hasSymbol(memory, f->symbol)) {
+    b.resultVar = b.varCount;
+    b.vars[b.varCount++] = f->symbol;
+  }
+
+  // Parameters come in their cells; variables and the result start at 0
+  b.block = newBlock(&b, NULL);
+  b.block->sealed = 1;
+  zero = constant(&b, 0);
+  for (child = routine->firstChild; child->kind == N_PARAM; child = child->next) {
+    if (!isByRef(child->symbol) && b.cellVars[child->symbol->offset] < 0)
+      continue;
+    param = append(&b, IR_PARAM, child, NULL, NULL);
+    param->value = child->symbol->offset;
+    param->symbol = child->symbol;
+    if (isByRef(child->symbol))
+      b.refs[child->symbol->offset] = param;
+  }
+  for (i = 0; i < b.varCount; i++)
+    b.block->defs[i] = zero;
+  for (param = b.block->first; param != NULL; param = param->next)
+    if (param->op == IR_PARAM && !isByRef(param->symbol))
+      b.block->defs[b.cellVars[param->value]] = param;
+
+  buildStatement(&b, block->lastChild);
+  if (routine->kind != N_FUNC_DECL)
+    append(&b, IR_RETURN, NULL, NULL, NULL);
+  else if (b.resultVar >= 0)
+    append(&b, IR_RETURN, NULL, readVariable(&b, b.block, b.resultVar), NULL);
+  else append(&b, IR_RETURN, NULL, readSymbol(&b, NULL, f->symbol), NULL);
+  free(b.vars);
+  free(b.cellVars);
+  free(b.refs);
+}
+
+void buildIr(CheckedProgram *program, IrProgram *ir) {
+  SymbolSet memory = {NULL, 0, 0};
+
+  memset(ir, 0, sizeof(IrProgram));
+  findMemory(&memory, program->tree.root, 1);
+  buildFunction(ir, &memory, program->tree.root, 1);
+  free(memory.slots);
+}
+
+/******************************************************************/
+
+int countIr(IrProgram *ir) {
+  IrFunction *f;
+  IrInstr *instr;
+  int count = 0, i, j;
+
+  for (i = 0; i < ir->count; i++)
+    for (f = ir->functions[i], j = 0; j < f->blockCount; j++)
+      for (instr = f->blocks[j]->first; instr != NULL; instr = instr->next)
+        count++;
+  return count;
+}
+
+static char *opNames[IR_OP_COUNT] = {
+  "const", "string", "param", "copy", "phi", "add", "sub", "mul", "div", "mod", "pow", "neg",
+  "strcmp", "addr", "index", "load", "store", "call", "readc", "readi", "writec", "writei",
+  "writeln", "jump", "branch", "return"
+};
+
+static char *comparatorText(int op) {
+  switch (op) {
+  case SB_EQ: return "=";
+  case SB_NEQ: return "!=";
+  case SB_LT: return "<";
+  case SB_LE: return "<=";
+  case SB_GT: return ">";
+  default: return ">=";
+  }
+}
+
+static void printInstr(IrInstr *instr, FILE *out) {
+  int i;
+
+  fprintf(out, "  ");
+  switch (instr->op) {
+  case IR_STORE: case IR_WRITEC: case IR_WRITEI: case IR_WRITELN:
+  case IR_JUMP: case IR_BRANCH: case IR_RETURN:
+    break;
+  default:
+    if (instr->op != IR_CALL || instr->symbol->type->element != NULL)
+      fprintf(out, "v%d = ", instr->id);
+    break;
+  }
+  fprintf(out, "%s", opNames[instr->op]);
+  switch (instr->op) {
+  case IR_CONST:
+  case IR_PARAM:
+    fprintf(out, " %d", instr->value);
+    break;
+  case IR_STRING:
+    fprintf(out, " \"%s\"", instr->text);
+    break;
+  case IR_ADDR:
+    fprintf(out, " %s, level %d cell %d", instr->symbol->name, instr->level, instr->value);
+    break;
+  case IR_CALL:
+    fprintf(out, " %s", instr->symbol->name);
+    break;
+  case IR_JUMP:
+    fprintf(out, " b%d\n", instr->block->succs[0]->id);
+    return;
+  case IR_BRANCH:
+    fprintf(out, " v%d %s v%d, b%d, b%d\n", instr->args[0]->id, comparatorText(instr->value),
+            instr->args[1]->id, instr->block->succs[0]->id, instr->block->succs[1]->id);
+    return;
+  default:
+    break;
+  }
+  for (i = 0; i < instr->argCount; i++)
+    fprintf(out, "%s v%d", i > 0 || instr->op == IR_CALL ? "," : "", instr->args[i]->id);
+  if (instr->op == IR_INDEX)
+    fprintf(out, ", length %d cells %d", instr->value, instr->level);
+  if (instr->op == IR_COPY || instr->op == IR_PHI || instr->op == IR_PARAM)
+    fprintf(out, "    ; %s", instr->symbol->name);
+  fputc('\n', out);
+}
+
+void printIr(IrProgram *ir, FILE *out) {
+  IrFunction *f;
+  IrBlock *block;
+  IrInstr *instr;
+  int i, j, k;
+
+  for (i = 0; i < ir->count; i++) {
+    f = ir->functions[i];
+    fprintf(out, "%s%s: level %d, %d params, %d cells\n", i > 0 ? "\n" : "",
+            f->symbol != NULL ? f->symbol->name : "program", f->level, f->params, f->cells);
+    for (j = 0; j < f->blockCount; j++) {
+      block = f->blocks[j];
+      fprintf(out, "b%d:", block->id);
+      for (k = 0; k < block->predCount; k++)
+        fprintf(out, "%s b%d", k > 0 ? "," : " from", block->preds[k]->id);
+      if (block->loop != NULL && block->loop->header == block)
+        fprintf(out, "    ; loop header, preheader b%d", block->loop->preheader->id);
+      fputc('\n', out);
+      for (instr = block->first; instr != NULL; instr = instr->next)
+        printInstr(instr, out);
+    }
+  }
+}
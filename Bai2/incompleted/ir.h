@@ -0,0 +1,133 @@
+/* Intermediate representation */
+
+#ifndef __IR_H__
+#define __IR_H__
+
+#include <stdio.h>
+#include <stddef.h>
+
+#include "typecheck.h"
+#include "bytecode.h"
+
+// Each routine, and the program's body, becomes a function: a control
+// flow graph of basic blocks of instructions in SSA form. The scalar
+// variables and parameters a routine declares, and a function's result,
+// become values joined by PHI where control flow meets, unless a nested
+// routine or a VAR argument reaches them. Those, arrays and the cells of
+// other frames stay in memory, read and written with LOAD and STORE.
+// Nothing in it depends on an engine, so any of them can take it.
+typedef enum {
+  IR_CONST,       // value
+  IR_STRING,      // text
+  IR_PARAM,       // value: the parameter's cell as the routine begins
+  IR_COPY,        // a: assigned to the variable symbol
+  IR_PHI,         // one argument per predecessor, in their order
+  IR_ADD,         // a b
+  IR_SUB,
+  IR_MUL,
+  IR_DIV,
+  IR_MOD,
+  IR_POW,
+  IR_NEG,         // a
+  IR_STRCMP,      // a b: the sign of the comparison
+  IR_ADDR,        // the cell value of the frame at scope level level
+  IR_INDEX,       // address index: value is the length, level the cells of an element
+  IR_LOAD,        // address
+  IR_STORE,       // address value
+  IR_CALL,        // symbol: the routine; level: static link hops; the arguments
+  IR_READC,
+  IR_READI,
+  IR_WRITEC,      // a
+  IR_WRITEI,      // a
+  IR_WRITELN,
+  IR_JUMP,        // to the first successor
+  IR_BRANCH,      // a b: to the first successor when a value b, value a comparator
+  IR_RETURN,      // [the function's result]
+  IR_OP_COUNT
+} IrOp;
+
+// Header cells below the frame pointer of a function
+#define IR_LINK -2
+#define IR_RESULT -1
+#define IR_HEADER 2
+
+// Like the closures, each KPL call nests C calls of the engine
+#define IR_C_STACK (4 << 20)
+
+struct IrBlock;
+struct IrLoop;
+
+typedef struct IrInstr {
+  IrOp op;
+  int id;                       // printed v<id>
+  int value, level;
+  char *text;
+  Symbol *symbol;               // variable of a COPY or PHI, routine of a CALL, cell of an ADDR
+  struct IrInstr **args;
+  int argCount, argCapacity;
+  struct IrBlock *block;
+  struct IrInstr *prev, *next;
+  int lineNo, colNo;            // where a run-time error is reported
+  struct IrInstr *replacement;  // set when a pass removes it: what its uses become
+  int mark;
+} IrInstr;
+
+typedef struct IrBlock {
+  int id;
+  IrInstr *first, *last;        // the last one jumps, branches or returns
+  struct IrBlock **preds;
+  int predCount, predCapacity;
+  struct IrBlock *succs[2];
+  int succCount;
+  struct IrLoop *loop;          // innermost loop it belongs to
+  struct IrBlock *idom;         // set by the passes
+  int order;                    // reverse postorder, -1 when unreachable
+  IrInstr **defs;               // while it is built: each variable's value
+  int sealed;                   // all the predecessors are known
+} IrBlock;
+
+// A WHILE, FOR or REPEAT: the preheader only jumps to the header, so it
+// is where invariant code is moved to
+typedef struct IrLoop {
+  IrBlock *preheader, *header;
+  struct IrLoop *parent;
+} IrLoop;
+
+typedef struct {
+  Symbol *symbol;               // NULL for the program's body
+  int level;                    // scope level of its frame
+  int params, cells;            // frame cells, parameters first
+  IrBlock **blocks;             // blocks[0] is the entry
+  int blockCount, blockCapacity;
+  IrLoop **loops;               // inner loops before the loops holding them
+  int loopCount, loopCapacity;
+  int valueCount;               // ids given so far
+  int maxPhis;                  // most PHIs of one block, counted by the engine
+} IrFunction;
+
+typedef struct IrChunk {
+  struct IrChunk *next;
+  size_t used, size;
+} IrChunk;
+
+typedef struct {
+  IrFunction **functions;       // the program's body, then each routine at its symbol's offset
+  int count, capacity;
+  IrChunk *chunks;
+} IrProgram;
+
+// The functions of a checked program that did not fail; sets the offset
+// of every variable and parameter to its frame cell and of every routine
+// to its function
+void buildIr(CheckedProgram *program, IrProgram *ir);
+void freeIr(IrProgram *ir);
+void *irAlloc(IrProgram *ir, size_t size);
+// Instructions in the blocks of all the functions
+int countIr(IrProgram *ir);
+void printIr(IrProgram *ir, FILE *out);
+
+// Same contract as runBytecode(); executed, when not NULL, is set to the
+// instructions the run went through
+int runIr(IrProgram *ir, FILE *in, FILE *out, long *executed);
+
+#endif
@@ -0,0 +1,421 @@
+/* IR optimization */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "iropt.h"
+
+// A removed instruction keeps its place in the arena and points at what
+// replaces it, so its uses are rewritten once at the end of a pass.
+// Only the scalars of SSA are reasoned about: memory is left in order,
+// and an operation that may fail (a division by a value not known to be
+// non-zero, an index not known to be in range) is never removed or moved,
+// only merged into an equal one that runs before it.
+
+static IrInstr *resolve(IrInstr *instr) {
+  while (instr->replacement != NULL)
+    instr = instr->replacement;
+  return instr;
+}
+
+static void resolveArgs(IrFunction *f) {
+  IrInstr *instr;
+  int i, j;
+
+  for (i = 0; i < f->blockCount; i++)
+    for (instr = f->blocks[i]->first; instr != NULL; instr = instr->next)
+      for (j = 0; j < instr->argCount; j++)
+        instr->args[j] = resolve(instr->args[j]);
+}
+
+static void unlink(IrInstr *instr) {
+  IrBlock *block = instr->block;
+
+  if (instr->prev != NULL)
+    instr->prev->next = instr->next;
+  else block->first = instr->next;
+  if (instr->next != NULL)
+    instr->next->prev = instr->prev;
+  else block->last = instr->prev;
+  instr->prev = instr->next = NULL;
+}
+
+// Before the jump ending the block
+static void insertLast(IrBlock *block, IrInstr *instr) {
+  IrInstr *jump = block->last;
+
+  instr->block = block;
+  instr->prev = jump->prev;
+  instr->next = jump;
+  if (jump->prev != NULL)
+    jump->prev->next = instr;
+  else block->first = instr;
+  jump->prev = instr;
+}
+
+// Depends on its arguments only and does nothing else
+static int isPure(IrInstr *instr) {
+  switch (instr->op) {
+  case IR_CONST: case IR_STRING: case IR_PARAM: case IR_ADD: case IR_SUB: case IR_MUL:
+  case IR_DIV: case IR_MOD: case IR_POW: case IR_NEG: case IR_STRCMP: case IR_ADDR: case IR_INDEX:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+
+static int mayFail(IrInstr *instr) {
+  IrInstr *x = instr->argCount > 0 ? instr->args[0] : NULL, *y = instr->argCount > 1 ? instr->args[1] : NULL;
+
+  switch (instr->op) {
+  case IR_DIV:
+  case IR_MOD:
+    return y->op != IR_CONST || y->value == 0;
+  case IR_POW:
+    return !(y->op == IR_CONST && y->value >= 0) && !(x->op == IR_CONST && x->value != 0);
+  case IR_INDEX:
+    return y->op != IR_CONST || y->value < 1 || y->value > instr->value;
+  default:
+    return 0;
+  }
+}
+
+/******************************************************************/
+
+// Sets each block's reverse postorder number, -1 when unreachable, and
+// returns the reachable blocks in that order
+static int orderBlocks(IrFunction *f, IrBlock **rpo) {
+  IrBlock **stack = (IrBlock**)malloc(f->blockCount * sizeof(IrBlock*)), *block, *succ;
+  int *next = (int*)malloc(f->blockCount * sizeof(int));
+  int top = 0, count = 0, i;
+
+  for (i = 0; i < f->blockCount; i++)
+    f->blocks[i]->order = -1;
+  stack[0] = f->blocks[0];
+  next[0] = 0;
+  f->blocks[0]->order = -2;
+  while (top >= 0) {
+    block = stack[top];
+    if (next[top] < block->succCount) {
+      succ = block->succs[next[top]++];
+      if (succ->order == -1) {
+        succ->order = -2;
+        stack[++top] = succ;
+        next[top] = 0;
+      }
+    } else {
+      rpo[count++] = block;
+      top--;
+    }
+  }
+  for (i = 0; i < count / 2; i++) {
+    block = rpo[i];
+    rpo[i] = rpo[count - 1 - i];
+    rpo[count - 1 - i] = block;
+  }
+  for (i = 0; i < count; i++)
+    rpo[i]->order = i;
+  free(stack);
+  free(next);
+  return count;
+}
+
+static IrBlock *intersect(IrBlock *a, IrBlock *b) {
+  while (a != b) {
+    while (a->order > b->order)
+      a = a->idom;
+    while (b->order > a->order)
+      b = b->idom;
+  }
+  return a;
+}
+
+// Cooper, Harvey and Kennedy, "A Simple, Fast Dominance Algorithm"
+static void findDominators(IrBlock **rpo, int count) {
+  IrBlock *idom, *pred;
+  int changed = 1, i, j;
+
+  for (i = 0; i < count; i++)
+    rpo[i]->idom = NULL;
+  rpo[0]->idom = rpo[0];
+  while (changed) {
+    changed = 0;
+    for (i = 1; i < count; i++) {
+      idom = NULL;
+      for (j = 0; j < rpo[i]->predCount; j++) {
+        pred = rpo[i]->preds[j];
+        if (pred->order < 0 || pred->idom == NULL)
+          continue;
+        idom = idom == NULL ? pred : intersect(pred, idom);
+      }
+      if (rpo[i]->idom != idom) {
+        rpo[i]->idom = idom;
+        changed = 1;
+      }
+    }
+  }
+}
+
+/******************************************************************/
+
+// A COPY is its argument; a PHI whose arguments are one value besides
+// itself is that value
+static int propagateCopies(IrFunction *f) {
+  IrInstr *instr, *next, *same, *arg;
+  int removed = 0, changed = 1, trivial, i, j;
+
+  for (i = 0; i < f->blockCount; i++)
+    for (instr = f->blocks[i]->first; instr != NULL; instr = next) {
+      next = instr->next;
+      if (instr->op == IR_COPY) {
+        instr->replacement = resolve(instr->args[0]);
+        unlink(instr);
+        removed++;
+      }
+    }
+  while (changed) {
+    changed = 0;
+    for (i = 0; i < f->blockCount; i++)
+      for (instr = f->blocks[i]->first; instr != NULL && instr->op == IR_PHI; instr = next) {
+        next = instr->next;
+        same = NULL;
+        trivial = 1;
+        for (j = 0; j < instr->argCount && trivial; j++) {
+          arg = resolve(instr->args[j]);
+          if (arg == instr || arg == same)
+            continue;
+          trivial = same == NULL;
+          same = arg;
+        }
+        if (trivial && same != NULL) {
+          instr->replacement = same;
+          unlink(instr);
+          removed++;
+          changed = 1;
+        }
+      }
+  }
+  resolveArgs(f);
+  return removed;
+}
+
+// Common subexpressions: walking the dominator tree, an instruction equal
+// to one in a dominating block is replaced by it
+typedef struct {
+  IrInstr **heads, **chain;     // hash buckets, chained through the ids
+  int mask;
+  IrInstr **available;          // in the order they were added
+  int count;
+} ValueTable;
+
+static int commutes(IrOp op) {
+  return op == IR_ADD || op == IR_MUL;
+}
+
+static unsigned hashValue(IrInstr *instr) {
+  unsigned hash = instr->op * 31u + instr->value * 17u + instr->level;
+  int i;
+
+  for (i = 0; i < instr->argCount; i++)
+    hash += commutes(instr->op) ? instr->args[i]->id * 2654435761u : (hash << 5) + instr->args[i]->id;
+  return hash + (unsigned)(size_t)instr->text;
+}
+
+static int sameValue(IrInstr *a, IrInstr *b) {
+  int i;
+
+  if (a->op != b->op || a->value != b->value || a->level != b->level || a->text != b->text ||
+      a->argCount != b->argCount)
+    return 0;
+  if (commutes(a->op) && a->args[0] == b->args[1] && a->args[1] == b->args[0])
+    return 1;
+  for (i = 0; i < a->argCount; i++)
+    if (a->args[i] != b->args[i])
+      return 0;
+  return 1;
+}
+
+static int numberBlock(ValueTable *t, IrBlock *block) {
+  IrInstr *instr, *next, *other;
+  unsigned hash;
+  int removed = 0, i;
+
+  for (instr = block->first; instr != NULL; instr = next) {
+    next = instr->next;
+    for (i = 0; i < instr->argCount; i++)
+      instr->args[i] = resolve(instr->args[i]);
+    if (!isPure(instr))
+      continue;
+    hash = hashValue(instr) & t->mask;
+    for (other = t->heads[hash]; other != NULL && !sameValue(instr, other); other = t->chain[other->id])
+      ;
+    if (other != NULL) {
+      instr->replacement = other;
+      unlink(instr);
+      removed++;
+    } else {
+      t->chain[instr->id] = t->heads[hash];
+      t->heads[hash] = instr;
+      t->available[t->count++] = instr;
+    }
+  }
+  return removed;
+}
+
+static int eliminateCommon(IrFunction *f) {
+  IrBlock **rpo = (IrBlock**)malloc(f->blockCount * sizeof(IrBlock*));
+  IrBlock **stack = (IrBlock**)malloc(2 * f->blockCount * sizeof(IrBlock*)), *block;
+  int *saved = (int*)malloc(2 * f->blockCount * sizeof(int));
+  int count = orderBlocks(f, rpo), top = 0, removed = 0, size, i;
+  ValueTable t;
+  IrInstr *instr;
+
+  findDominators(rpo, count);
+  for (size = 16; size < 2 * f->valueCount; size *= 2)
+    ;
+  t.heads = (IrInstr**)calloc(size, sizeof(IrInstr*));
+  t.chain = (IrInstr**)calloc(f->valueCount, sizeof(IrInstr*));
+  t.available = (IrInstr**)malloc(f->valueCount * sizeof(IrInstr*));
+  t.mask = size - 1;
+  t.count = 0;
+
+  // Preorder: on leaving a block (saved >= 0) what it added goes away
+  stack[0] = rpo[0];
+  saved[0] = -1;
+  while (top >= 0) {
+    block = stack[top];
+    if (saved[top] >= 0) {
+      for (; t.count > saved[top]; t.count--) {
+        instr = t.available[t.count - 1];
+        t.heads[hashValue(instr) & t.mask] = t.chain[instr->id];
+      }
+      top--;
+      continue;
+    }
+    saved[top] = t.count;
+    removed += numberBlock(&t, block);
+    for (i = count - 1; i > 0; i--)
+      if (rpo[i]->idom == block) {
+        stack[++top] = rpo[i];
+        saved[top] = -1;
+      }
+  }
+  resolveArgs(f);
+  free(t.heads);
+  free(t.chain);
+  free(t.available);
+  free(rpo);
+  free(stack);
+  free(saved);
+  return removed;
+}
+
+static int inLoop(IrBlock *block, IrLoop *loop) {
+  IrLoop *l;
+
+  for (l = block->loop; l != NULL; l = l->parent)
+    if (l == loop)
+      return 1;
+  return 0;
+}
+
+// An instruction of a loop that cannot fail and whose arguments are
+// computed outside it moves to the preheader, inner loops first, so it
+// can then leave the loops around them too
+static int hoistInvariants(IrFunction *f) {
+  IrBlock **rpo = (IrBlock**)malloc(f->blockCount * sizeof(IrBlock*)), *block;
+  IrInstr *instr, *next;
+  IrLoop *loop;
+  int count = orderBlocks(f, rpo), moved = 0, changed, i, j, k;
+
+  for (i = 0; i < f->loopCount; i++) {
+    loop = f->loops[i];
+    if (loop->preheader->order < 0)
+      continue;
+    do {
+      changed = 0;
+      for (j = 0; j < count; j++) {
+        block = rpo[j];
+        if (!inLoop(block, loop))
+          continue;
+        for (instr = block->first; instr != NULL; instr = next) {
+          next = instr->next;
+          if (!isPure(instr) || mayFail(instr))
+            continue;
+          for (k = 0; k < instr->argCount && !inLoop(instr->args[k]->block, loop); k++)
+            ;
+          if (k < instr->argCount)
+            continue;
+          unlink(instr);
+          insertLast(loop->preheader, instr);
+          moved++;
+          changed = 1;
+        }
+      }
+    } while (changed);
+  }
+  free(rpo);
+  return moved;
+}
+
+// What the effects of the function need is kept, the rest removed
+static int eliminateDead(IrFunction *f) {
+  IrInstr **work = (IrInstr**)malloc(f->valueCount * sizeof(IrInstr*)), *instr, *next, *arg;
+  int count = 0, removed = 0, i, j;
+
+  for (i = 0; i < f->blockCount; i++)
+    for (instr = f->blocks[i]->first; instr != NULL; instr = instr->next) {
+      instr->mark = !isPure(instr) && instr->op != IR_PHI && instr->op != IR_LOAD && instr->op != IR_COPY;
+      instr->mark |= mayFail(instr);
+      if (instr->mark)
+        work[count++] = instr;
+    }
+  while (count > 0)
+    for (instr = work[--count], j = 0; j < instr->argCount; j++) {
+      arg = instr->args[j];
+      if (!arg->mark) {
+        arg->mark = 1;
+        work[count++] = arg;
+      }
+    }
+  for (i = 0; i < f->blockCount; i++)
+    for (instr = f->blocks[i]->first; instr != NULL; instr = next) {
+      next = instr->next;
+      if (!instr->mark) {
+        unlink(instr);
+        removed++;
+      }
+    }
+  free(work);
+  return removed;
+}
+
+/******************************************************************/
+
+void optimizeIr(IrProgram *ir, IrPassStats stats[IR_PASS_RUNS]) {
+  static struct {
+    char *name;
+    int (*run)(IrFunction *f);
+  } passes[IR_PASS_RUNS] = {
+    {"copies", propagateCopies},
+    {"cse", eliminateCommon},
+    {"copies", propagateCopies},
+    {"licm", hoistInvariants},
+    {"dce", eliminateDead}
+  };
+  double start;
+  int i, j;
+
+  for (i = 0; i < IR_PASS_RUNS; i++) {
+    stats[i].name = passes[i].name;
+    stats[i].before = countIr(ir);
+    stats[i].changed = 0;
+    start = statsClock();
+    for (j = 0; j < ir->count; j++)
+      stats[i].changed += passes[i].run(ir->functions[j]);
+    stats[i].seconds = statsClock() - start;
+    stats[i].after = countIr(ir);
+  }
+}
@@ -0,0 +1,23 @@
+/* IR optimization */
+
+#ifndef __IROPT_H__
+#define __IROPT_H__
+
+#include "ir.h"
+
+// Copy propagation, common subexpressions, copy propagation again (a
+// PHI whose arguments became one value), loop-invariant code motion and
+// dead code elimination
+#define IR_PASS_RUNS 5
+
+typedef struct {
+  char *name;
+  double seconds;
+  int before, after;    // instructions in the program
+  int changed;          // instructions the pass removed, or moved
+} IrPassStats;
+
+// Runs each pass over every function, in order
+void optimizeIr(IrProgram *ir, IrPassStats stats[IR_PASS_RUNS]);
+
+#endif
@@ -0,0 +1,248 @@
+/* IR interpreter */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <setjmp.h>
+
+#include "arith.h"
+#include "vm.h"
+#include "ir.h"
+
+// A function's frame holds its cells, then a register for each value
+// and room for the PHIs of a block to be read before any is written
+typedef struct {
+  IrProgram *ir;
+  Cell *globals, *sp, *limit;
+  int *sizes;                   // frame cells of each function
+  uintptr_t cLimit;
+  FILE *in, *out;
+  jmp_buf trap;
+  char *failure;
+  IrInstr *failedAt;
+  long executed;
+} Machine;
+
+static void fail(Machine *m, IrInstr *instr, char *message) {
+  m->failure = message;
+  m->failedAt = instr;
+  longjmp(m->trap, 1);
+}
+
+static int compare(int op, int64_t a, int64_t b) {
+  switch (op) {
+  case SB_EQ: return a == b;
+  case SB_NEQ: return a != b;
+  case SB_LT: return a < b;
+  case SB_LE: return a <= b;
+  case SB_GT: return a > b;
+  default: return a >= b;
+  }
+}
+
+static int predIndex(IrBlock *block, IrBlock *pred) {
+  int i;
+
+  for (i = 0; block->preds[i] != pred; i++)
+    ;
+  return i;
+}
+
+static void run(Machine *m, IrFunction *f, Cell *fp);
+
+// The frame is reserved after the arguments were computed, so calls
+// among them have returned
+static Cell call(Machine *m, IrInstr *instr, Cell *fp, Cell *values) {
+  IrFunction *f = m->ir->functions[instr->symbol->offset];
+  int size = m->sizes[instr->symbol->offset], hops, i;
+  Cell *frame = m->sp + IR_HEADER, *sp = m->sp, *link = fp;
+
+  if (m->limit - frame < size || (uintptr_t)&i < m->cLimit)
+    fail(m, instr, ERM_STACKOVERFLOW);
+  m->sp = frame + size;
+  for (i = 0; i < instr->argCount; i++)
+    frame[i] = values[instr->args[i]->id];
+  for (; i < f->cells; i++)
+    frame[i].i = 0;
+  for (hops = instr->level; hops > 0; hops--)
+    link = link[IR_LINK].p;
+  frame[IR_LINK].p = link;
+  frame[IR_RESULT].i = 0;
+  run(m, f, frame);
+  m->sp = sp;
+  return frame[IR_RESULT];
+}
+
+static void run(Machine *m, IrFunction *f, Cell *fp) {
+  Cell *values = fp + f->cells, *phis = values + f->valueCount, *frame, *x, *y;
+  IrBlock *block = f->blocks[0], *next;
+  IrInstr *instr;
+  int from = 0, count, hops, n;
+  int32_t a, b;
+  char *s, *t;
+
+  for (;;) {
+    // PHIs take the values of the edge taken, all at once
+    for (count = 0, instr = block->first; instr->op == IR_PHI; instr = instr->next)
+      phis[count++] = values[instr->args[from]->id];
+    for (count = 0, instr = block->first; instr->op == IR_PHI; instr = instr->next)
+      values[instr->id] = phis[count++];
+    m->executed += count;
+
+    for (;; instr = instr->next) {
+      m->executed++;
+      x = instr->argCount > 0 ? &values[instr->args[0]->id] : NULL;
+      y = instr->argCount > 1 ? &values[instr->args[1]->id] : NULL;
+      switch (instr->op) {
+      case IR_CONST:
+        values[instr->id].i = instr->value;
+        continue;
+      case IR_STRING:
+        values[instr->id].s = instr->text;
+        continue;
+      case IR_PARAM:
+        values[instr->id] = fp[instr->value];
+        continue;
+      case IR_COPY:
+        values[instr->id] = *x;
+        continue;
+      case IR_ADD:
+        values[instr->id].i = kplAdd(x->i, y->i);
+        continue;
+      case IR_SUB:
+        values[instr->id].i = kplSub(x->i, y->i);
+        continue;
+      case IR_MUL:
+        values[instr->id].i = kplMul(x->i, y->i);
+        continue;
+      case IR_DIV:
+      case IR_MOD:
+        a = x->i;
+        b = y->i;
+        if (b == 0)
+          fail(m, instr, ERM_DIVISIONBYZERO);
+        values[instr->id].i = instr->op == IR_DIV ? kplDiv(a, b) : kplMod(a, b);
+        continue;
+      case IR_POW:
+        a = x->i;
+        b = y->i;
+        if (kplPowFails(a, b))
+          fail(m, instr, ERM_DIVISIONBYZERO);
+        values[instr->id].i = kplPow(a, b);
+        continue;
+      case IR_NEG:
+        values[instr->id].i = kplNeg(x->i);
+        continue;
+      case IR_STRCMP:
+        s = x->s != NULL ? x->s : "";
+        t = y->s != NULL ? y->s : "";
+        n = strcmp(s, t);
+        values[instr->id].i = (n > 0) - (n < 0);
+        continue;
+      case IR_ADDR:
+        if (instr->level == 1)
+          frame = m->globals;
+        else for (frame = fp, hops = f->level - instr->level; hops > 0; hops--)
+          frame = frame[IR_LINK].p;
+        values[instr->id].p = frame + instr->value;
+        continue;
+      case IR_INDEX:
+        if (y->i < 1 || y->i > instr->value)
+          fail(m, instr, ERM_INDEXOUTOFRANGE);
+        values[instr->id].p = x->p + (y->i - 1) * instr->level;
+        continue;
+      case IR_LOAD:
+        values[instr->id] = *x->p;
+        continue;
+      case IR_STORE:
+        *x->p = *y;
+        continue;
+      case IR_CALL:
+        values[instr->id] = call(m, instr, fp, values);
+        continue;
+      case IR_READC:
+        if ((values[instr->id].i = getc(m->in)) == EOF)
+          fail(m, instr, ERM_ENDOFINPUT);
+        continue;
+      case IR_READI:
+        if (fscanf(m->in, "%d", &a) != 1)
+          fail(m, instr, ERM_ENDOFINPUT);
+        values[instr->id].i = a;
+        continue;
+      case IR_WRITEC:
+        putc((char)x->i, m->out);
+        continue;
+      case IR_WRITEI:
+        fprintf(m->out, "%d", (int32_t)x->i);
+        continue;
+      case IR_WRITELN:
+        putc('\n', m->out);
+        continue;
+      case IR_JUMP:
+        next = block->succs[0];
+        break;
+      case IR_BRANCH:
+        next = block->succs[compare(instr->value, x->i, y->i) ? 0 : 1];
+        break;
+      default:
+        if (x != NULL)
+          fp[IR_RESULT] = *x;
+        return;
+      }
+      break;
+    }
+    from = predIndex(next, block);
+    block = next;
+  }
+}
+
+static void sizeFrames(IrProgram *ir, int *sizes) {
+  IrFunction *f;
+  IrInstr *instr;
+  int i, j, count;
+
+  for (i = 0; i < ir->count; i++) {
+    f = ir->functions[i];
+    f->maxPhis = 0;
+    for (j = 0; j < f->blockCount; j++) {
+      for (count = 0, instr = f->blocks[j]->first; instr != NULL && instr->op == IR_PHI; instr = instr->next)
+        count++;
+      if (count > f->maxPhis)
+        f->maxPhis = count;
+    }
+    sizes[i] = f->cells + f->valueCount + f->maxPhis;
+  }
+}
+
+int runIr(IrProgram *ir, FILE *in, FILE *out, long *executed) {
+  int *sizes = (int*)malloc(ir->count * sizeof(int));
+  size_t cells;
+  Cell *stack;
+  Machine m;
+
+  sizeFrames(ir, sizes);
+  cells = IR_HEADER + sizes[0] + VM_STACK_CELLS;
+  stack = (Cell*)malloc(cells * sizeof(Cell));
+  // Calls clear their own frames
+  memset(stack, 0, (IR_HEADER + ir->functions[0]->cells) * sizeof(Cell));
+  m.ir = ir;
+  m.sizes = sizes;
+  m.globals = stack + IR_HEADER;
+  m.sp = m.globals + sizes[0];
+  m.limit = stack + cells;
+  m.in = in;
+  m.out = out;
+  m.failure = NULL;
+  m.executed = 0;
+  m.cLimit = (uintptr_t)&m - IR_C_STACK;
+  if (setjmp(m.trap) == 0)
+    run(&m, ir->functions[0], m.globals);
+  fflush(out);
+  if (m.failure != NULL)
+    fprintf(stderr, "%d-%d:%s\n", m.failedAt->lineNo, m.failedAt->colNo, m.failure);
+  if (executed != NULL)
+    *executed = m.executed;
+  free(stack);
+  free(sizes);
+  return m.failure != NULL;
+}
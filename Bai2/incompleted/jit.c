@@ -0,0 +1,578 @@
+/* Template JIT */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "arith.h"
+#include "stats.h"
+#include "jit.h"
+
+// Each instruction becomes a fixed x86-64 template; nothing is cached in
+// registers across instructions except the machine's own: rbx = sp,
+// r12 = fp, r13 = globals, r14 = the JitState, r15 = the table of native
+// addresses. So native code can be entered at any instruction and can
+// hand any instruction back to the interpreter, which makes a check that
+// fails (division by zero, index, stack) simply a return to the VM, which
+// executes the instruction again and reports the error as usual.
+
+void initJit(Jit *jit, Bytecode *bc, int threshold) {
+  memset(jit, 0, sizeof(Jit));
+  jit->threshold = threshold;
+  jit->counts = (int*)calloc(bc->count, sizeof(int));
+}
+
+void freeJit(Jit *jit) {
+  if (jit->code != NULL)
+    munmap(jit->code, jit->size);
+  free(jit->table);
+  free(jit->counts);
+  memset(jit, 0, sizeof(Jit));
+}
+
+#if defined(__x86_64__) && defined(__linux__)
+
+typedef struct {
+  int at;             // rel32 to patch
+  int target;         // pc of the target instruction
+  int exit;           // to a stub returning target to the interpreter
+} Fixup;
+
+typedef struct {
+  unsigned char *bytes;
+  int count, capacity;
+  int *labels;        // native offset of each instruction
+  Fixup *fixups;
+  int fixupCount, fixupCapacity;
+  int exit;           // offset of the common exit
+} Emitter;
+
+#define CODE(e, s) emitBytes(e, (unsigned char*)(s), sizeof(s) - 1)
+#define STATE(field) ((int)offsetof(JitState, field))
+
+static void emitBytes(Emitter *e, unsigned char *bytes, int n) {
+  if (e->count + n > e->capacity) {
+    e->capacity = e->capacity ? 2 * e->capacity : 4096;
+    e->bytes = (unsigned char*)realloc(e->bytes, e->capacity);
+  }
+  memcpy(e->bytes + e->count, bytes, n);
+  e->count += n;
+}
+
+static void emit8(Emitter *e, int value) {
+  unsigned char byte = (unsigned char)value;
+  emitBytes(e, &byte, 1);
+}
+
+static void emit32(Emitter *e, int32_t value) {
+  emitBytes(e, (unsigned char*)&value, 4);
+}
+
+static void emit64(Emitter *e, uint64_t value) {
+  emitBytes(e, (unsigned char*)&value, 8);
+}
+
+// A rel32 to the instruction at pc, or to a stub leaving to the VM there
+static void emitTarget(Emitter *e, int pc, int exit) {
+  if (e->fixupCount == e->fixupCapacity) {
+    e->fixupCapacity = e->fixupCapacity ? 2 * e->fixupCapacity : 64;
+    e->fixups = (Fixup*)realloc(e->fixups, e->fixupCapacity * sizeof(Fixup));
+  }
+  e->fixups[e->fixupCount].at = e->count;
+  e->fixups[e->fixupCount].target = pc;
+  e->fixups[e->fixupCount++].exit = exit;
+  emit32(e, 0);
+}
+
+static void emitExit(Emitter *e, int pc) {
+  CODE(e, "\xB8");                          // mov eax, pc
+  emit32(e, pc);
+  CODE(e, "\xE9");                          // jmp exit
+  emit32(e, e->exit - (e->count + 4));
+}
+
+static void emitCall(Emitter *e, void *function) {
+  CODE(e, "\x48\xB8");                      // mov rax, function
+  emit64(e, (uint64_t)(uintptr_t)function);
+  CODE(e, "\xFF\xD0");                      // call rax
+}
+
+// The int32 in eax, sign-extended, replaces the top of the stack
+static void emitResult(Emitter *e) {
+  CODE(e, "\x48\x63\xC0");                  // movsxd rax, eax
+  CODE(e, "\x48\x89\x43\xF8");              // mov [rbx-8], rax
+}
+
+// rax = the frame hops static links up
+static void emitOuter(Emitter *e, int hops) {
+  CODE(e, "\x4C\x89\xE0");                  // mov rax, r12
+  for (; hops > 0; hops--)
+    CODE(e, "\x48\x8B\x40\xE8");            // mov rax, [rax-24]
+}
+
+static void emitPush(Emitter *e) {
+  CODE(e, "\x48\x83\xC3\x08");              // add rbx, 8
+}
+
+static void emitPop(Emitter *e, int cells) {
+  CODE(e, "\x48\x83\xEB");                  // sub rbx, 8 * cells
+  emit8(e, 8 * cells);
+}
+
+static int32_t powHelper(int32_t a, int32_t b) {
+  return kplPow(a, b);
+}
+
+static int32_t strcmpHelper(char *a, char *b) {
+  int sign = strcmp(a != NULL ? a : "", b != NULL ? b : "");
+  return (sign > 0) - (sign < 0);
+}
+
+static void writeIHelper(JitState *state, int64_t value) {
+  fprintf(state->out, "%d", (int32_t)value);
+}
+
+static void writeCHelper(JitState *state, int64_t value) {
+  putc((char)value, state->out);
+}
+
+static void writeLnHelper(JitState *state) {
+  putc('\n', state->out);
+}
+
+static void emitDivide(Emitter *e, int pc, int remainder) {
+  CODE(e, "\x8B\x4B\xF8");                  // mov ecx, [rbx-8]
+  CODE(e, "\x85\xC9");                      // test ecx, ecx
+  CODE(e, "\x0F\x84");                      // jz exit
+  emitTarget(e, pc, 1);
+  CODE(e, "\x8B\x43\xF0");                  // mov eax, [rbx-16]
+  CODE(e, "\x83\xF9\xFF");                  // cmp ecx, -1
+  CODE(e, "\x75\x04");                      // jne divide
+  if (remainder) {
+    CODE(e, "\x31\xC0");                    // xor eax, eax
+    CODE(e, "\xEB\x05");                    // jmp done
+    CODE(e, "\x99\xF7\xF9\x89\xD0");        // divide: cdq; idiv ecx; mov eax, edx
+  } else {
+    CODE(e, "\xF7\xD8");                    // neg eax
+    CODE(e, "\xEB\x03");                    // jmp done
+    CODE(e, "\x99\xF7\xF9");                // divide: cdq; idiv ecx
+  }
+  emitPop(e, 1);                            // done:
+  emitResult(e);
+}
+
+// The bias a negative dividend needs before shifting right by k: ecx =
+// 2 ** k - 1 when eax < 0, else 0
+static void emitBias(Emitter *e, int k) {
+  CODE(e, "\x89\xC1");                      // mov ecx, eax
+  CODE(e, "\xC1\xF9\x1F");                  // sar ecx, 31
+  CODE(e, "\xC1\xE9");                      // shr ecx, 32 - k
+  emit8(e, 32 - k);
+}
+
+// SHL, DIV_SHIFT, MOD_MASK and POW_CONST by their operand n
+static void emitReduced(Emitter *e, OpCode op, int n) {
+  int bit;
+
+  CODE(e, "\x8B\x43\xF8");                  // mov eax, [rbx-8]
+  switch (op) {
+  case OP_SHL:
+    CODE(e, "\xC1\xE0");                    // shl eax, n
+    emit8(e, n);
+    break;
+  case OP_DIV_SHIFT:
+    if (n == 0)
+      break;
+    emitBias(e, n);
+    CODE(e, "\x01\xC8");                    // add eax, ecx
+    CODE(e, "\xC1\xF8");                    // sar eax, n
+    emit8(e, n);
+    break;
+  case OP_MOD_MASK:
+    if (n == 0) {
+      CODE(e, "\x31\xC0");                  // xor eax, eax
+      break;
+    }
+    emitBias(e, n);
+    CODE(e, "\x01\xC8");                    // add eax, ecx
+    CODE(e, "\x25");                        // and eax, 2 ** n - 1
+    emit32(e, (1 << n) - 1);
+    CODE(e, "\x29\xC8");                    // sub eax, ecx
+    break;
+  default:
+    if (n == 0) {
+      CODE(e, "\xB8");                      // mov eax, 1
+      emit32(e, 1);
+      break;
+    }
+    // Square and multiply, from the bit below the top one down
+    CODE(e, "\x89\xC1");                    // mov ecx, eax
+    for (bit = 30; !(n >> bit & 1); bit--)
+      ;
+    for (bit--; bit >= 0; bit--) {
+      CODE(e, "\x0F\xAF\xC0");              // imul eax, eax
+      if (n >> bit & 1)
+        CODE(e, "\x0F\xAF\xC1");            // imul eax, ecx
+    }
+    break;
+  }
+  emitResult(e);
+}
+
+static void emitEnter(Emitter *e, int pc, int params, int size, int depth) {
+  int i;
+
+  CODE(e, "\x49\x8D\x84\x24");              // lea rax, [r12 + 8 * (size + depth)]
+  emit32(e, 8 * (size + depth));
+  CODE(e, "\x49\x3B\x46");                  // cmp rax, [r14 + limit]
+  emit8(e, STATE(limit));
+  CODE(e, "\x0F\x87");                      // ja exit
+  emitTarget(e, pc, 1);
+  if (size - params <= 16)
+    for (i = params; i < size; i++) {
+      CODE(e, "\x49\xC7\x84\x24");          // mov qword [r12 + 8 * i], 0
+      emit32(e, 8 * i);
+      emit32(e, 0);
+    }
+  else {
+    CODE(e, "\x49\x8D\x9C\x24");            // lea rbx, [r12 + 8 * params]
+    emit32(e, 8 * params);
+    CODE(e, "\x49\x8D\x8C\x24");            // lea rcx, [r12 + 8 * size]
+    emit32(e, 8 * size);
+    CODE(e, "\x48\x39\xCB");                // next: cmp rbx, rcx
+    CODE(e, "\x73\x0D");                    // jae done
+    CODE(e, "\x48\xC7\x03\x00\x00\x00\x00"); // mov qword [rbx], 0
+    CODE(e, "\x48\x83\xC3\x08");            // add rbx, 8
+    CODE(e, "\xEB\xEE");                    // jmp next
+  }
+  CODE(e, "\x49\x8D\x9C\x24");              // done: lea rbx, [r12 + 8 * size]
+  emit32(e, 8 * size);
+}
+
+static void emitReturn(Emitter *e, int value) {
+  CODE(e, "\x4C\x89\xE0");                  // mov rax, r12
+  if (value)
+    CODE(e, "\x48\x8B\x50\xE0");            // mov rdx, [rax-32]
+  CODE(e, "\x48\x8D\x58\xE0");              // lea rbx, [rax-32]
+  if (value) {
+    CODE(e, "\x48\x89\x13");                // mov [rbx], rdx
+    emitPush(e);
+  }
+  CODE(e, "\x48\x8B\x48\xF8");              // mov rcx, [rax-8]
+  CODE(e, "\x4C\x8B\x60\xF0");              // mov r12, [rax-16]
+  CODE(e, "\x41\xFF\x24\xCF");              // jmp [r15 + 8 * rcx]
+}
+
+static void emitInstruction(Emitter *e, Bytecode *bc, int pc) {
+  int32_t *code = bc->code + pc;
+  int i;
+
+  switch ((OpCode)code[0]) {
+  case OP_PUSH:
+    CODE(e, "\x48\xC7\x03");                // mov qword [rbx], value
+    emit32(e, code[1]);
+    emitPush(e);
+    break;
+  case OP_PUSH_STR:
+    CODE(e, "\x48\xB8");                    // mov rax, string
+    emit64(e, (uint64_t)(uintptr_t)bc->strings[code[1]]);
+    CODE(e, "\x48\x89\x03");                // mov [rbx], rax
+    emitPush(e);
+    break;
+  case OP_POP:
+    emitPop(e, 1);
+    break;
+  case OP_LOAD_LOCAL:
+  case OP_LOAD_GLOBAL:
+    if (code[0] == OP_LOAD_LOCAL)
+      CODE(e, "\x49\x8B\x84\x24");          // mov rax, [r12 + offset]
+    else CODE(e, "\x49\x8B\x85");           // mov rax, [r13 + offset]
+    emit32(e, 8 * code[1]);
+    CODE(e, "\x48\x89\x03");                // mov [rbx], rax
+    emitPush(e);
+    break;
+  case OP_STORE_LOCAL:
+  case OP_STORE_GLOBAL:
+    emitPop(e, 1);
+    CODE(e, "\x48\x8B\x03");                // mov rax, [rbx]
+    if (code[0] == OP_STORE_LOCAL)
+      CODE(e, "\x49\x89\x84\x24");          // mov [r12 + offset], rax
+    else CODE(e, "\x49\x89\x85");           // mov [r13 + offset], rax
+    emit32(e, 8 * code[1]);
+    break;
+  case OP_ADDR_LOCAL:
+  case OP_ADDR_GLOBAL:
+    if (code[0] == OP_ADDR_LOCAL)
+      CODE(e, "\x49\x8D\x84\x24");          // lea rax, [r12 + offset]
+    else CODE(e, "\x49\x8D\x85");           // lea rax, [r13 + offset]
+    emit32(e, 8 * code[1]);
+    CODE(e, "\x48\x89\x03");                // mov [rbx], rax
+    emitPush(e);
+    break;
+  case OP_LOAD_OUTER:
+    emitOuter(e, code[1]);
+    CODE(e, "\x48\x8B\x88");                // mov rcx, [rax + offset]
+    emit32(e, 8 * code[2]);
+    CODE(e, "\x48\x89\x0B");                // mov [rbx], rcx
+    emitPush(e);
+    break;
+  case OP_STORE_OUTER:
+    emitOuter(e, code[1]);
+    emitPop(e, 1);
+    CODE(e, "\x48\x8B\x0B");                // mov rcx, [rbx]
+    CODE(e, "\x48\x89\x88");                // mov [rax + offset], rcx
+    emit32(e, 8 * code[2]);
+    break;
+  case OP_ADDR_OUTER:
+    emitOuter(e, code[1]);
+    CODE(e, "\x48\x8D\x88");                // lea rcx, [rax + offset]
+    emit32(e, 8 * code[2]);
+    CODE(e, "\x48\x89\x0B");                // mov [rbx], rcx
+    emitPush(e);
+    break;
+  case OP_LOAD_IND:
+    CODE(e, "\x48\x8B\x43\xF8");            // mov rax, [rbx-8]
+    CODE(e, "\x48\x8B\x00");                // mov rax, [rax]
+    CODE(e, "\x48\x89\x43\xF8");            // mov [rbx-8], rax
+    break;
+  case OP_STORE_IND:
+    emitPop(e, 2);
+    CODE(e, "\x48\x8B\x43\x08");            // mov rax, [rbx+8]
+    CODE(e, "\x48\x8B\x0B");                // mov rcx, [rbx]
+    CODE(e, "\x48\x89\x08");                // mov [rax], rcx
+    break;
+  case OP_INDEX:
+    CODE(e, "\x48\x8B\x43\xF8");            // mov rax, [rbx-8]
+    CODE(e, "\x48\x83\xE8\x01");            // sub rax, 1
+    CODE(e, "\x48\x3D");                    // cmp rax, length - 1
+    emit32(e, code[1] - 1);
+    CODE(e, "\x0F\x87");                    // ja exit (unsigned: below 1 too)
+    emitTarget(e, pc, 1);
+    CODE(e, "\x48\x69\xC0");                // imul rax, rax, 8 * cells
+    emit32(e, 8 * code[2]);
+    emitPop(e, 1);
+    CODE(e, "\x48\x01\x43\xF8");            // add [rbx-8], rax
+    break;
+  case OP_INC_LOCAL:
+  case OP_INC_GLOBAL:
+    if (code[0] == OP_INC_LOCAL)
+      CODE(e, "\x41\x8B\x84\x24");          // mov eax, [r12 + offset]
+    else CODE(e, "\x41\x8B\x85");           // mov eax, [r13 + offset]
+    emit32(e, 8 * code[1]);
+    CODE(e, "\x83\xC0\x01");                // add eax, 1
+    CODE(e, "\x48\x63\xC0");                // movsxd rax, eax
+    if (code[0] == OP_INC_LOCAL)
+      CODE(e, "\x49\x89\x84\x24");          // mov [r12 + offset], rax
+    else CODE(e, "\x49\x89\x85");           // mov [r13 + offset], rax
+    emit32(e, 8 * code[1]);
+    break;
+  case OP_ADD:
+  case OP_SUB:
+  case OP_MUL:
+    emitPop(e, 1);
+    CODE(e, "\x8B\x43\xF8");                // mov eax, [rbx-8]
+    if (code[0] == OP_ADD)
+      CODE(e, "\x03\x03");                  // add eax, [rbx]
+    else if (code[0] == OP_SUB)
+      CODE(e, "\x2B\x03");                  // sub eax, [rbx]
+    else CODE(e, "\x0F\xAF\x03");           // imul eax, [rbx]
+    emitResult(e);
+    break;
+  case OP_DIV:
+  case OP_MOD:
+    emitDivide(e, pc, code[0] == OP_MOD);
+    break;
+  case OP_POW:
+    CODE(e, "\x8B\x7B\xF0");                // mov edi, [rbx-16]
+    CODE(e, "\x8B\x73\xF8");                // mov esi, [rbx-8]
+    CODE(e, "\x85\xFF");                    // test edi, edi
+    CODE(e, "\x75\x08");                    // jnz power
+    CODE(e, "\x85\xF6");                    // test esi, esi
+    CODE(e, "\x0F\x88");                    // js exit: zero to a negative power
+    emitTarget(e, pc, 1);
+    emitCall(e, powHelper);                 // power:
+    emitPop(e, 1);
+    emitResult(e);
+    break;
+  case OP_NEG:
+    CODE(e, "\x8B\x43\xF8");                // mov eax, [rbx-8]
+    CODE(e, "\xF7\xD8");                    // neg eax
+    emitResult(e);
+    break;
+  case OP_SHL:
+  case OP_DIV_SHIFT:
+  case OP_MOD_MASK:
+  case OP_POW_CONST:
+    emitReduced(e, (OpCode)code[0], code[1]);
+    break;
+  case OP_STRCMP:
+    CODE(e, "\x48\x8B\x7B\xF0");            // mov rdi, [rbx-16]
+    CODE(e, "\x48\x8B\x73\xF8");            // mov rsi, [rbx-8]
+    emitCall(e, strcmpHelper);
+    emitPop(e, 1);
+    emitResult(e);
+    break;
+  case OP_JMP:
+    CODE(e, "\xE9");                        // jmp target
+    emitTarget(e, code[1], 0);
+    break;
+  case OP_JEQ: case OP_JNE: case OP_JLT: case OP_JLE: case OP_JGT: case OP_JGE:
+    emitPop(e, 2);
+    CODE(e, "\x48\x8B\x03");                // mov rax, [rbx]
+    CODE(e, "\x48\x3B\x43\x08");            // cmp rax, [rbx+8]
+    emit8(e, 0x0F);                         // jcc target
+    switch (code[0]) {
+    case OP_JEQ: emit8(e, 0x84); break;
+    case OP_JNE: emit8(e, 0x85); break;
+    case OP_JLT: emit8(e, 0x8C); break;
+    case OP_JLE: emit8(e, 0x8E); break;
+    case OP_JGT: emit8(e, 0x8F); break;
+    default: emit8(e, 0x8D); break;
+    }
+    emitTarget(e, code[1], 0);
+    break;
+  case OP_FRAME:
+    CODE(e, "\x48\xC7\x03\x00\x00\x00\x00"); // mov qword [rbx], 0
+    CODE(e, "\x48\x83\xC3\x20");            // add rbx, 32
+    break;
+  case OP_CALL:
+    CODE(e, "\x48\x8D\x83");                // lea rax, [rbx - 8 * argc]: the new fp
+    emit32(e, -8 * code[2]);
+    CODE(e, "\x4C\x89\xE1");                // mov rcx, r12
+    for (i = 0; i < code[3]; i++)
+      CODE(e, "\x48\x8B\x49\xE8");          // mov rcx, [rcx-24]
+    CODE(e, "\x48\x89\x48\xE8");            // mov [rax-24], rcx
+    CODE(e, "\x4C\x89\x60\xF0");            // mov [rax-16], r12
+    CODE(e, "\x48\xC7\x40\xF8");            // mov qword [rax-8], return pc
+    emit32(e, pc + 4);
+    CODE(e, "\x49\x89\xC4");                // mov r12, rax
+    CODE(e, "\xE9");                        // jmp entry
+    emitTarget(e, code[1], 0);
+    break;
+  case OP_ENTER:
+    emitEnter(e, pc, code[1], code[2], code[3]);
+    break;
+  case OP_RET:
+  case OP_RET_VALUE:
+    emitReturn(e, code[0] == OP_RET_VALUE);
+    break;
+  case OP_WRITEI:
+  case OP_WRITEC:
+    CODE(e, "\x4C\x89\xF7");                // mov rdi, r14
+    CODE(e, "\x48\x8B\x73\xF8");            // mov rsi, [rbx-8]
+    emitPop(e, 1);
+    emitCall(e, code[0] == OP_WRITEI ? (void*)writeIHelper : (void*)writeCHelper);
+    break;
+  case OP_WRITELN:
+    CODE(e, "\x4C\x89\xF7");                // mov rdi, r14
+    emitCall(e, writeLnHelper);
+    break;
+  default:
+    // HALT, READC and READI are left to the interpreter
+    emitExit(e, pc);
+    break;
+  }
+}
+
+static void emitProgram(Emitter *e, Bytecode *bc) {
+  Fixup *f;
+  int pc, i;
+
+  // Entry: jitEntry(state, address)
+  CODE(e, "\x53\x41\x54\x41\x55\x41\x56\x41\x57"); // push rbx, r12, r13, r14, r15
+  CODE(e, "\x49\x89\xFE");                  // mov r14, rdi
+  CODE(e, "\x49\x8B\x5E"); emit8(e, STATE(sp));       // mov rbx, [r14 + sp]
+  CODE(e, "\x4D\x8B\x66"); emit8(e, STATE(fp));       // mov r12, [r14 + fp]
+  CODE(e, "\x4D\x8B\x6E"); emit8(e, STATE(globals));  // mov r13, [r14 + globals]
+  CODE(e, "\x4D\x8B\x7E"); emit8(e, STATE(table));    // mov r15, [r14 + table]
+  CODE(e, "\xFF\xE6");                      // jmp rsi
+
+  // Exit, with the pc to resume at in eax
+  e->exit = e->count;
+  CODE(e, "\x49\x89\x5E"); emit8(e, STATE(sp));       // mov [r14 + sp], rbx
+  CODE(e, "\x4D\x89\x66"); emit8(e, STATE(fp));       // mov [r14 + fp], r12
+  CODE(e, "\x41\x5F\x41\x5E\x41\x5D\x41\x5C\x5B\xC3"); // pop r15, r14, r13, r12, rbx; ret
+
+  for (i = 0; i < bc->count; i++)
+    e->labels[i] = -1;
+  for (pc = 0; pc < bc->count; pc += 1 + opOperands(bc->code[pc])) {
+    e->labels[pc] = e->count;
+    emitInstruction(e, bc, pc);
+  }
+
+  // The stubs that give an instruction back to the interpreter
+  for (i = 0; i < e->fixupCount; i++) {
+    f = &e->fixups[i];
+    if (f->exit) {
+      *(int32_t*)(e->bytes + f->at) = e->count - (f->at + 4);
+      emitExit(e, f->target);
+    } else *(int32_t*)(e->bytes + f->at) = e->labels[f->target] - (f->at + 4);
+  }
+}
+
+static int compileJit(Jit *jit, Bytecode *bc) {
+  Emitter e;
+  double start = statsClock();
+  void *code;
+  int pc;
+
+  memset(&e, 0, sizeof(Emitter));
+  e.labels = (int*)malloc(bc->count * sizeof(int));
+  emitProgram(&e, bc);
+
+  // Written while writable, then made executable and read-only
+  code = mmap(NULL, e.count, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code != MAP_FAILED) {
+    memcpy(code, e.bytes, e.count);
+    if (mprotect(code, e.count, PROT_READ | PROT_EXEC) != 0) {
+      munmap(code, e.count);
+      code = MAP_FAILED;
+    }
+  }
+  if (code != MAP_FAILED) {
+    jit->code = (unsigned char*)code;
+    jit->size = e.count;
+    jit->table = (void**)calloc(bc->count, sizeof(void*));
+    for (pc = 0; pc < bc->count; pc++)
+      if (e.labels[pc] >= 0)
+        jit->table[pc] = jit->code + e.labels[pc];
+  }
+  free(e.bytes);
+  free(e.labels);
+  free(e.fixups);
+  jit->compileSeconds = statsClock() - start;
+  return code != MAP_FAILED;
+}
+
+int enterJit(Jit *jit, int pc, Cell **sp, Cell **fp, Cell *globals, Cell *limit, FILE *out) {
+  JitState state = {*sp, *fp, globals, jit->table, limit, out};
+  int (*entry)(JitState*, void*) = (int (*)(JitState*, void*))jit->code;
+
+  pc = entry(&state, jit->table[pc]);
+  *sp = state.sp;
+  *fp = state.fp;
+  return pc;
+}
+
+#else
+
+static int compileJit(Jit *jit, Bytecode *bc) {
+  return 0;
+}
+
+int enterJit(Jit *jit, int pc, Cell **sp, Cell **fp, Cell *globals, Cell *limit, FILE *out) {
+  return pc;
+}
+
+#endif
+
+int jitHot(Jit *jit, Bytecode *bc, int pc) {
+  if (jit->table != NULL)
+    return 1;
+  if (jit->failed || ++jit->counts[pc] < jit->threshold)
+    return 0;
+  if (!compileJit(jit, bc))
+    jit->failed = 1;
+  return !jit->failed;
+}
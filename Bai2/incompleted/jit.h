@@ -0,0 +1,41 @@
+/* Template JIT */
+
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <stdio.h>
+#include "bytecode.h"
+
+// Passes through a backward jump or a routine entry before the program
+// is compiled to native code
+#define JIT_THRESHOLD 100
+
+// The machine registers the native code loads on entry and stores back
+// when it leaves; the offsets are baked into the generated code
+typedef struct {
+  Cell *sp, *fp, *globals;
+  void **table;       // native address of each instruction
+  Cell *limit;
+  FILE *out;
+} JitState;
+
+typedef struct {
+  int threshold;
+  int *counts;        // passes through each hot point
+  int failed;         // not x86-64 Linux, or the code could not be mapped
+  unsigned char *code;
+  size_t size;
+  void **table;       // NULL until compiled
+  double compileSeconds;
+} Jit;
+
+void initJit(Jit *jit, Bytecode *bc, int threshold);
+void freeJit(Jit *jit);
+// Called by the VM at a hot point; compiles once the threshold is passed.
+// Returns whether native code can be entered.
+int jitHot(Jit *jit, Bytecode *bc, int pc);
+// Runs natively from pc until an instruction the templates leave to the
+// interpreter (input, HALT, or one about to fail); returns its pc
+int enterJit(Jit *jit, int pc, Cell **sp, Cell **fp, Cell *globals, Cell *limit, FILE *out);
+
+#endif
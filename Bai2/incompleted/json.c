@@ -0,0 +1,263 @@
+/* JSON reader */
+
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include "json.h"
+
+typedef struct {
+  char *p, *end;
+  jmp_buf fail;
+} JsonReader;
+
+static JsonValue *parseValue(JsonReader *r);
+
+static void skipSpace(JsonReader *r) {
+  while (r->p < r->end && (*r->p == ' ' || *r->p == '\t' || *r->p == '\n' || *r->p == '\r'))
+    r->p++;
+}
+
+static void expect(JsonReader *r, char c) {
+  skipSpace(r);
+  if (r->p >= r->end || *r->p != c)
+    longjmp(r->fail, 1);
+  r->p++;
+}
+
+static JsonValue *newValue(JsonType type) {
+  JsonValue *value = (JsonValue*)calloc(1, sizeof(JsonValue));
+  value->type = type;
+  return value;
+}
+
+static int hexDigit(JsonReader *r) {
+  char c;
+
+  if (r->p >= r->end)
+    longjmp(r->fail, 1);
+  c = *r->p++;
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  longjmp(r->fail, 1);
+}
+
+// Decodes into a fresh buffer; \u escapes become UTF-8
+static char *parseString(JsonReader *r, size_t *length) {
+  char *start, *close, *out, *s, *end = r->end;
+  unsigned code, low;
+  int i;
+
+  expect(r, '"');
+  start = r->p;
+  while (r->p < r->end && *r->p != '"') {
+    if (*r->p == '\\')
+      r->p++;
+    r->p++;
+  }
+  if (r->p >= r->end)
+    longjmp(r->fail, 1);
+  s = out = (char*)malloc(r->p - start + 1);
+  close = r->end = r->p;
+  r->p = start;
+  while (r->p < r->end) {
+    if (*r->p != '\\') {
+      *s++ = *r->p++;
+      continue;
+    }
+    r->p++;
+    switch (*r->p++) {
+    case 'n': *s++ = '\n'; break;
+    case 't': *s++ = '\t'; break;
+    case 'r': *s++ = '\r'; break;
+    case 'b': *s++ = '\b'; break;
+    case 'f': *s++ = '\f'; break;
+    case 'u':
+      for (code = 0, i = 0; i < 4; i++)
+        code = code * 16 + hexDigit(r);
+      if (code >= 0xd800 && code < 0xdc00 && r->p + 6 <= r->end && r->p[0] == '\\' && r->p[1] == 'u') {
+        r->p += 2;
+        for (low = 0, i = 0; i < 4; i++)
+          low = low * 16 + hexDigit(r);
+        code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+      }
+      if (code < 0x80)
+        *s++ = (char)code;
+      else if (code < 0x800) {
+        *s++ = (char)(0xc0 | code >> 6);
+        *s++ = (char)(0x80 | (code & 0x3f));
+      } else if (code < 0x10000) {
+        *s++ = (char)(0xe0 | code >> 12);
+        *s++ = (char)(0x80 | ((code >> 6) & 0x3f));
+        *s++ = (char)(0x80 | (code & 0x3f));
+      } else {
+        *s++ = (char)(0xf0 | code >> 18);
+        *s++ = (char)(0x80 | ((code >> 12) & 0x3f));
+        *s++ = (char)(0x80 | ((code >> 6) & 0x3f));
+        *s++ = (char)(0x80 | (code & 0x3f));
+      }
+      break;
+    default: *s++ = r->p[-1]; break;
+    }
+  }
+  *s = '\0';
+  *length = s - out;
+  r->end = end;
+  r->p = close + 1;
+  return out;
+}
+
+static JsonValue *parseValue(JsonReader *r) {
+  JsonValue *value, **tail;
+  char *end;
+
+  skipSpace(r);
+  if (r->p >= r->end)
+    longjmp(r->fail, 1);
+  switch (*r->p) {
+  case '{':
+    value = newValue(JSON_OBJECT);
+    r->p++;
+    tail = &value->child;
+    skipSpace(r);
+    if (r->p < r->end && *r->p == '}') {
+      r->p++;
+      return value;
+    }
+    do {
+      size_t length;
+      char *key = parseString(r, &length);
+      expect(r, ':');
+      *tail = parseValue(r);
+      (*tail)->key = key;
+      tail = &(*tail)->next;
+      skipSpace(r);
+    } while (r->p < r->end && *r->p == ',' && r->p++);
+    expect(r, '}');
+    return value;
+  case '[':
+    value = newValue(JSON_ARRAY);
+    r->p++;
+    tail = &value->child;
+    skipSpace(r);
+    if (r->p < r->end && *r->p == ']') {
+      r->p++;
+      return value;
+    }
+    do {
+      *tail = parseValue(r);
+      tail = &(*tail)->next;
+      skipSpace(r);
+    } while (r->p < r->end && *r->p == ',' && r->p++);
+    expect(r, ']');
+    return value;
+  case '"':
+    value = newValue(JSON_STRING);
+    value->string = parseString(r, &value->length);
+    return value;
+  case 't':
+  case 'f':
+  case 'n':
+    value = newValue(JSON_NULL);
+    if (r->end - r->p >= 4 && memcmp(r->p, "true", 4) == 0) {
+      value->type = JSON_TRUE;
+      r->p += 4;
+    } else if (r->end - r->p >= 5 && memcmp(r->p, "false", 5) == 0) {
+      value->type = JSON_FALSE;
+      r->p += 5;
+    } else if (r->end - r->p >= 4 && memcmp(r->p, "null", 4) == 0) {
+      value->type = JSON_NULL;
+      r->p += 4;
+    } else {
+      free(value);
+      longjmp(r->fail, 1);
+    }
+    return value;
+  default:
+    value = newValue(JSON_NUMBER);
+    value->number = strtod(r->p, &end);
+    if (end == r->p || end > r->end) {
+      free(value);
+      longjmp(r->fail, 1);
+    }
+    r->p = end;
+    return value;
+  }
+}
+
+// Values built before a syntax error are leaked; requests are small and
+// malformed ones rare
+JsonValue *parseJson(char *text, size_t length) {
+  JsonReader r;
+
+  r.p = text;
+  r.end = text + length;
+  if (setjmp(r.fail) != 0)
+    return NULL;
+  return parseValue(&r);
+}
+
+void freeJson(JsonValue *value) {
+  JsonValue *next;
+
+  while (value != NULL) {
+    next = value->next;
+    freeJson(value->child);
+    free(value->key);
+    free(value->string);
+    free(value);
+    value = next;
+  }
+}
+
+JsonValue *jsonGet(JsonValue *object, char *path) {
+  JsonValue *member;
+  size_t length;
+  char *dot;
+
+  while (object != NULL && *path != '\0') {
+    if (object->type != JSON_OBJECT)
+      return NULL;
+    dot = strchr(path, '.');
+    length = dot != NULL ? (size_t)(dot - path) : strlen(path);
+    for (member = object->child; member != NULL; member = member->next)
+      if (strlen(member->key) == length && memcmp(member->key, path, length) == 0)
+        break;
+    object = member;
+    path += length + (dot != NULL);
+  }
+  return object;
+}
+
+char *jsonString(JsonValue *object, char *path) {
+  JsonValue *value = jsonGet(object, path);
+  return value != NULL && value->type == JSON_STRING ? value->string : NULL;
+}
+
+long jsonInt(JsonValue *object, char *path, long missing) {
+  JsonValue *value = jsonGet(object, path);
+  return value != NULL && value->type == JSON_NUMBER ? (long)value->number : missing;
+}
+
+void writeJsonString(FILE *f, char *s, size_t length) {
+  size_t i;
+  unsigned char c;
+
+  putc('"', f);
+  for (i = 0; i < length; i++) {
+    c = (unsigned char)s[i];
+    switch (c) {
+    case '"': fputs("\\\"", f); break;
+    case '\\': fputs("\\\\", f); break;
+    case '\n': fputs("\\n", f); break;
+    case '\r': fputs("\\r", f); break;
+    case '\t': fputs("\\t", f); break;
+    default:
+      if (c < 0x20)
+        fprintf(f, "\\u%04x", c);
+      else putc(c, f);
+    }
+  }
+  putc('"', f);
+}
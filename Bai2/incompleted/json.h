@@ -0,0 +1,33 @@
+/* JSON reader */
+
+#ifndef __JSON_H__
+#define __JSON_H__
+
+#include <stdio.h>
+
+typedef enum {
+  JSON_NULL, JSON_FALSE, JSON_TRUE, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT
+} JsonType;
+
+typedef struct JsonValue {
+  JsonType type;
+  char *key;                   // member name inside an object
+  double number;
+  char *string;                // decoded, NUL terminated
+  size_t length;
+  struct JsonValue *child;     // first element or member
+  struct JsonValue *next;
+} JsonValue;
+
+// NULL on malformed input
+JsonValue *parseJson(char *text, size_t length);
+void freeJson(JsonValue *value);
+
+// Member lookup along a dotted path ("params.textDocument.uri"); NULL if absent
+JsonValue *jsonGet(JsonValue *object, char *path);
+char *jsonString(JsonValue *object, char *path);
+long jsonInt(JsonValue *object, char *path, long missing);
+
+void writeJsonString(FILE *f, char *s, size_t length);
+
+#endif
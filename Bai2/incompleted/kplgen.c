@@ -0,0 +1,497 @@
+/* Synthetic program generator */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "token.h"
+
+#define USE_REPEAT   0x01
+#define USE_PARALLEL 0x02
+#define USE_POWER    0x04
+#define USE_MOD      0x08
+#define USE_STRINGS  0x10
+#define USE_ALL      0x1f
+
+#define LOCAL_VARS 4
+
+typedef struct {
+  unsigned long long seed;
+  long long size;        // stop after this many bytes, 0: use subCount
+  int subCount;
+  int depth;             // nesting of compound statements
+  int exprDepth;         // nesting of parentheses, indexes and calls
+  int commentPct;        // statements preceded by a comment, in percent
+  int identLen;          // 1 .. MAX_IDENT_LEN
+  int statements;        // statements in a body
+  int features;
+} GenOptions;
+
+static GenOptions opt;
+static unsigned long long state;
+static long long written = 0;
+static FILE *out;
+static int procCount = 0;    // procedures emitted so far
+static int funcCount = 0;
+
+/******************************************************************/
+
+// xorshift64*: the same seed always gives the same program
+static unsigned long long nextRandom(void) {
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 2685821657736338717ULL;
+}
+
+static int randomInt(int n) {
+  return n > 0 ? (int)((nextRandom() >> 33) % n) : 0;
+}
+
+static int chance(int percent) {
+  return randomInt(100) < percent;
+}
+
+static void emit(char *format, ...) {
+  va_list args;
+  int n;
+
+  va_start(args, format);
+  n = vfprintf(out, format, args);
+  va_end(args);
+  if (n > 0) written += n;
+}
+
+static void indent(int level) {
+  emit("%*s", 2 * level, "");
+}
+
+/******************************************************************/
+
+// Identifiers are a prefix letter and a number, padded to identLen with letters.
+// A digit (or a single letter) can never spell a keyword. Names repeat when
+// identLen is too short for the number.
+static void emitName(char prefix, int number) {
+  static char letters[] = "abcdefghijklmnopqrstuvwxyz";
+  char name[MAX_IDENT_LEN + 16];
+  int length;
+
+  if (opt.identLen == 1) {
+    emit("%c", letters[number % 26]);
+    return;
+  }
+  length = sprintf(name, "%c%d", prefix, number);
+  if (length > opt.identLen) {
+    // The number does not fit: keep its last digits
+    memmove(name + 1, name + length - opt.identLen + 1, opt.identLen);
+    length = opt.identLen;
+  }
+  for (; length < opt.identLen; length++)
+    name[length] = letters[(number + length) % 26];
+  name[length] = '\0';
+  emit("%s", name);
+}
+
+static void emitVariable(void) {
+  emitName('v', randomInt(LOCAL_VARS));
+}
+
+static void emitCommentLine(int level) {
+  static char *words[] = {"check", "the", "bound", "loop", "index", "value", "sum", "result", "again"};
+  int i, n = 1 + randomInt(8), block = chance(50);
+
+  indent(level);
+  emit(block ? "(*" : "//");
+  for (i = 0; i < n; i++)
+    emit(" %s", words[randomInt(9)]);
+  emit(block ? " *)\n" : "\n");
+}
+
+static void emitExpression(int depth);
+
+// Simple factors (kinds 0 to 2) are the most common at every depth
+static void emitFactor(int depth) {
+  int kind = randomInt(depth > 0 ? 10 : 3);
+
+  if (kind >= 7)
+    kind -= 7;
+
+  switch (kind) {
+  case 0:
+    emit("%d", randomInt(1000));
+    break;
+  case 1:
+    emitVariable();
+    break;
+  case 2:
+    emitName('c', 0);
+    break;
+  case 3:
+    emit("(");
+    emitExpression(depth - 1);
+    emit(")");
+    break;
+  case 4:
+    emitName('a', 0);
+    emit("(. ");
+    emitExpression(depth - 1);
+    emit(" .)");
+    break;
+  case 5:
+    if (funcCount > 0) {
+      emitName('f', randomInt(funcCount));
+      emit("(");
+      emitExpression(depth - 1);
+      emit(")");
+    } else emitVariable();
+    break;
+  default:
+    if (opt.features & USE_POWER) {
+      emitVariable();
+      emit(" ** ");
+      emitFactor(depth - 1);
+    } else emit("%d", randomInt(10));
+    break;
+  }
+}
+
+static void emitTerm(int depth) {
+  static char *ops[] = {" * ", " / ", " % "};
+  int i, n = randomInt(3);
+
+  emitFactor(depth);
+  for (i = 0; i < n; i++) {
+    emit("%s", ops[randomInt(opt.features & USE_MOD ? 3 : 2)]);
+    emitFactor(depth);
+  }
+}
+
+static void emitExpression(int depth) {
+  int i, n = randomInt(3);
+
+  if (chance(10))
+    emit("-");
+  emitTerm(depth);
+  for (i = 0; i < n; i++) {
+    emit(chance(50) ? " + " : " - ");
+    emitTerm(depth);
+  }
+}
+
+static void emitCondition(void) {
+  static char *ops[] = {" = ", " != ", " < ", " <= ", " > ", " >= "};
+
+  emitExpression(opt.exprDepth);
+  emit("%s", ops[randomInt(6)]);
+  emitExpression(opt.exprDepth);
+}
+
+/******************************************************************/
+
+static void emitStatement(int level, int depth, int forced);
+
+// Statements ::= Statement { ; Statement }
+static void emitStatements(int level, int depth, int count, int forced) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (chance(opt.commentPct))
+      emitCommentLine(level);
+    emitStatement(level, depth, forced && i == 0);
+    emit(i + 1 < count ? ";\n" : "\n");
+  }
+}
+
+static void emitSimpleStatement(int level) {
+  int kind = randomInt(5);
+
+  indent(level);
+  switch (kind) {
+  case 0:
+    if (opt.features & USE_PARALLEL) {
+      emitName('v', 0);
+      emit(", ");
+      emitName('v', 1);
+      emit(" := ");
+      emitExpression(opt.exprDepth);
+      emit(", ");
+      emitExpression(opt.exprDepth);
+      break;
+    }
+    // fall through
+  case 1:
+    emitVariable();
+    emit(" := ");
+    emitExpression(opt.exprDepth);
+    break;
+  case 2:
+    emitName('a', 0);
+    emit("(. ");
+    emitExpression(opt.exprDepth);
+    emit(" .) := ");
+    emitExpression(opt.exprDepth);
+    break;
+  case 3:
+    if (opt.features & USE_STRINGS) {
+      emitName('s', 0);
+      emit(" := \"text %d\"", randomInt(100000));
+      break;
+    }
+    // fall through
+  default:
+    if (procCount > 0 && chance(50)) {
+      emit("CALL ");
+      emitName('p', randomInt(procCount));
+      emit("(");
+      emitVariable();
+      emit(", 'x')");
+    } else {
+      emit("CALL WRITEI(");
+      emitExpression(opt.exprDepth);
+      emit(")");
+    }
+    break;
+  }
+}
+
+// A compound statement nested depth levels below this one; a forced statement
+// always reaches the full depth so the requested nesting does occur
+static void emitStatement(int level, int depth, int forced) {
+  int kind;
+
+  if (depth <= 0 || !(forced || chance(30))) {
+    emitSimpleStatement(level);
+    return;
+  }
+
+  kind = randomInt(opt.features & USE_REPEAT ? 6 : 5);
+  indent(level);
+  switch (kind) {
+  case 0:
+    emit("BEGIN\n");
+    emitStatements(level + 1, depth - 1, 1 + randomInt(3), forced);
+    indent(level);
+    emit("END");
+    break;
+  case 1:
+    emit("IF ");
+    emitCondition();
+    emit(" THEN\n");
+    emitStatement(level + 1, depth - 1, forced);
+    if (chance(50)) {
+      emit("\n");
+      indent(level);
+      emit("ELSE\n");
+      emitStatement(level + 1, depth - 1, 0);
+    }
+    break;
+  case 2:
+    emit("WHILE ");
+    emitCondition();
+    emit(" DO\n");
+    emitStatement(level + 1, depth - 1, forced);
+    break;
+  case 3:
+    emit("FOR ");
+    emitVariable();
+    emit(" := ");
+    emitExpression(opt.exprDepth);
+    emit(" TO ");
+    emitExpression(opt.exprDepth);
+    emit(" DO\n");
+    emitStatement(level + 1, depth - 1, forced);
+    break;
+  case 4:
+    emit("IF ");
+    emitCondition();
+    emit(" THEN\n");
+    emitStatement(level + 1, depth - 1, forced);
+    break;
+  default:
+    emit("REPEAT\n");
+    emitStatements(level + 1, depth - 1, 1 + randomInt(3), forced);
+    indent(level);
+    emit("UNTIL ");
+    emitCondition();
+    break;
+  }
+}
+
+/******************************************************************/
+
+static void emitLocals(void) {
+  int i;
+
+  emit("VAR ");
+  for (i = 0; i < LOCAL_VARS; i++) {
+    if (i > 0) emit("    ");
+    emitName('v', i);
+    emit(" : INTEGER;\n");
+  }
+  emit("    ");
+  emitName('a', 0);
+  emit(" : ARRAY(. 100 .) OF INTEGER;\n");
+  if (opt.features & USE_STRINGS) {
+    emit("    ");
+    emitName('s', 0);
+    emit(" : STRING;\n    ");
+    emitName('b', 0);
+    emit(" : BYTES;\n");
+  }
+}
+
+static void emitBody(void) {
+  emit("BEGIN\n");
+  emitStatements(1, opt.depth, opt.statements, 1);
+  emit("END;\n\n");
+}
+
+// Every third subroutine is a function, the others are procedures
+static void emitSubroutine(int index) {
+  if (index % 3 == 2) {
+    emit("FUNCTION ");
+    emitName('f', funcCount);
+    emit("(");
+    emitName('v', LOCAL_VARS);
+    emit(" : INTEGER) : INTEGER;\n");
+    emitLocals();
+    emit("BEGIN\n");
+    emitStatements(1, opt.depth, opt.statements - 1, 1);
+    emit(";\n  ");
+    emitName('f', funcCount);
+    emit(" := ");
+    emitExpression(opt.exprDepth);
+    emit("\nEND;\n\n");
+    funcCount++;
+  } else {
+    emit("PROCEDURE ");
+    emitName('p', procCount);
+    emit("(VAR ");
+    emitName('v', LOCAL_VARS);
+    emit(" : INTEGER; ");
+    emitName('v', LOCAL_VARS + 1);
+    emit(" : CHAR);\n");
+    emitLocals();
+    emitBody();
+    procCount++;
+  }
+}
+
+static void generate(void) {
+  int i;
+
+  emit("PROGRAM ");
+  emitName('g', 0);
+  emit(";\n");
+  emit("(* Generated by kplgen, seed %llu *)\n", opt.seed);
+  emit("CONST ");
+  emitName('c', 0);
+  emit(" = %d;\n", randomInt(1000));
+  if (opt.features & USE_STRINGS) {
+    emit("      ");
+    emitName('c', 1);
+    emit(" = \"generated\";\n");
+  }
+  emit("TYPE ");
+  emitName('t', 0);
+  emit(" = ARRAY(. 10 .) OF INTEGER;\n");
+  emitLocals();
+  emit("\n");
+
+  for (i = 0; opt.size > 0 ? written < opt.size : i < opt.subCount; i++)
+    emitSubroutine(i);
+
+  emit("BEGIN\n");
+  emitStatements(1, opt.depth, opt.statements, 1);
+  emit("END.\n");
+}
+
+/******************************************************************/
+
+static long long parseSize(char *text) {
+  char *end;
+  double n = strtod(text, &end);
+
+  switch (*end) {
+  case 'k': case 'K': n *= 1024; break;
+  case 'm': case 'M': n *= 1024 * 1024; break;
+  case 'g': case 'G': n *= 1024.0 * 1024 * 1024; break;
+  }
+  return (long long)n;
+}
+
+static void usage(void) {
+  printf("usage: kplgen [options] > program.kpl\n"
+         "  --seed N          random seed (default 1)\n"
+         "  --size N[K|M|G]   emit subroutines until the program reaches N bytes\n"
+         "  --procs N         number of subroutines when no size is given (default 10)\n"
+         "  --depth N         nesting of compound statements (default 3)\n"
+         "  --expr-depth N    nesting of parentheses, indexes and calls (default 2)\n"
+         "  --comments PCT    statements preceded by a comment (default 10)\n"
+         "  --ident-len N     identifier length, 1 to %d (default 6)\n"
+         "  --statements N    statements per body (default 8)\n"
+         "  --no-repeat --no-parallel --no-power --no-mod --no-strings\n",
+         MAX_IDENT_LEN);
+}
+
+int main(int argc, char *argv[]) {
+  int i;
+
+  opt.seed = 1;
+  opt.size = 0;
+  opt.subCount = 10;
+  opt.depth = 3;
+  opt.exprDepth = 2;
+  opt.commentPct = 10;
+  opt.identLen = 6;
+  opt.statements = 8;
+  opt.features = USE_ALL;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc)
+      opt.seed = strtoull(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+      opt.size = parseSize(argv[++i]);
+    else if (strcmp(argv[i], "--procs") == 0 && i + 1 < argc)
+      opt.subCount = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+      opt.depth = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--expr-depth") == 0 && i + 1 < argc)
+      opt.exprDepth = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--comments") == 0 && i + 1 < argc)
+      opt.commentPct = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--ident-len") == 0 && i + 1 < argc)
+      opt.identLen = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--statements") == 0 && i + 1 < argc)
+      opt.statements = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--no-repeat") == 0)
+      opt.features &= ~USE_REPEAT;
+    else if (strcmp(argv[i], "--no-parallel") == 0)
+      opt.features &= ~USE_PARALLEL;
+    else if (strcmp(argv[i], "--no-power") == 0)
+      opt.features &= ~USE_POWER;
+    else if (strcmp(argv[i], "--no-mod") == 0)
+      opt.features &= ~USE_MOD;
+    else if (strcmp(argv[i], "--no-strings") == 0)
+      opt.features &= ~USE_STRINGS;
+    else {
+      usage();
+      return 2;
+    }
+  }
+
+  if (opt.identLen < 1) opt.identLen = 1;
+  if (opt.identLen > MAX_IDENT_LEN) opt.identLen = MAX_IDENT_LEN;
+  if (opt.statements < 2) opt.statements = 2;
+  if (opt.depth < 0) opt.depth = 0;
+  if (opt.exprDepth < 0) opt.exprDepth = 0;
+
+  // xorshift must not start from zero
+  state = opt.seed * 0x9E3779B97F4A7C15ULL + 1;
+  out = stdout;
+  setvbuf(out, NULL, _IOFBF, 1 << 20);
+  generate();
+  fflush(out);
+  return 0;
+}
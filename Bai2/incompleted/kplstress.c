@@ -0,0 +1,432 @@
+/* Pathological input suite */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define MAX_POINTS 32
+
+typedef void (*PatternFunc)(FILE *f, long n);
+
+typedef struct {
+  char *name;
+  PatternFunc func;
+  int nested;          // n is a nesting depth rather than a length
+} Pattern;
+
+typedef struct {
+  long n;
+  long bytes;
+  double seconds;      // user + system time of the parser
+  long rssKb;
+  int parsed;
+  int signal;
+} Point;
+
+static char *parserPath = "./parser";
+static char *parserArgs[16];
+static int parserArgCount = 0;
+static char workDir[] = "/tmp/kplstressXXXXXX";
+static long maxDepth = 8000;
+static long maxLength = 1 << 20;
+static int steps = 8;
+static double maxSlope = 1.3;
+static double minFitTime = 0.01;
+static int timeLimit = 60;
+static long stackKb = 0;
+static char *expected = "Program parsed!";
+
+/******************************************************************/
+
+static void repeat(FILE *f, char *text, long n) {
+  long i;
+  for (i = 0; i < n; i++)
+    fputs(text, f);
+}
+
+static void header(FILE *f) {
+  fputs("PROGRAM STRESS;\nVAR x : INTEGER;\n    s : STRING;\n    a : ARRAY(. 10 .) OF INTEGER;\nBEGIN\n", f);
+}
+
+static void parens(FILE *f, long n) {
+  header(f);
+  fputs("x := ", f);
+  repeat(f, "(", n);
+  fputs("1", f);
+  repeat(f, ")", n);
+  fputs("\nEND.\n", f);
+}
+
+static void powers(FILE *f, long n) {
+  header(f);
+  fputs("x := ", f);
+  repeat(f, "x ** ", n);
+  fputs("2\nEND.\n", f);
+}
+
+static void indexes(FILE *f, long n) {
+  header(f);
+  fputs("x := ", f);
+  repeat(f, "a(. ", n);
+  fputs("1", f);
+  repeat(f, " .)", n);
+  fputs("\nEND.\n", f);
+}
+
+static void begins(FILE *f, long n) {
+  header(f);
+  repeat(f, "BEGIN ", n);
+  fputs("x := 1", f);
+  repeat(f, " END", n);
+  fputs("\nEND.\n", f);
+}
+
+static void ifs(FILE *f, long n) {
+  header(f);
+  repeat(f, "IF x = 1 THEN\n", n);
+  fputs("x := 1\nEND.\n", f);
+}
+
+static void whiles(FILE *f, long n) {
+  header(f);
+  repeat(f, "WHILE x < 1 DO\n", n);
+  fputs("x := 1\nEND.\n", f);
+}
+
+static void repeats(FILE *f, long n) {
+  header(f);
+  repeat(f, "REPEAT ", n);
+  fputs("x := 1", f);
+  repeat(f, " UNTIL x = 1", n);
+  fputs("\nEND.\n", f);
+}
+
+static void procedures(FILE *f, long n) {
+  fputs("PROGRAM STRESS;\n", f);
+  repeat(f, "PROCEDURE P;\n", n);
+  fputs("BEGIN END;\n", f);
+  repeat(f, "BEGIN END;\n", n - 1);
+  fputs("BEGIN\nCALL P\nEND.\n", f);
+}
+
+static void arrays(FILE *f, long n) {
+  fputs("PROGRAM STRESS;\nTYPE T = ", f);
+  repeat(f, "ARRAY(. 2 .) OF ", n);
+  fputs("INTEGER;\nBEGIN\nCALL WRITELN\nEND.\n", f);
+}
+
+static void sums(FILE *f, long n) {
+  header(f);
+  fputs("x := 1", f);
+  repeat(f, " + 1", n);
+  fputs("\nEND.\n", f);
+}
+
+static void products(FILE *f, long n) {
+  header(f);
+  fputs("x := 1", f);
+  repeat(f, " * 1", n);
+  fputs("\nEND.\n", f);
+}
+
+static void statements(FILE *f, long n) {
+  header(f);
+  repeat(f, "x := 1;\n", n);
+  fputs("x := 1\nEND.\n", f);
+}
+
+static void operands(FILE *f, long n) {
+  header(f);
+  fputs("CALL WRITEI(1", f);
+  repeat(f, ", x + 1", n);
+  fputs(")\nEND.\n", f);
+}
+
+static void arguments(FILE *f, long n) {
+  header(f);
+  fputs("CALL WRITEI(1", f);
+  repeat(f, ", 1", n);
+  fputs(")\nEND.\n", f);
+}
+
+static void declarations(FILE *f, long n) {
+  long i;
+
+  fputs("PROGRAM STRESS;\nVAR x : INTEGER;\n", f);
+  for (i = 0; i < n; i++)
+    fprintf(f, "    x%ld : INTEGER;\n", i);
+  fputs("BEGIN\nx := 1\nEND.\n", f);
+}
+
+static void comment(FILE *f, long n) {
+  header(f);
+  fputs("(*", f);
+  repeat(f, " a long comment (without end) * ) ( * ** ((((((((((((((((((((((\n", n);
+  fputs("*)\nx := 1\nEND.\n", f);
+}
+
+static void string(FILE *f, long n) {
+  header(f);
+  fputs("s := \"", f);
+  repeat(f, "a megabyte string a megabyte string a megabyte string a megabyte ", n);
+  fputs("\"\nEND.\n", f);
+}
+
+static Pattern patterns[] = {
+  {"parens", parens, 1},
+  {"powers", powers, 1},
+  {"indexes", indexes, 1},
+  {"begins", begins, 1},
+  {"ifs", ifs, 1},
+  {"whiles", whiles, 1},
+  {"repeats", repeats, 1},
+  {"procedures", procedures, 1},
+  {"arrays", arrays, 1},
+  {"sums", sums, 0},
+  {"products", products, 0},
+  {"statements", statements, 0},
+  {"arguments", arguments, 0},
+  {"operands", operands, 0},
+  {"declarations", declarations, 0},
+  {"comment", comment, 0},
+  {"string", string, 0},
+  {NULL, NULL, 0}
+};
+
+/******************************************************************/
+
+// A successful parse ends with the expected line; an empty one means no output at all
+static int endsWithExpected(char *fileName) {
+  char tail[256], buffer[256];
+  long length;
+  FILE *f = fopen(fileName, "rb");
+  int ok = 0;
+
+  if (f == NULL)
+    return 0;
+  if (expected[0] == '\0') {
+    fseek(f, 0, SEEK_END);
+    ok = ftell(f) == 0;
+  } else {
+    length = snprintf(tail, sizeof(tail), "%s\n", expected);
+    if (fseek(f, -length, SEEK_END) == 0 && fread(buffer, 1, length, f) == (size_t)length)
+      ok = memcmp(buffer, tail, length) == 0;
+  }
+  fclose(f);
+  return ok;
+}
+
+static void runParser(Pattern *pattern, long n, Point *point) {
+  char source[64], output[64];
+  char *argv[20];
+  struct rusage usage;
+  struct rlimit limit;
+  FILE *f;
+  pid_t pid;
+  int status, i, argc = 0, fd;
+
+  sprintf(source, "%s/input.kpl", workDir);
+  sprintf(output, "%s/output.txt", workDir);
+  f = fopen(source, "w");
+  pattern->func(f, n);
+  point->n = n;
+  point->bytes = ftell(f);
+  fclose(f);
+
+  argv[argc++] = parserPath;
+  for (i = 0; i < parserArgCount; i++)
+    argv[argc++] = parserArgs[i];
+  argv[argc++] = source;
+  argv[argc] = NULL;
+
+  fflush(stdout);
+  pid = fork();
+  if (pid == 0) {
+    // Statistics some modes print on stderr are not part of the result
+    fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, 1);
+    close(fd);
+    fd = open("/dev/null", O_WRONLY);
+    dup2(fd, 2);
+    close(fd);
+    // A runaway parse is stopped by SIGXCPU
+    limit.rlim_cur = timeLimit;
+    limit.rlim_max = timeLimit + 1;
+    setrlimit(RLIMIT_CPU, &limit);
+    if (stackKb > 0) {
+      limit.rlim_cur = limit.rlim_max = stackKb * 1024;
+      setrlimit(RLIMIT_STACK, &limit);
+    }
+    execv(parserPath, argv);
+    _exit(127);
+  }
+  wait4(pid, &status, 0, &usage);
+
+  point->seconds = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+                   usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+  point->rssKb = usage.ru_maxrss;
+  point->signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+  point->parsed = point->signal == 0 && endsWithExpected(output);
+}
+
+// Least squares slope of log(y) against log(x); y = c * x^slope
+static double fitSlope(double *x, double *y, int count) {
+  double sx = 0, sy = 0, sxx = 0, sxy = 0, lx, ly;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    lx = log(x[i]);
+    ly = log(y[i]);
+    sx += lx;
+    sy += ly;
+    sxx += lx * lx;
+    sxy += lx * ly;
+  }
+  return (count * sxy - sx * sy) / (count * sxx - sx * sx);
+}
+
+// Scale the pattern geometrically up to its limit, then check the curves.
+// Returns the number of failures.
+static int runPattern(Pattern *pattern) {
+  Point points[MAX_POINTS], probe;
+  double x[MAX_POINTS], y[MAX_POINTS];
+  long limit = pattern->nested ? maxDepth : maxLength, n, baseRss;
+  int count = 0, fitted, failures = 0, i;
+  double slope;
+
+  for (i = steps - 1; i >= 0 && count < MAX_POINTS; i--) {
+    n = limit >> i;
+    if (n < 1) continue;
+    runParser(pattern, n, &points[count]);
+    printf("%-13s %9ld %11ld %10.1f %9ld  %s\n", pattern->name, n, points[count].bytes,
+           points[count].seconds * 1e3, points[count].rssKb,
+           points[count].signal ? strsignal(points[count].signal) :
+           points[count].parsed ? "parsed" : "rejected");
+    if (!points[count].parsed) {
+      printf("%-13s FAIL: not parsed at %s %ld\n", pattern->name,
+             pattern->nested ? "depth" : "length", n);
+      failures++;
+    }
+    count++;
+    if (points[count - 1].signal)
+      break;
+  }
+
+  // Time, on the points long enough to measure
+  for (i = fitted = 0; i < count; i++)
+    if (points[i].seconds >= minFitTime && !points[i].signal) {
+      x[fitted] = points[i].n;
+      y[fitted++] = points[i].seconds;
+    }
+  if (fitted >= 3) {
+    slope = fitSlope(x, y, fitted);
+    printf("%-13s time ~ n^%.2f", pattern->name, slope);
+    if (slope > maxSlope) {
+      printf("  FAIL: super-linear");
+      failures++;
+    }
+    printf("\n");
+  } else printf("%-13s time too short to fit\n", pattern->name);
+
+  // Peak memory above the smallest run, on the points that grew by 1 MB or more
+  baseRss = points[0].rssKb;
+  for (i = fitted = 0; i < count; i++)
+    if (points[i].rssKb - baseRss >= 1024 && !points[i].signal) {
+      x[fitted] = points[i].n;
+      y[fitted++] = points[i].rssKb - baseRss;
+    }
+  if (fitted >= 3) {
+    slope = fitSlope(x, y, fitted);
+    printf("%-13s rss  ~ n^%.2f", pattern->name, slope);
+    if (slope > maxSlope) {
+      printf("  FAIL: super-linear");
+      failures++;
+    }
+    printf("\n");
+  }
+
+  // Beyond the supported depth the parser must reject the input, not crash
+  if (pattern->nested) {
+    runParser(pattern, maxDepth * 4, &probe);
+    if (probe.signal) {
+      printf("%-13s FAIL: %s at depth %ld\n", pattern->name, strsignal(probe.signal), probe.n);
+      failures++;
+    } else printf("%-13s depth %ld %s\n", pattern->name, probe.n,
+                  probe.parsed ? "parsed" : "rejected cleanly");
+  }
+  return failures;
+}
+
+static void usage(void) {
+  printf("usage: kplstress [options] [pattern...]\n"
+         "  --parser PATH     parser to run (default ./parser)\n"
+         "  --arg ARG         extra parser argument, may be repeated\n"
+         "  --depth N         nesting every nested pattern must reach (default %ld)\n"
+         "  --length N        largest length pattern (default %ld)\n"
+         "  --steps N         sizes per pattern, each twice the previous (default %d)\n"
+         "  --max-slope X     fail when time or memory grows faster than n^X (default %.1f)\n"
+         "  --stack KB        stack limit of the parser\n"
+         "  --expect LINE     last output line of a successful parse, empty for no output\n"
+         "  --timeout SEC     CPU time limit of one run (default %d)\n",
+         maxDepth, maxLength, steps, maxSlope, timeLimit);
+}
+
+int main(int argc, char *argv[]) {
+  char *selected[32];
+  int selectedCount = 0, failures = 0, i, j;
+  char command[64];
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--parser") == 0 && i + 1 < argc)
+      parserPath = argv[++i];
+    else if (strcmp(argv[i], "--arg") == 0 && i + 1 < argc && parserArgCount < 16)
+      parserArgs[parserArgCount++] = argv[++i];
+    else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc)
+      maxDepth = atol(argv[++i]);
+    else if (strcmp(argv[i], "--length") == 0 && i + 1 < argc)
+      maxLength = atol(argv[++i]);
+    else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+      steps = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--max-slope") == 0 && i + 1 < argc)
+      maxSlope = atof(argv[++i]);
+    else if (strcmp(argv[i], "--stack") == 0 && i + 1 < argc)
+      stackKb = atol(argv[++i]);
+    else if (strcmp(argv[i], "--expect") == 0 && i + 1 < argc)
+      expected = argv[++i];
+    else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+      timeLimit = atoi(argv[++i]);
+    else if (argv[i][0] != '-' && selectedCount < 32)
+      selected[selectedCount++] = argv[i];
+    else {
+      usage();
+      return 2;
+    }
+  }
+
+  if (mkdtemp(workDir) == NULL) {
+    perror("kplstress");
+    return 2;
+  }
+
+  printf("%-13s %9s %11s %10s %9s  %s\n", "pattern", "n", "bytes", "cpu ms", "rss KB", "result");
+  for (i = 0; patterns[i].name != NULL; i++) {
+    for (j = 0; j < selectedCount && strcmp(selected[j], patterns[i].name) != 0; j++)
+      ;
+    if (selectedCount > 0 && j == selectedCount)
+      continue;
+    failures += runPattern(&patterns[i]);
+  }
+
+  sprintf(command, "rm -rf %s", workDir);
+  if (system(command) != 0)
+    fprintf(stderr, "kplstress: can\'t remove %s\n", workDir);
+  printf("%d failures\n", failures);
+  return failures > 0;
+}
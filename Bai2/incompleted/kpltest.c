@@ -0,0 +1,1135 @@
+/* Golden test runner */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "reader.h"
+#include "parser.h"
+#include "error.h"
+#include "typecheck.h"
+#include "incremental.h"
+#include "treefile.h"
+#include "workpool.h"
+#include "stats.h"
+
+#define DEFAULT_TEST_DIR "../test"
+#define DEFAULT_CHECK_DIR "../test/check"
+#define DEFAULT_RUN_DIR "../test/run"
+#define DEFAULT_INCREMENTAL_DIR "../test/incremental"
+#define CONTEXT_LINES 3
+#define MAX_DIFF_EDITS 4000   // larger differences are not worth showing line by line
+#define RUN_TIME_LIMIT 20     // CPU seconds of one engine run or build
+#define REPLY_TIMEOUT 10000   // ms to wait for the server or a language server reply
+
+// The directory a program is found in says what is checked of it: the
+// token trace of the parser, the diagnostics of --check (check/), what
+// it prints when run (run/) or the traces of NAME.kpl, NAME.kpl.2,
+// NAME.kpl.3... parsed in turn as versions of one file (incremental/).
+typedef enum {
+  MODE_PARSE,
+  MODE_CHECK,
+  MODE_RUN,
+  MODE_INCREMENTAL
+} TestMode;
+
+// How a variant gets the output of a program
+typedef enum {
+  VIA_LIBRARY,          // compile() in this process
+  VIA_PARSER,           // parser with the options, stdout only
+  VIA_RUN,              // parser run with the options: stdout, stderr and exit status
+  VIA_BUILD,            // parser build, then the binary it made
+  VIA_INCREMENTAL,      // compileIncremental() on a fresh state
+  VIA_UNCHANGED,        // compileIncremental() again, which must reuse every subroutine
+  VIA_BODY,             // parser --body on the first subroutine, against its lines of the trace
+  VIA_CLIENT,           // kplclient to the parser --serve this runner started
+  VIA_CACHE_MISS,       // parser --cache --dump-tree on an empty cache
+  VIA_CACHE_HIT,        // the same on the cache the first run filled
+  VIA_CACHE_CORRUPTED,  // the same after the nodes of the cached tree were overwritten
+  VIA_LSP               // parser --lsp opening the program, then its semantic tokens
+} Via;
+
+// Every program of ../test is run each of these ways and every program of
+// run/ under each engine. Variants that print the same thing share its
+// golden; the one that writes it with --update comes first.
+typedef struct {
+  char *name;
+  Via via;
+  char *options;
+  char *golden;         // resultN.txt, outlineN.txt, treeN.txt...; NULL for NAME.txt
+  int writes;
+} Variant;
+
+static Variant parseVariants[] = {
+  {"parser output", VIA_LIBRARY, NULL, "result", 1},
+  {"--parallel --jobs 4", VIA_PARSER, "--parallel --jobs 4", "result", 0},
+  {"--pipeline", VIA_PARSER, "--pipeline", "result", 0},
+  {"--incremental", VIA_INCREMENTAL, NULL, "result", 0},
+  {"--incremental, unchanged", VIA_UNCHANGED, NULL, "result", 0},
+  {"--body", VIA_BODY, NULL, "result", 0},
+  {"kplclient", VIA_CLIENT, NULL, "result", 0},
+  {"--outline", VIA_PARSER, "--outline", "outline", 1},
+  {"--cache, miss", VIA_CACHE_MISS, NULL, "tree", 1},
+  {"--cache, hit", VIA_CACHE_HIT, NULL, "tree", 0},
+  {"--cache, corrupted", VIA_CACHE_CORRUPTED, NULL, "tree", 0},
+  {"--lsp", VIA_LSP, NULL, "lsp", 1}
+};
+
+static Variant runVariants[] = {
+  {"bytecode", VIA_RUN, "", NULL, 1},
+  {"bytecode --no-fold --no-reduce", VIA_RUN, "--no-fold --no-reduce", NULL, 0},
+  {"closure", VIA_RUN, "--engine closure", NULL, 0},
+  {"closure --simd scalar", VIA_RUN, "--engine closure --simd scalar", NULL, 0},
+  {"closure --no-vector", VIA_RUN, "--engine closure --no-vector", NULL, 0},
+  {"jit", VIA_RUN, "--engine jit --jit-threshold 1", NULL, 0},
+  {"ir", VIA_RUN, "--engine ir", NULL, 0},
+  {"ir --no-ir-opt", VIA_RUN, "--engine ir --no-ir-opt", NULL, 0},
+  {"build", VIA_BUILD, NULL, NULL, 0}
+};
+
+#define PARSE_VARIANT_COUNT ((int)(sizeof(parseVariants) / sizeof(parseVariants[0])))
+#define RUN_VARIANT_COUNT ((int)(sizeof(runVariants) / sizeof(runVariants[0])))
+
+typedef struct {
+  char *source;         // the program
+  TestMode mode;
+  Variant *variant;     // how it is run in ../test and run/
+  char *input;          // its stdin in run/, NAME.in or /dev/null
+  char *bodyName;       // the subroutine of --body
+  char *expected;       // its golden output
+  char *expectedText;
+  size_t expectedLength;
+  int hasExpected;
+  char *actual;         // what the parser printed
+  size_t actualLength;
+  char *report;         // unified diff or error, printed in order at the end
+  size_t reportLength;
+  int passed, updated;
+} TestCase;
+
+typedef struct {
+  TestCase *cases;
+  int count, capacity;
+  int update;
+  int pass;             // with --update, the variants that write go before the others compare
+  char *parserPath;
+  char *clientPath;
+  char workDir[32];
+  char socketPath[48];  // of the server kplclient talks to
+} TestRun;
+
+typedef struct {
+  char *text;
+  size_t length;
+} Line;
+
+typedef struct {
+  Line *lines;
+  int count;
+} Lines;
+
+typedef struct {
+  char op;              // ' ', '-' or '+'
+  int a, b;             // line indexes in the expected and actual output
+} Edit;
+
+/******************************************************************/
+
+static char *readWholeFile(char *fileName, size_t *length) {
+  FILE *f = fopen(fileName, "rb");
+  char *text;
+  long size;
+
+  if (f == NULL)
+    return NULL;
+  fseek(f, 0, SEEK_END);
+  size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  text = (char*)malloc(size + 1);
+  *length = fread(text, 1, size, f);
+  text[*length] = '\0';
+  fclose(f);
+  return text;
+}
+
+// exampleN.kpl is checked against resultN.txt, any other NAME.kpl against
+// NAME.txt; the other goldens of a variant are outlineN.txt or
+// NAME.outline.txt and so on. run/NAME.kpl reads NAME.in
+static char *siblingName(char *source, char *golden, char *extension) {
+  char *slash = strrchr(source, '/');
+  char *base = slash != NULL ? slash + 1 : source;
+  size_t dirLength = base - source;
+  size_t baseLength = strlen(base) - (strlen(base) > 4 ? 4 : 0);
+  char *name;
+
+  if (golden == NULL)
+    golden = "result";
+  name = (char*)malloc(dirLength + baseLength + strlen(golden) + 16);
+  memcpy(name, source, dirLength);
+  if (strncmp(base, "example", 7) == 0 && strcmp(extension, ".txt") == 0)
+    sprintf(name + dirLength, "%s%.*s.txt", golden, (int)(baseLength - 7), base + 7);
+  else if (strcmp(golden, "result") != 0)
+    sprintf(name + dirLength, "%.*s.%s%s", (int)baseLength, base, golden, extension);
+  else sprintf(name + dirLength, "%.*s%s", (int)baseLength, base, extension);
+  return name;
+}
+
+// The first subroutine a trace declares, NULL when it has none
+static char *firstSubroutine(char *expected) {
+  size_t length;
+  char *text = readWholeFile(expected, &length);
+  char *procedure, *function, *line, *colon, *name = NULL;
+
+  if (text == NULL)
+    return NULL;
+  procedure = strstr(text, ":KW_PROCEDURE\n");
+  function = strstr(text, ":KW_FUNCTION\n");
+  line = procedure == NULL || (function != NULL && function < procedure) ? function : procedure;
+  if (line != NULL && (line = strchr(line, '\n')) != NULL &&
+      (colon = strchr(line, ':')) != NULL && strncmp(colon, ":TK_IDENT(", 10) == 0)
+    name = strndup(colon + 10, strcspn(colon + 10, ")\n"));
+  free(text);
+  return name;
+}
+
+static TestMode modeOf(char *source) {
+  char *slash = strrchr(source, '/');
+  char *dir = slash;
+
+  if (slash == NULL)
+    return MODE_PARSE;
+  while (dir > source && dir[-1] != '/')
+    dir--;
+  if (slash - dir == 5 && strncmp(dir, "check", 5) == 0)
+    return MODE_CHECK;
+  if (slash - dir == 3 && strncmp(dir, "run", 3) == 0)
+    return MODE_RUN;
+  if (slash - dir == 11 && strncmp(dir, "incremental", 11) == 0)
+    return MODE_INCREMENTAL;
+  return MODE_PARSE;
+}
+
+static void addCase(TestRun *run, char *source, Variant *variant) {
+  TestCase *c;
+  struct stat st;
+  char *expected = siblingName(source, variant != NULL ? variant->golden : NULL, ".txt");
+  char *bodyName = NULL;
+
+  // --body is checked on the first subroutine there is
+  if (variant != NULL && variant->via == VIA_BODY && (bodyName = firstSubroutine(expected)) == NULL) {
+    free(expected);
+    return;
+  }
+  if (run->count == run->capacity) {
+    run->capacity = run->capacity ? run->capacity * 2 : 64;
+    run->cases = (TestCase*)realloc(run->cases, run->capacity * sizeof(TestCase));
+  }
+  c = &run->cases[run->count++];
+  memset(c, 0, sizeof(TestCase));
+  c->source = strdup(source);
+  c->mode = modeOf(source);
+  c->variant = variant;
+  c->bodyName = bodyName;
+  c->expected = expected;
+  if (c->mode == MODE_RUN) {
+    c->input = siblingName(source, NULL, ".in");
+    if (stat(c->input, &st) != 0) {
+      free(c->input);
+      c->input = strdup("/dev/null");
+    }
+  }
+}
+
+// A program of ../test is a case for each parse variant and one of run/
+// for each engine
+static void addProgram(TestRun *run, char *source) {
+  int i;
+
+  if (modeOf(source) == MODE_PARSE)
+    for (i = 0; i < PARSE_VARIANT_COUNT; i++)
+      addCase(run, source, &parseVariants[i]);
+  else if (modeOf(source) == MODE_RUN)
+    for (i = 0; i < RUN_VARIANT_COUNT; i++)
+      addCase(run, source, &runVariants[i]);
+  else addCase(run, source, NULL);
+  free(source);
+}
+
+static int compareNames(const void *a, const void *b) {
+  TestCase *x = (TestCase*)a, *y = (TestCase*)b;
+  int order = strcmp(x->source, y->source);
+
+  return order != 0 ? order : (x->variant > y->variant) - (x->variant < y->variant);
+}
+
+// Every *.kpl of a directory, or the file itself
+static int addCases(TestRun *run, char *path) {
+  struct stat st;
+  struct dirent *entry;
+  DIR *dir;
+  size_t length;
+  char *source;
+  int first = run->count;
+
+  if (stat(path, &st) != 0)
+    return -1;
+  if (!S_ISDIR(st.st_mode)) {
+    addProgram(run, strdup(path));
+    return 0;
+  }
+  if ((dir = opendir(path)) == NULL)
+    return -1;
+  while ((entry = readdir(dir)) != NULL) {
+    length = strlen(entry->d_name);
+    if (length < 5 || strcmp(entry->d_name + length - 4, ".kpl") != 0)
+      continue;
+    source = (char*)malloc(strlen(path) + length + 2);
+    sprintf(source, "%s/%s", path, entry->d_name);
+    addProgram(run, source);
+  }
+  closedir(dir);
+  qsort(run->cases + first, run->count - first, sizeof(TestCase), compareNames);
+  return 0;
+}
+
+/******************************************************************/
+
+static void splitLines(char *text, size_t length, Lines *out) {
+  size_t i, start = 0;
+  int capacity = 64;
+
+  out->count = 0;
+  out->lines = (Line*)malloc(capacity * sizeof(Line));
+  for (i = 0; i <= length; i++) {
+    if (i < length && text[i] != '\n')
+      continue;
+    if (i == length && start == length)
+      break;
+    if (out->count == capacity) {
+      capacity *= 2;
+      out->lines = (Line*)realloc(out->lines, capacity * sizeof(Line));
+    }
+    out->lines[out->count].text = text + start;
+    out->lines[out->count].length = i - start;
+    out->count++;
+    start = i + 1;
+  }
+}
+
+static int sameLine(Line *x, Line *y) {
+  return x->length == y->length && memcmp(x->text, y->text, x->length) == 0;
+}
+
+// Myers' O(ND) algorithm. trace[d] keeps the furthest x of every diagonal
+// -d..d so the path can be walked back; returns NULL when more than
+// MAX_DIFF_EDITS lines differ.
+static Edit *diffLines(Lines *a, Lines *b, int *editCount) {
+  int n = a->count, m = b->count, max = n + m;
+  int *v = (int*)calloc(2 * max + 3, sizeof(int)) + max + 1;
+  int **trace = (int**)malloc((MAX_DIFF_EDITS + 1) * sizeof(int*));
+  Edit *edits = (Edit*)malloc((n + m + 1) * sizeof(Edit));
+  int d, k, x, y, prevK, prevX, prevY, startX, count = 0, found = -1;
+  int *prev;
+
+  for (d = 0; d <= MAX_DIFF_EDITS && d <= max && found < 0; d++) {
+    for (k = -d; k <= d; k += 2) {
+      if (k == -d || (k != d && v[k - 1] < v[k + 1]))
+        x = v[k + 1];
+      else x = v[k - 1] + 1;
+      y = x - k;
+      while (x < n && y < m && sameLine(&a->lines[x], &b->lines[y])) {
+        x++;
+        y++;
+      }
+      v[k] = x;
+      if (x >= n && y >= m)
+        found = d;
+    }
+    trace[d] = (int*)malloc((2 * d + 1) * sizeof(int)) + d;
+    memcpy(trace[d] - d, v - d, (2 * d + 1) * sizeof(int));
+  }
+
+  if (found >= 0) {
+    x = n;
+    y = m;
+    for (d = found; d > 0; d--) {
+      prev = trace[d - 1];
+      k = x - y;
+      if (k == -d || (k != d && prev[k - 1] < prev[k + 1]))
+        prevK = k + 1;
+      else prevK = k - 1;
+      prevX = prev[prevK];
+      prevY = prevX - prevK;
+      // The snake of equal lines follows the single edit of this step
+      startX = prevK == k + 1 ? prevX : prevX + 1;
+      while (x > startX) {
+        edits[count].op = ' ';
+        edits[count].a = --x;
+        edits[count].b = --y;
+        count++;
+      }
+      edits[count].op = prevK == k + 1 ? '+' : '-';
+      edits[count].a = prevX;
+      edits[count].b = prevY;
+      count++;
+      x = prevX;
+      y = prevY;
+    }
+    while (x > 0 && y > 0) {
+      edits[count].op = ' ';
+      edits[count].a = --x;
+      edits[count].b = --y;
+      count++;
+    }
+    // Collected backwards
+    for (k = 0; k < count / 2; k++) {
+      Edit t = edits[k];
+      edits[k] = edits[count - 1 - k];
+      edits[count - 1 - k] = t;
+    }
+  }
+
+  for (k = 0; k < d; k++)
+    free(trace[k] - k);
+  free(trace);
+  free(v - max - 1);
+  if (found < 0) {
+    free(edits);
+    return NULL;
+  }
+  *editCount = count;
+  return edits;
+}
+
+// Hunks of CONTEXT_LINES lines around each change, as diff -u prints them
+static void printUnifiedDiff(FILE *f, char *expectedName, TestCase *c) {
+  Lines a, b;
+  Edit *edits;
+  Line *line;
+  int count, i, j, start, end, next, aStart, bStart, aLength, bLength;
+
+  splitLines(c->expectedText, c->expectedLength, &a);
+  splitLines(c->actual, c->actualLength, &b);
+  fprintf(f, "--- %s\n+++ %s (%s)\n", expectedName, c->source,
+          c->variant != NULL ? c->variant->name : c->mode == MODE_CHECK ? "--check diagnostics" :
+          "--incremental");
+  edits = diffLines(&a, &b, &count);
+  if (edits == NULL) {
+    fprintf(f, "@@ more than %d lines differ (%d expected, %d actual) @@\n",
+            MAX_DIFF_EDITS, a.count, b.count);
+    free(a.lines);
+    free(b.lines);
+    return;
+  }
+
+  if (a.count == b.count) {
+    for (i = 0; i < count && edits[i].op == ' '; i++)
+      ;
+    if (i == count)
+      fprintf(f, "@@ the outputs differ only in the newline at the end @@\n");
+  }
+  i = 0;
+  while (i < count) {
+    while (i < count && edits[i].op == ' ')
+      i++;
+    if (i == count)
+      break;
+    // Extend the hunk while the next change is within two contexts
+    start = i - CONTEXT_LINES > 0 ? i - CONTEXT_LINES : 0;
+    end = i;
+    for (j = i; j < count && j - end <= 2 * CONTEXT_LINES + 1; j++)
+      if (edits[j].op != ' ')
+        end = j;
+    next = end + 1;
+    end = end + CONTEXT_LINES + 1 < count ? end + CONTEXT_LINES + 1 : count;
+
+    aLength = bLength = 0;
+    for (j = start; j < end; j++) {
+      if (edits[j].op != '+') aLength++;
+      if (edits[j].op != '-') bLength++;
+    }
+    aStart = edits[start].a + (aLength > 0);
+    bStart = edits[start].b + (bLength > 0);
+    fprintf(f, "@@ -%d,%d +%d,%d @@\n", aStart, aLength, bStart, bLength);
+    for (j = start; j < end; j++) {
+      line = edits[j].op == '+' ? &b.lines[edits[j].b] : &a.lines[edits[j].a];
+      fprintf(f, "%c%.*s\n", edits[j].op, (int)line->length, line->text);
+    }
+    i = next;
+  }
+  free(edits);
+  free(a.lines);
+  free(b.lines);
+}
+
+/******************************************************************/
+
+static int writeExpected(TestCase *c) {
+  FILE *f = fopen(c->expected, "wb");
+
+  if (f == NULL)
+    return -1;
+  fwrite(c->actual, 1, c->actualLength, f);
+  return fclose(f) == 0 ? 0 : -1;
+}
+
+// Copies a file the child wrote, ending it with a newline so that what
+// follows starts a line of its own
+static void appendFile(FILE *out, char *fileName) {
+  size_t length;
+  char *text = readWholeFile(fileName, &length);
+
+  if (text == NULL)
+    return;
+  fwrite(text, 1, length, out);
+  if (length > 0 && text[length - 1] != '\n')
+    fputc('\n', out);
+  free(text);
+}
+
+// Runs argv on input and prints its stdout, then its stderr and how it
+// ended unless that was a plain exit 0:
+//   == stderr
+//   6-6:Index out of range!
+//   == exit 1
+// Given stderrText, only stdout and a signal are printed and what the
+// program wrote on stderr is returned there.
+static int runProgram(TestRun *run, int index, char **argv, char *input, char **stderrText, FILE *out) {
+  char output[64], errors[64];
+  struct rlimit limit;
+  struct stat st;
+  size_t length;
+  pid_t pid;
+  int status, fd;
+
+  sprintf(output, "%s/%d.out", run->workDir, index);
+  sprintf(errors, "%s/%d.err", run->workDir, index);
+  pid = fork();
+  if (pid == 0) {
+    fd = open(input, O_RDONLY);
+    dup2(fd, 0);
+    close(fd);
+    fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, 1);
+    close(fd);
+    fd = open(errors, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    dup2(fd, 2);
+    close(fd);
+    // An engine that loops forever is stopped by SIGXCPU
+    limit.rlim_cur = RUN_TIME_LIMIT;
+    limit.rlim_max = RUN_TIME_LIMIT + 1;
+    setrlimit(RLIMIT_CPU, &limit);
+    signal(SIGPIPE, SIG_DFL);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  if (pid < 0 || waitpid(pid, &status, 0) != pid) {
+    fprintf(out, "== can\'t run %s\n", argv[0]);
+    return -1;
+  }
+
+  appendFile(out, output);
+  if (stderrText != NULL)
+    *stderrText = readWholeFile(errors, &length);
+  else if (stat(errors, &st) == 0 && st.st_size > 0) {
+    fprintf(out, "== stderr\n");
+    appendFile(out, errors);
+  }
+  if (WIFSIGNALED(status))
+    fprintf(out, "== %s\n", strsignal(WTERMSIG(status)));
+  else if (stderrText == NULL && WEXITSTATUS(status) != 0)
+    fprintf(out, "== exit %d\n", WEXITSTATUS(status));
+  unlink(output);
+  unlink(errors);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Adds the words of options to argv; returns the copy they point into
+static char *addOptions(char **argv, int *argc, char *options) {
+  char *copy = strdup(options), *option, *rest;
+
+  for (option = strtok_r(copy, " ", &rest); option != NULL && *argc < 12;
+       option = strtok_r(NULL, " ", &rest))
+    argv[(*argc)++] = option;
+  return copy;
+}
+
+// parser run with the options of the engine, or parser build and then
+// the binary it made
+static void runEngine(TestRun *run, int index, FILE *out) {
+  TestCase *c = &run->cases[index];
+  char *argv[16], *options, binary[64];
+  int argc = 0;
+
+  argv[argc++] = run->parserPath;
+  if (c->variant->via == VIA_BUILD) {
+    sprintf(binary, "%s/%d.bin", run->workDir, index);
+    argv[argc++] = "build";
+    argv[argc++] = "-o";
+    argv[argc++] = binary;
+    argv[argc++] = c->source;
+    argv[argc] = NULL;
+    if (runProgram(run, index, argv, "/dev/null", NULL, out) == 0) {
+      argv[0] = binary;
+      argv[1] = NULL;
+      runProgram(run, index, argv, c->input, NULL, out);
+    }
+    unlink(binary);
+    return;
+  }
+
+  argv[argc++] = "run";
+  options = addOptions(argv, &argc, c->variant->options);
+  argv[argc++] = c->source;
+  argv[argc] = NULL;
+  runProgram(run, index, argv, c->input, NULL, out);
+  free(options);
+}
+
+// parser with the options of the variant, parser --body on the
+// subroutine of the case, or kplclient; only what they print on stdout
+// is compared
+static void runParser(TestRun *run, int index, FILE *out) {
+  TestCase *c = &run->cases[index];
+  char *argv[16], *options = NULL, *errors = NULL;
+  int argc = 0;
+
+  if (c->variant->via == VIA_CLIENT) {
+    argv[argc++] = run->clientPath;
+    argv[argc++] = "-s";
+    argv[argc++] = run->socketPath;
+  } else if (c->variant->via == VIA_BODY) {
+    argv[argc++] = run->parserPath;
+    argv[argc++] = "--body";
+    argv[argc++] = c->bodyName;
+  } else {
+    argv[argc++] = run->parserPath;
+    options = addOptions(argv, &argc, c->variant->options);
+  }
+  argv[argc++] = c->source;
+  argv[argc] = NULL;
+  runProgram(run, index, argv, "/dev/null", &errors, out);
+  free(errors);
+  free(options);
+}
+
+// Overwrites the nodes of every tree in dir and leaves the headers alone,
+// so that only mapTree() checking them keeps the trees from being used
+static void corruptCache(char *dir) {
+  DIR *d = opendir(dir);
+  struct dirent *entry;
+  TreeHeader header;
+  FlatNode junk;
+  char path[320];
+  uint32_t i;
+  FILE *f;
+
+  if (d == NULL)
+    return;
+  memset(&junk, 0xff, sizeof(FlatNode));
+  while ((entry = readdir(d)) != NULL) {
+    if (entry->d_name[0] == '.')
+      continue;
+    sprintf(path, "%.63s/%.255s", dir, entry->d_name);
+    if ((f = fopen(path, "r+b")) == NULL)
+      continue;
+    if (fread(&header, sizeof(TreeHeader), 1, f) == 1 && fseek(f, sizeof(TreeHeader), SEEK_SET) == 0)
+      for (i = 0; i < header.nodeCount; i++)
+        fwrite(&junk, sizeof(FlatNode), 1, f);
+    fclose(f);
+  }
+  closedir(d);
+}
+
+static void removeDirectory(char *dir) {
+  DIR *d = opendir(dir);
+  struct dirent *entry;
+  char path[320];
+
+  if (d == NULL)
+    return;
+  while ((entry = readdir(d)) != NULL)
+    if (entry->d_name[0] != '.') {
+      sprintf(path, "%.63s/%.255s", dir, entry->d_name);
+      unlink(path);
+    }
+  closedir(d);
+  rmdir(dir);
+}
+
+// parser --cache --dump-tree on a cache of the case's own: empty, filled
+// by a first run, or filled and then corrupted. A note follows the tree
+// when the cache was not hit, or missed, as it should have been.
+static void runCached(TestRun *run, int index, FILE *out) {
+  TestCase *c = &run->cases[index];
+  Via via = c->variant->via;
+  char dir[64], *errors = NULL, *expected = via == VIA_CACHE_HIT ? "cache hit" : "cache miss";
+  char *argv[] = {run->parserPath, "--cache", dir, "--dump-tree", c->source, NULL};
+  FILE *scratch;
+
+  sprintf(dir, "%s/%d.cache", run->workDir, index);
+  mkdir(dir, 0700);
+  if (via != VIA_CACHE_MISS) {
+    scratch = fopen("/dev/null", "w");
+    runProgram(run, index, argv, "/dev/null", &errors, scratch);
+    fclose(scratch);
+    free(errors);
+    if (via == VIA_CACHE_CORRUPTED)
+      corruptCache(dir);
+  }
+  runProgram(run, index, argv, "/dev/null", &errors, out);
+  if (errors == NULL || strncmp(errors, expected, strlen(expected)) != 0)
+    fprintf(out, "== no %s\n", expected);
+  free(errors);
+  removeDirectory(dir);
+}
+
+/******************************************************************/
+
+// Content-Length framed messages read from a language server
+typedef struct {
+  int fd;
+  char *data;
+  size_t length, capacity;
+} MessageReader;
+
+static void sendMessage(int fd, char *body) {
+  char header[64];
+  size_t length = strlen(body), done;
+  ssize_t n;
+
+  sprintf(header, "Content-Length: %lu\r\n\r\n", (unsigned long)length);
+  if (write(fd, header, strlen(header)) < 0)
+    return;
+  for (done = 0; done < length; done += n)
+    if ((n = write(fd, body + done, length - done)) <= 0)
+      return;
+}
+
+// The next message, or NULL when none came within REPLY_TIMEOUT
+static char *receiveMessage(MessageReader *r) {
+  struct pollfd fd = {r->fd, POLLIN, 0};
+  char *end, *header;
+  size_t start, length;
+  ssize_t n;
+
+  for (;;) {
+    if (r->data != NULL && (end = strstr(r->data, "\r\n\r\n")) != NULL) {
+      start = end + 4 - r->data;
+      *end = '\0';
+      // parser --lsp sends no header but Content-Length
+      length = strncasecmp(r->data, "Content-Length:", 15) == 0 ? strtoul(r->data + 15, NULL, 10) : 0;
+      *end = '\r';
+      if (r->length >= start + length) {
+        header = strndup(r->data + start, length);
+        r->length -= start + length;
+        memmove(r->data, r->data + start + length, r->length + 1);
+        return header;
+      }
+    }
+    if (poll(&fd, 1, REPLY_TIMEOUT) <= 0)
+      return NULL;
+    if (r->length + 4096 + 1 > r->capacity) {
+      r->capacity = r->length + 4096 + 1 + r->capacity;
+      r->data = (char*)realloc(r->data, r->capacity);
+    }
+    if ((n = read(r->fd, r->data + r->length, 4096)) <= 0)
+      return NULL;
+    r->length += n;
+    r->data[r->length] = '\0';
+  }
+}
+
+// Prints each message up to the one that contains marker
+static int awaitMessage(MessageReader *r, char *marker, FILE *out) {
+  char *message;
+  int found;
+
+  do {
+    if ((message = receiveMessage(r)) == NULL) {
+      fprintf(out, "== no reply with %s\n", marker);
+      return 0;
+    }
+    fprintf(out, "%s\n", message);
+    found = strstr(message, marker) != NULL;
+    free(message);
+  } while (!found);
+  return 1;
+}
+
+static void putJsonString(FILE *f, char *text, size_t length) {
+  size_t i;
+
+  fputc('"', f);
+  for (i = 0; i < length; i++)
+    if (text[i] == '"' || text[i] == '\\')
+      fprintf(f, "\\%c", text[i]);
+    else if (text[i] == '\n')
+      fputs("\\n", f);
+    else if (text[i] == '\r')
+      fputs("\\r", f);
+    else if (text[i] == '\t')
+      fputs("\\t", f);
+    else if ((unsigned char)text[i] < 0x20)
+      fprintf(f, "\\u%04x", text[i]);
+    else fputc(text[i], f);
+  fputc('"', f);
+}
+
+// parser --lsp opening the program as file:///NAME.kpl: what it sends up
+// to the diagnostics, the semantic tokens of the program and the reply to
+// shutdown
+static void runLanguageServer(TestRun *run, int index, FILE *out) {
+  TestCase *c = &run->cases[index];
+  char *slash = strrchr(c->source, '/'), *text, *message = NULL;
+  int toServer[2], fromServer[2], status, fd;
+  MessageReader reader = {-1, NULL, 0, 0};
+  size_t length, messageLength;
+  FILE *f;
+  pid_t pid;
+
+  if ((text = readWholeFile(c->source, &length)) == NULL) {
+    fprintf(out, "Can\'t read input file!\n");
+    return;
+  }
+  if (pipe(toServer) != 0 || pipe(fromServer) != 0) {
+    fprintf(out, "== can\'t run %s\n", run->parserPath);
+    free(text);
+    return;
+  }
+  // Other cases fork too; their children must not hold the pipes open
+  fcntl(toServer[1], F_SETFD, FD_CLOEXEC);
+  fcntl(fromServer[0], F_SETFD, FD_CLOEXEC);
+  pid = fork();
+  if (pid == 0) {
+    dup2(toServer[0], 0);
+    dup2(fromServer[1], 1);
+    fd = open("/dev/null", O_WRONLY);
+    dup2(fd, 2);
+    close(fd);
+    close(toServer[0]);
+    close(fromServer[1]);
+    signal(SIGPIPE, SIG_DFL);
+    execl(run->parserPath, run->parserPath, "--lsp", (char*)NULL);
+    _exit(127);
+  }
+  close(toServer[0]);
+  close(fromServer[1]);
+  reader.fd = fromServer[0];
+
+  f = open_memstream(&message, &messageLength);
+  fprintf(f, "{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/didOpen\",\"params\":{\"textDocument\":"
+          "{\"uri\":\"file:///%s\",\"languageId\":\"kpl\",\"version\":1,\"text\":",
+          slash != NULL ? slash + 1 : c->source);
+  putJsonString(f, text, length);
+  fprintf(f, "}}}");
+  fclose(f);
+
+  sendMessage(toServer[1], "{\"jsonrpc\":\"2.0\",\"id\":1,\"method\":\"initialize\",\"params\":{}}");
+  sendMessage(toServer[1], "{\"jsonrpc\":\"2.0\",\"method\":\"initialized\",\"params\":{}}");
+  sendMessage(toServer[1], message);
+  if (awaitMessage(&reader, "textDocument/publishDiagnostics", out)) {
+    free(message);
+    message = NULL;
+    f = open_memstream(&message, &messageLength);
+    fprintf(f, "{\"jsonrpc\":\"2.0\",\"id\":2,\"method\":\"textDocument/semanticTokens/full\","
+            "\"params\":{\"textDocument\":{\"uri\":\"file:///%s\"}}}",
+            slash != NULL ? slash + 1 : c->source);
+    fclose(f);
+    sendMessage(toServer[1], message);
+    if (awaitMessage(&reader, "\"id\":2", out)) {
+      sendMessage(toServer[1], "{\"jsonrpc\":\"2.0\",\"id\":3,\"method\":\"shutdown\"}");
+      if (awaitMessage(&reader, "\"id\":3", out))
+        sendMessage(toServer[1], "{\"jsonrpc\":\"2.0\",\"method\":\"exit\"}");
+    }
+  }
+  close(toServer[1]);
+  if (pid > 0 && waitpid(pid, &status, 0) == pid) {
+    if (WIFSIGNALED(status))
+      fprintf(out, "== %s\n", strsignal(WTERMSIG(status)));
+    else if (WEXITSTATUS(status) != 0)
+      fprintf(out, "== exit %d\n", WEXITSTATUS(status));
+  } else fprintf(out, "== can\'t run %s\n", run->parserPath);
+  close(fromServer[0]);
+  free(reader.data);
+  free(message);
+  free(text);
+}
+
+// parser --serve in the work directory for the kplclient cases; returns
+// its pid once the socket is there
+static pid_t startServer(TestRun *run) {
+  char *argv[] = {run->parserPath, "--serve", run->socketPath, "--jobs", "2", NULL};
+  struct stat st;
+  pid_t pid;
+  int fd, i;
+
+  sprintf(run->socketPath, "%s/server.sock", run->workDir);
+  pid = fork();
+  if (pid == 0) {
+    fd = open("/dev/null", O_RDWR);
+    dup2(fd, 0);
+    dup2(fd, 1);
+    dup2(fd, 2);
+    close(fd);
+    signal(SIGPIPE, SIG_DFL);
+    execv(argv[0], argv);
+    _exit(127);
+  }
+  for (i = 0; pid > 0 && i < REPLY_TIMEOUT / 10 && stat(run->socketPath, &st) != 0; i++)
+    usleep(10000);
+  return pid;
+}
+
+/******************************************************************/
+
+// Each version with what was reused of the ones before it
+static void compileVersions(TestCase *c, FILE *out) {
+  Incremental inc;
+  struct stat st;
+  char *version = (char*)malloc(strlen(c->source) + 16);
+  int n;
+
+  initIncremental(&inc);
+  strcpy(version, c->source);
+  for (n = 1; n == 1 || stat(version, &st) == 0; sprintf(version, "%s.%d", c->source, ++n)) {
+    fprintf(out, "==> version %d <==\n", n);
+    if (compileIncremental(version, &inc) == IO_ERROR)
+      fprintf(out, "Can\'t read input file!\n");
+    fprintf(out, "== %d subroutines reused, %d reparsed\n", inc.reused, inc.reparsed);
+  }
+  freeIncremental(&inc);
+  free(version);
+}
+
+// The trace of a first compileIncremental(), or of a second one on the
+// same file, which must have taken every subroutine from the first
+static void compileAgain(TestCase *c, FILE *out) {
+  Incremental inc;
+  FILE *scratch = NULL;
+
+  initIncremental(&inc);
+  if (c->variant->via == VIA_UNCHANGED) {
+    scratch = fopen("/dev/null", "w");
+    setOutputStream(scratch);
+    compileIncremental(c->source, &inc);
+    setOutputStream(out);
+  }
+  if (compileIncremental(c->source, &inc) == IO_ERROR)
+    fprintf(out, "Can\'t read input file!\n");
+  else if (scratch != NULL && inc.reparsed > 0)
+    fprintf(out, "== %d subroutines reparsed\n", inc.reparsed);
+  if (scratch != NULL)
+    fclose(scratch);
+  freeIncremental(&inc);
+}
+
+static int isLine(Line *line, char *text) {
+  return line->length == strlen(text) && memcmp(line->text, text, line->length) == 0;
+}
+
+static int endsWith(Line *line, char *suffix) {
+  size_t length = strlen(suffix);
+
+  return line->length >= length && memcmp(line->text + line->length - length, suffix, length) == 0;
+}
+
+// --body NAME prints the lines of the trace from the BEGIN of NAME, after
+// the subroutines it declares, up to its "Block parsed!"
+static void sliceBody(TestCase *c) {
+  Lines lines;
+  char *declaration = (char*)malloc(strlen(c->bodyName) + 16);
+  int i, depth = 0, start = -1, end = -1;
+  size_t first = 0, length = 0;
+
+  splitLines(c->expectedText, c->expectedLength, &lines);
+  sprintf(declaration, ":TK_IDENT(%s)", c->bodyName);
+  for (i = 1; i < lines.count; i++)
+    if (endsWith(&lines.lines[i], declaration) &&
+        (endsWith(&lines.lines[i - 1], ":KW_PROCEDURE") || endsWith(&lines.lines[i - 1], ":KW_FUNCTION")))
+      break;
+  for (; i < lines.count && start < 0; i++)
+    if (isLine(&lines.lines[i], "Parsing subtoutines ...."))
+      depth++;
+    else if (isLine(&lines.lines[i], "Subtoutines parsed ....") && --depth == 0)
+      start = i + 1;
+  for (; i < lines.count && end < 0; i++)
+    if (isLine(&lines.lines[i], "Block parsed!"))
+      end = i;
+  if (start >= 0 && end >= 0) {
+    first = lines.lines[start].text - c->expectedText;
+    length = lines.lines[end].text - lines.lines[start].text;
+  }
+  memmove(c->expectedText, c->expectedText + first, length);
+  c->expectedText[length] = '\0';
+  c->expectedLength = length;
+  free(lines.lines);
+  free(declaration);
+}
+
+static void runCase(int index, void *arg) {
+  TestRun *run = (TestRun*)arg;
+  TestCase *c = &run->cases[index];
+  Via via = c->variant != NULL ? c->variant->via : VIA_LIBRARY;
+  int writes = c->variant == NULL || c->variant->writes;
+  FILE *out, *report;
+  CheckedProgram program;
+  int status;
+
+  if (run->update && writes == run->pass)
+    return;
+
+  out = open_memstream(&c->actual, &c->actualLength);
+  if (via == VIA_RUN || via == VIA_BUILD)
+    runEngine(run, index, out);
+  else if (via == VIA_CACHE_MISS || via == VIA_CACHE_HIT || via == VIA_CACHE_CORRUPTED)
+    runCached(run, index, out);
+  else if (via == VIA_LSP)
+    runLanguageServer(run, index, out);
+  else if (via == VIA_PARSER || via == VIA_BODY || via == VIA_CLIENT)
+    runParser(run, index, out);
+  else if (via == VIA_INCREMENTAL || via == VIA_UNCHANGED) {
+    setOutputStream(out);
+    compileAgain(c, out);
+    setOutputStream(NULL);
+  } else if (c->mode == MODE_INCREMENTAL) {
+    setOutputStream(out);
+    compileVersions(c, out);
+    setOutputStream(NULL);
+  } else {
+    setOutputStream(out);
+    if (c->mode == MODE_CHECK) {
+      // Only the diagnostics; the trace is what the parse cases check
+      initCheckedProgram(&program);
+      traceEnabled = 0;
+      status = checkProgram(c->source, &program);
+      traceEnabled = 1;
+      freeCheckedProgram(&program);
+    } else status = compile(c->source);
+    if (status == IO_ERROR)
+      fprintf(out, "Can\'t read input file!\n");
+    setOutputStream(NULL);
+  }
+  fclose(out);
+
+  c->expectedText = readWholeFile(c->expected, &c->expectedLength);
+  c->hasExpected = c->expectedText != NULL;
+  if (c->hasExpected && via == VIA_BODY)
+    sliceBody(c);
+  c->passed = c->hasExpected && c->expectedLength == c->actualLength &&
+              memcmp(c->expectedText, c->actual, c->actualLength) == 0;
+  if (c->passed)
+    return;
+
+  report = open_memstream(&c->report, &c->reportLength);
+  if (run->update && writes) {
+    if (writeExpected(c) == 0) {
+      c->updated = 1;
+      fprintf(report, "%s: %s %s\n", c->source, c->hasExpected ? "updated" : "created", c->expected);
+    } else fprintf(report, "%s: can\'t write %s\n", c->source, c->expected);
+  } else if (!c->hasExpected)
+    fprintf(report, "%s: no expected output %s (run with --update to create it)\n",
+            c->source, c->expected);
+  else printUnifiedDiff(report, c->expected, c);
+  fclose(report);
+}
+
+int main(int argc, char *argv[]) {
+  TestRun run = {NULL, 0, 0, 0, 0, "./parser", "./kplclient", "/tmp/kpltestXXXXXX", ""};
+  char *defaultDirs[] = {DEFAULT_TEST_DIR, DEFAULT_CHECK_DIR, DEFAULT_RUN_DIR,
+                         DEFAULT_INCREMENTAL_DIR};
+  int jobs = defaultJobCount(), verbose = 0;
+  int i, failed = 0, updated = 0, paths = 0;
+  pid_t server = -1;
+  double start;
+  TestCase *c;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--update") == 0)
+      run.update = 1;
+    else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc)
+      jobs = atoi(argv[++i]) > 0 ? atoi(argv[i]) : defaultJobCount();
+    else if (strcmp(argv[i], "--verbose") == 0)
+      verbose = 1;
+    else if (strcmp(argv[i], "--parser") == 0 && i + 1 < argc)
+      run.parserPath = argv[++i];
+    else if (strcmp(argv[i], "--client") == 0 && i + 1 < argc)
+      run.clientPath = argv[++i];
+    else if (argv[i][0] == '-') {
+      printf("usage: kpltest [--update] [--jobs N] [--verbose] [--parser PATH] [--client PATH] "
+             "[DIR|FILE.kpl]...\n");
+      return 2;
+    } else {
+      paths++;
+      if (addCases(&run, argv[i]) != 0) {
+        printf("kpltest: can\'t read %s\n", argv[i]);
+        return 2;
+      }
+    }
+  }
+  for (i = 0; paths == 0 && i < 4; i++)
+    if (addCases(&run, defaultDirs[i]) != 0) {
+      printf("kpltest: can\'t read %s\n", defaultDirs[i]);
+      return 2;
+    }
+  if (mkdtemp(run.workDir) == NULL) {
+    printf("kpltest: can\'t create %s\n", run.workDir);
+    return 2;
+  }
+
+  // A language server or kplclient that dies must not take the runner with it
+  signal(SIGPIPE, SIG_IGN);
+  for (i = 0; i < run.count && server < 0; i++)
+    if (run.cases[i].variant != NULL && run.cases[i].variant->via == VIA_CLIENT)
+      server = startServer(&run);
+
+  start = statsClock();
+  fflush(stdout);
+  runWorkPool(jobs, run.count, runCase, &run);
+  if (run.update) {
+    run.pass = 1;
+    runWorkPool(jobs, run.count, runCase, &run);
+  }
+  if (server > 0) {
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    unlink(run.socketPath);
+  }
+  rmdir(run.workDir);
+
+  for (i = 0; i < run.count; i++) {
+    c = &run.cases[i];
+    if (c->report != NULL)
+      fwrite(c->report, 1, c->reportLength, stdout);
+    else if (verbose && c->variant != NULL)
+      printf("%s (%s): ok\n", c->source, c->variant->name);
+    else if (verbose)
+      printf("%s: ok\n", c->source);
+    if (c->updated)
+      updated++;
+    else if (!c->passed)
+      failed++;
+    free(c->source);
+    free(c->input);
+    free(c->bodyName);
+    free(c->expected);
+    free(c->expectedText);
+    free(c->actual);
+    free(c->report);
+  }
+  printf("%d tests, %d passed, %d failed", run.count, run.count - failed - updated, failed);
+  if (run.update)
+    printf(", %d updated", updated);
+  printf(" in %.3f s (%d jobs)\n", statsClock() - start, jobs);
+  free(run.cases);
+  return failed > 0 ? 1 : 0;
+}
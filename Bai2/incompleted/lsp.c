@@ -0,0 +1,1056 @@
+/* Language server */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <math.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "reader.h"
+#include "charcode.h"
+#include "token.h"
+#include "scanner.h"
+#include "parser.h"
+#include "error.h"
+#include "json.h"
+#include "stats.h"
+#include "lsp.h"
+
+#define MAX_MESSAGE 64
+#define READ_CHUNK 65536
+#define STATE_CHUNK 128         // lines relexed between checks for input
+
+// JSON-RPC and LSP error codes
+#define METHOD_NOT_FOUND -32601
+#define REQUEST_CANCELLED -32800
+#define CONTENT_MODIFIED -32801
+
+extern __thread long charPos;
+extern CharCode charCodes[];
+
+// The program is split at its checkpoints: the program head (offset 0),
+// every top-level FUNCTION and PROCEDURE and the main body. At a
+// checkpoint the parser is always in the same state, so a region can be
+// parsed on its own and its result stays valid while the bytes it read
+// are unchanged.
+typedef struct {
+  long offset;
+  long end;          // next checkpoint; -1 when the parse ended inside
+  long reach;        // last byte read, the lookahead included
+  int failed;
+  long errorOffset;
+  char message[MAX_MESSAGE];
+} Region;
+
+// Lexical state at a line start, for highlighting
+enum { IN_CODE, IN_COMMENT, IN_STRING };
+
+typedef struct {
+  char *uri;
+  long version;
+  char *text;
+  long length, capacity;
+
+  long *lines;                 // start offset of each line
+  unsigned char *lineStates;
+  long lineCount, lineCapacity;
+  // Line states from staleFrom on may be wrong; relexing can stop at the
+  // first line past staleTo whose state agrees. -1: all up to date.
+  long staleFrom, staleTo;
+
+  // Sorted by offset. Regions not reached from the program head are kept
+  // as islands: a later parse that arrives at their offset stops there.
+  // They are only dropped when an edit touches what they read, so undoing
+  // an edit that swallowed part of the program (an opened comment) is cheap.
+  Region *regions;
+  int regionCount, regionCapacity;
+
+  int dirty;
+  int gaps;                    // an edit dropped a region others link to
+  double *edits;               // arrival of the edits not diagnosed yet
+  int editCount, editCapacity;
+} Document;
+
+typedef struct Message {
+  JsonValue *json;
+  double arrival;
+  struct Message *next;
+} Message;
+
+enum { PARSE_DONE, PARSE_SPLICED, PARSE_YIELDED };
+
+static Document **documents;
+static int documentCount, documentCapacity;
+
+static char *input;
+static size_t inputLength, inputCapacity;
+static int inputClosed;
+static Message *queueHead, *queueTail;
+
+static int shutdownRequested;
+// Client positions count UTF-16 units unless it agreed to "utf-8"
+static int utf16Positions = 1;
+
+// Milliseconds from an edit's arrival to its diagnostics
+static double *latencies;
+static long latencyCount, latencyCapacity;
+
+// Parse in progress
+static Document *parsing;
+static long regionStart;
+static int parseStop;
+
+/******************************************************************/
+// Transport: Content-Length framed JSON on stdin and stdout
+
+// Read what is available, waiting up to timeout ms (-1: until data comes)
+static int readInput(int timeout) {
+  struct pollfd fd = {0, POLLIN, 0};
+  ssize_t n;
+
+  if (inputClosed || poll(&fd, 1, timeout) <= 0)
+    return 0;
+  if (inputLength + READ_CHUNK > inputCapacity) {
+    inputCapacity = inputLength + READ_CHUNK * 2;
+    input = (char*)realloc(input, inputCapacity);
+  }
+  n = read(0, input + inputLength, READ_CHUNK);
+  if (n <= 0) {
+    inputClosed = 1;
+    return 0;
+  }
+  inputLength += n;
+  return 1;
+}
+
+// Move the complete messages of the input buffer to the queue
+static void takeMessages(void) {
+  char *p = input, *end = input + inputLength, *header, *body;
+  long length;
+  Message *m;
+
+  for (;;) {
+    body = memmem(p, end - p, "\r\n\r\n", 4);
+    if (body == NULL)
+      break;
+    body += 4;
+    length = -1;
+    for (header = p; header < body; header = (char*)memchr(header, '\n', body - header) + 1)
+      if (strncasecmp(header, "Content-Length:", 15) == 0)
+        length = atol(header + 15);
+    if (length < 0) {
+      p = body;                 // no length: skip the header block
+      continue;
+    }
+    if (end - body < length)
+      break;
+    m = (Message*)malloc(sizeof(Message));
+    m->json = parseJson(body, length);
+    m->arrival = statsClock();
+    m->next = NULL;
+    if (queueTail != NULL)
+      queueTail->next = m;
+    else queueHead = m;
+    queueTail = m;
+    p = body + length;
+  }
+  inputLength = end - p;
+  memmove(input, p, inputLength);
+}
+
+static void readMessages(int wait) {
+  if (wait)
+    while (queueHead == NULL && readInput(-1))
+      takeMessages();
+  while (readInput(0))
+    ;
+  takeMessages();
+}
+
+static int inputPending(void) {
+  struct pollfd fd = {0, POLLIN, 0};
+  return queueHead != NULL || (!inputClosed && poll(&fd, 1, 0) > 0);
+}
+
+static void sendMessage(char *body, size_t length) {
+  printf("Content-Length: %lu\r\n\r\n", (unsigned long)length);
+  fwrite(body, 1, length, stdout);
+  fflush(stdout);
+}
+
+static void writeId(FILE *f, JsonValue *id) {
+  if (id == NULL)
+    fputs("null", f);
+  else if (id->type == JSON_STRING)
+    writeJsonString(f, id->string, id->length);
+  else fprintf(f, "%.0f", id->number);
+}
+
+// A response is written into a memory stream, then framed and sent
+static FILE *beginResponse(JsonValue *id, char **body, size_t *size) {
+  FILE *f = open_memstream(body, size);
+  fputs("{\"jsonrpc\":\"2.0\",\"id\":", f);
+  writeId(f, id);
+  fputs(",\"result\":", f);
+  return f;
+}
+
+static void endMessage(FILE *f, char **body, size_t *size) {
+  fputs("}", f);
+  fclose(f);
+  sendMessage(*body, *size);
+  free(*body);
+}
+
+static void sendNull(JsonValue *id) {
+  char *body;
+  size_t size;
+  FILE *f = beginResponse(id, &body, &size);
+
+  fputs("null", f);
+  endMessage(f, &body, &size);
+}
+
+static void sendError(JsonValue *id, int code, char *message) {
+  char *body;
+  size_t size;
+  FILE *f = open_memstream(&body, &size);
+
+  fputs("{\"jsonrpc\":\"2.0\",\"id\":", f);
+  writeId(f, id);
+  fprintf(f, ",\"error\":{\"code\":%d,\"message\":", code);
+  writeJsonString(f, message, strlen(message));
+  fputs("}", f);
+  endMessage(f, &body, &size);
+}
+
+/******************************************************************/
+// Documents
+
+static Document *findDocument(char *uri) {
+  int i;
+
+  for (i = 0; uri != NULL && i < documentCount; i++)
+    if (strcmp(documents[i]->uri, uri) == 0)
+      return documents[i];
+  return NULL;
+}
+
+static long lineOf(Document *d, long offset) {
+  long low = 0, high = d->lineCount - 1, middle;
+
+  while (low < high) {
+    middle = (low + high + 1) / 2;
+    if (d->lines[middle] <= offset)
+      low = middle;
+    else high = middle - 1;
+  }
+  return low;
+}
+
+// End of the line's text, its newline excluded
+static long lineEnd(Document *d, long line) {
+  return line + 1 < d->lineCount ? d->lines[line + 1] - 1 : d->length;
+}
+
+// Offset of a column of the parser, which counts bytes
+static long byteOffsetAt(Document *d, long line, long column) {
+  long end;
+
+  if (line < 0)
+    return 0;
+  if (line >= d->lineCount)
+    return d->length;
+  end = lineEnd(d, line);
+  return d->lines[line] + column < end ? d->lines[line] + column : end;
+}
+
+// The position units of size bytes of UTF-8: one per character, two for
+// the characters UTF-16 needs a surrogate pair for
+static long unitsOf(char *text, long size) {
+  long units = 0, i;
+
+  if (!utf16Positions)
+    return size;
+  for (i = 0; i < size; i++)
+    if ((text[i] & 0xc0) != 0x80)
+      units += (unsigned char)text[i] >= 0xf0 ? 2 : 1;
+  return units;
+}
+
+static long columnAt(Document *d, long line, long offset) {
+  return unitsOf(d->text + d->lines[line], offset - d->lines[line]);
+}
+
+// Offset of a client position
+static long offsetAt(Document *d, long line, long character) {
+  long p, end;
+
+  if (!utf16Positions || line < 0 || line >= d->lineCount)
+    return byteOffsetAt(d, line, character);
+  end = lineEnd(d, line);
+  for (p = d->lines[line]; p < end && character > 0; p++)
+    if ((d->text[p] & 0xc0) != 0x80)
+      character -= (unsigned char)d->text[p] >= 0xf0 ? 2 : 1;
+  while (p < end && (d->text[p] & 0xc0) == 0x80)
+    p++;
+  return p;
+}
+
+static void reserveLines(Document *d, long count) {
+  if (count > d->lineCapacity) {
+    d->lineCapacity = count * 2;
+    d->lines = (long*)realloc(d->lines, d->lineCapacity * sizeof(long));
+    d->lineStates = (unsigned char*)realloc(d->lineStates, d->lineCapacity);
+  }
+}
+
+static long countLines(char *text, long length) {
+  long count = 0;
+  char *p = text, *end = text + length;
+
+  while ((p = (char*)memchr(p, '\n', end - p)) != NULL) {
+    count++;
+    p++;
+  }
+  return count;
+}
+
+/******************************************************************/
+// Highlighting: a line is lexed on its own from the state at its start
+
+typedef enum {
+  SEM_KEYWORD, SEM_TYPE, SEM_NUMBER, SEM_STRING, SEM_COMMENT, SEM_OPERATOR
+} SemanticType;
+
+static char *semanticTypes[] = {"keyword", "type", "number", "string", "comment", "operator"};
+
+typedef struct {
+  unsigned *data;
+  long count, capacity;
+  long line, character;        // previous token, for the relative encoding
+  long offset;                 // and where it starts in the text
+} SemanticTokens;
+
+// The token from..to (byte offsets) of a line
+static void emit(SemanticTokens *out, Document *d, long line, long from, long to, SemanticType type) {
+  long character, length;
+  unsigned *t;
+
+  if (out == NULL || to <= from)
+    return;
+  // Tokens come in order, so a column is counted on from the previous one
+  if (out->count == 0 || line != out->line)
+    character = columnAt(d, line, from);
+  else character = out->character + unitsOf(d->text + out->offset, from - out->offset);
+  length = unitsOf(d->text + from, to - from);
+  if (out->count + 5 > out->capacity) {
+    out->capacity = out->capacity ? out->capacity * 2 : 1024;
+    out->data = (unsigned*)realloc(out->data, out->capacity * sizeof(unsigned));
+  }
+  t = out->data + out->count;
+  t[0] = line - out->line;
+  t[1] = line == out->line ? character - out->character : character;
+  t[2] = length;
+  t[3] = type;
+  t[4] = 0;
+  out->count += 5;
+  out->line = line;
+  out->character = character;
+  out->offset = from;
+}
+
+static int isWordChar(char c) {
+  CharCode code = charCodes[(unsigned char)c];
+  return code == CHAR_LETTER || code == CHAR_DIGIT;
+}
+
+// Emit the tokens of a line, return the state at the start of the next
+static int scanLine(Document *d, long line, int state, SemanticTokens *out) {
+  char *text = d->text, word[MAX_IDENT_LEN + 1];
+  long start = d->lines[line], end = lineEnd(d, line), p = start, q;
+  TokenType type;
+  int star, opener = 0;
+
+  while (p < end) {
+    q = p + opener;
+    opener = 0;
+    switch (state) {
+    case IN_COMMENT:
+      // As skipComment(): the comment ends at the first ')' after a '*'
+      for (star = 0; q < end && !(star && text[q] == ')'); q++)
+        star = text[q] == '*';
+      if (q < end) {
+        q++;
+        state = IN_CODE;
+      }
+      emit(out, d, line, p, q, SEM_COMMENT);
+      p = q;
+      continue;
+    case IN_STRING:
+      while (q < end && text[q] != '"')
+        q++;
+      if (q < end) {
+        q++;
+        state = IN_CODE;
+      }
+      emit(out, d, line, p, q, SEM_STRING);
+      p = q;
+      continue;
+    }
+
+    switch (charCodes[(unsigned char)text[p]]) {
+    case CHAR_LETTER:
+      while (q < end && isWordChar(text[q]))
+        q++;
+      if (q - p <= MAX_IDENT_LEN) {
+        memcpy(word, text + p, q - p);
+        word[q - p] = '\0';
+        type = checkKeyword(word);
+        if (type == KW_INTEGER || type == KW_CHAR || type == KW_STRING || type == KW_BYTES)
+          emit(out, d, line, p, q, SEM_TYPE);
+        else if (type != TK_NONE)
+          emit(out, d, line, p, q, SEM_KEYWORD);
+      }
+      break;
+    case CHAR_DIGIT:
+      while (q < end && charCodes[(unsigned char)text[q]] == CHAR_DIGIT)
+        q++;
+      emit(out, d, line, p, q, SEM_NUMBER);
+      break;
+    case CHAR_DOUBLEQUOTE:
+      state = IN_STRING;
+      opener = 1;
+      continue;
+    case CHAR_SINGLEQUOTE:
+      q = p + 2 < end && text[p + 2] == '\'' ? p + 3 : p + 1;
+      emit(out, d, line, p, q, SEM_STRING);
+      break;
+    case CHAR_LPAR:
+      if (p + 1 < end && text[p + 1] == '*') {
+        state = IN_COMMENT;
+        opener = 2;
+        continue;
+      }
+      q++;
+      break;
+    case CHAR_SLASH:
+      q = p + 1 < end && text[p + 1] == '/' ? end : p + 1;
+      emit(out, d, line, p, q, q == end ? SEM_COMMENT : SEM_OPERATOR);
+      break;
+    case CHAR_PLUS:
+    case CHAR_MINUS:
+    case CHAR_EQ:
+    case CHAR_PERCENT:
+      q++;
+      emit(out, d, line, p, p + 1, SEM_OPERATOR);
+      break;
+    case CHAR_TIMES:
+      q += p + 1 < end && text[p + 1] == '*' ? 2 : 1;
+      emit(out, d, line, p, q, SEM_OPERATOR);
+      break;
+    case CHAR_LT:
+    case CHAR_GT:
+    case CHAR_EXCLAIMATION:
+    case CHAR_COLON:
+      q += p + 1 < end && text[p + 1] == '=' ? 2 : 1;
+      if (q - p == 2 || charCodes[(unsigned char)text[p]] != CHAR_COLON)
+        emit(out, d, line, p, q, SEM_OPERATOR);
+      break;
+    default:
+      q++;
+      break;
+    }
+    p = q;
+  }
+  return state;
+}
+
+// Relex at most budget lines (all when negative) of the stale stretch.
+// Opening a comment or a string can change every later line, so this is
+// left out of the edits and done when idle or when tokens are asked for.
+static int updateLineStates(Document *d, long budget) {
+  long line;
+  int state;
+
+  if (d->staleFrom < 0)
+    return 1;
+  d->lineStates[0] = IN_CODE;
+  state = d->lineStates[d->staleFrom];
+  for (line = d->staleFrom; line + 1 < d->lineCount; line++) {
+    if (budget-- == 0) {
+      d->staleFrom = line;
+      return 0;
+    }
+    state = scanLine(d, line, state, NULL);
+    if (line + 1 > d->staleTo && d->lineStates[line + 1] == state)
+      break;
+    d->lineStates[line + 1] = state;
+  }
+  d->staleFrom = -1;
+  return 1;
+}
+
+/******************************************************************/
+// Regions
+
+// First region at or after offset
+static int lowerRegion(Document *d, long offset) {
+  int low = 0, high = d->regionCount, middle;
+
+  while (low < high) {
+    middle = (low + high) / 2;
+    if (d->regions[middle].offset < offset)
+      low = middle + 1;
+    else high = middle;
+  }
+  return low;
+}
+
+static Region *findRegion(Document *d, long offset) {
+  int i = lowerRegion(d, offset);
+  return i < d->regionCount && d->regions[i].offset == offset ? &d->regions[i] : NULL;
+}
+
+static void putRegion(Document *d, Region *r) {
+  int i = lowerRegion(d, r->offset);
+
+  if (i == d->regionCount || d->regions[i].offset != r->offset) {
+    if (d->regionCount == d->regionCapacity) {
+      d->regionCapacity = d->regionCapacity ? d->regionCapacity * 2 : 64;
+      d->regions = (Region*)realloc(d->regions, d->regionCapacity * sizeof(Region));
+    }
+    memmove(d->regions + i + 1, d->regions + i, (d->regionCount - i) * sizeof(Region));
+    d->regionCount++;
+  }
+  d->regions[i] = *r;
+}
+
+// Called by the parser at every checkpoint after the first
+static void onCheckpoint(void) {
+  long at = tokenOffset;
+  Region r;
+
+  if (at == regionStart)
+    return;
+  memset(&r, 0, sizeof(r));
+  r.offset = regionStart;
+  r.end = at;
+  r.reach = charPos;
+  putRegion(parsing, &r);
+  regionStart = at;
+
+  // The rest is known from an earlier parse
+  if (findRegion(parsing, at) != NULL) {
+    parseStop = PARSE_SPLICED;
+    abortCompile();
+  }
+  // Newer edits or requests first; the parse resumes from here later
+  if (inputPending()) {
+    parseStop = PARSE_YIELDED;
+    abortCompile();
+  }
+}
+
+static void parseFrom(Document *d, long from) {
+  long line = lineOf(d, from);
+  char *errors = NULL;
+  size_t size = 0;
+  FILE *messages = open_memstream(&errors, &size);
+  int errorLine, errorCol;
+  Region r;
+
+  parsing = d;
+  regionStart = from;
+  parseStop = PARSE_DONE;
+  setOutputStream(messages);
+  regionHook = onCheckpoint;
+  parseBufferFrom(d->text, d->length, from, line + 1, from - d->lines[line] + 1,
+                  from == 0 ? compileProgram : compileProgramTail);
+  regionHook = NULL;
+  setOutputStream(NULL);
+  fclose(messages);
+
+  if (parseStop == PARSE_DONE) {
+    memset(&r, 0, sizeof(r));
+    r.offset = regionStart;
+    r.end = -1;
+    r.reach = charPos;
+    r.failed = errorRaised;
+    if (errorRaised && sscanf(errors, "%d-%d:%63[^\n]", &errorLine, &errorCol, r.message) == 3)
+      r.errorOffset = byteOffsetAt(d, errorLine - 1, errorCol - 1);
+    putRegion(d, &r);
+  }
+  free(errors);
+}
+
+// Parse the stretches the edits invalidated. Returns 0 when it gave way
+// to pending input before reaching the end of the program.
+static int reparse(Document *d) {
+  Region *r;
+  long from;
+
+  for (;;) {
+    r = findRegion(d, 0);
+    from = 0;
+    while (r != NULL) {
+      if (r->end < 0)
+        return 1;
+      from = r->end;
+      r = findRegion(d, r->end);
+    }
+    parseFrom(d, from);
+    if (parseStop == PARSE_YIELDED)
+      return 0;
+  }
+}
+
+// Rebuild the regions edits dropped between islands, so that fixing an
+// error earlier in the program does not have to parse them all at once.
+// A region's end is a checkpoint whenever its offset is one. Returns 0
+// when it gave way to pending input.
+static int fillGaps(Document *d) {
+  long from;
+  int i;
+
+  for (i = 0; i < d->regionCount; i++) {
+    from = d->regions[i].end;
+    if (from < 0 || findRegion(d, from) != NULL)
+      continue;
+    parseFrom(d, from);
+    if (parseStop == PARSE_YIELDED)
+      return 0;
+    i = lowerRegion(d, from);
+  }
+  return 1;
+}
+
+// The region where the parse of the whole program ends
+static Region *finalRegion(Document *d) {
+  Region *r = findRegion(d, 0);
+
+  while (r != NULL && r->end >= 0)
+    r = findRegion(d, r->end);
+  return r;
+}
+
+/******************************************************************/
+// Edits
+
+static void setText(Document *d, char *text, long length) {
+  long p;
+
+  if (length + 1 > d->capacity) {
+    d->capacity = length + 1 + length / 2;
+    d->text = (char*)realloc(d->text, d->capacity);
+  }
+  memcpy(d->text, text, length);
+  d->length = length;
+  d->text[length] = '\0';
+
+  reserveLines(d, countLines(text, length) + 1);
+  d->lineCount = 1;
+  d->lines[0] = 0;
+  for (p = 0; p < length; p++)
+    if (text[p] == '\n')
+      d->lines[d->lineCount++] = p + 1;
+  memset(d->lineStates, IN_CODE, d->lineCount);
+  d->staleFrom = 0;
+  d->staleTo = d->lineCount;
+
+  d->regionCount = 0;
+  d->dirty = 1;
+}
+
+// Replace the bytes [start, oldEnd) by text
+static void applyEdit(Document *d, long start, long oldEnd, char *text, long length) {
+  long delta = length - (oldEnd - start);
+  long first = lineOf(d, start) + 1, last = lineOf(d, oldEnd) + 1;
+  long added = countLines(text, length), shift = added - (last - first), line, i;
+  Region *r;
+  int kept;
+
+  if (d->length + delta + 1 > d->capacity) {
+    d->capacity = (d->length + delta + 1) * 3 / 2;
+    d->text = (char*)realloc(d->text, d->capacity);
+  }
+  memmove(d->text + start + length, d->text + oldEnd, d->length - oldEnd);
+  memcpy(d->text + start, text, length);
+  d->length += delta;
+  d->text[d->length] = '\0';
+
+  // The line starts in (start, oldEnd] give way to the inserted ones
+  reserveLines(d, d->lineCount - (last - first) + added);
+  memmove(d->lines + first + added, d->lines + last, (d->lineCount - last) * sizeof(long));
+  memmove(d->lineStates + first + added, d->lineStates + last, d->lineCount - last);
+  d->lineCount += shift;
+  for (line = first + added; line < d->lineCount; line++)
+    d->lines[line] += delta;
+  for (i = 0, line = first; i < length; i++)
+    if (text[i] == '\n') {
+      d->lineStates[line] = 255;
+      d->lines[line++] = start + i + 1;
+    }
+
+  // Lines first - 1 to first + added - 1 were edited
+  if (d->staleFrom < 0) {
+    d->staleFrom = first - 1;
+    d->staleTo = first + added - 1;
+  } else {
+    if (d->staleFrom >= last)
+      d->staleFrom += shift;
+    else if (d->staleFrom >= first)
+      d->staleFrom = first - 1;
+    if (d->staleTo >= last)
+      d->staleTo += shift;
+    else if (d->staleTo >= first)
+      d->staleTo = first + added - 1;
+    if (d->staleFrom > first - 1)
+      d->staleFrom = first - 1;
+    if (d->staleTo < first + added - 1)
+      d->staleTo = first + added - 1;
+  }
+
+  // Regions that read nothing at or after the edit stay, those wholly
+  // after it move, the others go
+  for (i = kept = 0; i < d->regionCount; i++) {
+    r = &d->regions[i];
+    if (r->reach >= start) {
+      if (r->offset < oldEnd)
+        continue;
+      r->offset += delta;
+      r->reach += delta;
+      if (r->end >= 0)
+        r->end += delta;
+      if (r->failed)
+        r->errorOffset += delta;
+    }
+    d->regions[kept++] = *r;
+  }
+  if (kept < d->regionCount)
+    d->gaps = 1;
+  d->regionCount = kept;
+  d->dirty = 1;
+}
+
+static void addLatency(double ms) {
+  if (latencyCount == latencyCapacity) {
+    latencyCapacity = latencyCapacity ? latencyCapacity * 2 : 1024;
+    latencies = (double*)realloc(latencies, latencyCapacity * sizeof(double));
+  }
+  latencies[latencyCount++] = ms;
+}
+
+static void publishDiagnostics(Document *d) {
+  Region *r = finalRegion(d);
+  int failed = r != NULL && r->failed;
+  double done = statsClock();
+  long line, character;
+  char *body;
+  size_t size;
+  FILE *f;
+  int i;
+
+  for (i = 0; i < d->editCount; i++)
+    addLatency((done - d->edits[i]) * 1e3);
+  d->editCount = 0;
+
+  f = open_memstream(&body, &size);
+  fputs("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":", f);
+  writeJsonString(f, d->uri, strlen(d->uri));
+  fprintf(f, ",\"version\":%ld,\"diagnostics\":[", d->version);
+  if (failed) {
+    line = lineOf(d, r->errorOffset);
+    character = columnAt(d, line, r->errorOffset);
+    fprintf(f, "{\"range\":{\"start\":{\"line\":%ld,\"character\":%ld},"
+            "\"end\":{\"line\":%ld,\"character\":%ld}},\"severity\":1,\"source\":\"kpl\",\"message\":",
+            line, character, line, character + 1);
+    writeJsonString(f, r->message, strlen(r->message));
+    fputs("}", f);
+  }
+  fputs("]}", f);
+  endMessage(f, &body, &size);
+}
+
+/******************************************************************/
+// Requests
+
+static void openDocument(JsonValue *params) {
+  char *uri = jsonString(params, "textDocument.uri");
+  JsonValue *text = jsonGet(params, "textDocument.text");
+  Document *d;
+
+  if (uri == NULL || text == NULL || text->type != JSON_STRING)
+    return;
+  d = findDocument(uri);
+  if (d == NULL) {
+    d = (Document*)calloc(1, sizeof(Document));
+    d->uri = strdup(uri);
+    if (documentCount == documentCapacity) {
+      documentCapacity = documentCapacity ? documentCapacity * 2 : 8;
+      documents = (Document**)realloc(documents, documentCapacity * sizeof(Document*));
+    }
+    documents[documentCount++] = d;
+  }
+  d->version = jsonInt(params, "textDocument.version", 0);
+  setText(d, text->string, text->length);
+}
+
+static void changeDocument(JsonValue *params, double arrival) {
+  Document *d = findDocument(jsonString(params, "textDocument.uri"));
+  JsonValue *changes = jsonGet(params, "contentChanges"), *change, *text;
+  long start, end;
+
+  if (d == NULL || changes == NULL || changes->type != JSON_ARRAY)
+    return;
+  d->version = jsonInt(params, "textDocument.version", d->version);
+  for (change = changes->child; change != NULL; change = change->next) {
+    text = jsonGet(change, "text");
+    if (text == NULL || text->type != JSON_STRING)
+      continue;
+    if (jsonGet(change, "range") == NULL) {
+      setText(d, text->string, text->length);
+      continue;
+    }
+    start = offsetAt(d, jsonInt(change, "range.start.line", 0), jsonInt(change, "range.start.character", 0));
+    end = offsetAt(d, jsonInt(change, "range.end.line", 0), jsonInt(change, "range.end.character", 0));
+    if (end < start)
+      end = start;
+    applyEdit(d, start, end, text->string, text->length);
+  }
+  if (d->editCount == d->editCapacity) {
+    d->editCapacity = d->editCapacity ? d->editCapacity * 2 : 16;
+    d->edits = (double*)realloc(d->edits, d->editCapacity * sizeof(double));
+  }
+  d->edits[d->editCount++] = arrival;
+}
+
+static void closeDocument(JsonValue *params) {
+  Document *d = findDocument(jsonString(params, "textDocument.uri"));
+  char *body;
+  size_t size;
+  FILE *f;
+  int i;
+
+  if (d == NULL)
+    return;
+  f = open_memstream(&body, &size);
+  fputs("{\"jsonrpc\":\"2.0\",\"method\":\"textDocument/publishDiagnostics\",\"params\":{\"uri\":", f);
+  writeJsonString(f, d->uri, strlen(d->uri));
+  fputs(",\"diagnostics\":[]}", f);
+  endMessage(f, &body, &size);
+
+  for (i = 0; documents[i] != d; i++)
+    ;
+  documents[i] = documents[--documentCount];
+  free(d->uri);
+  free(d->text);
+  free(d->lines);
+  free(d->lineStates);
+  free(d->regions);
+  free(d->edits);
+  free(d);
+}
+
+// Positions are UTF-8 bytes when the client offers that, else the UTF-16
+// units LSP defaults to
+static void sendInitializeResult(JsonValue *id, JsonValue *params) {
+  JsonValue *encodings = jsonGet(params, "capabilities.general.positionEncodings"), *encoding;
+  char *body;
+  size_t size;
+  FILE *f = beginResponse(id, &body, &size);
+  int i;
+
+  utf16Positions = 1;
+  if (encodings != NULL && encodings->type == JSON_ARRAY)
+    for (encoding = encodings->child; encoding != NULL; encoding = encoding->next)
+      if (encoding->type == JSON_STRING && strcmp(encoding->string, "utf-8") == 0)
+        utf16Positions = 0;
+  fprintf(f, "{\"capabilities\":{\"positionEncoding\":\"%s\",", utf16Positions ? "utf-16" : "utf-8");
+  fputs("\"textDocumentSync\":{\"openClose\":true,\"change\":2},"
+        "\"semanticTokensProvider\":{\"legend\":{\"tokenTypes\":[", f);
+  for (i = 0; i < (int)(sizeof(semanticTypes) / sizeof(char*)); i++)
+    fprintf(f, "%s\"%s\"", i > 0 ? "," : "", semanticTypes[i]);
+  fputs("],\"tokenModifiers\":[]},\"full\":true,\"range\":true}},"
+        "\"serverInfo\":{\"name\":\"kpl-parser\",\"version\":\"1.0\"}}", f);
+  endMessage(f, &body, &size);
+}
+
+// Whole lines from first to last
+static void sendSemanticTokens(JsonValue *id, Document *d, long first, long last) {
+  SemanticTokens tokens = {NULL, 0, 0, 0, 0, 0};
+  char *body;
+  size_t size;
+  FILE *f;
+  long line, i;
+
+  while (d->staleFrom >= 0 && d->staleFrom < last)
+    updateLineStates(d, STATE_CHUNK);
+  for (line = first < 0 ? 0 : first; line <= last && line < d->lineCount; line++)
+    scanLine(d, line, d->lineStates[line], &tokens);
+  f = beginResponse(id, &body, &size);
+  fputs("{\"data\":[", f);
+  for (i = 0; i < tokens.count; i++)
+    fprintf(f, i > 0 ? ",%u" : "%u", tokens.data[i]);
+  fputs("]}", f);
+  endMessage(f, &body, &size);
+  free(tokens.data);
+}
+
+static int byValue(const void *a, const void *b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static double percentile(double *sorted, long count, double q) {
+  long i = (long)ceil(q * count) - 1;
+  return count == 0 ? 0 : sorted[i < 0 ? 0 : i];
+}
+
+static void sendStats(JsonValue *id) {
+  double *sorted = (double*)malloc((latencyCount + 1) * sizeof(double));
+  char *body;
+  size_t size;
+  FILE *f;
+
+  memcpy(sorted, latencies, latencyCount * sizeof(double));
+  qsort(sorted, latencyCount, sizeof(double), byValue);
+  f = beginResponse(id, &body, &size);
+  fprintf(f, "{\"edits\":%ld,\"p50Ms\":%.3f,\"p99Ms\":%.3f,\"maxMs\":%.3f}", latencyCount,
+          percentile(sorted, latencyCount, 0.5), percentile(sorted, latencyCount, 0.99),
+          percentile(sorted, latencyCount, 1));
+  endMessage(f, &body, &size);
+  free(sorted);
+}
+
+static void reportLatency(void) {
+  double *sorted;
+
+  if (latencyCount == 0)
+    return;
+  sorted = (double*)malloc(latencyCount * sizeof(double));
+  memcpy(sorted, latencies, latencyCount * sizeof(double));
+  qsort(sorted, latencyCount, sizeof(double), byValue);
+  fprintf(stderr, "kpl lsp: %ld edits, diagnostics after p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+          latencyCount, percentile(sorted, latencyCount, 0.5),
+          percentile(sorted, latencyCount, 0.99), percentile(sorted, latencyCount, 1));
+  free(sorted);
+}
+
+// A later message in the queue makes the request moot
+static int superseded(JsonValue *id, char *uri, int *code) {
+  Message *m;
+  char *method;
+  JsonValue *cancelled;
+
+  for (m = queueHead; m != NULL; m = m->next) {
+    method = jsonString(m->json, "method");
+    if (method == NULL)
+      continue;
+    cancelled = jsonGet(m->json, "params.id");
+    if (strcmp(method, "$/cancelRequest") == 0 && cancelled != NULL && id != NULL &&
+        cancelled->type == id->type && cancelled->number == id->number &&
+        (id->type != JSON_STRING || strcmp(cancelled->string, id->string) == 0)) {
+      *code = REQUEST_CANCELLED;
+      return 1;
+    }
+    if (uri != NULL && strcmp(method, "textDocument/didChange") == 0) {
+      char *changed = jsonString(m->json, "params.textDocument.uri");
+      if (changed != NULL && strcmp(changed, uri) == 0) {
+        *code = CONTENT_MODIFIED;
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Returns the exit status after "exit", -1 otherwise
+static int handleMessage(Message *m) {
+  JsonValue *id = jsonGet(m->json, "id"), *params = jsonGet(m->json, "params");
+  char *method = jsonString(m->json, "method");
+  char *uri = jsonString(params, "textDocument.uri");
+  Document *d;
+  int code;
+
+  if (method == NULL)
+    return -1;                  // a response to us, or malformed
+  if (id != NULL && superseded(id, uri, &code)) {
+    sendError(id, code, code == REQUEST_CANCELLED ? "Request cancelled" : "Content modified");
+    return -1;
+  }
+
+  if (strcmp(method, "initialize") == 0)
+    sendInitializeResult(id, params);
+  else if (strcmp(method, "shutdown") == 0) {
+    shutdownRequested = 1;
+    sendNull(id);
+  } else if (strcmp(method, "exit") == 0)
+    return shutdownRequested ? 0 : 1;
+  else if (strcmp(method, "textDocument/didOpen") == 0)
+    openDocument(params);
+  else if (strcmp(method, "textDocument/didChange") == 0)
+    changeDocument(params, m->arrival);
+  else if (strcmp(method, "textDocument/didClose") == 0)
+    closeDocument(params);
+  else if (strcmp(method, "textDocument/semanticTokens/full") == 0 ||
+           strcmp(method, "textDocument/semanticTokens/range") == 0) {
+    d = findDocument(uri);
+    if (d == NULL)
+      sendError(id, METHOD_NOT_FOUND, "Unknown document");
+    else if (jsonGet(params, "range") != NULL)
+      sendSemanticTokens(id, d, jsonInt(params, "range.start.line", 0), jsonInt(params, "range.end.line", 0));
+    else sendSemanticTokens(id, d, 0, d->lineCount - 1);
+  } else if (strcmp(method, "kpl/stats") == 0)
+    sendStats(id);
+  else if (id != NULL)
+    sendError(id, METHOD_NOT_FOUND, "Method not found");
+  return -1;
+}
+
+int runLanguageServer(void) {
+  Message *m;
+  int status, waiting, i;
+
+  traceEnabled = 0;
+  for (;;) {
+    for (waiting = 1, i = 0; i < documentCount; i++)
+      if (documents[i]->dirty || documents[i]->staleFrom >= 0)
+        waiting = 0;
+    readMessages(waiting);
+    if (queueHead == NULL && inputClosed) {
+      reportLatency();
+      return 1;
+    }
+
+    while ((m = queueHead) != NULL) {
+      queueHead = m->next;
+      if (queueHead == NULL)
+        queueTail = NULL;
+      status = handleMessage(m);
+      freeJson(m->json);
+      free(m);
+      if (status >= 0) {
+        reportLatency();
+        return status;
+      }
+    }
+
+    // Diagnostics once the queue is drained; a parse gives way to new input
+    for (i = 0; i < documentCount && !inputPending(); i++)
+      if (documents[i]->dirty && reparse(documents[i])) {
+        documents[i]->dirty = 0;
+        publishDiagnostics(documents[i]);
+      }
+    // Then islands and highlighting
+    for (i = 0; i < documentCount && !inputPending(); i++)
+      if (documents[i]->gaps && !documents[i]->dirty && fillGaps(documents[i]))
+        documents[i]->gaps = 0;
+    for (i = 0; i < documentCount; i++)
+      while (!inputPending() && !updateLineStates(documents[i], STATE_CHUNK))
+        ;
+  }
+}
@@ -0,0 +1,10 @@
+/* Language server */
+
+#ifndef __LSP_H__
+#define __LSP_H__
+
+// Serve the Language Server Protocol on stdin/stdout until "exit";
+// returns the exit status the protocol asks for
+int runLanguageServer(void);
+
+#endif
@@ -4,24 +4,655 @@
  * @version 1.0
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "reader.h"
 #include "parser.h"
+#include "error.h"
+#include "workpool.h"
+#include "batch.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "incremental.h"
+#include "treefile.h"
+#include "server.h"
+#include "lsp.h"
+#include "typecheck.h"
+#include "codegen.h"
+#include "vm.h"
+#include "closure.h"
+#include "cgen.h"
+#include "fold.h"
+#include "reduce.h"
+#include "iropt.h"
+#include "vector.h"
+#include "stats.h"
+#include "profile.h"
 
 /******************************************************************/
 
+typedef struct {
+  char **items;
+  int count, capacity;
+} FileList;
+
+void addFile(FileList *list, char *fileName) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 16;
+    list->items = (char**)realloc(list->items, list->capacity * sizeof(char*));
+  }
+  list->items[list->count++] = fileName;
+}
+
+// @filelist: one path per line, blank lines are ignored
+int addFileList(FileList *list, char *listName) {
+  FILE *f = fopen(listName, "rt");
+  char *line = NULL;
+  size_t capacity = 0, n;
+
+  if (f == NULL)
+    return IO_ERROR;
+  while (getline(&line, &capacity, f) != -1) {
+    n = strcspn(line, "\r\n");
+    line[n] = '\0';
+    if (n > 0)
+      addFile(list, strdup(line));
+  }
+  free(line);
+  fclose(f);
+  return IO_SUCCESS;
+}
+
+// --outline: print declarations and subroutine signatures, skimming bodies.
+// --body NAME: outline the file, then parse only the body of NAME.
+int compileOutlineOf(char *fileName, char *bodyName) {
+  Outline outline;
+  Subroutine *sub;
+  int status;
+
+  initOutline(&outline);
+  status = compileOutline(fileName, &outline);
+  if (status == IO_SUCCESS) {
+    if (bodyName == NULL)
+      printOutline(&outline, stdout);
+    else if ((sub = findSubroutine(&outline, bodyName)) == NULL)
+      printf("parser: no subroutine %s.\n", bodyName);
+    else status = compileBody(fileName, sub);
+  }
+  freeOutline(&outline);
+  return status;
+}
+
+int compileVersions(char **fileNames, int count) {
+  Incremental inc;
+  int i;
+
+  initIncremental(&inc);
+  for (i = 0; i < count; i++) {
+    printf("==> %s <==\n", fileNames[i]);
+    if (compileIncremental(fileNames[i], &inc) == IO_ERROR) {
+      printf("Can\'t read input file!\n");
+      continue;
+    }
+    fflush(stdout);
+    fprintf(stderr, "%s: %d subroutines reused, %d reparsed\n", fileNames[i], inc.reused, inc.reparsed);
+  }
+  freeIncremental(&inc);
+  return 0;
+}
+
+int checkFile(char *fileName) {
+  CheckedProgram program;
+  int status;
+
+  initCheckedProgram(&program);
+  status = checkProgram(fileName, &program);
+  freeCheckedProgram(&program);
+  return status;
+}
+
+// parser run [--engine bytecode|closure|jit|ir] [--jit-threshold N]
+// [--no-fold|--fold-report] [--no-reduce] [--no-ir-opt] [--dump-code]
+// [--dump-ir] [--no-vector|--vector-report] [--simd avx2|sse2|scalar]
+// [--time] FILE: check the program, fold its constants, reduce the
+// strength of its operations by numbers, vectorize its loops over arrays,
+// compile it for the engine and run it on stdin and stdout. --dump-code
+// prints the bytecode, or the IR with --engine ir, instead of running it;
+// --dump-ir is --engine ir --dump-code. Only the closure engine runs
+// loops vectorized, with the --simd kernels or else the widest there are.
+typedef enum {
+  ENGINE_BYTECODE,
+  ENGINE_CLOSURE,
+  ENGINE_JIT,
+  ENGINE_IR       // SSA form, optimized unless --no-ir-opt
+} Engine;
+
+typedef enum {
+  FOLD_OFF,
+  FOLD_ON,
+  FOLD_REPORT     // each folding and reduction, then a summary, on stderr
+} FoldMode;
+
+void foldProgram(CheckedProgram *program, FoldMode mode, int reduce) {
+  FILE *report = mode == FOLD_REPORT ? stderr : NULL;
+  FoldStats stats;
+  ReduceStats reduced;
+
+  if (mode != FOLD_OFF) {
+    foldConstants(program, &stats, report);
+    if (report != NULL)
+      fprintf(report, "folded %d expressions (%d operations) and %d constants, "
+              "%d indexes need no check, %d operations left to fail at run time\n",
+              stats.expressions, stats.operations, stats.constants, stats.indexes, stats.kept);
+  }
+  if (reduce) {
+    reduceStrength(program, &reduced, report);
+    if (report != NULL)
+      fprintf(report, "reduced %d operations to shifts, %d to masks and %d powers to "
+              "%d multiplications, dropped %d operations by 1\n",
+              reduced.shifts, reduced.masks, reduced.powers, reduced.multiplications,
+              reduced.identities);
+  }
+}
+
+typedef enum {
+  VECTOR_OFF,
+  VECTOR_ON,
+  VECTOR_REPORT   // each loop, then a summary, on stderr
+} VectorMode;
+
+void vectorizeProgram(CheckedProgram *program, VectorMode mode) {
+  FILE *report = mode == VECTOR_REPORT ? stderr : NULL;
+  VectorStats stats;
+
+  if (mode == VECTOR_OFF)
+    return;
+  vectorizeLoops(program, &stats, report);
+  if (report != NULL)
+    fprintf(report, "vectorized %d of %d loops, %d of them sums, with the %s kernels\n",
+            stats.vectorized, stats.loops, stats.sums, simdKernels()->name);
+}
+
+// --time: the phases of a run on stderr, with the moment the program
+// first wrote to stdout, which is what a short grading run waits for
+static double firstOutput;
+
+static ssize_t timedWrite(void *cookie, const char *buffer, size_t size) {
+  if (firstOutput == 0)
+    firstOutput = statsClock();
+  return fwrite(buffer, 1, size, stdout);
+}
+
+// --time with the IR: what each pass took and changed, and the
+// instructions the run went through
+static int runIrProgram(CheckedProgram *program, int optimize, int dumpCode, FILE *out,
+                        int timed, double *generated) {
+  IrPassStats stats[IR_PASS_RUNS];
+  IrProgram ir;
+  long executed;
+  int status = 0, i;
+
+  buildIr(program, &ir);
+  if (optimize)
+    optimizeIr(&ir, stats);
+  *generated = statsClock();
+  if (optimize && (timed || dumpCode))
+    for (i = 0; i < IR_PASS_RUNS; i++)
+      fprintf(stderr, "ir: %-6s %6d -> %6d instructions, %d changed, %.1f us\n", stats[i].name,
+              stats[i].before, stats[i].after, stats[i].changed, stats[i].seconds * 1e6);
+  if (dumpCode)
+    printIr(&ir, out);
+  else {
+    status = runIr(&ir, stdin, out, &executed);
+    if (timed)
+      fprintf(stderr, "ir: %ld instructions executed\n", executed);
+  }
+  freeIr(&ir);
+  return status;
+}
+
+int runFile(char *fileName, Engine engine, int jitThreshold, FoldMode fold, int reduce,
+            VectorMode vectorize, int optimize, int dumpCode, int timed) {
+  static cookie_io_functions_t timedStream = {NULL, timedWrite, NULL, NULL};
+  CheckedProgram program;
+  Bytecode bc;
+  ClosureProgram closures;
+  Jit jit;
+  FILE *out = stdout;
+  double start = statsClock(), checked, generated;
+  int status;
+
+  initCheckedProgram(&program);
+  traceEnabled = 0;
+  status = checkProgram(fileName, &program);
+  traceEnabled = 1;
+  if (status == IO_ERROR) {
+    freeCheckedProgram(&program);
+    printf("Can\'t read input file!\n");
+    return -1;
+  }
+  if (program.failed) {
+    freeCheckedProgram(&program);
+    return 1;
+  }
+  checked = statsClock();
+  foldProgram(&program, fold, reduce);
+  vectorizeProgram(&program, vectorize);
+  if (timed) {
+    out = fopencookie(NULL, "w", timedStream);
+    setvbuf(out, NULL, _IONBF, 0);
+  }
+
+  if (engine == ENGINE_IR)
+    status = runIrProgram(&program, optimize, dumpCode, out, timed, &generated);
+  else if (engine == ENGINE_CLOSURE) {
+    compileClosures(&program, &closures);
+    generated = statsClock();
+    status = runClosures(&closures, stdin, out);
+    if (timed && vectorize != VECTOR_OFF)
+      fprintf(stderr, "closure: %s kernels for vectorized loops\n", simdKernels()->name);
+    freeClosures(&closures);
+  } else {
+    initBytecode(&bc);
+    generateBytecode(&program, &bc);
+    generated = statsClock();
+    if (dumpCode)
+      printBytecode(&bc, out);
+    else if (engine == ENGINE_JIT) {
+      initJit(&jit, &bc, jitThreshold);
+      status = runBytecodeJit(&bc, stdin, out, &jit);
+      if (timed)
+        fprintf(stderr, "jit: %s, %zu bytes in %.1f us\n",
+                jit.table != NULL ? "compiled" : jit.failed ? "unavailable" : "not hot",
+                jit.size, jit.compileSeconds * 1e6);
+      freeJit(&jit);
+    } else status = runBytecode(&bc, stdin, out);
+    freeBytecode(&bc);
+  }
+
+  if (timed) {
+    fclose(out);
+    fflush(stdout);
+    fprintf(stderr, "check %.1f us, generate %.1f us, first output %.1f us, total %.1f us\n",
+            (checked - start) * 1e6, (generated - checked) * 1e6,
+            firstOutput > 0 ? (firstOutput - start) * 1e6 : 0, (statsClock() - start) * 1e6);
+  }
+  freeCheckedProgram(&program);
+  return status;
+}
+
+int runMain(int argc, char *argv[]) {
+  char *fileName = NULL;
+  Engine engine = ENGINE_BYTECODE;
+  FoldMode fold = FOLD_ON;
+  VectorMode vectorize = VECTOR_ON;
+  int jitThreshold = JIT_THRESHOLD;
+  int reduce = 1, optimize = 1, dumpCode = 0, timed = 0;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--dump-code") == 0)
+      dumpCode = 1;
+    else if (strcmp(argv[i], "--dump-ir") == 0) {
+      engine = ENGINE_IR;
+      dumpCode = 1;
+    }
+    else if (strcmp(argv[i], "--time") == 0)
+      timed = 1;
+    else if (strcmp(argv[i], "--no-fold") == 0)
+      fold = FOLD_OFF;
+    else if (strcmp(argv[i], "--fold-report") == 0)
+      fold = FOLD_REPORT;
+    else if (strcmp(argv[i], "--no-reduce") == 0)
+      reduce = 0;
+    else if (strcmp(argv[i], "--no-ir-opt") == 0)
+      optimize = 0;
+    else if (strcmp(argv[i], "--no-vector") == 0)
+      vectorize = VECTOR_OFF;
+    else if (strcmp(argv[i], "--vector-report") == 0)
+      vectorize = VECTOR_REPORT;
+    else if (strcmp(argv[i], "--simd") == 0 && i + 1 < argc) {
+      if (!selectSimdKernels(argv[++i])) {
+        printf("parser: no %s kernels on this processor.\n", argv[i]);
+        return -1;
+      }
+    }
+    else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc) {
+      i++;
+      if (strcmp(argv[i], "closure") == 0)
+        engine = ENGINE_CLOSURE;
+      else if (strcmp(argv[i], "bytecode") == 0)
+        engine = ENGINE_BYTECODE;
+      else if (strcmp(argv[i], "jit") == 0)
+        engine = ENGINE_JIT;
+      else if (strcmp(argv[i], "ir") == 0)
+        engine = ENGINE_IR;
+      else {
+        printf("parser: unknown engine %s.\n", argv[i]);
+        return -1;
+      }
+    } else if (strcmp(argv[i], "--jit-threshold") == 0 && i + 1 < argc)
+      jitThreshold = atoi(argv[++i]);
+    else fileName = argv[i];
+  }
+  if (fileName == NULL) {
+    printf("parser: no input file.\n");
+    return -1;
+  }
+  if (dumpCode && engine == ENGINE_CLOSURE)
+    fprintf(stderr, "parser: --dump-code shows bytecode and IR only\n");
+  if (vectorize == VECTOR_REPORT && engine != ENGINE_CLOSURE)
+    fprintf(stderr, "parser: only --engine closure runs loops vectorized\n");
+  return runFile(fileName, engine, jitThreshold, fold, reduce, vectorize, optimize, dumpCode, timed);
+}
+
+// parser build [-o OUTPUT] [--emit-c] FILE: translate the program to C
+// and compile that with gcc -O2 into OUTPUT (a.out). --emit-c writes the
+// C to stdout instead.
+int buildMain(int argc, char *argv[]) {
+  char *fileName = NULL, *output = "a.out", command[1024];
+  CheckedProgram program;
+  FILE *cc;
+  int emitC = 0, status, i;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--emit-c") == 0)
+      emitC = 1;
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+      output = argv[++i];
+    else fileName = argv[i];
+  }
+  if (fileName == NULL) {
+    printf("parser: no input file.\n");
+    return -1;
+  }
+  if (strchr(output, '\'') != NULL) {
+    printf("parser: unusable output name %s.\n", output);
+    return -1;
+  }
+
+  initCheckedProgram(&program);
+  traceEnabled = 0;
+  status = checkProgram(fileName, &program);
+  traceEnabled = 1;
+  if (status == IO_ERROR) {
+    freeCheckedProgram(&program);
+    printf("Can\'t read input file!\n");
+    return -1;
+  }
+  if (program.failed) {
+    freeCheckedProgram(&program);
+    return 1;
+  }
+
+  // gcc reduces the operations by numbers of the C itself
+  foldProgram(&program, FOLD_ON, 0);
+  if (emitC) {
+    generateC(&program, stdout);
+    status = 0;
+  } else {
+    snprintf(command, sizeof(command), "gcc -O2 -x c -o '%s' -", output);
+    if ((cc = popen(command, "w")) == NULL) {
+      freeCheckedProgram(&program);
+      printf("parser: can\'t run gcc.\n");
+      return -1;
+    }
+    generateC(&program, cc);
+    status = pclose(cc) != 0;
+    if (status)
+      printf("parser: gcc failed on the translation of %s.\n", fileName);
+  }
+  freeCheckedProgram(&program);
+  return status;
+}
+
+// --cache DIR: trees are stored as DIR/<source hash>.kplt and mapped back
+// instead of reparsing when the source has not changed
+int compileCached(char *fileName, char *cacheDir, int dump) {
+  ParseTree tree;
+  TreeFile file;
+  uint64_t hash;
+  char *path;
+  int status;
+  double start = statsClock(), hashed;
+
+  hash = hashSourceFile(fileName, &status);
+  if (status == IO_ERROR)
+    return IO_ERROR;
+  hashed = statsClock();
+  path = (char*)malloc(strlen(cacheDir) + 32);
+  sprintf(path, "%s/%016llx.kplt", cacheDir, (unsigned long long)hash);
+
+  if (mapTree(path, &file) == IO_SUCCESS && file.header->sourceHash == hash) {
+    fprintf(stderr, "cache hit: %u nodes mapped in %.1f us (source hashed in %.1f us)\n",
+            file.header->nodeCount, (statsClock() - hashed) * 1e6, (hashed - start) * 1e6);
+  } else {
+    unmapTree(&file);
+    initTree(&tree);
+    traceEnabled = 0;
+    status = compileTree(fileName, &tree);
+    traceEnabled = 1;
+    if (status == IO_SUCCESS && !tree.failed)
+      saveTree(&tree, hash, path);
+    freeTree(&tree);
+    if (status == IO_ERROR || mapTree(path, &file) == IO_ERROR) {
+      free(path);
+      return status;
+    }
+    fprintf(stderr, "cache miss: parsed and stored %u nodes in %.3f ms\n",
+            file.header->nodeCount, (statsClock() - start) * 1e3);
+  }
+
+  if (dump)
+    printFlatTree(&file, stdout);
+  unmapTree(&file);
+  free(path);
+  return IO_SUCCESS;
+}
+
+// --stats[=json]: counters and phase times of the run, printed on stderr
+// when main() returns
+static Stats runStats;
+static double runStart;
+static int statsJson;
+
+static void reportRunStats(void) {
+  fflush(stdout);
+  finishStats(&runStats, runStart);
+  reportStats(&runStats, stderr, statsJson);
+}
+
+// --profile: time spent in each grammar rule, with --profile-trace FILE
+// also written as a Chrome trace
+static char *profileTrace;
+
+static void reportProfile(void) {
+  Profiler *p = profiler;
+
+  fflush(stdout);
+  finishProfile(p);
+  printProfile(p, stderr);
+  if (profileTrace != NULL && writeChromeTrace(p, profileTrace) != 0)
+    fprintf(stderr, "parser: can't write %s\n", profileTrace);
+  profiler = NULL;
+  freeProfiler(p);
+}
+
 int main(int argc, char *argv[]) {
-  if (argc <= 1) {
+  FileList files = {NULL, 0, 0};
+  int jobs = 0;
+  int outlineOnly = 0;
+  int parallelBodies = 0;
+  int pipelined = 0;
+  int incrementalVersions = 0;
+  char *cacheDir = NULL;
+  int dumpTree = 0;
+  char *bodyName = NULL;
+  char *socketPath = NULL;
+  int fileLists = 0;
+  int languageServer = 0;
+  int checkNames = 0;
+  int statsEnabled = 0;
+  int profiled = 0;
+  long profileSample = 0;
+  long profileEvents = DEFAULT_TRACE_EVENTS;
+  int i;
+
+  if (argc > 1 && strcmp(argv[1], "run") == 0)
+    return runMain(argc - 1, argv + 1);
+  if (argc > 1 && strcmp(argv[1], "build") == 0)
+    return buildMain(argc - 1, argv + 1);
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+      if (jobs <= 0) jobs = defaultJobCount();
+    } else if (strcmp(argv[i], "--outline") == 0) {
+      outlineOnly = 1;
+    } else if (strcmp(argv[i], "--parallel") == 0) {
+      parallelBodies = 1;
+    } else if (strcmp(argv[i], "--pipeline") == 0) {
+      pipelined = 1;
+    } else if (strcmp(argv[i], "--incremental") == 0) {
+      incrementalVersions = 1;
+    } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+      cacheDir = argv[++i];
+    } else if (strcmp(argv[i], "--dump-tree") == 0) {
+      dumpTree = 1;
+    } else if (strcmp(argv[i], "--serve") == 0) {
+      socketPath = i + 1 < argc && argv[i + 1][0] != '-' ? argv[++i] : "";
+    } else if (strcmp(argv[i], "--lsp") == 0) {
+      languageServer = 1;
+    } else if (strcmp(argv[i], "--check") == 0) {
+      checkNames = 1;
+    } else if (strcmp(argv[i], "--stats") == 0 || strcmp(argv[i], "--stats=text") == 0) {
+      statsEnabled = 1;
+    } else if (strcmp(argv[i], "--stats=json") == 0) {
+      statsEnabled = 1;
+      statsJson = 1;
+    } else if (strcmp(argv[i], "--profile") == 0) {
+      profiled = 1;
+    } else if (strcmp(argv[i], "--profile-trace") == 0 && i + 1 < argc) {
+      profiled = 1;
+      profileTrace = argv[++i];
+    } else if (strcmp(argv[i], "--profile-sample") == 0 && i + 1 < argc) {
+      profiled = 1;
+      profileSample = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--profile-events") == 0 && i + 1 < argc) {
+      profileEvents = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--body") == 0 && i + 1 < argc) {
+      bodyName = argv[++i];
+    } else if (argv[i][0] == '@') {
+      fileLists = 1;
+      if (addFileList(&files, argv[i] + 1) == IO_ERROR) {
+        printf("Can\'t read file list %s!\n", argv[i] + 1);
+        return -1;
+      }
+    } else addFile(&files, argv[i]);
+  }
+
+  // Stay resident and parse requests from kplclient
+  if (socketPath != NULL) {
+    if (socketPath[0] == '\0' && (socketPath = defaultSocketPath()) == NULL) {
+      printf("parser: no private directory for the socket, name one after --serve!\n");
+      return -1;
+    }
+    if (runServer(socketPath, jobs > 0 ? jobs : defaultJobCount()) == IO_ERROR) {
+      printf("parser: can't listen on %s!\n", socketPath);
+      return -1;
+    }
+    return 0;
+  }
+
+  // Language server on stdin/stdout for an editor
+  if (languageServer)
+    return runLanguageServer();
+
+  if (files.count == 0) {
     printf("parser: no input file.\n");
     return -1;
   }
 
-  if (compile(argv[1]) == IO_ERROR) {
+  if (statsEnabled) {
+    if (parallelBodies || pipelined || files.count > 1 || fileLists || jobs > 0)
+      fprintf(stderr, "parser: --stats counts the main thread only\n");
+    initStats(&runStats);
+    stats = &runStats;
+    runStart = statsClock();
+    atexit(reportRunStats);
+  }
+
+  if (profiled) {
+    if (parallelBodies || pipelined || files.count > 1 || fileLists || jobs > 0)
+      fprintf(stderr, "parser: --profile covers the main thread only\n");
+    profiler = newProfiler(profileSample, profileEvents);
+    atexit(reportProfile);
+  }
+
+  if (checkNames && (outlineOnly || bodyName != NULL || parallelBodies || pipelined ||
+                     cacheDir != NULL || incrementalVersions || files.count > 1 || fileLists ||
+                     jobs > 0))
+    fprintf(stderr, "parser: --check applies to a plain parse of one file\n");
+
+  if (outlineOnly || bodyName != NULL) {
+    if (compileOutlineOf(files.items[0], bodyName) == IO_ERROR) {
+      printf("Can\'t read input file!\n");
+      return -1;
+    }
+    return 0;
+  }
+
+  // Subroutine bodies of one file parsed on several threads
+  if (parallelBodies) {
+    if (compileParallel(files.items[0], jobs > 0 ? jobs : defaultJobCount()) == IO_ERROR) {
+      printf("Can\'t read input file!\n");
+      return -1;
+    }
+    return 0;
+  }
+
+  // Lexer, parser and output writer on separate threads
+  if (pipelined) {
+    if (compilePipelined(files.items[0]) == IO_ERROR) {
+      printf("Can\'t read input file!\n");
+      return -1;
+    }
+    return 0;
+  }
+
+  if (cacheDir != NULL) {
+    if (compileCached(files.items[0], cacheDir, dumpTree) == IO_ERROR) {
+      printf("Can\'t read input file!\n");
+      return -1;
+    }
+    return 0;
+  }
+
+  // The files are successive versions of one program
+  if (incrementalVersions)
+    return compileVersions(files.items, files.count);
+
+  // Batch mode: several files, a file list or an explicit job count
+  if (files.count > 1 || jobs > 0 || fileLists)
+    return compileBatch(files.items, files.count, jobs > 0 ? jobs : defaultJobCount()) ? 1 : 0;
+
+  // --check: names and types are checked too
+  if (checkNames) {
+    if (checkFile(files.items[0]) == IO_ERROR) {
+      printf("Can\'t read input file!\n");
+      return -1;
+    }
+    return 0;
+  }
+
+  if (compile(files.items[0]) == IO_ERROR) {
     printf("Can\'t read input file!\n");
     return -1;
   }
     
   return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,68 @@
+/* Outline */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "outline.h"
+
+void initOutline(Outline *outline) {
+  outline->subs = NULL;
+  outline->count = 0;
+  outline->capacity = 0;
+  outline->traced = 0;
+}
+
+void freeOutline(Outline *outline) {
+  free(outline->subs);
+  initOutline(outline);
+}
+
+Subroutine *addSubroutine(Outline *outline, SubKind kind, Token *name, int depth) {
+  Subroutine *sub;
+
+  if (outline->count == outline->capacity) {
+    outline->capacity = outline->capacity ? outline->capacity * 2 : 16;
+    outline->subs = (Subroutine*)realloc(outline->subs, outline->capacity * sizeof(Subroutine));
+  }
+  sub = &outline->subs[outline->count++];
+  memset(sub, 0, sizeof(Subroutine));
+  sub->kind = kind;
+  strcpy(sub->name, name->string);
+  sub->depth = depth;
+  sub->lineNo = name->lineNo;
+  sub->colNo = name->colNo;
+  return sub;
+}
+
+// KPL identifiers are not case sensitive
+Subroutine *findSubroutine(Outline *outline, char *name) {
+  int i;
+  for (i = 0; i < outline->count; i++)
+    if (strcasecmp(outline->subs[i].name, name) == 0)
+      return &outline->subs[i];
+  return NULL;
+}
+
+static char *subKindToString(SubKind kind) {
+  switch (kind) {
+  case SUB_PROGRAM: return "PROGRAM";
+  case SUB_FUNCTION: return "FUNCTION";
+  case SUB_PROCEDURE: return "PROCEDURE";
+  default: return "";
+  }
+}
+
+void printOutline(Outline *outline, FILE *out) {
+  Subroutine *sub;
+  int i;
+
+  for (i = 0; i < outline->count; i++) {
+    sub = &outline->subs[i];
+    fprintf(out, "%*s%s %s %d-%d: %d params, %d consts, %d types, %d vars, body %d-%d..%d-%d tokens %ld..%ld\n",
+            2 * sub->depth, "", subKindToString(sub->kind), sub->name, sub->lineNo, sub->colNo,
+            sub->paramCount, sub->constCount, sub->typeCount, sub->varCount,
+            sub->bodyLineNo, sub->bodyColNo, sub->endLineNo, sub->endColNo,
+            sub->firstToken, sub->lastToken);
+  }
+}
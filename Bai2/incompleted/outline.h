@@ -0,0 +1,45 @@
+/* Outline */
+
+#ifndef __OUTLINE_H__
+#define __OUTLINE_H__
+
+#include <stdio.h>
+#include "token.h"
+
+typedef enum {
+  SUB_PROGRAM,
+  SUB_FUNCTION,
+  SUB_PROCEDURE
+} SubKind;
+
+// A program or subroutine whose BEGIN ... END body was skimmed, not parsed
+typedef struct {
+  SubKind kind;
+  char name[MAX_IDENT_LEN + 1];
+  int depth;
+  int lineNo, colNo;
+  int paramCount;
+  int constCount, typeCount, varCount;
+  // Body: tokens [firstToken, lastToken], from BEGIN to the matching END
+  long firstToken, lastToken;
+  long bodyOffset;
+  int bodyLineNo, bodyColNo;
+  int endLineNo, endColNo;
+  int skimmed;
+  // Traced outlines: where the body's trace belongs in the outline trace
+  long traceOffset;
+} Subroutine;
+
+typedef struct {
+  Subroutine *subs;
+  int count, capacity;
+  int traced;
+} Outline;
+
+void initOutline(Outline *outline);
+void freeOutline(Outline *outline);
+Subroutine *addSubroutine(Outline *outline, SubKind kind, Token *name, int depth);
+Subroutine *findSubroutine(Outline *outline, char *name);
+void printOutline(Outline *outline, FILE *out);
+
+#endif
@@ -0,0 +1,110 @@
+/* Parallel body parsing */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reader.h"
+#include "scanner.h"
+#include "parser.h"
+#include "error.h"
+#include "outline.h"
+#include "workpool.h"
+#include "stats.h"
+#include "parallel.h"
+
+typedef struct {
+  Subroutine *sub;
+  char *text;
+  size_t length;
+  long tokens;
+  int failed;
+} BodyResult;
+
+typedef struct {
+  char *fileName;
+  BodyResult *bodies;
+} BodyJobs;
+
+static int compareBodies(const void *a, const void *b) {
+  long x = ((BodyResult*)a)->sub->traceOffset;
+  long y = ((BodyResult*)b)->sub->traceOffset;
+  return x < y ? -1 : x > y;
+}
+
+static void compileOneBody(int index, void *arg) {
+  BodyJobs *jobs = (BodyJobs*)arg;
+  BodyResult *body = &jobs->bodies[index];
+  FILE *out = open_memstream(&body->text, &body->length);
+
+  setOutputStream(out);
+  compileBody(jobs->fileName, body->sub);
+  body->failed = errorRaised;
+  body->tokens = tokenCount;
+  setOutputStream(NULL);
+  fclose(out);
+}
+
+// Pass 1 parses declarations and headers and skims every body, keeping its
+// trace. Pass 2 parses the bodies concurrently. The traces are then merged
+// back in source order, which gives the output of a sequential compile().
+int compileParallel(char *fileName, int jobs) {
+  Outline outline;
+  BodyJobs bodyJobs;
+  char *trace = NULL;
+  size_t traceLength = 0, pos = 0;
+  FILE *out;
+  long tokens;
+  int i, count = 0, status;
+  double start, skimmed, parsed;
+
+  start = statsClock();
+  initOutline(&outline);
+  outline.traced = 1;
+  out = open_memstream(&trace, &traceLength);
+  setOutputStream(out);
+  status = compileOutline(fileName, &outline);
+  tokens = tokenCount;
+  setOutputStream(NULL);
+  fclose(out);
+  if (status == IO_ERROR) {
+    free(trace);
+    freeOutline(&outline);
+    return IO_ERROR;
+  }
+  skimmed = statsClock();
+
+  // Only bodies reached by the outline pass are parsed
+  bodyJobs.fileName = fileName;
+  bodyJobs.bodies = (BodyResult*)calloc(outline.count, sizeof(BodyResult));
+  for (i = 0; i < outline.count; i++)
+    if (outline.subs[i].bodyLineNo > 0)
+      bodyJobs.bodies[count++].sub = &outline.subs[i];
+  qsort(bodyJobs.bodies, count, sizeof(BodyResult), compareBodies);
+
+  runWorkPool(jobs, count, compileOneBody, &bodyJobs);
+  parsed = statsClock();
+
+  for (i = 0; i < count; i++) {
+    BodyResult *body = &bodyJobs.bodies[i];
+    fwrite(trace + pos, 1, body->sub->traceOffset - pos, stdout);
+    pos = body->sub->traceOffset;
+    fwrite(body->text, 1, body->length, stdout);
+    // The first error in source order ends the output, as in compile()
+    if (body->failed || !body->sub->skimmed)
+      break;
+  }
+  if (i == count)
+    fwrite(trace + pos, 1, traceLength - pos, stdout);
+  fflush(stdout);
+
+  for (i = 0; i < count; i++)
+    free(bodyJobs.bodies[i].text);
+  fprintf(stderr, "%d bodies, %ld outline tokens, %d jobs: skim %.3f s, bodies %.3f s\n",
+          count, tokens, jobs, skimmed - start, parsed - skimmed);
+
+  free(bodyJobs.bodies);
+  free(trace);
+  freeOutline(&outline);
+  return IO_SUCCESS;
+}
@@ -0,0 +1,8 @@
+/* Parallel body parsing */
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+int compileParallel(char *fileName, int jobs);
+
+#endif
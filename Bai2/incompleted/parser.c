@@ -10,35 +10,211 @@
 #include "scanner.h"
 #include "parser.h"
 #include "error.h"
+#include "incremental.h"
+#include "profile.h"
+#include "symtab.h"
 
-Token *currentToken;
-Token *lookAhead;
+__thread Token *currentToken;
+__thread Token *lookAhead;
+
+// Where scan() gets its tokens from; NULL means the scanner itself
+__thread TokenSource tokenSource;
+
+// Outline mode: declarations are parsed, BEGIN ... END bodies are only skimmed
+__thread Outline *outline;
+__thread int currentSub = -1;
+
+// Incremental mode: unchanged top-level subroutines reuse their last result
+__thread Incremental *incremental;
+
+// Parse tree being built (NULL: trace only) and the node receiving children
+__thread ParseTree *parseTree;
+__thread Node *currentNode;
+
+// Nesting of blocks, types, statements and factors; deeper input is
+// rejected before the recursion can overflow the stack
+__thread int nestingLevel;
+
+// Language server: called at each top-level subroutine and at the main
+// body, where the parse can later be resumed (see compileProgramTail)
+__thread void (*regionHook)(void);
+
+// Name checking (--check): declarations and uses of identifiers are
+// resolved against the open scopes; NULL: syntax only
+__thread SymbolTable *symbols;
 
 void scan(void) {
-  Token* tmp = currentToken;
+  freeToken(currentToken);
   currentToken = lookAhead;
-  lookAhead = getValidToken();
-  free(tmp);
+  // Cleared first: a lexical error jumps out of getValidToken()
+  lookAhead = NULL;
+  lookAhead = tokenSource != NULL ? tokenSource() : getValidToken();
 }
 
 void eat(TokenType tokenType) {
   if (lookAhead->tokenType == tokenType) {
-    printToken(lookAhead);
+    if (traceEnabled)
+      printToken(lookAhead);
     scan();
   } else missingToken(tokenType, lookAhead->lineNo, lookAhead->colNo);
 }
 
+void enterNesting(void) {
+  if (++nestingLevel > MAX_NESTING)
+    error(ERR_NESTINGTOODEEP, lookAhead->lineNo, lookAhead->colNo);
+}
+
+// Start a node under the current one and make it current. Returns the
+// node to give back to endNode().
+Node *beginNode(NodeKind kind, Token *token) {
+  Node *saved = currentNode;
+
+  if (parseTree == NULL)
+    return NULL;
+  currentNode = newNode(parseTree, kind, token);
+  currentNode->op = token->tokenType;
+  if (saved != NULL)
+    appendChild(saved, currentNode);
+  else parseTree->root = currentNode;
+  return saved;
+}
+
+// Like beginNode(), but the last child parsed so far becomes the first
+// operand of the new node (left associative operators, comparisons)
+Node *beginOperator(NodeKind kind, Token *token) {
+  Node *saved = currentNode, *left;
+
+  if (parseTree == NULL)
+    return NULL;
+  left = removeLastChild(saved);
+  beginNode(kind, token);
+  currentNode->op = token->tokenType;
+  appendChild(currentNode, left);
+  return saved;
+}
+
+void endNode(Node *saved) {
+  if (parseTree != NULL)
+    currentNode = saved;
+}
+
+Node *addLeaf(NodeKind kind, Token *token) {
+  Node *saved = beginNode(kind, token);
+  Node *leaf = currentNode;
+  endNode(saved);
+  return leaf;
+}
+
+// Name of the current node: the token just eaten
+void nameNode(void) {
+  if (currentNode != NULL)
+    setNodeText(parseTree, currentNode, currentToken->string);
+}
+
+// Leaf for the number, char, string or identifier just eaten
+Node *addTokenLeaf(void) {
+  Node *leaf;
+
+  switch (currentToken->tokenType) {
+  case TK_NUMBER:
+    leaf = addLeaf(N_NUMBER, currentToken);
+    break;
+  case TK_CHAR:
+    leaf = addLeaf(N_CHAR, currentToken);
+    break;
+  case TK_STRING:
+    leaf = addLeaf(N_STRING, currentToken);
+    break;
+  default:
+    leaf = addLeaf(N_VARIABLE, currentToken);
+    break;
+  }
+  if (leaf == NULL)
+    return NULL;
+  leaf->value = currentToken->value;
+  if (leaf->kind == N_STRING || leaf->kind == N_VARIABLE)
+    setNodeText(parseTree, leaf, currentToken->string);
+  return leaf;
+}
+
+// Declare the identifier just eaten in the innermost scope, by the
+// current node
+void declareIdent(SymbolKind kind) {
+  Symbol *symbol;
+
+  if (symbols == NULL)
+    return;
+  symbol = declareSymbol(symbols, currentToken->string, kind, currentToken->lineNo, currentToken->colNo);
+  if (symbol == NULL)
+    error(ERR_DUPLICATEIDENT, currentToken->lineNo, currentToken->colNo);
+  symbol->node = currentNode;
+  if (currentNode != NULL)
+    currentNode->symbol = symbol;
+}
+
+// The identifier just eaten must be declared as one of kinds; err is
+// reported when it is declared as something else
+Symbol *checkIdent(unsigned kinds, ErrorCode err) {
+  Symbol *symbol;
+
+  if (symbols == NULL)
+    return NULL;
+  symbol = lookupSymbol(symbols, currentToken->string);
+  // A missing name is reported as the kind expected, unless several are
+  if (symbol == NULL)
+    error(err == ERR_INVALIDLVALUE || err == ERR_INVALIDFACTOR ? ERR_UNDECLAREDIDENT : err,
+          currentToken->lineNo, currentToken->colNo);
+  if ((KIND_BIT(symbol->kind) & kinds) == 0)
+    error(err, currentToken->lineNo, currentToken->colNo);
+  return symbol;
+}
+
+void bindSymbol(Node *node, Symbol *symbol) {
+  if (node != NULL)
+    node->symbol = symbol;
+}
+
+void openScope(void) {
+  if (symbols != NULL)
+    enterScope(symbols);
+}
+
+void closeScope(void) {
+  if (symbols != NULL)
+    exitScope(symbols);
+}
+
+int enterSubroutine(SubKind kind) {
+  int saved = currentSub;
+  if (outline != NULL) {
+    addSubroutine(outline, kind, currentToken, saved < 0 ? 0 : outline->subs[saved].depth + 1);
+    currentSub = outline->count - 1;
+  }
+  return saved;
+}
+
 void compileProgram(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_PROGRAM, lookAhead);
   assert("Parsing a Program ....");
   eat(KW_PROGRAM);
   eat(TK_IDENT);
+  nameNode();
+  declareIdent(SYM_PROGRAM);
+  enterSubroutine(SUB_PROGRAM);
   eat(SB_SEMICOLON);
+  openScope();
   compileBlock();
+  closeScope();
   eat(SB_PERIOD);
+  endNode(saved);
   assert("Program parsed!");
 }
 
 void compileBlock(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_BLOCK, lookAhead);
+  enterNesting();
   assert("Parsing a Block ....");
   if (lookAhead->tokenType == KW_CONST) {
     eat(KW_CONST);
@@ -47,10 +223,13 @@ void compileBlock(void) {
     compileBlock2();
   } 
   else compileBlock2();
+  endNode(saved);
+  nestingLevel--;
   assert("Block parsed!");
 }
 
 void compileBlock2(void) {
+  PROFILE_RULE();
   if (lookAhead->tokenType == KW_TYPE) {
     eat(KW_TYPE);
     compileTypeDecl();
@@ -61,6 +240,7 @@ void compileBlock2(void) {
 }
 
 void compileBlock3(void) {
+  PROFILE_RULE();
   if (lookAhead->tokenType == KW_VAR) {
     eat(KW_VAR);
     compileVarDecl();
@@ -71,71 +251,154 @@ void compileBlock3(void) {
 }
 
 void compileBlock4(void) {
+  PROFILE_RULE();
   compileSubDecls();
+  if (regionHook != NULL && nestingLevel == 1)
+    regionHook();
   compileBlock5();
 }
 
+// The rest of the program from a top-level subroutine or the main body,
+// parsed as compileProgram would parse it from there
+void compileProgramTail(void) {
+  PROFILE_RULE();
+  enterNesting();
+  compileBlock4();
+  nestingLevel--;
+  eat(SB_PERIOD);
+}
+
 void compileBlock5(void) {
+  PROFILE_RULE();
+  Node *saved;
+
+  if (outline != NULL) {
+    skipBody(&outline->subs[currentSub]);
+    return;
+  }
+  saved = beginNode(N_GROUP, lookAhead);
   eat(KW_BEGIN);
   compileStatements();
   eat(KW_END);
+  endNode(saved);
+}
+
+void skipBody(Subroutine *sub) {
+  // Only BEGIN/END nesting matters here, statements are not parsed
+  int nesting = 0;
+
+  if (lookAhead->tokenType != KW_BEGIN)
+    missingToken(KW_BEGIN, lookAhead->lineNo, lookAhead->colNo);
+  sub->firstToken = tokenCount - 1;
+  sub->bodyOffset = tokenOffset;
+  sub->bodyLineNo = lookAhead->lineNo;
+  sub->bodyColNo = lookAhead->colNo;
+  if (traceEnabled) {
+    fflush(getOutputStream());
+    sub->traceOffset = ftell(getOutputStream());
+  }
+
+  do {
+    switch (lookAhead->tokenType) {
+    case KW_BEGIN:
+      nesting++;
+      break;
+    case KW_END:
+      nesting--;
+      break;
+    case TK_EOF:
+      missingToken(KW_END, lookAhead->lineNo, lookAhead->colNo);
+      break;
+    default:
+      break;
+    }
+    if (nesting == 0) {
+      sub->lastToken = tokenCount - 1;
+      sub->endLineNo = lookAhead->lineNo;
+      sub->endColNo = lookAhead->colNo;
+    }
+    scan();
+  } while (nesting > 0);
+  sub->skimmed = 1;
 }
 
 void compileConstDecls(void) {
+  PROFILE_RULE();
   // BNF: ConstDecls ::= ConstDecl ConstDecls | epsilon
-  if (lookAhead->tokenType == TK_IDENT) {
+  while (lookAhead->tokenType == TK_IDENT)
     compileConstDecl();
-    compileConstDecls();
-  }
-  // else: epsilon (không làm gì)
 }
 
 void compileConstDecl(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_CONST_DECL, lookAhead);
   // BNF: ConstDecl ::= Ident = Constant ;
+  if (outline != NULL)
+    outline->subs[currentSub].constCount++;
   eat(TK_IDENT);
+  nameNode();
+  declareIdent(SYM_CONSTANT);
   eat(SB_EQ);
   compileConstant();
   eat(SB_SEMICOLON);
+  endNode(saved);
 }
 
 void compileTypeDecls(void) {
+  PROFILE_RULE();
   // BNF: TypeDecls ::= TypeDecl TypeDecls | epsilon
-  if (lookAhead->tokenType == TK_IDENT) {
+  while (lookAhead->tokenType == TK_IDENT)
     compileTypeDecl();
-    compileTypeDecls();
-  }
 }
 
 void compileTypeDecl(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_TYPE_DECL, lookAhead);
   // BNF: TypeDecl ::= Ident = Type ;
+  if (outline != NULL)
+    outline->subs[currentSub].typeCount++;
   eat(TK_IDENT);
+  nameNode();
+  declareIdent(SYM_TYPE);
   eat(SB_EQ);
   compileType();
   eat(SB_SEMICOLON);
+  endNode(saved);
 }
 
 void compileVarDecls(void) {
+  PROFILE_RULE();
   // BNF: VarDecls ::= VarDecl VarDecls | epsilon
-  if (lookAhead->tokenType == TK_IDENT) {
+  while (lookAhead->tokenType == TK_IDENT)
     compileVarDecl();
-    compileVarDecls();
-  }
 }
 
 void compileVarDecl(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_VAR_DECL, lookAhead);
   // BNF: VarDecl ::= Ident : Type ;
+  if (outline != NULL)
+    outline->subs[currentSub].varCount++;
   eat(TK_IDENT);
+  nameNode();
+  declareIdent(SYM_VARIABLE);
   eat(SB_COLON);
   compileType();
   eat(SB_SEMICOLON);
+  endNode(saved);
 }
 
 void compileSubDecls(void) {
+  PROFILE_RULE();
   assert("Parsing subtoutines ....");
   
   // Lặp liên tục chừng nào còn nhìn thấy FUNCTION hoặc PROCEDURE
   while (lookAhead->tokenType == KW_FUNCTION || lookAhead->tokenType == KW_PROCEDURE) {
-    if (lookAhead->tokenType == KW_FUNCTION) {
+    if (regionHook != NULL && nestingLevel == 1)
+      regionHook();
+    if (incremental != NULL) {
+      compileSubDeclIncremental();
+    } else if (lookAhead->tokenType == KW_FUNCTION) {
       compileFuncDecl();
     } else {
       compileProcDecl();
@@ -146,30 +409,52 @@ void compileSubDecls(void) {
 }
 
 void compileFuncDecl(void) {
+  PROFILE_RULE();
+  Node *parent = beginNode(N_FUNC_DECL, lookAhead);
+  int saved;
   assert("Parsing a function ....");
   eat(KW_FUNCTION);
   eat(TK_IDENT);
+  nameNode();
+  declareIdent(SYM_FUNCTION);
+  saved = enterSubroutine(SUB_FUNCTION);
+  openScope();
   compileParams();
   eat(SB_COLON);
   compileBasicType();
   eat(SB_SEMICOLON);
   compileBlock();
+  closeScope();
   eat(SB_SEMICOLON);
+  currentSub = saved;
+  endNode(parent);
   assert("Function parsed ....");
 }
 
 void compileProcDecl(void) {
+  PROFILE_RULE();
+  Node *parent = beginNode(N_PROC_DECL, lookAhead);
+  int saved;
   assert("Parsing a procedure ....");
   eat(KW_PROCEDURE);
   eat(TK_IDENT);
+  nameNode();
+  declareIdent(SYM_PROCEDURE);
+  saved = enterSubroutine(SUB_PROCEDURE);
+  openScope();
   compileParams();
   eat(SB_SEMICOLON);
   compileBlock();
+  closeScope();
   eat(SB_SEMICOLON);
+  currentSub = saved;
+  endNode(parent);
   assert("Procedure parsed ....");
 }
 
 void compileUnsignedConstant(void) {
+  PROFILE_RULE();
+  Symbol *symbol = NULL;
   // BNF: UnsignedConstant ::= Number | ConstIdent | ConstChar | String
   switch (lookAhead->tokenType) {
   case TK_NUMBER:
@@ -177,6 +462,7 @@ void compileUnsignedConstant(void) {
     break;
   case TK_IDENT:
     eat(TK_IDENT);
+    symbol = checkIdent(KIND_BIT(SYM_CONSTANT), ERR_UNDECLAREDCONSTANT);
     break;
   case TK_CHAR:
     eat(TK_CHAR);
@@ -188,18 +474,26 @@ void compileUnsignedConstant(void) {
     error(ERR_INVALIDCONSTANT, lookAhead->lineNo, lookAhead->colNo);
     break;
   }
+  bindSymbol(addTokenLeaf(), symbol);
 }
 
 void compileConstant(void) {
+  PROFILE_RULE();
   // BNF: Constant ::= + Constant2 | - Constant2 | Constant2
+  Node *saved;
+
   switch (lookAhead->tokenType) {
   case SB_PLUS:
+    saved = beginNode(N_UNARY, lookAhead);
     eat(SB_PLUS);
     compileConstant2();
+    endNode(saved);
     break;
   case SB_MINUS:
+    saved = beginNode(N_UNARY, lookAhead);
     eat(SB_MINUS);
     compileConstant2();
+    endNode(saved);
     break;
   case TK_CHAR:
   case TK_NUMBER:
@@ -214,10 +508,13 @@ void compileConstant(void) {
 }
 
 void compileConstant2(void) {
+  PROFILE_RULE();
+  Symbol *symbol = NULL;
   // BNF: Constant2 ::= Ident | Number | Char | String
   switch (lookAhead->tokenType) {
   case TK_IDENT:
     eat(TK_IDENT);
+    symbol = checkIdent(KIND_BIT(SYM_CONSTANT), ERR_UNDECLAREDCONSTANT);
     break;
   case TK_NUMBER:
     eat(TK_NUMBER);
@@ -232,10 +529,14 @@ void compileConstant2(void) {
     error(ERR_INVALIDCONSTANT, lookAhead->lineNo, lookAhead->colNo);
     break;
   }
+  bindSymbol(addTokenLeaf(), symbol);
 }
 
 void compileType(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_TYPE, lookAhead);
   // BNF: Type ::= KW_INTEGER | KW_CHAR | KW_STRING | KW_BYTES | TypeIdent | ArrayType
+  enterNesting();
   switch (lookAhead->tokenType) {
   case KW_INTEGER:
     eat(KW_INTEGER);
@@ -251,11 +552,15 @@ void compileType(void) {
     break;
   case TK_IDENT:
     eat(TK_IDENT);
+    nameNode();
+    bindSymbol(currentNode, checkIdent(KIND_BIT(SYM_TYPE), ERR_UNDECLAREDTYPE));
     break;
   case KW_ARRAY:
     eat(KW_ARRAY);
     eat(SB_LSEL);
     eat(TK_NUMBER);
+    if (currentNode != NULL)
+      currentNode->value = currentToken->value;
     eat(SB_RSEL);
     eat(KW_OF);
     compileType();
@@ -264,9 +569,13 @@ void compileType(void) {
     error(ERR_INVALIDTYPE, lookAhead->lineNo, lookAhead->colNo);
     break;
   }
+  endNode(saved);
+  nestingLevel--;
 }
 
 void compileBasicType(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_TYPE, lookAhead);
   // BNF: BasicType ::= INTEGER | CHAR | STRING | BYTES
   switch (lookAhead->tokenType) {
   case KW_INTEGER:
@@ -285,9 +594,11 @@ void compileBasicType(void) {
     error(ERR_INVALIDBASICTYPE, lookAhead->lineNo, lookAhead->colNo);
     break;
   }
+  endNode(saved);
 }
 
 void compileParams(void) {
+  PROFILE_RULE();
   // BNF: Params ::= ( Param Params2 ) | epsilon
   if (lookAhead->tokenType == SB_LPAR) {
     eat(SB_LPAR);
@@ -298,74 +609,87 @@ void compileParams(void) {
 }
 
 void compileParams2(void) {
+  PROFILE_RULE();
   // BNF: Params2 ::= ; Param Params2 | epsilon
-  if (lookAhead->tokenType == SB_SEMICOLON) {
+  while (lookAhead->tokenType == SB_SEMICOLON) {
     eat(SB_SEMICOLON);
     compileParam();
-    compileParams2();
   }
 }
 
 void compileParam(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_PARAM, lookAhead);
   // BNF: Param ::= Ident : BasicType | VAR Ident : BasicType
+  if (outline != NULL)
+    outline->subs[currentSub].paramCount++;
   if (lookAhead->tokenType == TK_IDENT) {
     eat(TK_IDENT);
+    nameNode();
+    declareIdent(SYM_PARAMETER);
     eat(SB_COLON);
     compileBasicType();
   } else if (lookAhead->tokenType == KW_VAR) {
     eat(KW_VAR);
     eat(TK_IDENT);
+    nameNode();
+    declareIdent(SYM_PARAMETER);
     eat(SB_COLON);
     compileBasicType();
   } else {
     error(ERR_INVALIDPARAM, lookAhead->lineNo, lookAhead->colNo);
   }
+  endNode(saved);
 }
 
 void compileStatements(void) {
+  PROFILE_RULE();
   // BNF: Statements ::= Statement Statements2
   compileStatement();
   compileStatements2();
 }
 
 void compileStatements2(void) {
+  PROFILE_RULE();
   // BNF: Statements2 ::= ; Statement Statements2 | epsilon
-  if (lookAhead->tokenType == SB_SEMICOLON) {
+  while (lookAhead->tokenType == SB_SEMICOLON) {
     eat(SB_SEMICOLON);
     compileStatement();
-    compileStatements2();
-  }
-  else {
-    // XỬ LÝ LỖI THIẾU CHẤM PHẨY:
-    // Nếu không thấy dấu chấm phẩy, nhưng lại thấy bắt đầu của một câu lệnh mới
-    // --> Nghĩa là thiếu dấu chấm phẩy ngăn cách.
-    if (lookAhead->tokenType == KW_CALL || 
-        lookAhead->tokenType == TK_IDENT || 
-        lookAhead->tokenType == KW_IF || 
-        lookAhead->tokenType == KW_WHILE || 
-        lookAhead->tokenType == KW_FOR || 
-        lookAhead->tokenType == KW_REPEAT || // Cấu trúc mới thêm
-        lookAhead->tokenType == KW_BEGIN) {
-        
-        eat(SB_SEMICOLON); // Lệnh này sẽ kích hoạt error: "Missing ';'" và dừng chương trình
-    }
-    
-    // Nếu không phải các trường hợp trên, ta mới coi là epsilon (Hết danh sách)
-    // Trường hợp đúng: Gặp KW_END hoặc KW_ELSE
   }
+  // XỬ LÝ LỖI THIẾU CHẤM PHẨY:
+  // Nếu không thấy dấu chấm phẩy, nhưng lại thấy bắt đầu của một câu lệnh mới
+  // --> Nghĩa là thiếu dấu chấm phẩy ngăn cách.
+  if (lookAhead->tokenType == KW_CALL || 
+      lookAhead->tokenType == TK_IDENT || 
+      lookAhead->tokenType == KW_IF || 
+      lookAhead->tokenType == KW_WHILE || 
+      lookAhead->tokenType == KW_FOR || 
+      lookAhead->tokenType == KW_REPEAT || // Cấu trúc mới thêm
+      lookAhead->tokenType == KW_BEGIN) {
+      
+      eat(SB_SEMICOLON); // Lệnh này sẽ kích hoạt error: "Missing ';'" và dừng chương trình
+  }
+  
+  // Nếu không phải các trường hợp trên, ta mới coi là epsilon (Hết danh sách)
+  // Trường hợp đúng: Gặp KW_END hoặc KW_ELSE
 }
 
 // MỚI: Hàm xử lý lệnh REPEAT ... UNTIL
 void compileRepeatSt(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_REPEAT, lookAhead);
   assert("Parsing a repeat statement ....");
   eat(KW_REPEAT);
   compileStatements();
   eat(KW_UNTIL);
   compileCondition();
+  endNode(saved);
   assert("Repeat statement parsed ....");
 }
 
 void compileStatement(void) {
+  PROFILE_RULE();
+  enterNesting();
   switch (lookAhead->tokenType) {
   case TK_IDENT:
     compileAssignSt();
@@ -393,38 +717,51 @@ void compileStatement(void) {
   case KW_END:
   case KW_ELSE:
   case KW_UNTIL: // MỚI
+    addLeaf(N_EMPTY, lookAhead);
     break;
     // Error occurs
   default:
     error(ERR_INVALIDSTATEMENT, lookAhead->lineNo, lookAhead->colNo);
     break;
   }
+  nestingLevel--;
+}
+
+void compileLValue(void) {
+  PROFILE_RULE();
+  // Variable ::= Ident [Indexes]
+  Node *saved = beginNode(N_VARIABLE, lookAhead);
+  eat(TK_IDENT);
+  nameNode();
+  // A function name takes the result
+  bindSymbol(currentNode, checkIdent(KIND_BIT(SYM_VARIABLE) | KIND_BIT(SYM_PARAMETER) |
+                                     KIND_BIT(SYM_FUNCTION), ERR_INVALIDLVALUE));
+  if (lookAhead->tokenType == SB_LSEL) {
+    compileIndexes();
+  }
+  endNode(saved);
 }
 
 void compileAssignSt(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_ASSIGN, lookAhead);
   assert("Parsing an assign statement ....");
   
   // --- PHẦN 1: VẾ TRÁI (LEFT-HAND SIDE) ---
   
   // 1.1. Đọc biến đầu tiên
-  // Variable ::= Ident [Indexes]
-  eat(TK_IDENT);
-  if (lookAhead->tokenType == SB_LSEL) {
-    compileIndexes();
-  }
+  compileLValue();
 
   // 1.2. Vòng lặp: Nếu thấy dấu phẩy thì tiếp tục đọc biến tiếp theo
   while (lookAhead->tokenType == SB_COMMA) {
     eat(SB_COMMA); // Ăn dấu ,
-    
-    eat(TK_IDENT); // Ăn tên biến tiếp theo
-    if (lookAhead->tokenType == SB_LSEL) {
-      compileIndexes(); // Ăn chỉ số mảng (nếu có)
-    }
+    compileLValue(); // Ăn tên biến tiếp theo và chỉ số mảng (nếu có)
   }
 
   // --- PHẦN 2: DẤU GÁN ---
   eat(SB_ASSIGN);
+  if (currentNode != NULL)
+    currentNode->value = currentNode->childCount;
 
   // --- PHẦN 3: VẾ PHẢI (RIGHT-HAND SIDE) ---
 
@@ -437,26 +774,42 @@ void compileAssignSt(void) {
     compileExpression(); // Phân tích biểu thức tiếp theo
   }
 
+  endNode(saved);
   assert("Assign statement parsed ....");
 }
 
 void compileCallSt(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_CALL, lookAhead);
+  Symbol *symbol;
   assert("Parsing a call statement ....");
   eat(KW_CALL);
   eat(TK_IDENT);
+  nameNode();
+  // READC and READI may also be called with the variable to read into
+  symbol = checkIdent(KIND_BIT(SYM_PROCEDURE) | KIND_BIT(SYM_FUNCTION), ERR_UNDECLAREDPROCEDURE);
+  if (symbol != NULL && symbol->kind == SYM_FUNCTION && symbol->level > 0)
+    error(ERR_UNDECLAREDPROCEDURE, currentToken->lineNo, currentToken->colNo);
+  bindSymbol(currentNode, symbol);
   compileArguments();
+  endNode(saved);
   assert("Call statement parsed ....");
 }
 
 void compileGroupSt(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_GROUP, lookAhead);
   assert("Parsing a group statement ....");
   eat(KW_BEGIN);
   compileStatements();
   eat(KW_END);
+  endNode(saved);
   assert("Group statement parsed ....");
 }
 
 void compileIfSt(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_IF, lookAhead);
   assert("Parsing an if statement ....");
   eat(KW_IF);
   compileCondition();
@@ -464,68 +817,69 @@ void compileIfSt(void) {
   compileStatement();
   if (lookAhead->tokenType == KW_ELSE) 
     compileElseSt();
+  endNode(saved);
   assert("If statement parsed ....");
 }
 
 void compileElseSt(void) {
+  PROFILE_RULE();
   eat(KW_ELSE);
   compileStatement();
 }
 
 void compileWhileSt(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_WHILE, lookAhead);
   assert("Parsing a while statement ....");
   eat(KW_WHILE);
   compileCondition();
   eat(KW_DO);
   compileStatement();
+  endNode(saved);
   assert("While statement parsed ....");
 }
 
 void compileForSt(void) {
+  PROFILE_RULE();
+  Node *saved = beginNode(N_FOR, lookAhead);
   assert("Parsing a for statement ....");
   eat(KW_FOR);
   eat(TK_IDENT);
+  nameNode();
+  bindSymbol(currentNode, checkIdent(KIND_BIT(SYM_VARIABLE) | KIND_BIT(SYM_PARAMETER),
+                                     ERR_UNDECLAREDVARIABLE));
   eat(SB_ASSIGN);
   compileExpression();
   eat(KW_TO);
   compileExpression();
   eat(KW_DO);
   compileStatement();
+  endNode(saved);
   assert("For statement parsed ....");
 }
 
 void compileCondition(void) {
+  PROFILE_RULE();
   // BNF: Condition ::= Expression Condition2
   compileExpression();
   compileCondition2();
 }
 
 void compileCondition2(void) {
+  PROFILE_RULE();
+  Node *saved;
   // BNF: Condition2 ::= = Expr | != Expr | ...
   switch (lookAhead->tokenType) {
   case SB_EQ:
-    eat(SB_EQ);
-    compileExpression();
-    break;
   case SB_NEQ:
-    eat(SB_NEQ);
-    compileExpression();
-    break;
   case SB_LE:
-    eat(SB_LE);
-    compileExpression();
-    break;
   case SB_LT:
-    eat(SB_LT);
-    compileExpression();
-    break;
   case SB_GE:
-    eat(SB_GE);
-    compileExpression();
-    break;
   case SB_GT:
-    eat(SB_GT);
+    saved = beginOperator(N_CONDITION, lookAhead);
+    eat(lookAhead->tokenType);
     compileExpression();
+    endNode(saved);
     break;
   default:
     error(ERR_INVALIDCOMPARATOR, lookAhead->lineNo, lookAhead->colNo);
@@ -534,6 +888,7 @@ void compileCondition2(void) {
 }
 
 void compileArguments(void) {
+  PROFILE_RULE();
   // BNF: Arguments ::= ( Expression Arguments2 ) | epsilon
   if (lookAhead->tokenType == SB_LPAR) {
     eat(SB_LPAR);
@@ -544,15 +899,17 @@ void compileArguments(void) {
 }
 
 void compileArguments2(void) {
+  PROFILE_RULE();
   // BNF: Arguments2 ::= , Expression Arguments2 | epsilon
-  if (lookAhead->tokenType == SB_COMMA) {
+  while (lookAhead->tokenType == SB_COMMA) {
     eat(SB_COMMA);
     compileExpression();
-    compileArguments2();
   }
 }
 
 void compileExpression(void) {
+  PROFILE_RULE();
+  Node *saved;
   assert("Parsing an expression");
   // BNF: Expression ::= + Expression2 | - Expression2 | Expression2
   switch (lookAhead->tokenType) {
@@ -561,8 +918,12 @@ void compileExpression(void) {
     compileExpression2();
     break;
   case SB_MINUS:
+    // The sign applies to the first term only: - a + b is (- a) + b
+    saved = beginNode(N_UNARY, lookAhead);
     eat(SB_MINUS);
-    compileExpression2();
+    compileTerm();
+    endNode(saved);
+    compileExpression3();
     break;
   default:
     compileExpression2();
@@ -572,24 +933,24 @@ void compileExpression(void) {
 }
 
 void compileExpression2(void) {
+  PROFILE_RULE();
   // BNF: Expression2 ::= Term Expression3
   compileTerm();
   compileExpression3();
 }
 
 void compileExpression3(void) {
+  PROFILE_RULE();
+  Node *saved;
   // BNF: Expression3 ::= + Term Expression3 | - Term Expression3 | epsilon
-  switch (lookAhead->tokenType) {
-  case SB_PLUS:
-    eat(SB_PLUS);
+  // The tail recursion is a loop so a long sum does not grow the stack
+  while (lookAhead->tokenType == SB_PLUS || lookAhead->tokenType == SB_MINUS) {
+    saved = beginOperator(N_BINARY, lookAhead);
+    eat(lookAhead->tokenType);
     compileTerm();
-    compileExpression3();
-    break;
-  case SB_MINUS:
-    eat(SB_MINUS);
-    compileTerm();
-    compileExpression3();
-    break;
+    endNode(saved);
+  }
+  switch (lookAhead->tokenType) {
   // Follow set
   case SB_SEMICOLON:
   case KW_END:
@@ -615,29 +976,24 @@ void compileExpression3(void) {
 }
 
 void compileTerm(void) {
+  PROFILE_RULE();
   // BNF: Term ::= Factor Term2
   compileFactor();
   compileTerm2();
 }
 
 void compileTerm2(void) {
+  PROFILE_RULE();
+  Node *saved;
   // BNF: Term2 ::= * Factor Term2 | / Factor Term2 | % Factor Term2 | epsilon
-  switch (lookAhead->tokenType) {
-  case SB_TIMES:
-    eat(SB_TIMES);
-    compileFactor();
-    compileTerm2();
-    break;
-  case SB_SLASH:
-    eat(SB_SLASH);
-    compileFactor();
-    compileTerm2();
-    break;
-  case SB_MOD: // MỚI: Phép lấy dư
-    eat(SB_MOD);
+  while (lookAhead->tokenType == SB_TIMES || lookAhead->tokenType == SB_SLASH ||
+         lookAhead->tokenType == SB_MOD) { // MỚI: Phép lấy dư
+    saved = beginOperator(N_BINARY, lookAhead);
+    eat(lookAhead->tokenType);
     compileFactor();
-    compileTerm2();
-    break;
+    endNode(saved);
+  }
+  switch (lookAhead->tokenType) {
   // Follow set (giống Expression3 + PLUS + MINUS)
   case SB_PLUS:
   case SB_MINUS:
@@ -665,7 +1021,10 @@ void compileTerm2(void) {
 }
 
 void compileFactor(void) {
+  PROFILE_RULE();
+  Node *saved;
   // BNF: Factor ::= Number | Char | String | Ident... | (Expr)
+  enterNesting();
   switch (lookAhead->tokenType) {
   case TK_NUMBER:
   case TK_CHAR:
@@ -678,18 +1037,29 @@ void compileFactor(void) {
     eat(SB_RPAR);
     break;
   case TK_IDENT:
+    saved = beginNode(N_VARIABLE, lookAhead);
     eat(TK_IDENT);
+    nameNode();
     // Xử lý sự nhập nhằng LL(2) giữa Biến và Hàm
     switch (lookAhead->tokenType) {
     case SB_LSEL: // Variable (Array index)
+      bindSymbol(currentNode, checkIdent(KIND_BIT(SYM_VARIABLE) | KIND_BIT(SYM_PARAMETER),
+                                         ERR_UNDECLAREDVARIABLE));
       compileIndexes();
       break;
     case SB_LPAR: // Function Call
+      bindSymbol(currentNode, checkIdent(KIND_BIT(SYM_FUNCTION), ERR_UNDECLAREDFUNCTION));
+      if (currentNode != NULL)
+        currentNode->kind = N_FUNC_CALL;
       compileArguments();
       break;
     default: // Variable (Simple)
+      bindSymbol(currentNode, checkIdent(KIND_BIT(SYM_CONSTANT) | KIND_BIT(SYM_VARIABLE) |
+                                         KIND_BIT(SYM_PARAMETER) | KIND_BIT(SYM_FUNCTION),
+                                         ERR_INVALIDFACTOR));
       break;
     }
+    endNode(saved);
     break;
   default:
     error(ERR_INVALIDFACTOR, lookAhead->lineNo, lookAhead->colNo);
@@ -699,33 +1069,142 @@ void compileFactor(void) {
   // MỚI: Xử lý phép lũy thừa (**)
   // Factor -> Base ** Factor | Base
   if (lookAhead->tokenType == SB_POWER) {
+      saved = beginOperator(N_BINARY, lookAhead);
       eat(SB_POWER);
       compileFactor(); // Đệ quy để xử lý tính kết hợp phải (Right Associative)
+      endNode(saved);
   }
+  nestingLevel--;
 }
 
 void compileIndexes(void) {
+  PROFILE_RULE();
   // BNF: Indexes ::= [ Expr ] Indexes | epsilon
-  if (lookAhead->tokenType == SB_LSEL) {
+  while (lookAhead->tokenType == SB_LSEL) {
     eat(SB_LSEL);
     compileExpression();
     eat(SB_RSEL);
-    compileIndexes();
   }
 }
 
-int compile(char *fileName) {
+// Parse one grammar rule from the current token source
+void parseRule(void (*rule)(void)) {
+  jmp_buf trap;
+
+  currentToken = NULL;
+  lookAhead = NULL;
+  errorRaised = 0;
+  nestingLevel = 0;
+
+  // A syntax error jumps back here so the tokens can be released
+  errorTrap = &trap;
+  if (setjmp(trap) == 0) {
+    scan();
+    rule();
+  }
+  errorTrap = NULL;
+  unwindRules();
+
+  freeToken(currentToken);
+  freeToken(lookAhead);
+  currentToken = NULL;
+  lookAhead = NULL;
+}
+
+// Parse one grammar rule from the start of the file, or from the start
+// of a body recorded by an earlier outline
+int runParser(char *fileName, Subroutine *from, void (*rule)(void)) {
   if (openInputStream(fileName) == IO_ERROR)
     return IO_ERROR;
+  if (from != NULL &&
+      seekInputStream(from->bodyOffset, from->bodyLineNo, from->bodyColNo) == IO_ERROR) {
+    closeInputStream();
+    return IO_ERROR;
+  }
 
-  currentToken = NULL;
-  lookAhead = getValidToken();
+  tokenCount = 0;
+  parseRule(rule);
+  closeInputStream();
+  return IO_SUCCESS;
+}
 
-  compileProgram();
+int compile(char *fileName) {
+  return runParser(fileName, NULL, compileProgram);
+}
+
+// Parse one grammar rule from source held in memory
+int parseBuffer(char *buffer, size_t size, void (*rule)(void)) {
+  if (openInputBuffer(buffer, size) == IO_ERROR)
+    return IO_ERROR;
+  tokenCount = 0;
+  parseRule(rule);
+  closeInputStream();
+  return IO_SUCCESS;
+}
 
-  free(currentToken);
-  free(lookAhead);
+// Parse one grammar rule from a position recorded in an earlier parse
+int parseBufferFrom(char *buffer, size_t size, long offset, int line, int col,
+                    void (*rule)(void)) {
+  if (openInputBuffer(buffer, size) == IO_ERROR)
+    return IO_ERROR;
+  if (offset > 0 && seekInputStream(offset, line, col) == IO_ERROR) {
+    closeInputStream();
+    return IO_ERROR;
+  }
+  tokenCount = 0;
+  parseRule(rule);
   closeInputStream();
   return IO_SUCCESS;
+}
+
+// Parse and build the tree with names resolved into table, which must
+// outlive the tree; tracing is left to the caller
+int compileChecked(char *fileName, ParseTree *tree, SymbolTable *table) {
+  int status;
 
-}
\ No newline at end of file
+  declarePredefined(table);
+  symbols = table;
+  status = compileTree(fileName, tree);
+  symbols = NULL;
+  return status;
+}
+
+int compileBuffer(char *buffer, size_t size) {
+  return parseBuffer(buffer, size, compileProgram);
+}
+
+int compileOutline(char *fileName, Outline *result) {
+  int status;
+
+  outline = result;
+  currentSub = -1;
+  traceEnabled = result->traced;
+  status = runParser(fileName, NULL, compileProgram);
+  traceEnabled = 1;
+  outline = NULL;
+  return status;
+}
+
+int compileBody(char *fileName, Subroutine *sub) {
+  return runParser(fileName, sub, compileBlock5);
+}
+
+// Parse and build the tree; tracing is left to the caller
+int compileTree(char *fileName, ParseTree *tree) {
+  int status;
+
+  parseTree = tree;
+  currentNode = NULL;
+  status = compile(fileName);
+  tree->failed = errorRaised;
+  parseTree = NULL;
+  currentNode = NULL;
+  return status;
+}
+
+// The tokens come from another thread (see pipeline.c)
+void compileTokens(TokenSource source) {
+  tokenSource = source;
+  parseRule(compileProgram);
+  tokenSource = NULL;
+}
@@ -6,9 +6,23 @@
 #ifndef __PARSER_H__
 #define __PARSER_H__
 #include "token.h"
+#include "outline.h"
+#include "ast.h"
+#include "symtab.h"
+
+typedef Token* (*TokenSource)(void);
+
+// Deepest nesting of blocks, types, statements and factors accepted
+#define MAX_NESTING 8192
 
 void scan(void);
 void eat(TokenType tokenType);
+void enterNesting(void);
+
+// Language server hook, see compileProgramTail()
+extern __thread void (*regionHook)(void);
+// Name checking, see compileChecked()
+extern __thread SymbolTable *symbols;
 
 void compileProgram(void);
 void compileBlock(void);
@@ -16,6 +30,8 @@ void compileBlock2(void);
 void compileBlock3(void);
 void compileBlock4(void);
 void compileBlock5(void);
+void compileProgramTail(void);
+void skipBody(Subroutine *sub);
 void compileConstDecls(void);
 void compileConstDecl(void);
 void compileTypeDecls(void);
@@ -36,6 +52,7 @@ void compileParam(void);
 void compileStatements(void);
 void compileStatements2(void);
 void compileStatement(void);
+void compileLValue(void);
 void compileAssignSt(void);
 void compileCallSt(void);
 void compileGroupSt(void);
@@ -43,6 +60,7 @@ void compileIfSt(void);
 void compileElseSt(void);
 void compileWhileSt(void);
 void compileForSt(void);
+void compileRepeatSt(void);
 void compileArguments(void);
 void compileArguments2(void);
 void compileCondition(void);
@@ -56,5 +74,14 @@ void compileFactor(void);
 void compileIndexes(void);
 
 int compile(char *fileName);
+int compileChecked(char *fileName, ParseTree *tree, SymbolTable *table);
+int compileBuffer(char *buffer, size_t size);
+int parseBuffer(char *buffer, size_t size, void (*rule)(void));
+int parseBufferFrom(char *buffer, size_t size, long offset, int line, int col,
+                    void (*rule)(void));
+int compileOutline(char *fileName, Outline *outline);
+int compileBody(char *fileName, Subroutine *sub);
+int compileTree(char *fileName, ParseTree *tree);
+void compileTokens(TokenSource source);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,113 @@
+/* Hardware performance counters */
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfcount.h"
+
+static struct {
+  char *name;
+  uint32_t type;
+  uint64_t config;
+} events[COUNTER_COUNT] = {
+  {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+  {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+  {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+  {"l1d_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+     (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+  {"llc_misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL |
+     (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)}
+};
+
+// Value, time enabled and time running of one counter
+typedef struct {
+  uint64_t value, enabled, running;
+} Reading;
+
+static int openEvent(uint32_t type, uint64_t config) {
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;   // allowed with perf_event_paranoid <= 2
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+int openCounters(CounterSet *set, char **reason) {
+  int i, opened = 0, error = 0;
+
+  for (i = 0; i < COUNTER_COUNT; i++) {
+    set->values[i] = 0;
+    set->fds[i] = openEvent(events[i].type, events[i].config);
+    if (set->fds[i] >= 0)
+      opened++;
+    else if (error == 0)
+      error = errno;
+  }
+  if (opened == 0 && reason != NULL) {
+    switch (error) {
+    case ENOENT:
+    case EOPNOTSUPP: *reason = "no hardware PMU (virtual machine or container?)"; break;
+    case EACCES:
+    case EPERM: *reason = "not permitted, see /proc/sys/kernel/perf_event_paranoid"; break;
+    case ENOSYS: *reason = "perf_event_open is not supported by this kernel"; break;
+    default: *reason = strerror(error); break;
+    }
+  }
+  return opened;
+}
+
+void startCounters(CounterSet *set) {
+  int i;
+
+  for (i = 0; i < COUNTER_COUNT; i++)
+    if (set->fds[i] >= 0) {
+      ioctl(set->fds[i], PERF_EVENT_IOC_RESET, 0);
+      ioctl(set->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+// More events than the PMU has registers are time-shared; the count is
+// scaled up by enabled / running time
+void stopCounters(CounterSet *set) {
+  Reading reading;
+  int i;
+
+  for (i = 0; i < COUNTER_COUNT; i++) {
+    set->values[i] = 0;
+    if (set->fds[i] < 0)
+      continue;
+    ioctl(set->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    if (read(set->fds[i], &reading, sizeof(reading)) != sizeof(reading) || reading.running == 0)
+      continue;
+    set->values[i] = (double)reading.value * reading.enabled / reading.running;
+  }
+}
+
+int counterAvailable(CounterSet *set, Counter counter) {
+  return set->fds[counter] >= 0;
+}
+
+char *counterName(Counter counter) {
+  return events[counter].name;
+}
+
+void closeCounters(CounterSet *set) {
+  int i;
+
+  for (i = 0; i < COUNTER_COUNT; i++) {
+    if (set->fds[i] >= 0)
+      close(set->fds[i]);
+    set->fds[i] = -1;
+  }
+}
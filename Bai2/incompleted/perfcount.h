@@ -0,0 +1,29 @@
+/* Hardware performance counters */
+
+#ifndef __PERFCOUNT_H__
+#define __PERFCOUNT_H__
+
+typedef enum {
+  COUNTER_CYCLES,
+  COUNTER_INSTRUCTIONS,
+  COUNTER_BRANCH_MISSES,
+  COUNTER_L1D_MISSES,
+  COUNTER_LLC_MISSES,
+  COUNTER_COUNT
+} Counter;
+
+typedef struct {
+  int fds[COUNTER_COUNT];         // -1: the event could not be opened
+  double values[COUNTER_COUNT];   // scaled when the kernel multiplexed
+} CounterSet;
+
+// Opens the counters for this thread, disabled; 0 when none is available,
+// with the reason in *reason
+int openCounters(CounterSet *set, char **reason);
+void startCounters(CounterSet *set);
+void stopCounters(CounterSet *set);
+int counterAvailable(CounterSet *set, Counter counter);
+char *counterName(Counter counter);
+void closeCounters(CounterSet *set);
+
+#endif
@@ -0,0 +1,227 @@
+/* Pipelined compilation */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#include "reader.h"
+#include "scanner.h"
+#include "parser.h"
+#include "error.h"
+#include "ring.h"
+#include "stats.h"
+#include "pipeline.h"
+
+// Stage 1 (lexer thread) -> token batches -> stage 2 (parser, calling thread)
+// -> output chunks -> stage 3 (writer thread) -> stdout
+
+typedef struct {
+  Token *tokens[TOKEN_BATCH];
+  int count;
+  int last;           // no batch follows this one
+  char *errorText;    // lexical error met after the tokens of this batch
+} TokenBatch;
+
+typedef struct {
+  char *data;
+  size_t length;      // 0 ends the output stream
+} OutputChunk;
+
+typedef struct {
+  char *fileName;
+  int openFailed;
+  long tokens;
+  Ring tokenRing;
+  Ring outputRing;
+  TokenBatch *filling;
+  // Consumer side
+  TokenBatch *reading;
+  int next;
+  int lastLineNo, lastColNo;
+  double start, firstOutput;
+} Pipeline;
+
+static __thread Pipeline *pipeline;
+
+static void freeBatch(TokenBatch *batch) {
+  int i;
+  for (i = 0; i < batch->count; i++)
+    freeToken(batch->tokens[i]);
+  free(batch->errorText);
+  free(batch);
+}
+
+/******************************************************************/
+
+static void *lexerMain(void *arg) {
+  Pipeline *p = (Pipeline*)arg;
+  jmp_buf trap;
+  char *text = NULL;
+  size_t length = 0;
+  FILE *errors;
+  Token *token;
+
+  p->filling = (TokenBatch*)calloc(1, sizeof(TokenBatch));
+  if (openInputStream(p->fileName) == IO_ERROR) {
+    p->openFailed = 1;
+    p->filling->last = 1;
+    ringPush(&p->tokenRing, p->filling);
+    return NULL;
+  }
+
+  // Lexical errors are captured and handed to the parser with the tokens
+  errors = open_memstream(&text, &length);
+  setOutputStream(errors);
+  tokenCount = 0;
+  errorTrap = &trap;
+  if (setjmp(trap) == 0) {
+    do {
+      token = getValidToken();
+      p->filling->tokens[p->filling->count++] = token;
+      if (token->tokenType == TK_EOF)
+        break;
+      if (p->filling->count == TOKEN_BATCH) {
+        if (!ringPush(&p->tokenRing, p->filling))
+          break;
+        p->filling = (TokenBatch*)calloc(1, sizeof(TokenBatch));
+      }
+    } while (1);
+  }
+  errorTrap = NULL;
+  setOutputStream(NULL);
+  fclose(errors);
+
+  p->tokens = tokenCount;
+  if (length > 0)
+    p->filling->errorText = text;
+  else free(text);
+  p->filling->last = 1;
+  if (!ringPush(&p->tokenRing, p->filling))
+    freeBatch(p->filling);
+  closeInputStream();
+  return NULL;
+}
+
+// Token source of the parser: hands out the batched tokens in order
+static Token *pipelineToken(void) {
+  Pipeline *p = pipeline;
+  TokenBatch *batch = p->reading;
+  Token *token;
+
+  while (p->next == batch->count) {
+    if (batch->errorText != NULL) {
+      fputs(batch->errorText, getOutputStream());
+      abortCompile();
+    }
+    if (batch->last)
+      return makeToken(TK_EOF, p->lastLineNo, p->lastColNo);
+    free(batch);
+    batch = p->reading = (TokenBatch*)ringPop(&p->tokenRing);
+    p->next = 0;
+  }
+
+  // The parser frees the tokens it is given
+  token = batch->tokens[p->next];
+  batch->tokens[p->next++] = NULL;
+  p->lastLineNo = token->lineNo;
+  p->lastColNo = token->colNo;
+  return token;
+}
+
+/******************************************************************/
+
+static ssize_t writeOutput(void *cookie, const char *buf, size_t size) {
+  Pipeline *p = (Pipeline*)cookie;
+  OutputChunk *chunk;
+
+  if (size == 0)
+    return 0;
+  chunk = (OutputChunk*)malloc(sizeof(OutputChunk));
+  chunk->data = (char*)malloc(size);
+  memcpy(chunk->data, buf, size);
+  chunk->length = size;
+  ringPush(&p->outputRing, chunk);
+  return size;
+}
+
+static int closeOutput(void *cookie) {
+  Pipeline *p = (Pipeline*)cookie;
+  OutputChunk *chunk = (OutputChunk*)calloc(1, sizeof(OutputChunk));
+  ringPush(&p->outputRing, chunk);
+  return 0;
+}
+
+static void *writerMain(void *arg) {
+  Pipeline *p = (Pipeline*)arg;
+  OutputChunk *chunk;
+
+  for (;;) {
+    chunk = (OutputChunk*)ringPop(&p->outputRing);
+    if (chunk->length == 0) {
+      free(chunk);
+      break;
+    }
+    if (p->firstOutput == 0)
+      p->firstOutput = statsClock();
+    fwrite(chunk->data, 1, chunk->length, stdout);
+    free(chunk->data);
+    free(chunk);
+  }
+  fflush(stdout);
+  return NULL;
+}
+
+/******************************************************************/
+
+int compilePipelined(char *fileName) {
+  Pipeline p;
+  pthread_t lexer, writer;
+  cookie_io_functions_t io = {NULL, writeOutput, NULL, closeOutput};
+  TokenBatch *batch;
+  FILE *out;
+  double elapsed;
+
+  memset(&p, 0, sizeof(p));
+  p.fileName = fileName;
+  initRing(&p.tokenRing);
+  initRing(&p.outputRing);
+  p.start = statsClock();
+
+  pthread_create(&lexer, NULL, lexerMain, &p);
+  p.reading = (TokenBatch*)ringPop(&p.tokenRing);
+  if (p.openFailed) {
+    pthread_join(lexer, NULL);
+    freeBatch(p.reading);
+    return IO_ERROR;
+  }
+
+  pthread_create(&writer, NULL, writerMain, &p);
+  out = fopencookie(&p, "w", io);
+  setvbuf(out, NULL, _IOFBF, 1 << 16);
+  setOutputStream(out);
+
+  pipeline = &p;
+  compileTokens(pipelineToken);
+  pipeline = NULL;
+
+  setOutputStream(NULL);
+  fclose(out);
+  pthread_join(writer, NULL);
+
+  // The parser may stop early: release the lexer and what it already queued
+  cancelRing(&p.tokenRing);
+  pthread_join(lexer, NULL);
+  freeBatch(p.reading);
+  while ((batch = (TokenBatch*)ringTryPop(&p.tokenRing)) != NULL)
+    freeBatch(batch);
+
+  elapsed = statsClock() - p.start;
+  if (elapsed <= 0) elapsed = 1e-9;
+  fprintf(stderr, "pipelined: %ld tokens in %.3f s (%.0f tokens/s), first output after %.3f ms\n",
+          p.tokens, elapsed, p.tokens / elapsed,
+          p.firstOutput > 0 ? (p.firstOutput - p.start) * 1e3 : 0.0);
+  return IO_SUCCESS;
+}
@@ -0,0 +1,10 @@
+/* Pipelined compilation */
+
+#ifndef __PIPELINE_H__
+#define __PIPELINE_H__
+
+#define TOKEN_BATCH 256
+
+int compilePipelined(char *fileName);
+
+#endif
@@ -0,0 +1,285 @@
+/* Grammar rule profiler */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "profile.h"
+
+__thread Profiler *profiler;
+
+// Rule names, registered by PROFILE_RULE() on first use
+static const char *ruleNames[MAX_PROFILED_RULES];
+static int ruleCount;
+
+static volatile sig_atomic_t sampleDue;
+static timer_t sampleTimer;
+
+static void onProfileTimer(int sig) {
+  sampleDue = 1;
+}
+
+// A high resolution timer: ITIMER_PROF only fires once per kernel tick
+static void startProfileTimer(long period) {
+  struct sigevent event;
+  struct itimerspec timer;
+
+  memset(&event, 0, sizeof(event));
+  event.sigev_notify = SIGEV_SIGNAL;
+  event.sigev_signo = SIGPROF;
+  signal(SIGPROF, onProfileTimer);
+  timer_create(CLOCK_MONOTONIC, &event, &sampleTimer);
+  timer.it_interval.tv_sec = period / 1000000;
+  timer.it_interval.tv_nsec = period % 1000000 * 1000;
+  timer.it_value = timer.it_interval;
+  timer_settime(sampleTimer, 0, &timer, NULL);
+}
+
+static double wallClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Cycles where the TSC is available, nanoseconds elsewhere
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static char *tickUnit(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return "rdtsc cycles";
+#else
+  return "ns";
+#endif
+}
+
+Profiler *newProfiler(long period, long maxEvents) {
+  Profiler *p = (Profiler*)calloc(1, sizeof(Profiler));
+
+  p->period = period > 0 ? period : 0;
+  p->maxEvents = maxEvents;
+  p->startTime = wallClock();
+  p->startTicks = p->lastSample = ticks();
+  if (p->period > 0)
+    startProfileTimer(p->period);
+  return p;
+}
+
+void freeProfiler(Profiler *p) {
+  free(p->stack);
+  free(p->sampled);
+  free(p->events);
+  free(p);
+}
+
+static void addEvent(Profiler *p, int rule, char phase, uint64_t at) {
+  if (p->eventCount == p->eventCapacity) {
+    p->eventCapacity = p->eventCapacity ? p->eventCapacity * 2 : 4096;
+    p->events = (TraceEvent*)realloc(p->events, p->eventCapacity * sizeof(TraceEvent));
+  }
+  p->events[p->eventCount].rule = rule;
+  p->events[p->eventCount].phase = phase;
+  p->events[p->eventCount].ticks = at;
+  p->eventCount++;
+}
+
+// Begin events stop at the cap; end events always follow their begin
+static int beginEvent(Profiler *p, int rule, uint64_t at) {
+  if (p->beginEvents >= p->maxEvents) {
+    p->droppedEvents++;
+    return 0;
+  }
+  p->beginEvents++;
+  addEvent(p, rule, 'B', at);
+  return 1;
+}
+
+// Charge the ticks since the last sample to the current stack: all of it
+// to the rule on top, once to every distinct rule below. The trace gets
+// the frames that ended and began since the previous sample.
+static void takeSample(Profiler *p) {
+  uint64_t now = ticks(), elapsed = now - p->lastSample;
+  int i, common = 0;
+  int rule;
+
+  sampleDue = 0;
+  p->lastSample = now;
+  p->sampleNo++;
+  if (p->depth > 0)
+    p->rules[p->stack[p->depth - 1].rule].exclusive += elapsed;
+  for (i = 0; i < p->depth; i++) {
+    rule = p->stack[i].rule;
+    if (p->marks[rule] != p->sampleNo) {
+      p->marks[rule] = p->sampleNo;
+      p->rules[rule].inclusive += elapsed;
+    }
+  }
+
+  while (common < p->depth && common < p->sampledDepth &&
+         p->stack[common].start == p->sampled[common].start)
+    common++;
+  for (i = p->sampledDepth - 1; i >= common; i--)
+    if (p->sampled[i].traced)
+      addEvent(p, p->sampled[i].rule, 'E', now);
+  for (i = common; i < p->depth; i++)
+    p->stack[i].traced = beginEvent(p, p->stack[i].rule, now);
+
+  if (p->depth > p->sampledCapacity) {
+    p->sampledCapacity = p->capacity;
+    p->sampled = (ProfileFrame*)realloc(p->sampled, p->sampledCapacity * sizeof(ProfileFrame));
+  }
+  memcpy(p->sampled, p->stack, p->depth * sizeof(ProfileFrame));
+  p->sampledDepth = p->depth;
+}
+
+int enterRule(int *id, const char *name) {
+  Profiler *p = profiler;
+  ProfileFrame *frame;
+
+  if (*id < 0) {
+    if (ruleCount == MAX_PROFILED_RULES)
+      return 0;
+    ruleNames[ruleCount] = name;
+    *id = ruleCount++;
+  }
+  if (sampleDue)
+    takeSample(p);
+  if (p->depth == p->capacity) {
+    p->capacity = p->capacity ? p->capacity * 2 : 256;
+    p->stack = (ProfileFrame*)realloc(p->stack, p->capacity * sizeof(ProfileFrame));
+  }
+  frame = &p->stack[p->depth++];
+  frame->rule = *id;
+  frame->children = 0;
+  frame->traced = 0;
+  p->rules[*id].calls++;
+
+  if (p->period > 0)
+    frame->start = ++p->entries;
+  else {
+    p->rules[*id].active++;
+    frame->start = ticks();
+    frame->traced = beginEvent(p, *id, frame->start);
+  }
+  return 1;
+}
+
+void exitRule(void) {
+  Profiler *p = profiler;
+  ProfileFrame *frame;
+  uint64_t elapsed;
+
+  if (p == NULL || p->depth == 0)
+    return;
+  if (sampleDue)
+    takeSample(p);
+  frame = &p->stack[--p->depth];
+  if (p->period > 0)
+    return;
+
+  elapsed = ticks() - frame->start;
+  p->rules[frame->rule].exclusive += elapsed - frame->children;
+  if (--p->rules[frame->rule].active == 0)
+    p->rules[frame->rule].inclusive += elapsed;
+  if (p->depth > 0)
+    p->stack[p->depth - 1].children += elapsed;
+  if (frame->traced)
+    addEvent(p, frame->rule, 'E', frame->start + elapsed);
+}
+
+// A syntax error longjmps past the rules still open
+void unwindRules(void) {
+  while (profiler != NULL && profiler->depth > 0)
+    exitRule();
+}
+
+void finishProfile(Profiler *p) {
+  int i;
+
+  unwindRules();
+  if (p->period > 0) {
+    timer_delete(sampleTimer);
+    takeSample(p);
+    for (i = p->sampledDepth - 1; i >= 0; i--)
+      if (p->sampled[i].traced)
+        addEvent(p, p->sampled[i].rule, 'E', p->lastSample);
+    p->sampledDepth = 0;
+  }
+  p->endTicks = ticks();
+  p->endTime = wallClock();
+}
+
+static double ticksPerUs(Profiler *p) {
+  double us = (p->endTime - p->startTime) * 1e6;
+  return us > 0 && p->endTicks > p->startTicks ? (p->endTicks - p->startTicks) / us : 1;
+}
+
+static int byExclusive(const void *a, const void *b) {
+  uint64_t x = profiler->rules[*(const int*)a].exclusive;
+  uint64_t y = profiler->rules[*(const int*)b].exclusive;
+  return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void printProfile(Profiler *p, FILE *f) {
+  int order[MAX_PROFILED_RULES];
+  Profiler *saved = profiler;
+  double perMs = ticksPerUs(p) * 1e3;
+  double total = p->endTicks > p->startTicks ? (double)(p->endTicks - p->startTicks) : 1;
+  RuleProfile *r;
+  int i, count = 0;
+
+  for (i = 0; i < ruleCount; i++)
+    if (p->rules[i].calls > 0)
+      order[count++] = i;
+  profiler = p;
+  qsort(order, count, sizeof(int), byExclusive);
+  profiler = saved;
+
+  if (p->period > 0)
+    fprintf(f, "rule profile: sampled every %ld us (%ld samples), %s\n",
+            p->period, p->sampleNo, tickUnit());
+  else fprintf(f, "rule profile: every call timed, %s\n", tickUnit());
+  fprintf(f, "%-26s %10s %12s %6s %12s %6s\n",
+          "rule", "calls", "incl ms", "incl%", "excl ms", "excl%");
+  for (i = 0; i < count; i++) {
+    r = &p->rules[order[i]];
+    fprintf(f, "%-26s %10ld %12.3f %5.1f%% %12.3f %5.1f%%\n", ruleNames[order[i]], r->calls,
+            r->inclusive / perMs, 100 * r->inclusive / total,
+            r->exclusive / perMs, 100 * r->exclusive / total);
+  }
+  fprintf(f, "%-26s %10s %12.3f\n", "run", "", total / perMs);
+  if (p->droppedEvents > 0)
+    fprintf(f, "trace: %ld rule entries past the %ld event cap left out\n",
+            p->droppedEvents, p->maxEvents);
+}
+
+// Chrome trace_event format, for chrome://tracing or Perfetto
+int writeChromeTrace(Profiler *p, char *path) {
+  FILE *f = fopen(path, "w");
+  double perUs = ticksPerUs(p);
+  TraceEvent *e;
+  long i;
+
+  if (f == NULL)
+    return -1;
+  fprintf(f, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+  for (i = 0; i < p->eventCount; i++) {
+    e = &p->events[i];
+    fprintf(f, "{\"name\": \"%s\", \"cat\": \"rule\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": 1}%s\n",
+            ruleNames[e->rule], e->phase, (e->ticks - p->startTicks) / perUs,
+            i + 1 < p->eventCount ? "," : "");
+  }
+  fprintf(f, "]}\n");
+  return fclose(f) == 0 ? 0 : -1;
+}
@@ -0,0 +1,87 @@
+/* Grammar rule profiler */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define MAX_PROFILED_RULES 64
+#define DEFAULT_TRACE_EVENTS 1000000
+
+typedef struct {
+  long calls;
+  long active;          // frames of this rule on the stack (recursion)
+  uint64_t inclusive;   // ticks with the rule on the stack, counted once
+  uint64_t exclusive;   // ticks with the rule on top
+} RuleProfile;
+
+typedef struct {
+  int rule;
+  int traced;           // its begin event was recorded
+  uint64_t start;       // entry ticks; entry number when sampling
+  uint64_t children;    // inclusive ticks of the direct callees
+} ProfileFrame;
+
+typedef struct {
+  int rule;
+  char phase;           // 'B' or 'E'
+  uint64_t ticks;
+} TraceEvent;
+
+typedef struct {
+  RuleProfile rules[MAX_PROFILED_RULES];
+  ProfileFrame *stack;
+  int depth, capacity;
+
+  // Sampling: with period > 0 (microseconds) a SIGPROF timer marks a
+  // sample as due and the next rule entry or exit charges the
+  // ticks since the last sample to the stack as it stood. Call counts
+  // stay exact.
+  long period;
+  uint64_t lastSample;
+  long sampleNo;
+  long marks[MAX_PROFILED_RULES];
+  uint64_t entries;
+  ProfileFrame *sampled;  // stack of the previous sample, for the trace
+  int sampledDepth, sampledCapacity;
+
+  TraceEvent *events;
+  long eventCount, eventCapacity;
+  long beginEvents, maxEvents;   // rule entries put in the trace, and the cap
+  long droppedEvents;
+
+  uint64_t startTicks, endTicks;
+  double startTime, endTime;
+} Profiler;
+
+// Profiler of the run on this thread; NULL (the default) disables it
+extern __thread Profiler *profiler;
+
+int enterRule(int *id, const char *name);
+void exitRule(void);
+
+static inline void leaveRule(int *entered) {
+  if (*entered)
+    exitRule();
+}
+
+// First statement of every grammar rule. The cleanup attribute closes the
+// frame on every return; a syntax error longjmp is handled by unwindRules().
+#ifdef NO_PROFILE
+#define PROFILE_RULE()
+#else
+#define PROFILE_RULE() \
+  static int ruleId = -1; \
+  int ruleEntered __attribute__((cleanup(leaveRule))) = \
+    profiler != NULL ? enterRule(&ruleId, __func__) : 0
+#endif
+
+Profiler *newProfiler(long period, long maxEvents);
+void freeProfiler(Profiler *p);
+void unwindRules(void);
+void finishProfile(Profiler *p);
+void printProfile(Profiler *p, FILE *f);
+int writeChromeTrace(Profiler *p, char *path);
+
+#endif
@@ -6,13 +6,19 @@
 
 #include <stdio.h>
 #include "reader.h"
+#include "stats.h"
 
-FILE *inputStream;
-int lineNo, colNo;
-int currentChar;
+// Reader state is per thread so several files can be compiled at once
+__thread FILE *inputStream;
+__thread FILE *outputStream;
+__thread int lineNo, colNo;
+__thread int currentChar;
+__thread long charPos;
 
 int readChar(void) {
   currentChar = getc(inputStream);
+  STATS_ADD(readChars, 1);
+  charPos ++;
   colNo ++;
   if (currentChar == '\n') {
     lineNo ++;
@@ -22,16 +28,59 @@ int readChar(void) {
 }
 
 int openInputStream(char *fileName) {
+  double start = STATS_ON ? phaseStart(PHASE_OPEN) : 0;
+
   inputStream = fopen(fileName, "rt");
   if (inputStream == NULL)
     return IO_ERROR;
   lineNo = 1;
   colNo = 0;
+  charPos = -1;
+  readChar();
+  if (STATS_ON)
+    chargePhase(PHASE_OPEN, start);
+  return IO_SUCCESS;
+}
+
+// Read the source from memory instead of a file
+int openInputBuffer(char *buffer, size_t size) {
+  if (size == 0)
+    inputStream = fopen("/dev/null", "r");
+  else inputStream = fmemopen(buffer, size, "r");
+  if (inputStream == NULL)
+    return IO_ERROR;
+  lineNo = 1;
+  colNo = 0;
+  charPos = -1;
+  readChar();
+  return IO_SUCCESS;
+}
+
+// Continue reading at a position recorded earlier (byte offset, line, column)
+int seekInputStream(long offset, int line, int col) {
+  if (fseek(inputStream, offset, SEEK_SET) != 0)
+    return IO_ERROR;
+  lineNo = line;
+  colNo = col - 1;
+  charPos = offset - 1;
   readChar();
   return IO_SUCCESS;
 }
 
 void closeInputStream() {
+  double start = STATS_ON ? phaseStart(PHASE_OPEN) : 0;
+
+  STATS_ADD(bytesRead, ftell(inputStream));
   fclose(inputStream);
+  if (STATS_ON)
+    chargePhase(PHASE_OPEN, start);
+}
+
+FILE *getOutputStream(void) {
+  return outputStream != NULL ? outputStream : stdout;
+}
+
+void setOutputStream(FILE *stream) {
+  outputStream = stream;
 }
 
@@ -7,11 +7,19 @@
 #ifndef __READER_H__
 #define __READER_H__
 
+#include <stdio.h>
+
 #define IO_ERROR 0
 #define IO_SUCCESS 1
 
 int readChar(void);
 int openInputStream(char *fileName);
+int openInputBuffer(char *buffer, size_t size);
 void closeInputStream(void);
+int seekInputStream(long offset, int line, int col);
+
+// Trace/diagnostic output of the current thread (stdout unless redirected)
+FILE *getOutputStream(void);
+void setOutputStream(FILE *stream);
 
 #endif
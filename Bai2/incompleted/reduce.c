@@ -0,0 +1,134 @@
+/* Strength reduction */
+
+#include <string.h>
+
+#include "reduce.h"
+
+typedef struct {
+  ReduceStats *stats;
+  FILE *report;
+} Reducer;
+
+// k when n is 2 ** k, or -1
+static int powerOfTwo(int n) {
+  int k;
+
+  for (k = 0; k <= 30; k++)
+    if (n == 1 << k)
+      return k;
+  return -1;
+}
+
+int powerChainLength(int n) {
+  int count = 0;
+
+  // Square for each bit below the top one, multiply for each set bit
+  for (; n > 1; n >>= 1)
+    count += 1 + (n & 1);
+  return count;
+}
+
+// The number becomes the second child
+static void swapOperands(Node *node) {
+  Node *left = node->firstChild, *right = node->lastChild;
+
+  node->firstChild = right;
+  node->lastChild = left;
+  right->prev = NULL;
+  right->next = left;
+  left->prev = right;
+  left->next = NULL;
+}
+
+static void mark(Reducer *r, Node *node, ReductionKind kind, int amount) {
+  node->value = kind | amount << 8;
+  switch (kind) {
+  case REDUCE_IDENTITY:
+    r->stats->identities++;
+    if (r->report != NULL)
+      fprintf(r->report, "%d-%d: operation by 1 dropped\n", node->lineNo, node->colNo);
+    break;
+  case REDUCE_SHIFT:
+  case REDUCE_DIVIDE:
+    r->stats->shifts++;
+    if (r->report != NULL)
+      fprintf(r->report, "%d-%d: %s %d by a shift of %d\n", node->lineNo, node->colNo,
+              kind == REDUCE_SHIFT ? "*" : "/", 1 << amount, amount);
+    break;
+  case REDUCE_MODULO:
+    r->stats->masks++;
+    if (r->report != NULL)
+      fprintf(r->report, "%d-%d: %% %d by a mask of %d\n", node->lineNo, node->colNo,
+              1 << amount, (1 << amount) - 1);
+    break;
+  default:
+    r->stats->powers++;
+    r->stats->multiplications += powerChainLength(amount);
+    if (r->report != NULL)
+      fprintf(r->report, "%d-%d: ** %d by %d multiplications\n", node->lineNo, node->colNo,
+              amount, powerChainLength(amount));
+    break;
+  }
+}
+
+static void reduceBinary(Reducer *r, Node *node) {
+  Node *left = node->firstChild, *right = node->lastChild;
+  int k;
+
+  // A number is pure, so it may be evaluated second
+  if (node->op == SB_TIMES && left->kind == N_NUMBER && right->kind != N_NUMBER) {
+    swapOperands(node);
+    right = left;
+  }
+  if (right->kind != N_NUMBER)
+    return;
+  k = powerOfTwo(right->value);
+  switch (node->op) {
+  case SB_TIMES:
+  case SB_SLASH:
+    if (k == 0)
+      mark(r, node, REDUCE_IDENTITY, 0);
+    else if (k > 0)
+      mark(r, node, node->op == SB_TIMES ? REDUCE_SHIFT : REDUCE_DIVIDE, k);
+    break;
+  case SB_MOD:
+    if (k >= 0)
+      mark(r, node, REDUCE_MODULO, k);
+    break;
+  case SB_POWER:
+    // A negative exponent may divide by zero, which is left to OP_POW
+    if (right->value == 1)
+      mark(r, node, REDUCE_IDENTITY, 0);
+    else if (right->value >= 0 && right->value <= REDUCE_MAX_POWER)
+      mark(r, node, REDUCE_POWER, right->value);
+    break;
+  default:
+    break;
+  }
+}
+
+static void reduceNode(Reducer *r, Node *node) {
+  Node *child;
+
+  switch (node->kind) {
+  case N_CONST_DECL:
+  case N_TYPE_DECL:
+  case N_VAR_DECL:
+  case N_PARAM:
+  case N_TYPE:
+    return;
+  default:
+    break;
+  }
+  for (child = node->firstChild; child != NULL; child = child->next)
+    reduceNode(r, child);
+  if (node->kind == N_BINARY)
+    reduceBinary(r, node);
+}
+
+void reduceStrength(CheckedProgram *program, ReduceStats *stats, FILE *report) {
+  Reducer r = {stats, report};
+
+  memset(stats, 0, sizeof(ReduceStats));
+  reduceNode(&r, program->tree.root);
+}
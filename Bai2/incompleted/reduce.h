@@ -0,0 +1,44 @@
+/* Strength reduction */
+
+#ifndef __REDUCE_H__
+#define __REDUCE_H__
+
+#include <stdio.h>
+#include "typecheck.h"
+
+// Constant exponents up to this become multiplication chains
+#define REDUCE_MAX_POWER 64
+
+// What a binary operation by a number reduces to. The pass leaves it in
+// the value of the N_BINARY node as kind | amount << 8, with the other
+// operand as the first child.
+typedef enum {
+  REDUCE_NONE,
+  REDUCE_IDENTITY,    // x * 1, x / 1, x ** 1: x itself
+  REDUCE_SHIFT,       // x * 2 ** k: x shifted left by k
+  REDUCE_DIVIDE,      // x / 2 ** k: a biased arithmetic shift right by k
+  REDUCE_MODULO,      // x % 2 ** k: x less its quotient shifted back
+  REDUCE_POWER        // x ** n, 0 <= n <= REDUCE_MAX_POWER: a multiplication chain
+} ReductionKind;
+
+#define reductionKind(node) ((ReductionKind)((node)->value & 0xFF))
+#define reductionAmount(node) ((node)->value >> 8)
+
+typedef struct {
+  int shifts;         // multiplications and divisions
+  int masks;          // modulos
+  int powers;
+  int multiplications;  // in the chains of the powers
+  int identities;
+} ReduceStats;
+
+// Marks, in the tree of a checked program that did not fail, each
+// operation whose operand is a number it can be reduced by; run after
+// foldConstants, which leaves more numbers. With report set, each
+// reduction is written there as "line-col: ...".
+void reduceStrength(CheckedProgram *program, ReduceStats *stats, FILE *report);
+
+// Multiplications in the chain of x ** n
+int powerChainLength(int n);
+
+#endif
@@ -0,0 +1,66 @@
+/* Single-producer/single-consumer ring */
+
+#include <stddef.h>
+#include <sched.h>
+
+#include "ring.h"
+
+#define RING_SPINS 64
+
+void initRing(Ring *ring) {
+  atomic_init(&ring->head, 0);
+  atomic_init(&ring->tail, 0);
+  atomic_init(&ring->cancelled, 0);
+}
+
+int ringTryPush(Ring *ring, void *item) {
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+  size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+  if (tail - head == RING_SIZE)
+    return 0;
+  ring->slots[tail & (RING_SIZE - 1)] = item;
+  atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+  return 1;
+}
+
+void *ringTryPop(Ring *ring) {
+  size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+  size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+  void *item;
+
+  if (head == tail)
+    return NULL;
+  item = ring->slots[head & (RING_SIZE - 1)];
+  atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+  return item;
+}
+
+// Blocking push: spins briefly, then yields the CPU. Returns 0 when the
+// consumer has cancelled the ring and the item was not queued.
+int ringPush(Ring *ring, void *item) {
+  int spins = 0;
+
+  while (!ringTryPush(ring, item)) {
+    if (atomic_load_explicit(&ring->cancelled, memory_order_relaxed))
+      return 0;
+    if (++spins > RING_SPINS)
+      sched_yield();
+  }
+  return 1;
+}
+
+// Blocking pop; items must not be NULL
+void *ringPop(Ring *ring) {
+  void *item;
+  int spins = 0;
+
+  while ((item = ringTryPop(ring)) == NULL)
+    if (++spins > RING_SPINS)
+      sched_yield();
+  return item;
+}
+
+void cancelRing(Ring *ring) {
+  atomic_store_explicit(&ring->cancelled, 1, memory_order_relaxed);
+}
@@ -0,0 +1,26 @@
+/* Single-producer/single-consumer ring */
+
+#ifndef __RING_H__
+#define __RING_H__
+
+#include <stdatomic.h>
+
+#define RING_SIZE 64   // must be a power of two
+
+// Lock-free queue of pointers between exactly one producer thread and one
+// consumer thread. Each index is written by one side only.
+typedef struct {
+  void *slots[RING_SIZE];
+  atomic_size_t head;       // next slot to pop, written by the consumer
+  atomic_size_t tail;       // next slot to push, written by the producer
+  atomic_int cancelled;     // set by the consumer when it stops early
+} Ring;
+
+void initRing(Ring *ring);
+int ringTryPush(Ring *ring, void *item);
+void *ringTryPop(Ring *ring);
+int ringPush(Ring *ring, void *item);
+void *ringPop(Ring *ring);
+void cancelRing(Ring *ring);
+
+#endif
@@ -12,11 +12,16 @@
 #include "token.h"
 #include "error.h"
 #include "scanner.h"
+#include "stats.h"
 
 
-extern int lineNo;
-extern int colNo;
-extern int currentChar;
+extern __thread int lineNo;
+extern __thread int colNo;
+extern __thread int currentChar;
+extern __thread long charPos;
+
+__thread long tokenCount;
+__thread long tokenOffset;
 
 extern CharCode charCodes[];
 
@@ -143,20 +148,28 @@ Token* readString(void) {
   readChar(); // Bỏ qua dấu " mở đầu
 
   while (currentChar != EOF && charCodes[currentChar] != CHAR_DOUBLEQUOTE) {
-      if (count <= MAX_IDENT_LEN) { // Tận dụng MAX_IDENT_LEN hoặc tự định nghĩa MAX_STRING_LEN
+      // Keep room for the terminator: string[] has MAX_IDENT_LEN + 1 bytes
+      if (count < MAX_IDENT_LEN) { // Tận dụng MAX_IDENT_LEN hoặc tự định nghĩa MAX_STRING_LEN
           token->string[count] = (char)currentChar;
-          count++;
       }
+      count++;
       // Nếu muốn xử lý ký tự thoát (escape) như \n, \" thì viết thêm code ở đây
       readChar();
   }
-  token->string[count] = '\0';
+  token->string[count > MAX_IDENT_LEN ? MAX_IDENT_LEN : count] = '\0';
 
   if (currentChar == EOF) {
       error(ERR_INVALIDSYMBOL, ln, cn); // Hoặc tạo lỗi mới ERR_UNTERMINATED_STRING
       return token;
   }
 
+  // A longer constant does not fit in string[]: refuse it rather than cut it
+  if (count > MAX_IDENT_LEN) {
+      readChar();
+      error(ERR_STRINGTOOLONG, ln, cn);
+      return token;
+  }
+
   readChar(); // Bỏ qua dấu " đóng
   return token;
 }
@@ -174,6 +187,7 @@ Token* getToken(void) {
   Token *token;
   int ln, cn;
 
+  tokenOffset = charPos;
   if (currentChar == EOF) 
     return makeToken(TK_EOF, lineNo, colNo);
 
@@ -341,75 +355,85 @@ Token* getToken(void) {
 }
 
 Token* getValidToken(void) {
+  double start = STATS_ON ? phaseStart(PHASE_SCAN) : 0;
   Token *token = getToken();
   while (token->tokenType == TK_NONE) {
-    free(token);
+    freeToken(token);
     token = getToken();
   }
+  tokenCount++;
+  if (STATS_ON) {
+    stats->tokens[token->tokenType]++;
+    chargePhase(PHASE_SCAN, start);
+  }
   return token;
 }
 
 /******************************************************************/
 
 void printToken(Token *token) {
+  FILE *out = getOutputStream();
+  double start = STATS_ON ? phaseStart(PHASE_OUTPUT) : 0;
 
-  printf("%d-%d:", token->lineNo, token->colNo);
+  fprintf(out, "%d-%d:", token->lineNo, token->colNo);
 
   switch (token->tokenType) {
-  case TK_NONE: printf("TK_NONE\n"); break;
-  case TK_IDENT: printf("TK_IDENT(%s)\n", token->string); break;
-  case TK_NUMBER: printf("TK_NUMBER(%s)\n", token->string); break;
-  case TK_CHAR: printf("TK_CHAR(\'%s\')\n", token->string); break;
-  case TK_EOF: printf("TK_EOF\n"); break;
-
-  case KW_PROGRAM: printf("KW_PROGRAM\n"); break;
-  case KW_CONST: printf("KW_CONST\n"); break;
-  case KW_TYPE: printf("KW_TYPE\n"); break;
-  case KW_VAR: printf("KW_VAR\n"); break;
-  case KW_INTEGER: printf("KW_INTEGER\n"); break;
-  case KW_CHAR: printf("KW_CHAR\n"); break;
-  case KW_ARRAY: printf("KW_ARRAY\n"); break;
-  case KW_OF: printf("KW_OF\n"); break;
-  case KW_FUNCTION: printf("KW_FUNCTION\n"); break;
-  case KW_PROCEDURE: printf("KW_PROCEDURE\n"); break;
-  case KW_BEGIN: printf("KW_BEGIN\n"); break;
-  case KW_END: printf("KW_END\n"); break;
-  case KW_CALL: printf("KW_CALL\n"); break;
-  case KW_IF: printf("KW_IF\n"); break;
-  case KW_THEN: printf("KW_THEN\n"); break;
-  case KW_ELSE: printf("KW_ELSE\n"); break;
-  case KW_WHILE: printf("KW_WHILE\n"); break;
-  case KW_DO: printf("KW_DO\n"); break;
-  case KW_FOR: printf("KW_FOR\n"); break;
-  case KW_TO: printf("KW_TO\n"); break;
-
-  case SB_SEMICOLON: printf("SB_SEMICOLON\n"); break;
-  case SB_COLON: printf("SB_COLON\n"); break;
-  case SB_PERIOD: printf("SB_PERIOD\n"); break;
-  case SB_COMMA: printf("SB_COMMA\n"); break;
-  case SB_ASSIGN: printf("SB_ASSIGN\n"); break;
-  case SB_EQ: printf("SB_EQ\n"); break;
-  case SB_NEQ: printf("SB_NEQ\n"); break;
-  case SB_LT: printf("SB_LT\n"); break;
-  case SB_LE: printf("SB_LE\n"); break;
-  case SB_GT: printf("SB_GT\n"); break;
-  case SB_GE: printf("SB_GE\n"); break;
-  case SB_PLUS: printf("SB_PLUS\n"); break;
-  case SB_MINUS: printf("SB_MINUS\n"); break;
-  case SB_TIMES: printf("SB_TIMES\n"); break;
-  case SB_SLASH: printf("SB_SLASH\n"); break;
-  case SB_LPAR: printf("SB_LPAR\n"); break;
-  case SB_RPAR: printf("SB_RPAR\n"); break;
-  case SB_LSEL: printf("SB_LSEL\n"); break;
-  case SB_RSEL: printf("SB_RSEL\n"); break;
-  case TK_STRING: printf("TK_STRING(\"%s\")\n", token->string); break; // <--- THÊM
-  case KW_STRING: printf("KW_STRING\n"); break; // <--- THÊM
-  case SB_MOD: printf("SB_MOD\n"); break;       // <--- THÊM
-  case KW_BYTES: printf("KW_BYTES\n"); break; // <--- THÊM
-  case SB_POWER: printf("SB_POWER\n"); break; // <--- THÊM
-  case KW_REPEAT: printf("KW_REPEAT\n"); break; // <--- THÊM
-  case KW_UNTIL: printf("KW_UNTIL\n"); break;   // <--- THÊM
+  case TK_NONE: fprintf(out, "TK_NONE\n"); break;
+  case TK_IDENT: fprintf(out, "TK_IDENT(%s)\n", token->string); break;
+  case TK_NUMBER: fprintf(out, "TK_NUMBER(%s)\n", token->string); break;
+  case TK_CHAR: fprintf(out, "TK_CHAR(\'%s\')\n", token->string); break;
+  case TK_EOF: fprintf(out, "TK_EOF\n"); break;
+
+  case KW_PROGRAM: fprintf(out, "KW_PROGRAM\n"); break;
+  case KW_CONST: fprintf(out, "KW_CONST\n"); break;
+  case KW_TYPE: fprintf(out, "KW_TYPE\n"); break;
+  case KW_VAR: fprintf(out, "KW_VAR\n"); break;
+  case KW_INTEGER: fprintf(out, "KW_INTEGER\n"); break;
+  case KW_CHAR: fprintf(out, "KW_CHAR\n"); break;
+  case KW_ARRAY: fprintf(out, "KW_ARRAY\n"); break;
+  case KW_OF: fprintf(out, "KW_OF\n"); break;
+  case KW_FUNCTION: fprintf(out, "KW_FUNCTION\n"); break;
+  case KW_PROCEDURE: fprintf(out, "KW_PROCEDURE\n"); break;
+  case KW_BEGIN: fprintf(out, "KW_BEGIN\n"); break;
+  case KW_END: fprintf(out, "KW_END\n"); break;
+  case KW_CALL: fprintf(out, "KW_CALL\n"); break;
+  case KW_IF: fprintf(out, "KW_IF\n"); break;
+  case KW_THEN: fprintf(out, "KW_THEN\n"); break;
+  case KW_ELSE: fprintf(out, "KW_ELSE\n"); break;
+  case KW_WHILE: fprintf(out, "KW_WHILE\n"); break;
+  case KW_DO: fprintf(out, "KW_DO\n"); break;
+  case KW_FOR: fprintf(out, "KW_FOR\n"); break;
+  case KW_TO: fprintf(out, "KW_TO\n"); break;
+
+  case SB_SEMICOLON: fprintf(out, "SB_SEMICOLON\n"); break;
+  case SB_COLON: fprintf(out, "SB_COLON\n"); break;
+  case SB_PERIOD: fprintf(out, "SB_PERIOD\n"); break;
+  case SB_COMMA: fprintf(out, "SB_COMMA\n"); break;
+  case SB_ASSIGN: fprintf(out, "SB_ASSIGN\n"); break;
+  case SB_EQ: fprintf(out, "SB_EQ\n"); break;
+  case SB_NEQ: fprintf(out, "SB_NEQ\n"); break;
+  case SB_LT: fprintf(out, "SB_LT\n"); break;
+  case SB_LE: fprintf(out, "SB_LE\n"); break;
+  case SB_GT: fprintf(out, "SB_GT\n"); break;
+  case SB_GE: fprintf(out, "SB_GE\n"); break;
+  case SB_PLUS: fprintf(out, "SB_PLUS\n"); break;
+  case SB_MINUS: fprintf(out, "SB_MINUS\n"); break;
+  case SB_TIMES: fprintf(out, "SB_TIMES\n"); break;
+  case SB_SLASH: fprintf(out, "SB_SLASH\n"); break;
+  case SB_LPAR: fprintf(out, "SB_LPAR\n"); break;
+  case SB_RPAR: fprintf(out, "SB_RPAR\n"); break;
+  case SB_LSEL: fprintf(out, "SB_LSEL\n"); break;
+  case SB_RSEL: fprintf(out, "SB_RSEL\n"); break;
+  case TK_STRING: fprintf(out, "TK_STRING(\"%s\")\n", token->string); break; // <--- THÊM
+  case KW_STRING: fprintf(out, "KW_STRING\n"); break; // <--- THÊM
+  case SB_MOD: fprintf(out, "SB_MOD\n"); break;       // <--- THÊM
+  case KW_BYTES: fprintf(out, "KW_BYTES\n"); break; // <--- THÊM
+  case SB_POWER: fprintf(out, "SB_POWER\n"); break; // <--- THÊM
+  case KW_REPEAT: fprintf(out, "KW_REPEAT\n"); break; // <--- THÊM
+  case KW_UNTIL: fprintf(out, "KW_UNTIL\n"); break;   // <--- THÊM
   }
+  if (STATS_ON)
+    chargePhase(PHASE_OUTPUT, start);
 }
 
 // int scan(char *fileName) {
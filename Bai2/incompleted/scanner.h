@@ -9,6 +9,11 @@
 
 #include "token.h"
 
+// Number of valid tokens produced by the current thread
+extern __thread long tokenCount;
+// Byte offset of the last token produced (the parser's lookAhead)
+extern __thread long tokenOffset;
+
 Token* getToken(void);
 Token* getValidToken(void);
 void printToken(Token *token);
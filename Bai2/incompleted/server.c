@@ -0,0 +1,410 @@
+/* Parse server */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "reader.h"
+#include "scanner.h"
+#include "parser.h"
+#include "error.h"
+#include "stats.h"
+#include "server.h"
+
+#define MAX_HEADER 4096
+#define MAX_SOURCE (64 * 1024 * 1024)
+#define RECEIVE_TIMEOUT 5
+#define SEND_TIMEOUT 5
+
+// Log-linear histogram of microseconds: values below 8 are exact, above that
+// every power of two is split into 8 buckets (at most 12.5% error)
+#define HIST_SUB_BITS 3
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+typedef struct {
+  uint64_t counts[HIST_BUCKETS];
+  uint64_t total, max;
+} Histogram;
+
+typedef struct {
+  int fd;
+  double accepted;
+  int dropped;          // the peer stopped reading the reply
+} Connection;
+
+typedef struct {
+  int listenFd;
+  int stopping;
+  double started;
+
+  // Accepted connections waiting for a worker
+  Connection *queue;
+  int head, count, capacity;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+
+  // Counters, guarded by lock
+  uint64_t requests, syntaxErrors, ioErrors, badRequests, dropped;
+  uint64_t bytes, tokens;
+  Histogram latency, parse;
+} Server;
+
+/******************************************************************/
+
+static int bucketOf(uint64_t value) {
+  int e;
+
+  if (value < HIST_SUB)
+    return (int)value;
+  e = 63 - __builtin_clzll(value);
+  return (e - HIST_SUB_BITS + 1) * HIST_SUB + (int)((value >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+// Largest value that falls into the bucket
+static uint64_t bucketLimit(int index) {
+  int e, sub;
+
+  if (index < HIST_SUB)
+    return index;
+  e = index / HIST_SUB + HIST_SUB_BITS - 1;
+  sub = index % HIST_SUB;
+  return ((uint64_t)(HIST_SUB + sub + 1) << (e - HIST_SUB_BITS)) - 1;
+}
+
+static void recordValue(Histogram *h, double seconds) {
+  uint64_t us = (uint64_t)(seconds * 1e6);
+
+  h->counts[bucketOf(us)]++;
+  h->total++;
+  if (us > h->max) h->max = us;
+}
+
+static uint64_t percentile(Histogram *h, double p) {
+  uint64_t rank = (uint64_t)(p * h->total + 0.5), seen = 0;
+  int i;
+
+  if (h->total == 0)
+    return 0;
+  if (rank < 1) rank = 1;
+  for (i = 0; i < HIST_BUCKETS; i++) {
+    seen += h->counts[i];
+    if (seen >= rank)
+      return bucketLimit(i) < h->max ? bucketLimit(i) : h->max;
+  }
+  return h->max;
+}
+
+static void printHistogram(FILE *out, char *name, Histogram *h) {
+  fprintf(out, "%s_us p50 %llu p90 %llu p99 %llu max %llu\n", name,
+          (unsigned long long)percentile(h, 0.50), (unsigned long long)percentile(h, 0.90),
+          (unsigned long long)percentile(h, 0.99), (unsigned long long)h->max);
+}
+
+static void printStats(Server *server, FILE *out) {
+  double uptime = statsClock() - server->started;
+
+  if (uptime <= 0) uptime = 1e-9;
+  pthread_mutex_lock(&server->lock);
+  fprintf(out, "requests %llu\n", (unsigned long long)server->requests);
+  fprintf(out, "syntax_errors %llu\n", (unsigned long long)server->syntaxErrors);
+  fprintf(out, "io_errors %llu\n", (unsigned long long)server->ioErrors);
+  fprintf(out, "bad_requests %llu\n", (unsigned long long)server->badRequests);
+  fprintf(out, "dropped %llu\n", (unsigned long long)server->dropped);
+  fprintf(out, "bytes %llu\n", (unsigned long long)server->bytes);
+  fprintf(out, "tokens %llu\n", (unsigned long long)server->tokens);
+  fprintf(out, "uptime_s %.3f\n", uptime);
+  fprintf(out, "requests_per_s %.1f\n", server->requests / uptime);
+  fprintf(out, "tokens_per_s %.0f\n", server->tokens / uptime);
+  fprintf(out, "queued %d\n", server->count);
+  printHistogram(out, "latency", &server->latency);
+  printHistogram(out, "parse", &server->parse);
+  pthread_mutex_unlock(&server->lock);
+}
+
+/******************************************************************/
+
+static void pushConnection(Server *server, int fd) {
+  pthread_mutex_lock(&server->lock);
+  if (server->count == server->capacity) {
+    Connection *queue = (Connection*)malloc(2 * server->capacity * sizeof(Connection));
+    int i;
+    for (i = 0; i < server->count; i++)
+      queue[i] = server->queue[(server->head + i) % server->capacity];
+    free(server->queue);
+    server->queue = queue;
+    server->head = 0;
+    server->capacity *= 2;
+  }
+  server->queue[(server->head + server->count) % server->capacity].fd = fd;
+  server->queue[(server->head + server->count) % server->capacity].accepted = statsClock();
+  server->count++;
+  pthread_cond_signal(&server->ready);
+  pthread_mutex_unlock(&server->lock);
+}
+
+// Returns 0 once the server is stopping and the queue is drained
+static int popConnection(Server *server, Connection *conn) {
+  pthread_mutex_lock(&server->lock);
+  while (server->count == 0 && !server->stopping)
+    pthread_cond_wait(&server->ready, &server->lock);
+  if (server->count == 0) {
+    pthread_mutex_unlock(&server->lock);
+    return 0;
+  }
+  *conn = server->queue[server->head];
+  server->head = (server->head + 1) % server->capacity;
+  server->count--;
+  pthread_mutex_unlock(&server->lock);
+  return 1;
+}
+
+static void stopServer(Server *server) {
+  pthread_mutex_lock(&server->lock);
+  server->stopping = 1;
+  pthread_cond_broadcast(&server->ready);
+  pthread_mutex_unlock(&server->lock);
+  // Wakes up the accept loop
+  shutdown(server->listenFd, SHUT_RDWR);
+}
+
+/******************************************************************/
+
+// The peer runs as the server's user, or as root: it may name files and
+// stop the server
+static int isTrusted(int fd) {
+  struct ucred peer;
+  socklen_t size = sizeof(peer);
+
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &size) < 0)
+    return 0;
+  return peer.uid == geteuid() || peer.uid == 0;
+}
+
+// Parse one request; the parser output goes straight to the socket
+static char *compileRequest(Server *server, char *header, FILE *in, FILE *out, int trusted) {
+  char *buffer;
+  long size;
+  int status;
+  double start;
+
+  if (strncmp(header, "SOURCE ", 7) == 0) {
+    size = strtol(header + 7, NULL, 10);
+    if (size < 0 || size > MAX_SOURCE)
+      return "bad-request";
+    buffer = (char*)malloc(size + 1);
+    if (fread(buffer, 1, size, in) != (size_t)size) {
+      free(buffer);
+      return "bad-request";
+    }
+    start = statsClock();
+    status = compileBuffer(buffer, size);
+    free(buffer);
+  } else if (strncmp(header, "PATH ", 5) == 0) {
+    // The trace echoes the file, which the peer may not be allowed to read
+    if (!trusted)
+      return "forbidden";
+    size = 0;
+    start = statsClock();
+    status = compile(header + 5);
+  } else return "bad-request";
+
+  if (status == IO_ERROR)
+    fprintf(out, "Can\'t read input file!\n");
+
+  pthread_mutex_lock(&server->lock);
+  recordValue(&server->parse, statsClock() - start);
+  server->bytes += size;
+  if (status == IO_ERROR)
+    server->ioErrors++;
+  else {
+    server->tokens += tokenCount;
+    if (errorRaised) server->syntaxErrors++;
+  }
+  pthread_mutex_unlock(&server->lock);
+
+  if (status == IO_ERROR)
+    return "io-error";
+  return errorRaised ? "error" : "ok";
+}
+
+// The reply stream. A peer that reads nothing for SEND_TIMEOUT seconds is
+// dropped; the rest of the reply is thrown away rather than blocking the
+// worker in write().
+static ssize_t sendReply(void *cookie, const char *buffer, size_t size) {
+  Connection *conn = (Connection*)cookie;
+  size_t sent = 0;
+  ssize_t n;
+
+  while (!conn->dropped && sent < size) {
+    n = write(conn->fd, buffer + sent, size - sent);
+    if (n > 0)
+      sent += n;
+    else if (n < 0 && errno == EINTR)
+      continue;
+    else {
+      conn->dropped = 1;
+      shutdown(conn->fd, SHUT_RDWR);
+    }
+  }
+  return size;
+}
+
+static void serveConnection(Server *server, Connection *conn) {
+  static cookie_io_functions_t replyStream = {NULL, sendReply, NULL, NULL};
+  struct timeval receiveTimeout = {RECEIVE_TIMEOUT, 0}, sendTimeout = {SEND_TIMEOUT, 0};
+  char header[MAX_HEADER];
+  char *status;
+  FILE *in, *out;
+  int counted = 1, trusted = isTrusted(conn->fd);
+
+  setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+  setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+  conn->dropped = 0;
+  in = fdopen(conn->fd, "r");
+  out = fopencookie(conn, "w", replyStream);
+  if (in == NULL || out == NULL) {
+    if (in != NULL) fclose(in);
+    else close(conn->fd);
+    if (out != NULL) fclose(out);
+    return;
+  }
+
+  if (fgets(header, sizeof(header), in) == NULL) {
+    status = "bad-request";
+  } else {
+    header[strcspn(header, "\r\n")] = '\0';
+    if (strcmp(header, "STATS") == 0) {
+      printStats(server, out);
+      status = "ok";
+      counted = 0;
+    } else if (strcmp(header, "SHUTDOWN") == 0) {
+      if (trusted)
+        stopServer(server);
+      status = trusted ? "ok" : "forbidden";
+      counted = 0;
+    } else {
+      setOutputStream(out);
+      status = compileRequest(server, header, in, out, trusted);
+      setOutputStream(NULL);
+    }
+  }
+  fprintf(out, STATUS_PREFIX "%s\n", status);
+  fclose(out);
+  fclose(in);
+
+  pthread_mutex_lock(&server->lock);
+  if (conn->dropped)
+    server->dropped++;
+  else if (strcmp(status, "bad-request") == 0 || strcmp(status, "forbidden") == 0)
+    server->badRequests++;
+  else if (counted) {
+    server->requests++;
+    recordValue(&server->latency, statsClock() - conn->accepted);
+  }
+  pthread_mutex_unlock(&server->lock);
+}
+
+static void *serverWorker(void *p) {
+  Server *server = (Server*)p;
+  Connection conn;
+
+  while (popConnection(server, &conn))
+    serveConnection(server, &conn);
+  return NULL;
+}
+
+// A socket left at the path by a server that is gone may be replaced;
+// one a server still answers on, or anything else, may not
+static int isStale(struct sockaddr_un *addr) {
+  struct stat st;
+  int fd, answered;
+
+  if (lstat(addr->sun_path, &st) < 0)
+    return errno == ENOENT;
+  if (!S_ISSOCK(st.st_mode) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+    return 0;
+  answered = connect(fd, (struct sockaddr*)addr, sizeof(*addr)) == 0;
+  close(fd);
+  if (answered)
+    fprintf(stderr, "parser: a server already answers on %s\n", addr->sun_path);
+  return !answered && unlink(addr->sun_path) == 0;
+}
+
+int runServer(char *socketPath, int jobs) {
+  Server server;
+  struct sockaddr_un addr;
+  pthread_t *threads;
+  mode_t mask;
+  int fd, i, bound;
+
+  if (strlen(socketPath) >= sizeof(addr.sun_path))
+    return IO_ERROR;
+  memset(&server, 0, sizeof(server));
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  strcpy(addr.sun_path, socketPath);
+
+  server.listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (server.listenFd < 0)
+    return IO_ERROR;
+  if (!isStale(&addr)) {
+    close(server.listenFd);
+    return IO_ERROR;
+  }
+  // Only the user may connect, from the moment the socket exists
+  mask = umask(077);
+  bound = bind(server.listenFd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+  umask(mask);
+  if (!bound || chmod(socketPath, 0600) < 0 || listen(server.listenFd, 128) < 0) {
+    close(server.listenFd);
+    return IO_ERROR;
+  }
+
+  // A client that goes away must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+  server.started = statsClock();
+  server.capacity = 64;
+  server.queue = (Connection*)malloc(server.capacity * sizeof(Connection));
+  pthread_mutex_init(&server.lock, NULL);
+  pthread_cond_init(&server.ready, NULL);
+
+  threads = (pthread_t*)malloc(jobs * sizeof(pthread_t));
+  for (i = 0; i < jobs; i++)
+    pthread_create(&threads[i], NULL, serverWorker, &server);
+  fprintf(stderr, "parser: serving on %s with %d workers\n", socketPath, jobs);
+
+  for (;;) {
+    fd = accept(server.listenFd, NULL, NULL);
+    if (fd >= 0)
+      pushConnection(&server, fd);
+    else if (server.stopping)
+      break;
+    else if (errno != EINTR && errno != ECONNABORTED) {
+      stopServer(&server);
+      break;
+    }
+  }
+
+  for (i = 0; i < jobs; i++)
+    pthread_join(threads[i], NULL);
+  close(server.listenFd);
+  unlink(socketPath);
+  printStats(&server, stderr);
+
+  pthread_cond_destroy(&server.ready);
+  pthread_mutex_destroy(&server.lock);
+  free(server.queue);
+  free(threads);
+  return IO_SUCCESS;
+}
@@ -0,0 +1,28 @@
+/* Parse server */
+
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#define SOCKET_NAME "kpl-parser.sock"
+
+// One request per connection. The request is a header line:
+//   SOURCE <length>   followed by <length> bytes of KPL source
+//   PATH <file>       a file readable by the server
+//   STATS             latency histograms and throughput counters
+//   SHUTDOWN          stop accepting, finish the queued requests and exit
+// The reply is the parser output followed by a last line
+//   #status ok | error | io-error | bad-request | forbidden
+// The socket is 0600; PATH and SHUTDOWN are also forbidden to a peer
+// running as another user than the server (root excepted).
+// A peer that sends nothing, or reads nothing of the reply, for five
+// seconds is dropped.
+#define STATUS_PREFIX "#status "
+
+// SOCKET_NAME in $XDG_RUNTIME_DIR, or else in /tmp/kpl-parser-UID, a
+// directory only the user may enter. NULL when there is no such place.
+char *defaultSocketPath(void);
+
+// Refuses, returning IO_ERROR, to take over a socket a server answers on
+int runServer(char *socketPath, int jobs);
+
+#endif
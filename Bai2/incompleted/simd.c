@@ -0,0 +1,200 @@
+/* SIMD kernels of vectorized loops */
+
+#include <string.h>
+
+#include "vector.h"
+
+// Cells are 64 bits wide and hold 32-bit values, so a 128-bit vector
+// does two of them and a 256-bit one four. The products only need the
+// low halves, which SSE2 and AVX2 multiply 32 by 32 into 64 bits.
+
+// The scalar kernels also finish the tails, one cell at a time; they
+// are kept scalar so that --simd scalar measures what vectors win
+#define SCALAR __attribute__((optimize("no-tree-vectorize")))
+
+static SCALAR void addScalar(int64_t *d, int64_t *x, int64_t *y, int n) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    d[i] = (int64_t)((uint64_t)x[i] + (uint64_t)y[i]);
+}
+
+static SCALAR void subScalar(int64_t *d, int64_t *x, int64_t *y, int n) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    d[i] = (int64_t)((uint64_t)x[i] - (uint64_t)y[i]);
+}
+
+static SCALAR void mulScalar(int64_t *d, int64_t *x, int64_t *y, int n) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    d[i] = (int64_t)((uint64_t)(uint32_t)x[i] * (uint32_t)y[i]);
+}
+
+static SCALAR void storeScalar(int64_t *d, int64_t *x, int n) {
+  int i;
+
+  for (i = 0; i < n; i++)
+    d[i] = (int32_t)x[i];
+}
+
+static SCALAR int64_t sumScalar(int64_t *x, int n) {
+  uint64_t sum = 0;
+  int i;
+
+  for (i = 0; i < n; i++)
+    sum += (uint64_t)x[i];
+  return (int64_t)sum;
+}
+
+#if defined(__x86_64__)
+
+#include <immintrin.h>
+
+// SSE2 is part of x86-64, so these need no check
+#define LOAD128(p) _mm_loadu_si128((__m128i*)(p))
+#define STORE128(p, v) _mm_storeu_si128((__m128i*)(p), v)
+
+static void addSse2(int64_t *d, int64_t *x, int64_t *y, int n) {
+  int i;
+
+  for (i = 0; i + 2 <= n; i += 2)
+    STORE128(d + i, _mm_add_epi64(LOAD128(x + i), LOAD128(y + i)));
+  addScalar(d + i, x + i, y + i, n - i);
+}
+
+static void subSse2(int64_t *d, int64_t *x, int64_t *y, int n) {
+  int i;
+
+  for (i = 0; i + 2 <= n; i += 2)
+    STORE128(d + i, _mm_sub_epi64(LOAD128(x + i), LOAD128(y + i)));
+  subScalar(d + i, x + i, y + i, n - i);
+}
+
+static void mulSse2(int64_t *d, int64_t *x, int64_t *y, int n) {
+  int i;
+
+  for (i = 0; i + 2 <= n; i += 2)
+    STORE128(d + i, _mm_mul_epu32(LOAD128(x + i), LOAD128(y + i)));
+  mulScalar(d + i, x + i, y + i, n - i);
+}
+
+// The sign of each low half copied into the high half
+static void storeSse2(int64_t *d, int64_t *x, int n) {
+  __m128i low = _mm_set_epi32(0, -1, 0, -1), v, sign;
+  int i;
+
+  for (i = 0; i + 2 <= n; i += 2) {
+    v = LOAD128(x + i);
+    sign = _mm_shuffle_epi32(_mm_srai_epi32(v, 31), _MM_SHUFFLE(2, 2, 0, 0));
+    STORE128(d + i, _mm_or_si128(_mm_and_si128(low, v), _mm_andnot_si128(low, sign)));
+  }
+  storeScalar(d + i, x + i, n - i);
+}
+
+static int64_t sumSse2(int64_t *x, int n) {
+  __m128i sum = _mm_setzero_si128();
+  int64_t lanes[2];
+  int i;
+
+  for (i = 0; i + 2 <= n; i += 2)
+    sum = _mm_add_epi64(sum, LOAD128(x + i));
+  STORE128(lanes, sum);
+  return (int64_t)((uint64_t)lanes[0] + (uint64_t)lanes[1] + (uint64_t)sumScalar(x + i, n - i));
+}
+
+#define AVX2 __attribute__((target("avx2")))
+#define LOAD256(p) _mm256_loadu_si256((__m256i*)(p))
+#define STORE256(p, v) _mm256_storeu_si256((__m256i*)(p), v)
+
+static AVX2 void addAvx2(int64_t *d, int64_t *x, int64_t *y, int n) {
+  int i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    STORE256(d + i, _mm256_add_epi64(LOAD256(x + i), LOAD256(y + i)));
+  addScalar(d + i, x + i, y + i, n - i);
+}
+
+static AVX2 void subAvx2(int64_t *d, int64_t *x, int64_t *y, int n) {
+  int i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    STORE256(d + i, _mm256_sub_epi64(LOAD256(x + i), LOAD256(y + i)));
+  subScalar(d + i, x + i, y + i, n - i);
+}
+
+static AVX2 void mulAvx2(int64_t *d, int64_t *x, int64_t *y, int n) {
+  int i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    STORE256(d + i, _mm256_mul_epu32(LOAD256(x + i), LOAD256(y + i)));
+  mulScalar(d + i, x + i, y + i, n - i);
+}
+
+static AVX2 void storeAvx2(int64_t *d, int64_t *x, int n) {
+  __m256i v, sign;
+  int i;
+
+  for (i = 0; i + 4 <= n; i += 4) {
+    v = LOAD256(x + i);
+    sign = _mm256_shuffle_epi32(_mm256_srai_epi32(v, 31), _MM_SHUFFLE(2, 2, 0, 0));
+    STORE256(d + i, _mm256_blend_epi32(v, sign, 0xAA));
+  }
+  storeScalar(d + i, x + i, n - i);
+}
+
+static AVX2 int64_t sumAvx2(int64_t *x, int n) {
+  __m256i sum = _mm256_setzero_si256();
+  int64_t lanes[4];
+  int i;
+
+  for (i = 0; i + 4 <= n; i += 4)
+    sum = _mm256_add_epi64(sum, LOAD256(x + i));
+  STORE256(lanes, sum);
+  return (int64_t)((uint64_t)lanes[0] + (uint64_t)lanes[1] + (uint64_t)lanes[2] + (uint64_t)lanes[3] +
+                   (uint64_t)sumScalar(x + i, n - i));
+}
+
+#endif
+
+// Widest first
+static SimdKernels kernels[] = {
+#if defined(__x86_64__)
+  {"avx2", addAvx2, subAvx2, mulAvx2, storeAvx2, sumAvx2},
+  {"sse2", addSse2, subSse2, mulSse2, storeSse2, sumSse2},
+#endif
+  {"scalar", addScalar, subScalar, mulScalar, storeScalar, sumScalar},
+  {NULL}
+};
+
+static SimdKernels *selected;
+
+static int isSupported(SimdKernels *k) {
+#if defined(__x86_64__)
+  if (strcmp(k->name, "avx2") == 0)
+    return __builtin_cpu_supports("avx2");
+#endif
+  return 1;
+}
+
+SimdKernels *simdKernels(void) {
+  SimdKernels *k;
+
+  for (k = kernels; selected == NULL; k++)
+    if (isSupported(k))
+      selected = k;
+  return selected;
+}
+
+int selectSimdKernels(char *name) {
+  SimdKernels *k;
+
+  for (k = kernels; k->name != NULL; k++)
+    if (strcmp(k->name, name) == 0 && isSupported(k)) {
+      selected = k;
+      return 1;
+    }
+  return 0;
+}
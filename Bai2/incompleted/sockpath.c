@@ -0,0 +1,32 @@
+/* Default socket path of the parse server */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "server.h"
+
+char *defaultSocketPath(void) {
+  static char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+  char *dir = getenv("XDG_RUNTIME_DIR");
+  char own[64];
+  struct stat st;
+  int n;
+
+  if (dir != NULL && dir[0] == '/')
+    n = snprintf(path, sizeof(path), "%s/" SOCKET_NAME, dir);
+  else {
+    // Made 0700 here, or else it must already be ours and closed to others
+    snprintf(own, sizeof(own), "/tmp/kpl-parser-%u", (unsigned)getuid());
+    if (mkdir(own, 0700) < 0 && errno != EEXIST)
+      return NULL;
+    if (lstat(own, &st) < 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+        (st.st_mode & 077) != 0)
+      return NULL;
+    n = snprintf(path, sizeof(path), "%s/" SOCKET_NAME, own);
+  }
+  return n < (int)sizeof(path) ? path : NULL;
+}
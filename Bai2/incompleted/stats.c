@@ -0,0 +1,178 @@
+/* Run statistics */
+
+#include <string.h>
+#include <time.h>
+
+#include "stats.h"
+
+__thread Stats *stats;
+
+// Cost of one statsClock() call, measured once and taken off the phases
+static double clockCost = -1;
+
+// Per-token phases time their first calls, then one call in 16 scaled up
+// to the calls not timed, which keeps the clock reads from dominating a
+// long run. The first calls run cold, so they are not taken as samples.
+#define EXACT_CALLS 256
+static long sampleMask[PHASE_COUNT] = {0, 15, 0, 15};
+
+static char *phaseNames[PHASE_COUNT] = {"open/read", "scan", "parse", "output"};
+
+static char *tokenTypeNames[TOKEN_TYPE_COUNT] = {
+  "TK_NONE", "TK_IDENT", "TK_NUMBER", "TK_CHAR", "TK_STRING", "TK_EOF",
+  "KW_PROGRAM", "KW_CONST", "KW_TYPE", "KW_VAR",
+  "KW_INTEGER", "KW_CHAR", "KW_ARRAY", "KW_OF",
+  "KW_FUNCTION", "KW_PROCEDURE",
+  "KW_BEGIN", "KW_END", "KW_CALL",
+  "KW_IF", "KW_THEN", "KW_ELSE",
+  "KW_WHILE", "KW_DO", "KW_FOR", "KW_TO",
+  "KW_REPEAT", "KW_UNTIL",
+  "KW_STRING",
+  "KW_BYTES",
+  "SB_SEMICOLON", "SB_COLON", "SB_PERIOD", "SB_COMMA",
+  "SB_ASSIGN", "SB_EQ", "SB_NEQ", "SB_LT", "SB_LE", "SB_GT", "SB_GE",
+  "SB_PLUS", "SB_MINUS", "SB_TIMES", "SB_SLASH", "SB_MOD",
+  "SB_POWER",
+  "SB_LPAR", "SB_RPAR", "SB_LSEL", "SB_RSEL"
+};
+
+double statsClock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void measureClockCost(void) {
+  double start = statsClock();
+  int i;
+
+  for (i = 0; i < 1000; i++)
+    statsClock();
+  clockCost = (statsClock() - start) / 1001;
+}
+
+void initStats(Stats *s) {
+  memset(s, 0, sizeof(Stats));
+  if (clockCost < 0)
+    measureClockCost();
+}
+
+// Start timing a call of phase, or return 0 when this call is not sampled
+double phaseStart(Phase phase) {
+  long call = stats->phaseCalls[phase]++;
+
+  if (call >= EXACT_CALLS && (call & sampleMask[phase]) != 0)
+    return 0;
+  return statsClock();
+}
+
+void chargePhase(Phase phase, double start) {
+  double time;
+
+  if (start == 0)
+    return;
+  time = statsClock() - start;
+  stats->phaseTime[phase] += time;
+  stats->phaseTimings[phase]++;
+  if (stats->phaseCalls[phase] > EXACT_CALLS) {
+    stats->sampleTime[phase] += time;
+    stats->samples[phase]++;
+  }
+}
+
+// Close the run started at start: each timed interval loses the cost of
+// one clock read, the calls not timed get the mean of the samples, and
+// what no phase claimed is parsing. Should the phases still claim more
+// than the total, they are scaled down to fit and marked estimated.
+void finishStats(Stats *s, double start) {
+  double claimed = 0, room, mean;
+  long timings = 0;
+  int i;
+
+  s->total = statsClock() - start;
+  s->estimated = 0;
+  for (i = 0; i < PHASE_COUNT; i++) {
+    if (i == PHASE_PARSE)
+      continue;
+    s->phaseTime[i] -= s->phaseTimings[i] * clockCost;
+    if (s->samples[i] > 0) {
+      mean = s->sampleTime[i] / s->samples[i] - clockCost;
+      s->phaseTime[i] += (s->phaseCalls[i] - s->phaseTimings[i]) * (mean > 0 ? mean : 0);
+    }
+    if (s->phaseTime[i] < 0)
+      s->phaseTime[i] = 0;
+    claimed += s->phaseTime[i];
+    timings += s->phaseTimings[i];
+  }
+  s->overhead = timings * 2 * clockCost;
+  if (s->overhead > s->total)
+    s->overhead = s->total;
+  room = s->total - s->overhead;
+  if (claimed > room) {
+    for (i = 0; i < PHASE_COUNT; i++)
+      s->phaseTime[i] *= room / claimed;
+    claimed = room;
+    s->estimated = 1;
+  }
+  s->phaseTime[PHASE_PARSE] = room - claimed;
+}
+
+static long tokenTotal(Stats *s) {
+  long total = 0;
+  int i;
+
+  for (i = 0; i < TOKEN_TYPE_COUNT; i++)
+    total += s->tokens[i];
+  return total;
+}
+
+static void reportText(Stats *s, FILE *f) {
+  double total = s->total > 0 ? s->total : 1;
+  int i;
+
+  fprintf(f, "bytes read         %12ld\n", s->bytesRead);
+  fprintf(f, "readChar calls     %12ld\n", s->readChars);
+  fprintf(f, "keyword lookups    %12ld\n", s->keywordLookups);
+  fprintf(f, "token allocations  %12ld\n", s->tokenAllocs);
+  fprintf(f, "peak token memory  %12ld bytes (%ld tokens)\n",
+          s->peakTokens * (long)sizeof(Token), s->peakTokens);
+  fprintf(f, "tokens             %12ld\n", tokenTotal(s));
+  for (i = 0; i < TOKEN_TYPE_COUNT; i++)
+    if (s->tokens[i] > 0)
+      fprintf(f, "  %-16s %12ld\n", tokenTypeNames[i], s->tokens[i]);
+  fprintf(f, "phase                      ms\n");
+  for (i = 0; i < PHASE_COUNT; i++)
+    fprintf(f, "  %-16s %12.3f %5.1f%%\n", phaseNames[i],
+            s->phaseTime[i] * 1e3, 100 * s->phaseTime[i] / total);
+  fprintf(f, "  %-16s %12.3f %5.1f%%\n", "timer overhead",
+          s->overhead * 1e3, 100 * s->overhead / total);
+  fprintf(f, "  %-16s %12.3f\n", "total", s->total * 1e3);
+  if (s->estimated)
+    fprintf(f, "  (estimated: the timed phases were scaled down to the total)\n");
+}
+
+static void reportJson(Stats *s, FILE *f) {
+  int i, first = 1;
+
+  fprintf(f, "{\"bytesRead\": %ld, \"readCharCalls\": %ld, \"keywordLookups\": %ld, ",
+          s->bytesRead, s->readChars, s->keywordLookups);
+  fprintf(f, "\"tokenAllocations\": %ld, \"peakTokens\": %ld, \"peakTokenBytes\": %ld,\n",
+          s->tokenAllocs, s->peakTokens, s->peakTokens * (long)sizeof(Token));
+  fprintf(f, " \"tokens\": {\"total\": %ld", tokenTotal(s));
+  for (i = 0; i < TOKEN_TYPE_COUNT; i++)
+    if (s->tokens[i] > 0)
+      fprintf(f, ", \"%s\": %ld", tokenTypeNames[i], s->tokens[i]);
+  fprintf(f, "},\n \"phasesMs\": {");
+  for (i = 0; i < PHASE_COUNT; i++) {
+    fprintf(f, "%s\"%s\": %.3f", first ? "" : ", ", phaseNames[i], s->phaseTime[i] * 1e3);
+    first = 0;
+  }
+  fprintf(f, ", \"timerOverhead\": %.3f, \"total\": %.3f, \"estimated\": %s}}\n",
+          s->overhead * 1e3, s->total * 1e3, s->estimated ? "true" : "false");
+}
+
+void reportStats(Stats *s, FILE *f, int json) {
+  if (json)
+    reportJson(s, f);
+  else reportText(s, f);
+}
@@ -0,0 +1,56 @@
+/* Run statistics */
+
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <stdio.h>
+
+#include "token.h"
+
+typedef enum {
+  PHASE_OPEN,     // opening, seeking and closing the source
+  PHASE_SCAN,     // getValidToken(), reading included
+  PHASE_PARSE,    // everything else
+  PHASE_OUTPUT,   // writing the trace
+  PHASE_COUNT
+} Phase;
+
+typedef struct {
+  long bytesRead;
+  long readChars;
+  long tokens[TOKEN_TYPE_COUNT];
+  long keywordLookups;
+  long tokenAllocs;
+  long liveTokens, peakTokens;
+  double phaseTime[PHASE_COUNT];
+  long phaseCalls[PHASE_COUNT];
+  long phaseTimings[PHASE_COUNT];   // calls actually timed
+  double sampleTime[PHASE_COUNT];   // of the calls timed once sampling began
+  long samples[PHASE_COUNT];
+  double overhead;  // clock reads of the timed intervals
+  double total;
+  int estimated;    // the phases were scaled down to fit in the total
+} Stats;
+
+// Counters of the run on this thread; NULL (the default) disables them
+extern __thread Stats *stats;
+
+// Built with -DNO_STATS every hook compiles to nothing; otherwise a
+// disabled hook costs one well predicted branch
+#ifdef NO_STATS
+#define STATS_ON 0
+#else
+#define STATS_ON (stats != NULL)
+#endif
+
+#define STATS_ADD(field, n) do { if (STATS_ON) stats->field += (n); } while (0)
+
+void initStats(Stats *s);
+// Monotonic seconds; every timing of the parser and its tools reads it
+double statsClock(void);
+double phaseStart(Phase phase);
+void chargePhase(Phase phase, double start);
+void finishStats(Stats *s, double start);
+void reportStats(Stats *s, FILE *f, int json);
+
+#endif
@@ -0,0 +1,152 @@
+/* Symbol table */
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "symtab.h"
+
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+void initSymbolTable(SymbolTable *table) {
+  table->capacity = 256;
+  table->count = 0;
+  table->slots = (NameSlot*)calloc(table->capacity, sizeof(NameSlot));
+  table->blocks = NULL;
+  table->log = NULL;
+  table->logCount = table->logCapacity = 0;
+  table->scopeCapacity = 16;
+  table->scopes = (int*)malloc(table->scopeCapacity * sizeof(int));
+  table->scopes[0] = 0;
+  table->level = 0;
+}
+
+void freeSymbolTable(SymbolTable *table) {
+  SymbolBlock *block = table->blocks, *next;
+
+  while (block != NULL) {
+    next = block->next;
+    free(block);
+    block = next;
+  }
+  free(table->slots);
+  free(table->log);
+  free(table->scopes);
+}
+
+// Names are case-insensitive, like the keywords
+static unsigned foldName(char *name, char *folded) {
+  unsigned hash = FNV_OFFSET;
+  int i;
+
+  for (i = 0; name[i] != '\0' && i < MAX_IDENT_LEN; i++) {
+    folded[i] = (char)toupper((unsigned char)name[i]);
+    hash = (hash ^ (unsigned char)folded[i]) * FNV_PRIME;
+  }
+  folded[i] = '\0';
+  return hash;
+}
+
+// Linear probing; the slot of the name or the empty slot where it goes.
+// Slots are never emptied, so probe chains stay intact.
+static NameSlot *findSlot(SymbolTable *table, char *folded, unsigned hash) {
+  int i = (int)(hash & (table->capacity - 1));
+
+  while (table->slots[i].name[0] != '\0' && strcmp(table->slots[i].name, folded) != 0)
+    i = (i + 1) & (table->capacity - 1);
+  return &table->slots[i];
+}
+
+static void grow(SymbolTable *table) {
+  NameSlot *old = table->slots, *slot;
+  char folded[MAX_IDENT_LEN + 1];
+  int i, capacity = table->capacity;
+
+  table->capacity *= 2;
+  table->slots = (NameSlot*)calloc(table->capacity, sizeof(NameSlot));
+  for (i = 0; i < capacity; i++)
+    if (old[i].name[0] != '\0') {
+      slot = findSlot(table, old[i].name, foldName(old[i].name, folded));
+      *slot = old[i];
+    }
+  free(old);
+}
+
+static Symbol *newSymbol(SymbolTable *table) {
+  SymbolBlock *block = table->blocks;
+
+  if (block == NULL || block->used == sizeof(block->symbols) / sizeof(Symbol)) {
+    block = (SymbolBlock*)malloc(sizeof(SymbolBlock));
+    block->next = table->blocks;
+    block->used = 0;
+    table->blocks = block;
+  }
+  return &block->symbols[block->used++];
+}
+
+void enterScope(SymbolTable *table) {
+  if (++table->level == table->scopeCapacity) {
+    table->scopeCapacity *= 2;
+    table->scopes = (int*)realloc(table->scopes, table->scopeCapacity * sizeof(int));
+  }
+  table->scopes[table->level] = table->logCount;
+}
+
+void exitScope(SymbolTable *table) {
+  char folded[MAX_IDENT_LEN + 1];
+  Symbol *symbol;
+  int mark = table->scopes[table->level--];
+
+  while (table->logCount > mark) {
+    symbol = table->log[--table->logCount];
+    findSlot(table, folded, foldName(symbol->name, folded))->symbol = symbol->shadowed;
+  }
+}
+
+Symbol *declareSymbol(SymbolTable *table, char *name, SymbolKind kind, int lineNo, int colNo) {
+  char folded[MAX_IDENT_LEN + 1];
+  unsigned hash = foldName(name, folded);
+  NameSlot *slot = findSlot(table, folded, hash);
+  Symbol *symbol;
+
+  if (slot->name[0] == '\0') {
+    if (2 * (table->count + 1) > table->capacity) {
+      grow(table);
+      slot = findSlot(table, folded, hash);
+    }
+    strcpy(slot->name, folded);
+    slot->symbol = NULL;
+    table->count++;
+  } else if (slot->symbol != NULL && slot->symbol->level == table->level)
+    return NULL;
+
+  if (table->logCount == table->logCapacity) {
+    table->logCapacity = table->logCapacity ? 2 * table->logCapacity : 256;
+    table->log = (Symbol**)realloc(table->log, table->logCapacity * sizeof(Symbol*));
+  }
+  symbol = newSymbol(table);
+  memset(symbol, 0, sizeof(Symbol));
+  strcpy(symbol->name, name);
+  symbol->kind = kind;
+  symbol->level = table->level;
+  symbol->lineNo = lineNo;
+  symbol->colNo = colNo;
+  symbol->shadowed = slot->symbol;
+  slot->symbol = symbol;
+  table->log[table->logCount++] = symbol;
+  return symbol;
+}
+
+Symbol *lookupSymbol(SymbolTable *table, char *name) {
+  char folded[MAX_IDENT_LEN + 1];
+  return findSlot(table, folded, foldName(name, folded))->symbol;
+}
+
+void declarePredefined(SymbolTable *table) {
+  declareSymbol(table, "READC", SYM_FUNCTION, 0, 0)->builtin = BUILTIN_READC;
+  declareSymbol(table, "READI", SYM_FUNCTION, 0, 0)->builtin = BUILTIN_READI;
+  declareSymbol(table, "WRITEC", SYM_PROCEDURE, 0, 0)->builtin = BUILTIN_WRITEC;
+  declareSymbol(table, "WRITEI", SYM_PROCEDURE, 0, 0)->builtin = BUILTIN_WRITEI;
+  declareSymbol(table, "WRITELN", SYM_PROCEDURE, 0, 0)->builtin = BUILTIN_WRITELN;
+}
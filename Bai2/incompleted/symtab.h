@@ -0,0 +1,82 @@
+/* Symbol table */
+
+#ifndef __SYMTAB_H__
+#define __SYMTAB_H__
+
+#include "token.h"
+
+typedef enum {
+  SYM_CONSTANT,
+  SYM_TYPE,
+  SYM_VARIABLE,
+  SYM_PARAMETER,
+  SYM_FUNCTION,
+  SYM_PROCEDURE,
+  SYM_PROGRAM
+} SymbolKind;
+
+#define KIND_BIT(kind) (1u << (kind))
+
+typedef enum {
+  BUILTIN_NONE,
+  BUILTIN_READC,
+  BUILTIN_READI,
+  BUILTIN_WRITEC,
+  BUILTIN_WRITEI,
+  BUILTIN_WRITELN
+} Builtin;
+
+struct Type;
+struct Node;
+
+// One declaration. Symbols outlive their scope, so the parse tree can
+// point at them (Node.symbol) for the passes that follow the parse.
+typedef struct Symbol {
+  char name[MAX_IDENT_LEN + 1];   // as declared
+  SymbolKind kind;
+  Builtin builtin;
+  int level;                      // scope depth, 0: predefined
+  int lineNo, colNo;
+  struct Node *node;              // declaring node, NULL when predefined
+  struct Type *type;              // set by the type checker
+  int offset;                     // set by the code generator: frame cell, or routine entry
+  struct Symbol *shadowed;        // outer declaration it hides
+} Symbol;
+
+// A name ever seen, case-folded, and its innermost declaration
+typedef struct {
+  char name[MAX_IDENT_LEN + 1];   // "": empty slot
+  Symbol *symbol;                 // NULL: not declared in any open scope
+} NameSlot;
+
+typedef struct SymbolBlock {
+  struct SymbolBlock *next;
+  int used;
+  Symbol symbols[256];
+} SymbolBlock;
+
+// All the open scopes share one hash table, so a lookup costs the same
+// at any depth. Each declaration is pushed on a single undo log; leaving
+// a scope pops the log back to the scope's mark and gives each name the
+// declaration it shadowed.
+typedef struct {
+  NameSlot *slots;
+  int capacity, count;            // capacity is a power of two
+  SymbolBlock *blocks;
+  Symbol **log;
+  int logCount, logCapacity;
+  int *scopes;                    // logCount when each open scope began
+  int level, scopeCapacity;
+} SymbolTable;
+
+void initSymbolTable(SymbolTable *table);
+void freeSymbolTable(SymbolTable *table);
+void enterScope(SymbolTable *table);
+void exitScope(SymbolTable *table);
+// NULL when the innermost scope already declares the name
+Symbol *declareSymbol(SymbolTable *table, char *name, SymbolKind kind, int lineNo, int colNo);
+Symbol *lookupSymbol(SymbolTable *table, char *name);
+// Scope 0: READC, READI, WRITEC, WRITEI and WRITELN
+void declarePredefined(SymbolTable *table);
+
+#endif
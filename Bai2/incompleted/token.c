@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include "token.h"
+#include "stats.h"
 
 struct {
   char string[MAX_IDENT_LEN + 1];
@@ -48,6 +49,7 @@ int keywordEq(char *kw, char *string) {
 
 TokenType checkKeyword(char *string) {
   int i;
+  STATS_ADD(keywordLookups, 1);
   for (i = 0; i < KEYWORDS_COUNT; i++)
     if (keywordEq(keywords[i].string, string)) 
       return keywords[i].tokenType;
@@ -59,9 +61,21 @@ Token* makeToken(TokenType tokenType, int lineNo, int colNo) {
   token->tokenType = tokenType;
   token->lineNo = lineNo;
   token->colNo = colNo;
+  if (STATS_ON) {
+    stats->tokenAllocs++;
+    if (++stats->liveTokens > stats->peakTokens)
+      stats->peakTokens = stats->liveTokens;
+  }
   return token;
 }
 
+void freeToken(Token *token) {
+  if (token == NULL)
+    return;
+  STATS_ADD(liveTokens, -1);
+  free(token);
+}
+
 char *tokenToString(TokenType tokenType) {
   switch (tokenType) {
   case TK_NONE: return "None";
@@ -30,6 +30,8 @@ typedef enum {
   SB_LPAR, SB_RPAR, SB_LSEL, SB_RSEL
 } TokenType; 
 
+#define TOKEN_TYPE_COUNT (SB_RSEL + 1)
+
 typedef struct {
   char string[MAX_IDENT_LEN + 1];
   int lineNo, colNo;
@@ -39,6 +41,7 @@ typedef struct {
 
 TokenType checkKeyword(char *string);
 Token* makeToken(TokenType tokenType, int lineNo, int colNo);
+void freeToken(Token *token);
 char *tokenToString(TokenType tokenType);
 
 #endif
@@ -0,0 +1,299 @@
+/* Serialized parse trees */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "reader.h"
+#include "treefile.h"
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+// FNV-1a style mixing, eight bytes at a time so that hashing the source
+// stays far cheaper than parsing it
+uint64_t hashSourceFile(char *fileName, int *status) {
+  uint64_t buffer[1 << 13];
+  uint64_t hash = FNV_OFFSET, word;
+  size_t n, i;
+  FILE *f = fopen(fileName, "rb");
+
+  if (f == NULL) {
+    *status = IO_ERROR;
+    return 0;
+  }
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+    for (i = 0; i < n / 8; i++) {
+      hash ^= buffer[i];
+      hash *= FNV_PRIME;
+      hash ^= hash >> 29;
+    }
+    if (n % 8 != 0) {
+      word = 0;
+      memcpy(&word, (char*)buffer + n - n % 8, n % 8);
+      hash ^= word ^ (n % 8);
+      hash *= FNV_PRIME;
+      hash ^= hash >> 29;
+    }
+  }
+  fclose(f);
+  *status = IO_SUCCESS;
+  return hash;
+}
+
+/******************************************************************/
+
+typedef struct {
+  FlatNode *nodes;
+  uint32_t nodeCount;
+  char *texts;
+  uint32_t textSize, textCapacity;
+} TreeWriter;
+
+// One level of the preorder walk: the next child to visit and the flat
+// index of its previous sibling (0: none, the root is never a sibling).
+// Walks keep their own stack since a long sum gives a very deep tree.
+typedef struct {
+  Node *child;
+  uint32_t previous;
+} FlattenFrame;
+
+static uint32_t addText(TreeWriter *w, char *text) {
+  uint32_t offset = w->textSize;
+  size_t length = strlen(text) + 1;
+
+  while (w->textSize + length > w->textCapacity) {
+    w->textCapacity = w->textCapacity ? 2 * w->textCapacity : 4096;
+    w->texts = (char*)realloc(w->texts, w->textCapacity);
+  }
+  memcpy(w->texts + w->textSize, text, length);
+  w->textSize += length;
+  return offset;
+}
+
+static void addFlatNode(TreeWriter *w, Node *node) {
+  FlatNode *flat = &w->nodes[w->nodeCount++];
+
+  flat->kind = node->kind;
+  flat->op = node->op;
+  flat->lineNo = node->lineNo;
+  flat->colNo = node->colNo;
+  flat->value = node->value;
+  flat->text = node->text != NULL ? addText(w, node->text) : TREE_NO_TEXT;
+  flat->childCount = node->childCount;
+  flat->next = 0;
+}
+
+static void flatten(TreeWriter *w, Node *root) {
+  FlattenFrame *stack, *frame;
+  int top = 1, capacity = 64;
+  Node *node;
+
+  stack = (FlattenFrame*)malloc(capacity * sizeof(FlattenFrame));
+  stack[0].child = root;
+  stack[0].previous = 0;
+  while (top > 0) {
+    frame = &stack[top - 1];
+    if ((node = frame->child) == NULL) {
+      top--;
+      continue;
+    }
+    frame->child = node->next;
+    if (frame->previous != 0)
+      w->nodes[frame->previous].next = w->nodeCount;
+    frame->previous = w->nodeCount;
+    addFlatNode(w, node);
+
+    if (node->firstChild != NULL) {
+      if (top == capacity) {
+        capacity *= 2;
+        stack = (FlattenFrame*)realloc(stack, capacity * sizeof(FlattenFrame));
+      }
+      stack[top].child = node->firstChild;
+      stack[top].previous = 0;
+      top++;
+    }
+  }
+  free(stack);
+}
+
+// Written to a temporary name and renamed, so readers of a shared cache
+// directory never map a half written file
+int saveTree(ParseTree *tree, uint64_t sourceHash, char *path) {
+  TreeWriter w;
+  TreeHeader header;
+  char *tmp;
+  FILE *f;
+  int ok;
+
+  if (tree->root == NULL)
+    return IO_ERROR;
+  memset(&w, 0, sizeof(w));
+  w.nodes = (FlatNode*)calloc(tree->nodeCount, sizeof(FlatNode));
+  flatten(&w, tree->root);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, TREE_MAGIC, 4);
+  header.version = TREE_VERSION;
+  header.sourceHash = sourceHash;
+  header.nodeCount = w.nodeCount;
+  header.textSize = w.textSize;
+  header.fileSize = sizeof(TreeHeader) + (uint64_t)w.nodeCount * sizeof(FlatNode) + w.textSize;
+
+  tmp = (char*)malloc(strlen(path) + 32);
+  sprintf(tmp, "%s.%ld.tmp", path, (long)getpid());
+  f = fopen(tmp, "wb");
+  ok = f != NULL;
+  if (ok) {
+    ok = fwrite(&header, sizeof(header), 1, f) == 1
+      && fwrite(w.nodes, sizeof(FlatNode), w.nodeCount, f) == w.nodeCount
+      && fwrite(w.texts, 1, w.textSize, f) == w.textSize;
+    ok = fclose(f) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) remove(tmp);
+  }
+
+  free(tmp);
+  free(w.nodes);
+  free(w.texts);
+  return ok ? IO_SUCCESS : IO_ERROR;
+}
+
+/******************************************************************/
+
+// A corrupt or truncated file must not make a reader loop or read past
+// the mapping: every link goes forward within the nodes, every text
+// starts within the text area and the area ends in a NUL
+static int isWellFormed(TreeFile *file) {
+  TreeHeader *header = file->header;
+  FlatNode *node;
+  uint32_t i;
+
+  if (header->textSize > 0 && file->texts[header->textSize - 1] != '\0')
+    return 0;
+  for (i = 0; i < header->nodeCount; i++) {
+    node = &file->nodes[i];
+    if (node->kind >= NODE_KIND_COUNT ||
+        (node->next != 0 && (node->next <= i || node->next >= header->nodeCount)) ||
+        (node->text != TREE_NO_TEXT && node->text >= header->textSize))
+      return 0;
+  }
+  return 1;
+}
+
+// Maps the file read-only and checks it in one pass over the nodes,
+// which is still far cheaper than parsing the source again
+int mapTree(char *path, TreeFile *file) {
+  struct stat st;
+  TreeHeader *header;
+  int fd = open(path, O_RDONLY);
+
+  memset(file, 0, sizeof(TreeFile));
+  if (fd < 0)
+    return IO_ERROR;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(TreeHeader)) {
+    close(fd);
+    return IO_ERROR;
+  }
+  file->base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (file->base == MAP_FAILED) {
+    file->base = NULL;
+    return IO_ERROR;
+  }
+  file->size = st.st_size;
+
+  header = (TreeHeader*)file->base;
+  if (memcmp(header->magic, TREE_MAGIC, 4) != 0 || header->version != TREE_VERSION ||
+      header->fileSize != (uint64_t)st.st_size || header->nodeCount == 0 ||
+      sizeof(TreeHeader) + (uint64_t)header->nodeCount * sizeof(FlatNode) + header->textSize != header->fileSize) {
+    unmapTree(file);
+    return IO_ERROR;
+  }
+  file->header = header;
+  file->nodes = (FlatNode*)(header + 1);
+  file->texts = (char*)(file->nodes + header->nodeCount);
+  if (!isWellFormed(file)) {
+    unmapTree(file);
+    return IO_ERROR;
+  }
+  return IO_SUCCESS;
+}
+
+void unmapTree(TreeFile *file) {
+  if (file->base != NULL)
+    munmap(file->base, file->size);
+  memset(file, 0, sizeof(TreeFile));
+}
+
+FlatNode *flatRoot(TreeFile *file) {
+  return &file->nodes[0];
+}
+
+FlatNode *flatChild(TreeFile *file, FlatNode *node) {
+  uint32_t index = node - file->nodes + 1;
+  return node->childCount > 0 && index < file->header->nodeCount ? &file->nodes[index] : NULL;
+}
+
+FlatNode *flatNext(TreeFile *file, FlatNode *node) {
+  return node->next != 0 && node->next < file->header->nodeCount ? &file->nodes[node->next] : NULL;
+}
+
+char *flatText(TreeFile *file, FlatNode *node) {
+  if (node->text == TREE_NO_TEXT || node->text >= file->header->textSize)
+    return NULL;
+  return file->texts + node->text;
+}
+
+static void printFlatNode(TreeFile *file, FlatNode *node, int depth, FILE *out) {
+  char *text = flatText(file, node);
+
+  fprintf(out, "%*s%d-%d:%s", 2 * depth, "", node->lineNo, node->colNo,
+          nodeKindToString((NodeKind)node->kind));
+  if (text != NULL)
+    fprintf(out, "(%s)", text);
+  switch (node->kind) {
+  case N_NUMBER:
+  case N_CHAR:
+  case N_ASSIGN:
+    fprintf(out, " %d", node->value);
+    break;
+  case N_TYPE:
+  case N_UNARY:
+  case N_BINARY:
+  case N_CONDITION:
+    fprintf(out, " %s", tokenToString((TokenType)node->op));
+    if (node->op == KW_ARRAY)
+      fprintf(out, " %d", node->value);
+    break;
+  default:
+    break;
+  }
+  fprintf(out, "\n");
+}
+
+// Preorder with an explicit stack of the next sibling at each depth
+void printFlatTree(TreeFile *file, FILE *out) {
+  FlatNode **stack, *node;
+  int top = 1, capacity = 64;
+
+  stack = (FlatNode**)malloc(capacity * sizeof(FlatNode*));
+  stack[0] = flatRoot(file);
+  while (top > 0) {
+    if ((node = stack[top - 1]) == NULL) {
+      top--;
+      continue;
+    }
+    printFlatNode(file, node, top - 1, out);
+    stack[top - 1] = flatNext(file, node);
+    if (top == capacity) {
+      capacity *= 2;
+      stack = (FlatNode**)realloc(stack, capacity * sizeof(FlatNode*));
+    }
+    stack[top++] = flatChild(file, node);
+  }
+  free(stack);
+}
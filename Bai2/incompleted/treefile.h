@@ -0,0 +1,55 @@
+/* Serialized parse trees */
+
+#ifndef __TREEFILE_H__
+#define __TREEFILE_H__
+
+#include <stdio.h>
+#include <stdint.h>
+#include "ast.h"
+
+#define TREE_MAGIC "KPLT"
+#define TREE_VERSION 1
+#define TREE_NO_TEXT 0xffffffffu
+
+// File layout: header, nodes in preorder, then the NUL-terminated texts.
+// There are no pointers: a node's first child is the node right after it,
+// siblings are linked by index and texts are offsets into the text area.
+typedef struct {
+  char magic[4];
+  uint32_t version;
+  uint64_t sourceHash;     // FNV-1a of the source file the tree was made from
+  uint32_t nodeCount;
+  uint32_t textSize;
+  uint64_t fileSize;
+} TreeHeader;
+
+typedef struct {
+  uint16_t kind;
+  uint16_t op;
+  uint32_t lineNo, colNo;
+  int32_t value;
+  uint32_t text;           // TREE_NO_TEXT or offset in the text area
+  uint32_t childCount;
+  uint32_t next;           // next sibling, 0 for the last child
+} FlatNode;
+
+typedef struct {
+  void *base;
+  size_t size;
+  TreeHeader *header;
+  FlatNode *nodes;
+  char *texts;
+} TreeFile;
+
+uint64_t hashSourceFile(char *fileName, int *status);
+int saveTree(ParseTree *tree, uint64_t sourceHash, char *path);
+int mapTree(char *path, TreeFile *file);
+void unmapTree(TreeFile *file);
+
+FlatNode *flatRoot(TreeFile *file);
+FlatNode *flatChild(TreeFile *file, FlatNode *node);
+FlatNode *flatNext(TreeFile *file, FlatNode *node);
+char *flatText(TreeFile *file, FlatNode *node);
+void printFlatTree(TreeFile *file, FILE *out);
+
+#endif
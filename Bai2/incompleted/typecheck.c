@@ -0,0 +1,318 @@
+/* Type checking */
+
+#include <stdlib.h>
+#include <setjmp.h>
+
+#include "reader.h"
+#include "parser.h"
+#include "error.h"
+#include "typecheck.h"
+
+// One pass over the tree; every node is visited once and every type
+// comparison is a pointer comparison, so checking is linear
+typedef struct {
+  TypeTable *types;
+  Symbol **routines;      // functions whose body is being checked
+  int routineCount, routineCapacity;
+} Checker;
+
+static Type *checkExpression(Checker *c, Node *node);
+static void checkStatement(Checker *c, Node *node);
+static void checkBlock(Checker *c, Node *block);
+
+void initCheckedProgram(CheckedProgram *program) {
+  initTree(&program->tree);
+  initSymbolTable(&program->symbols);
+  initTypeTable(&program->types);
+  program->failed = 0;
+}
+
+void freeCheckedProgram(CheckedProgram *program) {
+  freeTree(&program->tree);
+  freeSymbolTable(&program->symbols);
+  freeTypeTable(&program->types);
+}
+
+static void mismatch(Node *node) {
+  error(ERR_TYPEINCONSISTENCY, node->lineNo, node->colNo);
+}
+
+static void expectType(Node *node, Type *actual, Type *expected) {
+  if (actual != expected)
+    mismatch(node);
+}
+
+static Type *resolveType(Checker *c, Node *node) {
+  switch (node->op) {
+  case KW_INTEGER: node->type = &intType; break;
+  case KW_CHAR: node->type = &charType; break;
+  case KW_STRING: node->type = &stringType; break;
+  case KW_BYTES: node->type = &bytesType; break;
+  case KW_ARRAY:
+    node->type = arrayType(c->types, node->value, resolveType(c, node->firstChild));
+    break;
+  default:
+    node->type = node->symbol->type;
+    break;
+  }
+  return node->type;
+}
+
+static Type *checkConstant(Checker *c, Node *node) {
+  switch (node->kind) {
+  case N_NUMBER: node->type = &intType; break;
+  case N_CHAR: node->type = &charType; break;
+  case N_STRING: node->type = &stringType; break;
+  case N_UNARY:
+    expectType(node, checkConstant(c, node->firstChild), &intType);
+    node->type = &intType;
+    break;
+  default:
+    node->type = node->symbol->type;
+    break;
+  }
+  return node->type;
+}
+
+// Type of a variable, parameter or array element
+static Type *checkIndexes(Checker *c, Node *node, Type *type) {
+  Node *index;
+
+  for (index = node->firstChild; index != NULL; index = index->next) {
+    if (type->typeClass != TY_ARRAY)
+      error(ERR_NOTANARRAY, index->lineNo, index->colNo);
+    expectType(index, checkExpression(c, index), &intType);
+    type = type->element;
+  }
+  return type;
+}
+
+// A VAR parameter needs something to point at
+static int isReference(Node *node) {
+  return node->kind == N_VARIABLE &&
+         (node->symbol->kind == SYM_VARIABLE || node->symbol->kind == SYM_PARAMETER);
+}
+
+static void checkArguments(Checker *c, Node *call, Type *routine) {
+  Node *arg = call->firstChild;
+  int i;
+
+  if (call->childCount != routine->size)
+    error(ERR_INVALIDARGUMENTS, call->lineNo, call->colNo);
+  for (i = 0; i < routine->size; i++, arg = arg->next) {
+    expectType(arg, checkExpression(c, arg), routine->params[i]);
+    if (routine->byRef[i] && !isReference(arg))
+      error(ERR_INVALIDARGUMENTS, arg->lineNo, arg->colNo);
+  }
+}
+
+static Type *checkExpression(Checker *c, Node *node) {
+  Symbol *symbol = node->symbol;
+
+  switch (node->kind) {
+  case N_NUMBER:
+  case N_CHAR:
+  case N_STRING:
+    return checkConstant(c, node);
+  case N_UNARY:
+    expectType(node->firstChild, checkExpression(c, node->firstChild), &intType);
+    node->type = &intType;
+    break;
+  case N_BINARY:
+    expectType(node->firstChild, checkExpression(c, node->firstChild), &intType);
+    expectType(node->lastChild, checkExpression(c, node->lastChild), &intType);
+    node->type = &intType;
+    break;
+  case N_FUNC_CALL:
+    checkArguments(c, node, symbol->type);
+    node->type = symbol->type->element;
+    break;
+  default:
+    // A function named without arguments is called
+    if (symbol->kind == SYM_FUNCTION) {
+      checkArguments(c, node, symbol->type);
+      node->type = symbol->type->element;
+    } else node->type = checkIndexes(c, node, symbol->type);
+    break;
+  }
+  return node->type;
+}
+
+static void checkCondition(Checker *c, Node *node) {
+  Type *left = checkExpression(c, node->firstChild);
+
+  if (!isBasicType(left))
+    mismatch(node->firstChild);
+  expectType(node->lastChild, checkExpression(c, node->lastChild), left);
+}
+
+// The result of a function is assigned inside its own body
+static Type *checkLValue(Checker *c, Node *node) {
+  Symbol *symbol = node->symbol;
+  int i;
+
+  if (symbol->kind == SYM_FUNCTION) {
+    for (i = 0; i < c->routineCount && c->routines[i] != symbol; i++)
+      ;
+    if (i == c->routineCount)
+      error(ERR_INVALIDLVALUE, node->lineNo, node->colNo);
+    node->type = symbol->type->element;
+  } else node->type = checkIndexes(c, node, symbol->type);
+  if (!isBasicType(node->type))
+    mismatch(node);
+  return node->type;
+}
+
+static void checkAssignment(Checker *c, Node *node) {
+  Node *target, *value;
+  int i;
+
+  if (node->childCount != 2 * node->value)
+    error(ERR_UNBALANCEDASSIGNMENT, node->lineNo, node->colNo);
+  value = childAt(node, node->value);
+  for (i = 0, target = node->firstChild; i < node->value; i++, target = target->next, value = value->next)
+    expectType(value, checkExpression(c, value), checkLValue(c, target));
+}
+
+static void checkCall(Checker *c, Node *node) {
+  Symbol *symbol = node->symbol;
+
+  // CALL READC(C) and CALL READI(N) read into their argument
+  if (symbol->kind == SYM_FUNCTION) {
+    if (node->childCount > 1)
+      error(ERR_INVALIDARGUMENTS, node->lineNo, node->colNo);
+    if (node->childCount == 1) {
+      expectType(node->firstChild, checkExpression(c, node->firstChild), symbol->type->element);
+      if (!isReference(node->firstChild))
+        error(ERR_INVALIDARGUMENTS, node->firstChild->lineNo, node->firstChild->colNo);
+    }
+  } else checkArguments(c, node, symbol->type);
+}
+
+static void checkStatement(Checker *c, Node *node) {
+  Node *child;
+
+  switch (node->kind) {
+  case N_ASSIGN:
+    checkAssignment(c, node);
+    break;
+  case N_CALL:
+    checkCall(c, node);
+    break;
+  case N_GROUP:
+    for (child = node->firstChild; child != NULL; child = child->next)
+      checkStatement(c, child);
+    break;
+  case N_IF:
+    checkCondition(c, node->firstChild);
+    for (child = node->firstChild->next; child != NULL; child = child->next)
+      checkStatement(c, child);
+    break;
+  case N_WHILE:
+    checkCondition(c, node->firstChild);
+    checkStatement(c, node->lastChild);
+    break;
+  case N_FOR:
+    child = node->firstChild;
+    expectType(node, node->symbol->type, &intType);
+    expectType(child, checkExpression(c, child), &intType);
+    expectType(child->next, checkExpression(c, child->next), &intType);
+    checkStatement(c, node->lastChild);
+    break;
+  case N_REPEAT:
+    for (child = node->firstChild; child != node->lastChild; child = child->next)
+      checkStatement(c, child);
+    checkCondition(c, node->lastChild);
+    break;
+  default:
+    break;
+  }
+}
+
+static void checkRoutine(Checker *c, Node *node) {
+  Symbol *symbol = node->symbol;
+  Type *params[node->childCount], *result = NULL;
+  char byRef[node->childCount];
+  Node *child;
+  int count = 0;
+
+  for (child = node->firstChild; child->kind == N_PARAM; child = child->next) {
+    child->symbol->type = resolveType(c, child->firstChild);
+    params[count] = child->symbol->type;
+    byRef[count++] = child->op == KW_VAR;
+  }
+  if (node->kind == N_FUNC_DECL) {
+    result = resolveType(c, child);
+    child = child->next;
+  }
+  // Before the body, which may call itself
+  symbol->type = routineType(c->types, result, count, params, byRef);
+
+  if (c->routineCount == c->routineCapacity) {
+    c->routineCapacity = c->routineCapacity ? 2 * c->routineCapacity : 16;
+    c->routines = (Symbol**)realloc(c->routines, c->routineCapacity * sizeof(Symbol*));
+  }
+  c->routines[c->routineCount++] = symbol;
+  checkBlock(c, child);
+  c->routineCount--;
+}
+
+static void checkBlock(Checker *c, Node *block) {
+  Node *child;
+
+  for (child = block->firstChild; child != NULL; child = child->next)
+    switch (child->kind) {
+    case N_CONST_DECL:
+      child->symbol->type = checkConstant(c, child->firstChild);
+      break;
+    case N_TYPE_DECL:
+    case N_VAR_DECL:
+      child->symbol->type = resolveType(c, child->firstChild);
+      break;
+    case N_FUNC_DECL:
+    case N_PROC_DECL:
+      checkRoutine(c, child);
+      break;
+    default:
+      checkStatement(c, child);
+      break;
+    }
+}
+
+static void typePredefined(SymbolTable *symbols, TypeTable *types) {
+  Type *intParam[1] = {&intType}, *charParam[1] = {&charType};
+  char byValue[1] = {0};
+
+  lookupSymbol(symbols, "READC")->type = routineType(types, &charType, 0, NULL, NULL);
+  lookupSymbol(symbols, "READI")->type = routineType(types, &intType, 0, NULL, NULL);
+  lookupSymbol(symbols, "WRITEC")->type = routineType(types, NULL, 1, charParam, byValue);
+  lookupSymbol(symbols, "WRITEI")->type = routineType(types, NULL, 1, intParam, byValue);
+  lookupSymbol(symbols, "WRITELN")->type = routineType(types, NULL, 0, NULL, NULL);
+}
+
+int checkTypes(CheckedProgram *program) {
+  Checker c = {&program->types, NULL, 0, 0};
+  jmp_buf trap;
+
+  typePredefined(&program->symbols, &program->types);
+  errorRaised = 0;
+  errorTrap = &trap;
+  if (setjmp(trap) == 0)
+    checkBlock(&c, program->tree.root->firstChild);
+  errorTrap = NULL;
+  free(c.routines);
+  if (errorRaised)
+    program->failed = 1;
+  return !errorRaised;
+}
+
+int checkProgram(char *fileName, CheckedProgram *program) {
+  int status = compileChecked(fileName, &program->tree, &program->symbols);
+
+  if (status == IO_ERROR)
+    return IO_ERROR;
+  program->failed = program->tree.failed;
+  if (!program->failed)
+    checkTypes(program);
+  return IO_SUCCESS;
+}
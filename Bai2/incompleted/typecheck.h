@@ -0,0 +1,27 @@
+/* Type checking */
+
+#ifndef __TYPECHECK_H__
+#define __TYPECHECK_H__
+
+#include "ast.h"
+#include "symtab.h"
+#include "types.h"
+
+// A program parsed with its names resolved, then type checked. The tree
+// points at the symbols and the symbols at the types, so they are kept
+// and freed together.
+typedef struct {
+  ParseTree tree;
+  SymbolTable symbols;
+  TypeTable types;
+  int failed;       // a syntax, name or type error was reported
+} CheckedProgram;
+
+void initCheckedProgram(CheckedProgram *program);
+void freeCheckedProgram(CheckedProgram *program);
+// Parse, resolve names and check types; errors go to the output stream
+int checkProgram(char *fileName, CheckedProgram *program);
+// The type pass alone, over a tree parsed with names resolved
+int checkTypes(CheckedProgram *program);
+
+#endif
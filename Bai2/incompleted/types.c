@@ -0,0 +1,176 @@
+/* Type descriptors */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "types.h"
+
+#define TYPE_BLOCK_SIZE (16 * 1024)
+#define FNV_OFFSET 2166136261u
+#define FNV_PRIME 16777619u
+
+// The basic types are shared by all tables
+Type intType = {TY_INTEGER};
+Type charType = {TY_CHAR};
+Type stringType = {TY_STRING};
+Type bytesType = {TY_BYTES};
+
+void initTypeTable(TypeTable *table) {
+  table->capacity = 64;
+  table->count = 0;
+  table->buckets = (Type**)calloc(table->capacity, sizeof(Type*));
+  table->blocks = NULL;
+}
+
+void freeTypeTable(TypeTable *table) {
+  TypeBlock *block = table->blocks, *next;
+
+  while (block != NULL) {
+    next = block->next;
+    free(block);
+    block = next;
+  }
+  free(table->buckets);
+}
+
+static void *typeAlloc(TypeTable *table, size_t size) {
+  TypeBlock *block = table->blocks;
+  size_t blockSize;
+  void *p;
+
+  size = (size + 7) & ~(size_t)7;
+  if (block == NULL || block->used + size > block->size) {
+    blockSize = size > TYPE_BLOCK_SIZE ? size : TYPE_BLOCK_SIZE;
+    block = (TypeBlock*)malloc(sizeof(TypeBlock) + blockSize);
+    block->next = table->blocks;
+    block->used = 0;
+    block->size = blockSize;
+    table->blocks = block;
+  }
+  p = (char*)(block + 1) + block->used;
+  block->used += size;
+  return p;
+}
+
+static unsigned mix(unsigned hash, uintptr_t value) {
+  int i;
+  for (i = 0; i < (int)sizeof(value); i++) {
+    hash ^= (value >> (8 * i)) & 0xff;
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static unsigned hashType(Type *type) {
+  unsigned hash = mix(mix(mix(FNV_OFFSET, type->typeClass), type->size), (uintptr_t)type->element);
+  int i;
+
+  if (type->typeClass == TY_ROUTINE)
+    for (i = 0; i < type->size; i++)
+      hash = mix(mix(hash, (uintptr_t)type->params[i]), type->byRef[i]);
+  return hash;
+}
+
+// Components are already interned, so comparing them is comparing pointers
+static int sameType(Type *a, Type *b) {
+  if (a->typeClass != b->typeClass || a->size != b->size || a->element != b->element)
+    return 0;
+  return a->typeClass != TY_ROUTINE ||
+         (memcmp(a->params, b->params, a->size * sizeof(Type*)) == 0 &&
+          memcmp(a->byRef, b->byRef, a->size) == 0);
+}
+
+static void grow(TypeTable *table) {
+  Type **old = table->buckets, *type, *next;
+  int i, capacity = table->capacity;
+
+  table->capacity *= 2;
+  table->buckets = (Type**)calloc(table->capacity, sizeof(Type*));
+  for (i = 0; i < capacity; i++)
+    for (type = old[i]; type != NULL; type = next) {
+      next = type->chain;
+      type->chain = table->buckets[type->hash & (table->capacity - 1)];
+      table->buckets[type->hash & (table->capacity - 1)] = type;
+    }
+  free(old);
+}
+
+// The descriptor equal to key, made from key the first time
+static Type *intern(TypeTable *table, Type *key) {
+  Type **bucket, *type;
+
+  key->hash = hashType(key);
+  bucket = &table->buckets[key->hash & (table->capacity - 1)];
+  for (type = *bucket; type != NULL; type = type->chain)
+    if (type->hash == key->hash && sameType(type, key))
+      return type;
+
+  type = (Type*)typeAlloc(table, sizeof(Type));
+  *type = *key;
+  if (key->typeClass == TY_ROUTINE) {
+    type->params = (Type**)typeAlloc(table, key->size * sizeof(Type*));
+    memcpy(type->params, key->params, key->size * sizeof(Type*));
+    type->byRef = (char*)typeAlloc(table, key->size);
+    memcpy(type->byRef, key->byRef, key->size);
+  }
+  type->chain = *bucket;
+  *bucket = type;
+  if (++table->count > table->capacity)
+    grow(table);
+  return type;
+}
+
+Type *arrayType(TypeTable *table, int size, Type *element) {
+  Type key;
+
+  memset(&key, 0, sizeof(key));
+  key.typeClass = TY_ARRAY;
+  key.size = size;
+  key.element = element;
+  return intern(table, &key);
+}
+
+Type *routineType(TypeTable *table, Type *result, int paramCount, Type **params, char *byRef) {
+  Type key;
+
+  memset(&key, 0, sizeof(key));
+  key.typeClass = TY_ROUTINE;
+  key.size = paramCount;
+  key.element = result;
+  key.params = params;
+  key.byRef = byRef;
+  return intern(table, &key);
+}
+
+int isBasicType(Type *type) {
+  return type == &intType || type == &charType || type == &stringType || type == &bytesType;
+}
+
+void printType(Type *type, FILE *out) {
+  int i;
+
+  switch (type->typeClass) {
+  case TY_INTEGER: fputs("INTEGER", out); break;
+  case TY_CHAR: fputs("CHAR", out); break;
+  case TY_STRING: fputs("STRING", out); break;
+  case TY_BYTES: fputs("BYTES", out); break;
+  case TY_ARRAY:
+    fprintf(out, "ARRAY(. %d .) OF ", type->size);
+    printType(type->element, out);
+    break;
+  case TY_ROUTINE:
+    fputs(type->element != NULL ? "FUNCTION(" : "PROCEDURE(", out);
+    for (i = 0; i < type->size; i++) {
+      fputs(i > 0 ? "; " : "", out);
+      fputs(type->byRef[i] ? "VAR " : "", out);
+      printType(type->params[i], out);
+    }
+    fputs(")", out);
+    if (type->element != NULL) {
+      fputs(" : ", out);
+      printType(type->element, out);
+    }
+    break;
+  }
+}
@@ -0,0 +1,50 @@
+/* Type descriptors */
+
+#ifndef __TYPES_H__
+#define __TYPES_H__
+
+#include <stdio.h>
+
+typedef enum {
+  TY_INTEGER,
+  TY_CHAR,
+  TY_STRING,
+  TY_BYTES,
+  TY_ARRAY,
+  TY_ROUTINE
+} TypeClass;
+
+// Every type exists once: structurally equal types are the same
+// descriptor, so two types are equal exactly when their pointers are
+typedef struct Type {
+  TypeClass typeClass;
+  int size;                 // arrays: element count; routines: parameter count
+  struct Type *element;     // arrays: element type; routines: result, NULL for procedures
+  struct Type **params;     // routines
+  char *byRef;              // routines: 1 for each VAR parameter
+  unsigned hash;
+  struct Type *chain;       // next descriptor in the same bucket
+} Type;
+
+extern Type intType, charType, stringType, bytesType;
+
+typedef struct TypeBlock {
+  struct TypeBlock *next;
+  size_t used, size;
+} TypeBlock;
+
+typedef struct {
+  Type **buckets;
+  int capacity, count;
+  TypeBlock *blocks;
+} TypeTable;
+
+void initTypeTable(TypeTable *table);
+void freeTypeTable(TypeTable *table);
+Type *arrayType(TypeTable *table, int size, Type *element);
+// params and byRef are copied
+Type *routineType(TypeTable *table, Type *result, int paramCount, Type **params, char *byRef);
+int isBasicType(Type *type);
+void printType(Type *type, FILE *out);
+
+#endif
@@ -0,0 +1,389 @@
+/* Loop vectorization */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "vector.h"
+
+typedef struct {
+  Symbol *index, *sum;
+  Symbol **scalars;             // read in the loop, besides I and S
+  int scalarCount;
+  VectorLoop *plan;
+  char reason[160];
+} Analyzer;
+
+static void reject(Analyzer *a, char *format, ...) {
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(a->reason, sizeof(a->reason), format, args);
+  va_end(args);
+}
+
+static int isReference(Symbol *symbol) {
+  return symbol->kind == SYM_PARAMETER && symbol->node->op == KW_VAR;
+}
+
+// A VAR parameter may stand for another one, or for any variable of the
+// routines around its own
+static int mayAlias(Symbol *x, Symbol *y) {
+  if (isReference(x) && isReference(y))
+    return 1;
+  if (isReference(x))
+    return y->level < x->level;
+  return isReference(y) && x->level < y->level;
+}
+
+static int isScalar(Node *node) {
+  Symbol *symbol = node->symbol;
+
+  return node->kind == N_VARIABLE && node->firstChild == NULL && symbol->type == &intType &&
+         (symbol->kind == SYM_VARIABLE || symbol->kind == SYM_PARAMETER);
+}
+
+static int addOperand(Analyzer *a, VectorOpKind kind, Node *node, int x, int y) {
+  VectorLoop *plan = a->plan;
+  VectorOperand *operand;
+
+  if ((plan->count & (plan->count - 1)) == 0)
+    plan->operands = (VectorOperand*)realloc(plan->operands,
+                                             (plan->count ? 2 * plan->count : 1) * sizeof(VectorOperand));
+  operand = &plan->operands[plan->count];
+  operand->kind = kind;
+  operand->node = node;
+  operand->offset = 0;
+  operand->x = x;
+  operand->y = y;
+  return plan->count++;
+}
+
+// Changes nothing and reads nothing the loop changes
+static int isInvariant(Analyzer *a, Node *node) {
+  Node *child;
+
+  switch (node->kind) {
+  case N_NUMBER:
+    return 1;
+  case N_VARIABLE:
+    if (node->symbol->kind == SYM_CONSTANT)
+      return 1;
+    if (!isScalar(node) || node->symbol == a->index || node->symbol == a->sum)
+      return 0;
+    a->scalars = (Symbol**)realloc(a->scalars, (a->scalarCount + 1) * sizeof(Symbol*));
+    a->scalars[a->scalarCount++] = node->symbol;
+    return 1;
+  case N_UNARY:
+  case N_BINARY:
+    for (child = node->firstChild; child != NULL; child = child->next)
+      if (!isInvariant(a, child))
+        return 0;
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+// I, I + c, c + I or I - c
+static int indexOffset(Analyzer *a, Node *index, int *offset) {
+  Node *x = index->firstChild, *y = index->lastChild;
+
+  *offset = 0;
+  if (index->kind == N_VARIABLE && index->symbol == a->index && index->firstChild == NULL)
+    return 1;
+  if (index->kind != N_BINARY || (index->op != SB_PLUS && index->op != SB_MINUS))
+    return 0;
+  if (index->op == SB_PLUS && x->kind == N_NUMBER) {
+    y = x;
+    x = index->lastChild;
+  }
+  if (x->kind != N_VARIABLE || x->symbol != a->index || x->firstChild != NULL ||
+      y->kind != N_NUMBER || y->value == INT32_MIN)
+    return 0;
+  *offset = index->op == SB_PLUS ? y->value : -y->value;
+  return 1;
+}
+
+static int element(Analyzer *a, Node *node, int *offset) {
+  Type *type = node->symbol->type;
+
+  if (node->symbol->kind == SYM_FUNCTION)
+    reject(a, "calls %s", node->symbol->name);
+  else if (node->firstChild == NULL && type->typeClass != TY_ARRAY)
+    reject(a, "%s is not an INTEGER", node->symbol->name);
+  else if (type->typeClass != TY_ARRAY || type->element != &intType || node->childCount != 1)
+    reject(a, "%s is not a one-dimensional INTEGER array", node->symbol->name);
+  else if (!indexOffset(a, node->firstChild, offset))
+    reject(a, "the index of %s is not %s plus a number", node->symbol->name, a->index->name);
+  else return 1;
+  return 0;
+}
+
+static int buildOperand(Analyzer *a, Node *node) {
+  Node *target = a->plan->target;
+  int x, y, offset;
+
+  if (isInvariant(a, node))
+    return addOperand(a, VEC_INVARIANT, node, 0, 0);
+  switch (node->kind) {
+  case N_VARIABLE:
+    if (node->symbol == a->index && node->firstChild == NULL)
+      return addOperand(a, VEC_INDEX, node, 0, 0);
+    if (node->symbol == a->sum) {
+      reject(a, "%s is read besides its sum", a->sum->name);
+      return -1;
+    }
+    if (!element(a, node, &offset))
+      return -1;
+    // An element stored by an earlier iteration cannot be read a block at a time
+    if (a->sum == NULL && node->symbol == target->symbol && offset < a->plan->targetOffset) {
+      reject(a, "%s(.%s%+d.) reads what %s(.%s%+d.) stored %d iterations before",
+             node->symbol->name, a->index->name, offset, target->symbol->name,
+             a->index->name, a->plan->targetOffset, a->plan->targetOffset - offset);
+      return -1;
+    }
+    if (a->sum == NULL && node->symbol != target->symbol && mayAlias(node->symbol, target->symbol)) {
+      reject(a, "%s and %s may be the same array", node->symbol->name, target->symbol->name);
+      return -1;
+    }
+    x = addOperand(a, VEC_ELEMENT, node, 0, 0);
+    a->plan->operands[x].offset = offset;
+    return x;
+  case N_UNARY:
+    if ((x = buildOperand(a, node->firstChild)) < 0)
+      return -1;
+    return node->op == SB_MINUS ? addOperand(a, VEC_NEG, node, x, 0) : x;
+  case N_BINARY:
+    if (node->op == SB_SLASH || node->op == SB_MOD) {
+      reject(a, "%s at %d-%d may divide by zero", node->op == SB_SLASH ? "/" : "%",
+             node->lineNo, node->colNo);
+      return -1;
+    }
+    if (node->op == SB_POWER) {
+      reject(a, "** at %d-%d has no vector operation", node->lineNo, node->colNo);
+      return -1;
+    }
+    if ((x = buildOperand(a, node->firstChild)) < 0 || (y = buildOperand(a, node->lastChild)) < 0)
+      return -1;
+    return addOperand(a, node->op == SB_PLUS ? VEC_ADD : node->op == SB_MINUS ? VEC_SUB : VEC_MUL,
+                      node, x, y);
+  case N_FUNC_CALL:
+    reject(a, "calls %s", node->symbol->name);
+    return -1;
+  default:
+    reject(a, "reads a value that is not an INTEGER");
+    return -1;
+  }
+}
+
+static int isSum(Analyzer *a, Node *node) {
+  return node->kind == N_VARIABLE && node->symbol == a->sum && node->firstChild == NULL;
+}
+
+static int isAddition(Node *node) {
+  return node->kind == N_BINARY && (node->op == SB_PLUS || node->op == SB_MINUS);
+}
+
+// S + x - y ..., S the first term: the other terms as one value added to
+// S, or subtracted from it when there is just one
+static int buildTerms(Analyzer *a, Node *node, int whole) {
+  Node *first = node->firstChild;
+  int x, y;
+
+  if (!isAddition(node) || (!isSum(a, first) && !isAddition(first))) {
+    reject(a, "%s is assigned, not summed", a->sum->name);
+    return -1;
+  }
+  if (!isSum(a, first)) {
+    if ((x = buildTerms(a, first, 0)) < 0 || (y = buildOperand(a, node->lastChild)) < 0)
+      return -1;
+    return addOperand(a, node->op == SB_PLUS ? VEC_ADD : VEC_SUB, node, x, y);
+  }
+  if ((y = buildOperand(a, node->lastChild)) < 0)
+    return -1;
+  if (node->op == SB_PLUS || whole)
+    a->plan->sum = node->op;
+  else y = addOperand(a, VEC_NEG, node, y, 0);
+  return y;
+}
+
+// A(.I + c.) := value, or S := S + value, S := value + S, S := S - value
+// and S := S + x - y ...
+static int buildAssignment(Analyzer *a, Node *node) {
+  VectorLoop *plan = a->plan;
+  Node *target = node->firstChild, *value = node->lastChild;
+
+  if (node->kind != N_ASSIGN) {
+    reject(a, "the body is not an assignment");
+    return 0;
+  }
+  if (node->value != 1) {
+    reject(a, "the body assigns %d variables at once", node->value);
+    return 0;
+  }
+  plan->target = target;
+  if (target->symbol == a->index) {
+    reject(a, "the body assigns %s", a->index->name);
+    return 0;
+  }
+  if (isScalar(target)) {
+    a->sum = target->symbol;
+    plan->sum = SB_PLUS;
+    if (value->kind == N_BINARY && value->op == SB_PLUS && isSum(a, value->lastChild))
+      return buildOperand(a, value->firstChild) >= 0;
+    return buildTerms(a, value, 1) >= 0;
+  }
+  if (!element(a, target, &plan->targetOffset))
+    return 0;
+  return buildOperand(a, value) >= 0;
+}
+
+// A VAR parameter may be the variable the loop counts or sums in
+static int isAliased(Analyzer *a) {
+  Symbol *changed[2] = {a->index, a->sum}, *other;
+  int i, j;
+
+  for (i = 0; i < 2 && changed[i] != NULL; i++)
+    for (j = -1; j < a->scalarCount; j++) {
+      other = j < 0 ? changed[1 - i] : a->scalars[j];
+      if (other != NULL && other != changed[i] && mayAlias(changed[i], other)) {
+        reject(a, "%s may be %s", other->name, changed[i]->name);
+        return 1;
+      }
+    }
+  return 0;
+}
+
+// I := I + 1 or I := 1 + I
+static int isStep(Analyzer *a, Node *node) {
+  Node *value = node->lastChild, *x, *y;
+
+  if (node->kind != N_ASSIGN || node->value != 1 || node->firstChild->symbol != a->index ||
+      node->firstChild->firstChild != NULL || value->kind != N_BINARY || value->op != SB_PLUS)
+    return 0;
+  x = value->firstChild;
+  y = value->lastChild;
+  if (x->kind == N_NUMBER) {
+    x = y;
+    y = value->firstChild;
+  }
+  return x->kind == N_VARIABLE && x->symbol == a->index && x->firstChild == NULL &&
+         y->kind == N_NUMBER && y->value == 1;
+}
+
+static VectorLoop *analyze(Node *loop, char *reason, size_t size) {
+  Analyzer a;
+  VectorLoop *plan = (VectorLoop*)calloc(1, sizeof(VectorLoop));
+  Node *body = loop->lastChild, *cond = loop->firstChild;
+  int ok = 0;
+
+  memset(&a, 0, sizeof(Analyzer));
+  a.plan = plan;
+  plan->loop = loop;
+  if (loop->kind == N_FOR) {
+    a.index = loop->symbol;
+    if (body->kind == N_GROUP && body->childCount == 1)
+      body = body->firstChild;
+    if (a.index->type != &intType)
+      reject(&a, "%s is not an INTEGER", a.index->name);
+    else ok = buildAssignment(&a, body);
+  } else if (cond->kind != N_CONDITION || (cond->op != SB_LE && cond->op != SB_LT) ||
+             !isScalar(cond->firstChild))
+    reject(&a, "the test is not I <= N or I < N");
+  else {
+    a.index = cond->firstChild->symbol;
+    plan->bound = cond->lastChild;
+    plan->inclusive = cond->op == SB_LE;
+    if (body->kind != N_GROUP || body->childCount != 2 || !isStep(&a, body->lastChild))
+      reject(&a, "the body is not one assignment then %s := %s + 1", a.index->name, a.index->name);
+    else if ((ok = buildAssignment(&a, body->firstChild)) && !isInvariant(&a, plan->bound)) {
+      reject(&a, "the bound of %s is not a value the loop leaves alone", a.index->name);
+      ok = 0;
+    }
+  }
+  ok = ok && !isAliased(&a);
+  free(a.scalars);
+  if (!ok) {
+    snprintf(reason, size, "%s", a.reason);
+    freeVectorLoop(plan);
+    return NULL;
+  }
+  return plan;
+}
+
+void freeVectorLoop(VectorLoop *plan) {
+  if (plan != NULL)
+    free(plan->operands);
+  free(plan);
+}
+
+VectorLoop *planVectorLoop(Node *loop) {
+  char reason[160];
+
+  return analyze(loop, reason, sizeof(reason));
+}
+
+/******************************************************************/
+
+static void report(FILE *out, VectorLoop *plan, Node *loop, char *reason) {
+  Symbol *index = loop->kind == N_FOR ? loop->symbol : NULL;
+  int i, elements = 0;
+
+  if (out == NULL)
+    return;
+  fprintf(out, "%d-%d: %s loop", loop->lineNo, loop->colNo, loop->kind == N_FOR ? "FOR" : "WHILE");
+  if (plan == NULL) {
+    if (index != NULL)
+      fprintf(out, " over %s", index->name);
+    fprintf(out, " not vectorized: %s\n", reason);
+    return;
+  }
+  for (i = 0; i < plan->count; i++)
+    elements += plan->operands[i].kind == VEC_ELEMENT;
+  fprintf(out, " vectorized, %d element%s read, ", elements, elements == 1 ? "" : "s");
+  if (plan->sum != 0)
+    fprintf(out, "summed into %s\n", plan->target->symbol->name);
+  else fprintf(out, "stored into %s\n", plan->target->symbol->name);
+}
+
+static void vectorizeNode(Node *node, VectorStats *stats, FILE *out) {
+  VectorLoop *plan;
+  Node *child;
+  char reason[160];
+
+  switch (node->kind) {
+  case N_CONST_DECL:
+  case N_TYPE_DECL:
+  case N_VAR_DECL:
+  case N_PARAM:
+  case N_TYPE:
+  case N_CONDITION:
+  case N_BINARY:
+  case N_UNARY:
+  case N_VARIABLE:
+  case N_FUNC_CALL:
+    return;
+  case N_FOR:
+  case N_WHILE:
+    stats->loops++;
+    plan = analyze(node, reason, sizeof(reason));
+    node->value = plan != NULL;
+    if (plan != NULL) {
+      stats->vectorized++;
+      stats->sums += plan->sum != 0;
+    }
+    report(out, plan, node, reason);
+    freeVectorLoop(plan);
+    break;
+  default:
+    break;
+  }
+  for (child = node->firstChild; child != NULL; child = child->next)
+    vectorizeNode(child, stats, out);
+}
+
+void vectorizeLoops(CheckedProgram *program, VectorStats *stats, FILE *report) {
+  memset(stats, 0, sizeof(VectorStats));
+  vectorizeNode(program->tree.root, stats, report);
+}
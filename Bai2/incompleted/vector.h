@@ -0,0 +1,87 @@
+/* Loop vectorization */
+
+#ifndef __VECTOR_H__
+#define __VECTOR_H__
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "typecheck.h"
+
+// A loop is vectorized when it counts an INTEGER variable I up by one,
+// FOR I := ... TO N DO or WHILE I <= N DO (or I < N) ending its body with
+// I := I + 1, and the rest of its body is one assignment of +, - and *
+// over the elements A(.I + c.) of one-dimensional INTEGER arrays, I and
+// values the loop does not change. The assignment either stores an
+// element, A(.I + c.) := ..., or sums, S := S + x - y ... with S first.
+// An element may not read what an earlier iteration stored. The pass
+// leaves 1 in the value of the loop's node for the engine.
+#define isVectorLoop(node) ((node)->value == 1)
+
+// Iterations that go through each step of a loop together
+#define VECTOR_BLOCK 256
+
+typedef enum {
+  VEC_ELEMENT,        // node: A(.I + offset.)
+  VEC_INVARIANT,      // node: an expression the loop does not change
+  VEC_INDEX,          // the loop variable
+  VEC_ADD,            // x y: earlier operands
+  VEC_SUB,
+  VEC_MUL,
+  VEC_NEG             // x
+} VectorOpKind;
+
+typedef struct {
+  VectorOpKind kind;
+  Node *node;
+  int offset;
+  int x, y;
+} VectorOperand;
+
+typedef struct {
+  Node *loop;         // N_FOR or N_WHILE
+  Node *bound;        // WHILE: the expression I is compared to
+  int inclusive;      // WHILE I <= N rather than I < N
+  VectorOperand *operands;  // leaves and steps, in order; the last one is the value
+  int count;
+  Node *target;       // the element stored, or the variable summed into
+  TokenType sum;      // SB_PLUS or SB_MINUS for a sum, else 0
+  int targetOffset;
+} VectorLoop;
+
+typedef struct {
+  int loops;          // FOR and WHILE loops looked at
+  int vectorized;
+  int sums;           // of the vectorized loops
+} VectorStats;
+
+// Marks the loops of a checked program that did not fail that can be
+// vectorized. With report set, every FOR and WHILE loop is written
+// there as "line-col: ..." with why it was or was not.
+void vectorizeLoops(CheckedProgram *program, VectorStats *stats, FILE *report);
+
+// The plan of a loop the pass marked
+VectorLoop *planVectorLoop(Node *loop);
+void freeVectorLoop(VectorLoop *plan);
+
+// Operations over n cells of INTEGER values. Only the low 32 bits of
+// the operands matter, which +, - and * keep exact, so the values are
+// sign-extended only when stored. The tail of n past the last full
+// vector is done one cell at a time.
+typedef struct {
+  char *name;
+  void (*add)(int64_t *d, int64_t *x, int64_t *y, int n);
+  void (*sub)(int64_t *d, int64_t *x, int64_t *y, int n);
+  void (*mul)(int64_t *d, int64_t *x, int64_t *y, int n);
+  void (*store)(int64_t *d, int64_t *x, int n);
+  int64_t (*sum)(int64_t *x, int n);
+} SimdKernels;
+
+// The widest kernels the processor runs, chosen when first asked for:
+// "avx2", "sse2", or else "scalar"
+SimdKernels *simdKernels(void);
+// Makes the kernels of that name the ones used; returns 0 when the
+// processor lacks them
+int selectSimdKernels(char *name);
+
+#endif
@@ -0,0 +1,281 @@
+/* Virtual machine */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arith.h"
+#include "vm.h"
+
+// Each handler jumps straight to the next one through the label table
+// (computed goto), so there is no central switch to mispredict. The
+// operand stack and the frames share one array; ENTER checks the room
+// a routine needs once, from the sizes the code generator worked out.
+#define DISPATCH() goto *labels[*pc]
+#define NEXT(words) do { pc += (words); DISPATCH(); } while (0)
+#define FAIL(message, at) do { failure = (message); failedAt = (at); goto failed; } while (0)
+// A backward jump is a hot point: once the JIT has compiled the program
+// the loop carries on in native code
+#define BRANCH() do { \
+    n = pc[1]; \
+    if (jit != NULL && n < pc - code && jitHot(jit, bc, n)) { pc = code + n; goto native; } \
+    pc = code + n; \
+    DISPATCH(); \
+  } while (0)
+
+static int compareStrings(char *a, char *b) {
+  int sign = strcmp(a != NULL ? a : "", b != NULL ? b : "");
+  return (sign > 0) - (sign < 0);
+}
+
+int runBytecode(Bytecode *bc, FILE *in, FILE *out) {
+  return runBytecodeJit(bc, in, out, NULL);
+}
+
+int runBytecodeJit(Bytecode *bc, FILE *in, FILE *out, Jit *jit) {
+  static void *labels[OP_COUNT] = {
+    &&op_halt, &&op_push, &&op_push_str, &&op_pop,
+    &&op_load_local, &&op_store_local, &&op_addr_local,
+    &&op_load_global, &&op_store_global, &&op_addr_global,
+    &&op_load_outer, &&op_store_outer, &&op_addr_outer,
+    &&op_load_ind, &&op_store_ind, &&op_index,
+    &&op_inc_local, &&op_inc_global,
+    &&op_add, &&op_sub, &&op_mul, &&op_div, &&op_mod, &&op_pow, &&op_neg,
+    &&op_shl, &&op_div_shift, &&op_mod_mask, &&op_pow_const,
+    &&op_strcmp,
+    &&op_jmp, &&op_jeq, &&op_jne, &&op_jlt, &&op_jle, &&op_jgt, &&op_jge,
+    &&op_frame, &&op_call, &&op_enter, &&op_ret, &&op_ret_value,
+    &&op_readc, &&op_readi, &&op_writec, &&op_writei, &&op_writeln
+  };
+  int32_t *code = bc->code, *pc = code;
+  // Room for the program's frame (the first ENTER) and the routines.
+  // Not calloc: ENTER clears each frame, and clearing all of it would
+  // cost more than a short program runs.
+  size_t cells = FRAME_HEADER + bc->code[2] + bc->code[3] + VM_STACK_CELLS;
+  Cell *stack = (Cell*)malloc(cells * sizeof(Cell)), *limit = stack + cells;
+  Cell *fp = stack + FRAME_HEADER, *globals = fp, *sp = fp, *p, result;
+  char *failure = NULL;
+  int failedAt = 0, n, c;
+
+  DISPATCH();
+
+op_halt:
+  goto done;
+op_push:
+  (sp++)->i = pc[1];
+  NEXT(2);
+op_push_str:
+  (sp++)->s = bc->strings[pc[1]];
+  NEXT(2);
+op_pop:
+  sp--;
+  NEXT(1);
+
+op_load_local:
+  *sp++ = fp[pc[1]];
+  NEXT(2);
+op_store_local:
+  fp[pc[1]] = *--sp;
+  NEXT(2);
+op_addr_local:
+  (sp++)->p = fp + pc[1];
+  NEXT(2);
+op_load_global:
+  *sp++ = globals[pc[1]];
+  NEXT(2);
+op_store_global:
+  globals[pc[1]] = *--sp;
+  NEXT(2);
+op_addr_global:
+  (sp++)->p = globals + pc[1];
+  NEXT(2);
+op_load_outer:
+  for (p = fp, n = pc[1]; n > 0; n--)
+    p = p[FRAME_LINK].p;
+  *sp++ = p[pc[2]];
+  NEXT(3);
+op_store_outer:
+  for (p = fp, n = pc[1]; n > 0; n--)
+    p = p[FRAME_LINK].p;
+  p[pc[2]] = *--sp;
+  NEXT(3);
+op_addr_outer:
+  for (p = fp, n = pc[1]; n > 0; n--)
+    p = p[FRAME_LINK].p;
+  (sp++)->p = p + pc[2];
+  NEXT(3);
+op_load_ind:
+  sp[-1] = *sp[-1].p;
+  NEXT(1);
+op_store_ind:
+  sp -= 2;
+  *sp[1].p = sp[0];
+  NEXT(1);
+op_index:
+  // Arrays are indexed from 1
+  n = (int32_t)(--sp)->i;
+  if (n < 1 || n > pc[1])
+    FAIL(ERM_INDEXOUTOFRANGE, pc - code);
+  sp[-1].p += (n - 1) * pc[2];
+  NEXT(3);
+op_inc_local:
+  fp[pc[1]].i = kplAdd(fp[pc[1]].i, 1);
+  NEXT(2);
+op_inc_global:
+  globals[pc[1]].i = kplAdd(globals[pc[1]].i, 1);
+  NEXT(2);
+
+op_add:
+  sp--;
+  sp[-1].i = kplAdd(sp[-1].i, sp[0].i);
+  NEXT(1);
+op_sub:
+  sp--;
+  sp[-1].i = kplSub(sp[-1].i, sp[0].i);
+  NEXT(1);
+op_mul:
+  sp--;
+  sp[-1].i = kplMul(sp[-1].i, sp[0].i);
+  NEXT(1);
+op_div:
+  sp--;
+  if (sp[0].i == 0)
+    FAIL(ERM_DIVISIONBYZERO, pc - code);
+  sp[-1].i = kplDiv(sp[-1].i, sp[0].i);
+  NEXT(1);
+op_mod:
+  sp--;
+  if (sp[0].i == 0)
+    FAIL(ERM_DIVISIONBYZERO, pc - code);
+  sp[-1].i = kplMod(sp[-1].i, sp[0].i);
+  NEXT(1);
+op_pow:
+  sp--;
+  if (kplPowFails(sp[-1].i, sp[0].i))
+    FAIL(ERM_DIVISIONBYZERO, pc - code);
+  sp[-1].i = kplPow(sp[-1].i, sp[0].i);
+  NEXT(1);
+op_neg:
+  sp[-1].i = kplNeg(sp[-1].i);
+  NEXT(1);
+op_shl:
+  sp[-1].i = kplShl(sp[-1].i, pc[1]);
+  NEXT(2);
+op_div_shift:
+  sp[-1].i = kplDivShift(sp[-1].i, pc[1]);
+  NEXT(2);
+op_mod_mask:
+  sp[-1].i = kplModMask(sp[-1].i, pc[1]);
+  NEXT(2);
+op_pow_const:
+  sp[-1].i = kplPow(sp[-1].i, pc[1]);
+  NEXT(2);
+op_strcmp:
+  sp--;
+  sp[-1].i = compareStrings(sp[-1].s, sp[0].s);
+  NEXT(1);
+
+op_jmp:
+  BRANCH();
+op_jeq:
+  sp -= 2;
+  if (sp[0].i == sp[1].i) BRANCH();
+  NEXT(2);
+op_jne:
+  sp -= 2;
+  if (sp[0].i != sp[1].i) BRANCH();
+  NEXT(2);
+op_jlt:
+  sp -= 2;
+  if (sp[0].i < sp[1].i) BRANCH();
+  NEXT(2);
+op_jle:
+  sp -= 2;
+  if (sp[0].i <= sp[1].i) BRANCH();
+  NEXT(2);
+op_jgt:
+  sp -= 2;
+  if (sp[0].i > sp[1].i) BRANCH();
+  NEXT(2);
+op_jge:
+  sp -= 2;
+  if (sp[0].i >= sp[1].i) BRANCH();
+  NEXT(2);
+
+op_frame:
+  // The result of a function that never assigns it is 0
+  sp[0].i = 0;
+  sp += FRAME_HEADER;
+  NEXT(1);
+op_call:
+  p = sp - pc[2];
+  for (result.p = fp, n = pc[3]; n > 0; n--)
+    result.p = result.p[FRAME_LINK].p;
+  p[FRAME_LINK] = result;
+  p[FRAME_CALLER].p = fp;
+  p[FRAME_RETURN].i = pc + 4 - code;
+  fp = p;
+  pc = code + pc[1];
+  DISPATCH();
+op_enter:
+  if (jit != NULL && jitHot(jit, bc, pc - code))
+    goto native;
+enter:
+  // A routine that would not fit is reported at its call
+  if (limit - fp < pc[2] + pc[3])
+    FAIL(ERM_STACKOVERFLOW, fp[FRAME_RETURN].i - 4);
+  for (sp = fp + pc[1]; sp < fp + pc[2]; sp++)
+    sp->i = 0;
+  NEXT(4);
+op_ret:
+  sp = fp - FRAME_HEADER;
+  pc = code + fp[FRAME_RETURN].i;
+  fp = fp[FRAME_CALLER].p;
+  if (jit != NULL && jit->table != NULL)
+    goto native;
+  DISPATCH();
+op_ret_value:
+  result = fp[FRAME_RESULT];
+  sp = fp - FRAME_HEADER;
+  *sp++ = result;
+  pc = code + fp[FRAME_RETURN].i;
+  fp = fp[FRAME_CALLER].p;
+  if (jit != NULL && jit->table != NULL)
+    goto native;
+  DISPATCH();
+
+op_readc:
+  if ((c = getc(in)) == EOF)
+    FAIL(ERM_ENDOFINPUT, pc - code);
+  (sp++)->i = c;
+  NEXT(1);
+op_readi:
+  if (fscanf(in, "%d", &n) != 1)
+    FAIL(ERM_ENDOFINPUT, pc - code);
+  (sp++)->i = n;
+  NEXT(1);
+op_writec:
+  putc((char)(--sp)->i, out);
+  NEXT(1);
+op_writei:
+  fprintf(out, "%d", (int32_t)(--sp)->i);
+  NEXT(1);
+op_writeln:
+  putc('\n', out);
+  NEXT(1);
+
+native:
+  // Native code gives back the instructions it leaves to the interpreter;
+  // an ENTER it gives back is about to overflow and must not re-enter it
+  pc = code + enterJit(jit, pc - code, &sp, &fp, globals, limit, out);
+  if (*pc == OP_ENTER)
+    goto enter;
+  DISPATCH();
+
+failed:
+  fflush(out);
+  fprintf(stderr, "%d-%d:%s\n", bc->lineNos[failedAt], bc->colNos[failedAt], failure);
+done:
+  fflush(out);
+  free(stack);
+  return failure != NULL;
+}
@@ -0,0 +1,24 @@
+/* Virtual machine */
+
+#ifndef __VM_H__
+#define __VM_H__
+
+#include <stdio.h>
+#include "bytecode.h"
+#include "jit.h"
+
+// Cells of stack for frames and operands, besides the program's own frame
+#define VM_STACK_CELLS (1 << 20)
+
+#define ERM_DIVISIONBYZERO "Division by zero!"
+#define ERM_INDEXOUTOFRANGE "Index out of range!"
+#define ERM_STACKOVERFLOW "Stack overflow!"
+#define ERM_ENDOFINPUT "End of input!"
+
+// Runs the program reading from in and writing to out. A run-time error
+// is reported as "line-col:message" on stderr and returns 1.
+int runBytecode(Bytecode *bc, FILE *in, FILE *out);
+// Same, handing hot loops and routines to the JIT (NULL: interpret only)
+int runBytecodeJit(Bytecode *bc, FILE *in, FILE *out, Jit *jit);
+
+#endif
@@ -0,0 +1,107 @@
+/* Work pool */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "workpool.h"
+
+// Each worker owns a contiguous range [head, tail) of task indexes.
+// The owner pops from the head (keeping source order), idle workers steal from the tail.
+typedef struct {
+  pthread_mutex_t lock;
+  int head, tail;
+} WorkQueue;
+
+typedef struct {
+  WorkQueue *queues;
+  int jobs;
+  WorkFunc func;
+  void *arg;
+} WorkPool;
+
+typedef struct {
+  WorkPool *pool;
+  int id;
+} Worker;
+
+int defaultJobCount(void) {
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int)n : 1;
+}
+
+static int popOwn(WorkQueue *q) {
+  int index = -1;
+  pthread_mutex_lock(&q->lock);
+  if (q->head < q->tail)
+    index = q->head++;
+  pthread_mutex_unlock(&q->lock);
+  return index;
+}
+
+static int steal(WorkQueue *q) {
+  int index = -1;
+  pthread_mutex_lock(&q->lock);
+  if (q->head < q->tail)
+    index = --q->tail;
+  pthread_mutex_unlock(&q->lock);
+  return index;
+}
+
+static void *workerMain(void *p) {
+  Worker *self = (Worker*)p;
+  WorkPool *pool = self->pool;
+  int index, i;
+
+  for (;;) {
+    index = popOwn(&pool->queues[self->id]);
+    // Own queue is empty: steal from the other workers
+    for (i = 1; index < 0 && i < pool->jobs; i++)
+      index = steal(&pool->queues[(self->id + i) % pool->jobs]);
+    if (index < 0)
+      break;
+    pool->func(index, pool->arg);
+  }
+  return NULL;
+}
+
+void runWorkPool(int jobs, int taskCount, WorkFunc func, void *arg) {
+  WorkPool pool;
+  Worker *workers;
+  pthread_t *threads;
+  int i, chunk;
+
+  if (jobs > taskCount) jobs = taskCount;
+  if (jobs <= 1) {
+    for (i = 0; i < taskCount; i++)
+      func(i, arg);
+    return;
+  }
+
+  pool.jobs = jobs;
+  pool.func = func;
+  pool.arg = arg;
+  pool.queues = (WorkQueue*)malloc(jobs * sizeof(WorkQueue));
+  workers = (Worker*)malloc(jobs * sizeof(Worker));
+  threads = (pthread_t*)malloc(jobs * sizeof(pthread_t));
+
+  chunk = (taskCount + jobs - 1) / jobs;
+  for (i = 0; i < jobs; i++) {
+    pthread_mutex_init(&pool.queues[i].lock, NULL);
+    pool.queues[i].head = i * chunk < taskCount ? i * chunk : taskCount;
+    pool.queues[i].tail = (i + 1) * chunk < taskCount ? (i + 1) * chunk : taskCount;
+    workers[i].pool = &pool;
+    workers[i].id = i;
+  }
+
+  for (i = 0; i < jobs; i++)
+    pthread_create(&threads[i], NULL, workerMain, &workers[i]);
+  for (i = 0; i < jobs; i++)
+    pthread_join(threads[i], NULL);
+
+  for (i = 0; i < jobs; i++)
+    pthread_mutex_destroy(&pool.queues[i].lock);
+  free(pool.queues);
+  free(workers);
+  free(threads);
+}
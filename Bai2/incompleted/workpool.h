@@ -0,0 +1,11 @@
+/* Work pool */
+
+#ifndef __WORKPOOL_H__
+#define __WORKPOOL_H__
+
+typedef void (*WorkFunc)(int index, void *arg);
+
+int defaultJobCount(void);
+void runWorkPool(int jobs, int taskCount, WorkFunc func, void *arg);
+
+#endif